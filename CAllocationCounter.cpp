@@ -0,0 +1,165 @@
+#include "CAllocationCounter.h"
+#include <cstdlib>
+#include <new>
+
+static volatile LONG s_allocations = 0;
+
+//a count for each thread counted, only ever written by its thread and padded
+//so they are not on one cache line. Entries are given back as threads end
+struct ThreadAllocations {
+	volatile LONG in_use;
+	volatile LONG count;
+	char padding[64 - 2 * sizeof( LONG )];
+};
+static ThreadAllocations s_threads[ALLOCATION_MAX_THREADS];
+static volatile LONG s_forgotten = 0; // counted by threads since ended
+
+//1 + the calling thread's entry in s_threads once it has asked to be counted
+static __declspec( thread ) LONG s_thread_slot = 0;
+static __declspec( thread ) bool s_thread_counted = false;
+
+//every new in the program comes through these. delete needs replacing too,
+//to free with what allocated
+void *operator new( size_t size )
+{
+	InterlockedIncrement( &s_allocations );
+	if ( s_thread_counted )
+		s_threads[s_thread_slot - 1].count++;
+	void *p = malloc( size > 0 ? size : 1 );
+	if ( p == NULL )
+		throw std::bad_alloc();
+	return p;
+}
+
+void *operator new[]( size_t size )
+{
+	return operator new( size );
+}
+
+void *operator new( size_t size, const std::nothrow_t & ) throw()
+{
+	InterlockedIncrement( &s_allocations );
+	if ( s_thread_counted )
+		s_threads[s_thread_slot - 1].count++;
+	return malloc( size > 0 ? size : 1 );
+}
+
+void *operator new[]( size_t size, const std::nothrow_t &nothrow ) throw()
+{
+	return operator new( size, nothrow );
+}
+
+void operator delete( void *p ) throw()
+{
+	free( p );
+}
+
+void operator delete[]( void *p ) throw()
+{
+	free( p );
+}
+
+void operator delete( void *p, const std::nothrow_t & ) throw()
+{
+	free( p );
+}
+
+void operator delete[]( void *p, const std::nothrow_t & ) throw()
+{
+	free( p );
+}
+
+CAllocationCounter::CAllocationCounter() : _warmup( 0 ), _settled( 0 ), _start( 0 ), _checked( 0 ), _allocating( 0 ), _total( 0 ), _worst( 0 ), _worst_frame( 0 )
+{
+}
+
+LONG CAllocationCounter::allocations()
+{
+	return s_allocations;
+}
+
+bool CAllocationCounter::countThisThread( bool counted )
+{
+	//threads past the last entry are never counted
+	for ( LONG t = 0; counted && s_thread_slot == 0 && t < ALLOCATION_MAX_THREADS; ++t )
+	{
+		if ( InterlockedCompareExchange( &s_threads[t].in_use, 1, 0 ) == 0 )
+			s_thread_slot = t + 1;
+	}
+	assert( "CAllocationCounter::countThisThread out of thread entries" && ( !counted || s_thread_slot != 0 ) );
+
+	const bool was_counted = s_thread_counted;
+	s_thread_counted = counted && s_thread_slot != 0;
+	return was_counted;
+}
+
+void CAllocationCounter::forgetThisThread()
+{
+	if ( s_thread_slot == 0 )
+		return;
+
+	//the count moves over before the entry is free for another thread
+	ThreadAllocations *thread = &s_threads[s_thread_slot - 1];
+	s_thread_counted = false;
+	InterlockedExchangeAdd( &s_forgotten, thread->count );
+	thread->count = 0;
+	InterlockedExchange( &thread->in_use, 0 );
+	s_thread_slot = 0;
+}
+
+LONG CAllocationCounter::counted()
+{
+	LONG total = s_forgotten;
+	for ( LONG t = 0; t < ALLOCATION_MAX_THREADS; ++t )
+		total += s_threads[t].count;
+	return total;
+}
+
+void CAllocationCounter::init( unsigned int warmup )
+{
+	_warmup = warmup;
+	_settled = 0;
+}
+
+void CAllocationCounter::beginFrame()
+{
+	_start = counted();
+}
+
+void CAllocationCounter::endFrame( unsigned int frame, bool steady )
+{
+	if ( !steady )
+	{
+		_settled = 0;
+		return;
+	}
+	if ( _settled < _warmup )
+	{
+		_settled++;
+		return;
+	}
+
+	const LONG allocated = counted() - _start;
+	_checked++;
+	if ( allocated == 0 )
+		return;
+
+	//the first few are worth seeing as they happen, to find what allocated
+	if ( _allocating < 10 )
+		std::cerr << "Frame " << frame << " made " << allocated << " heap allocations\n";
+	_allocating++;
+	_total += allocated;
+	if ( allocated > _worst )
+	{
+		_worst = allocated;
+		_worst_frame = frame;
+	}
+}
+
+void CAllocationCounter::print( std::ostream &out ) const
+{
+	out << "Heap allocations: " << _allocating << " of " << _checked << " steady frames allocated";
+	if ( _allocating > 0 )
+		out << ", " << _total << " in all, at most " << _worst << " in frame " << _worst_frame;
+	out << "\n";
+}
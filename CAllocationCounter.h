@@ -0,0 +1,52 @@
+#pragma once
+#include <windows.h>
+#include <iostream>
+#include <cassert>
+
+//Threads whose allocations can be told apart, the render thread and every job worker
+#define ALLOCATION_MAX_THREADS 64
+
+//Counts every allocation made through operator new, and checks frames that
+//should allocate nothing do not. The global operators are replaced in
+//CAllocationCounter.cpp. Each thread keeps its own count, and only threads
+//that ask are counted towards frames: the render thread and the job workers,
+//so a loader, a driver thread or anything else running alongside cannot fail
+//a frame that allocated nothing itself. Frames are checked once warmup frames
+//have passed since the last that was not steady, such as one still loading,
+//by which time every container a frame uses should have reached its size
+class CAllocationCounter {
+private:
+	unsigned int _warmup; // steady frames to let pass before checking
+	unsigned int _settled; // steady frames in a row so far
+	LONG _start; // allocations by the threads counted when the frame began
+	unsigned int _checked, _allocating; // frames checked, and of those how many allocated
+	unsigned long long _total; // allocations by checked frames
+	LONG _worst; // most allocations by one checked frame
+	unsigned int _worst_frame;
+
+public:
+	CAllocationCounter();
+
+	//allocations since the program started, by any thread
+	static LONG allocations();
+
+	//whether the calling thread's allocations count towards frames from now on,
+	//returning whether they did
+	static bool countThisThread( bool counted );
+
+	//for a thread counted to call as it ends, so its entry can be used again
+	static void forgetThisThread();
+
+	//allocations by the threads counted, while they were counted
+	static LONG counted();
+
+	void init( unsigned int warmup );
+
+	void beginFrame();
+
+	//steady is false for frames expected to allocate, which restart the warmup
+	void endFrame( unsigned int frame, bool steady );
+
+	bool passed() const { return _allocating == 0; }
+	void print( std::ostream &out ) const;
+};
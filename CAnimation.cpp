@@ -0,0 +1,448 @@
+#include "CAnimation.h"
+#include <xmmintrin.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <cstring>
+#include <cmath>
+#include <limits>
+
+static const char *shape_properties[] = { "position.x", "position.y", "position.z", "rotation.x", "rotation.y", "rotation.z" };
+static const char *light_properties[] = { "position.x", "position.y", "position.z", "direction.x", "direction.y", "direction.z", "cone", "intensity" };
+#define SHAPE_COMPONENTS 6
+#define LIGHT_COMPONENTS 8
+
+CAnimation::CAnimation() : _jobs( NULL )
+{
+	QueryPerformanceFrequency( &_frequency );
+	resetStats();
+}
+
+bool CAnimation::parseTarget( const char *kind, unsigned int index, const char *property, unsigned int *target )
+{
+	const bool light = strcmp( kind, "light" ) == 0;
+	if ( !light && strcmp( kind, "shape" ) != 0 )
+		return false;
+
+	const char **properties = light ? light_properties : shape_properties;
+	const unsigned int count = light ? LIGHT_COMPONENTS : SHAPE_COMPONENTS;
+	for ( unsigned int c = 0; c < count; ++c )
+	{
+		if ( strcmp( property, properties[c] ) == 0 )
+		{
+			*target = CAnimation::target( light, index, c );
+			return true;
+		}
+	}
+	return false;
+}
+
+float *CAnimation::field( unsigned int target, std::vector<Shape> &shapes, std::vector<Light> &lights )
+{
+	const unsigned int index = target >> 4, component = target & 7;
+	if ( ( target & 8 ) == 0 )
+	{
+		if ( index >= shapes.size() )
+			return NULL;
+		Float3 &v = component < 3 ? shapes[index].position : shapes[index].rotation;
+		return component % 3 == 0 ? &v.x : component % 3 == 1 ? &v.y : &v.z;
+	}
+
+	if ( index >= lights.size() )
+		return NULL;
+	Light &light = lights[index];
+	if ( component == 6 )
+		return &light.coneAngle;
+	if ( component == 7 )
+		return &light.intensity;
+	Float3 &v = component < 3 ? light.position : light.direction;
+	return component % 3 == 0 ? &v.x : component % 3 == 1 ? &v.y : &v.z;
+}
+
+void CAnimation::addClip( bool cubic, bool loop, const std::vector<float> &times, const std::vector<unsigned int> &targets, const std::vector<float> &values )
+{
+	assert( "CAnimation::addClip; a value is needed for every channel at every key" && values.size() == times.size() * targets.size() );
+	_clips.push_back( Clip() );
+	Clip &clip = _clips.back();
+	clip.cubic = cubic;
+	clip.loop = loop;
+	clip.times = times;
+	clip.channels = targets.size();
+	clip.padded = ( clip.channels + 3 ) & ~3u;
+	clip.targets = targets;
+
+	//the padding channels stay at zero
+	clip.values.assign( times.size() * clip.padded, 0.0f );
+	for ( unsigned int k = 0; k < times.size(); ++k )
+	{
+		for ( unsigned int c = 0; c < clip.channels; ++c )
+			clip.values[k * clip.padded + c] = values[c * times.size() + k];
+	}
+
+	//and every real channel starts unlike any value, so the first evaluation moves them all
+	clip.output.assign( clip.padded, 0.0f );
+	for ( unsigned int c = 0; c < clip.channels; ++c )
+		clip.output[c] = std::numeric_limits<float>::quiet_NaN();
+	clip.changed.assign( clip.padded / 4, 0 );
+}
+
+bool CAnimation::load( const char *path )
+{
+	std::ifstream file( path );
+	if ( !file )
+		return false;
+
+	clear();
+	std::string line;
+	unsigned int number = 0;
+	bool in_clip = false, cubic = false, loop = true;
+	std::vector<float> times, values;
+	std::vector<unsigned int> targets;
+	const char *error = NULL;
+	while ( error == NULL && std::getline( file, line ) )
+	{
+		number++;
+		std::istringstream words( line );
+		std::string word;
+		if ( line.empty() || line[0] == '#' || !( words >> word ) )
+			continue;
+
+		if ( word == "clip" )
+		{
+			if ( in_clip && !times.empty() )
+				addClip( cubic, loop, times, targets, values );
+			std::string interpolation, repeat;
+			words >> interpolation >> repeat;
+			if ( interpolation != "linear" && interpolation != "cubic" )
+				error = "a clip is linear or cubic";
+			cubic = interpolation == "cubic";
+			loop = repeat != "once";
+			in_clip = true;
+			times.clear();
+			targets.clear();
+			values.clear();
+		}
+		else if ( word == "keys" )
+		{
+			float time;
+			while ( words >> time )
+			{
+				if ( !times.empty() && time <= times.back() )
+					error = "keys out of time order";
+				times.push_back( time );
+			}
+			if ( !in_clip || !targets.empty() || times.empty() )
+				error = "keys must start a clip";
+		}
+		else
+		{
+			unsigned int index, target;
+			std::string property;
+			if ( !in_clip || times.empty() )
+				error = "a channel before its clip's keys";
+			else if ( !( words >> index >> property ) || !parseTarget( word.c_str(), index, property.c_str(), &target ) )
+				error = "not a shape or light channel";
+			else
+			{
+				//values are kept channel by channel until the clip is added
+				const unsigned int before = values.size();
+				float value;
+				while ( words >> value )
+					values.push_back( value );
+				if ( values.size() - before != times.size() )
+					error = "a channel needs a value for each key";
+				else
+					targets.push_back( target );
+			}
+		}
+	}
+	if ( error == NULL && in_clip && !times.empty() )
+		addClip( cubic, loop, times, targets, values );
+
+	if ( error != NULL )
+	{
+		std::cerr << "Animation " << path << " line " << number << ": " << error << "\n";
+		clear();
+		return false;
+	}
+	return !_clips.empty();
+}
+
+bool CAnimation::bake( SceneDelegate *scene, float seconds, float rate )
+{
+	clear();
+	if ( seconds <= 0.0f || rate <= 0.0f )
+		return false;
+
+	const unsigned int keys = std::max( 2u, (unsigned int)( seconds * rate + 0.5f ) + 1 );
+	const unsigned int shapes = scene->numberOfShapes(), lights = scene->numberOfLights();
+	const unsigned int columns = shapes * SHAPE_COMPONENTS + lights * LIGHT_COMPONENTS;
+	std::vector<Shape> shape_row( shapes );
+	std::vector<Light> light_row( lights );
+
+	//the first pass finds the channels that vary, so only they are kept on the
+	//second, as a large scene would not fit every channel of every key
+	std::vector<float> first( columns );
+	std::vector<bool> varies( columns, false );
+	std::vector<float> times( keys );
+	for ( unsigned int k = 0; k < keys; ++k )
+	{
+		times[k] = seconds * k / ( keys - 1 );
+		scene->animate( times[k] );
+		for ( unsigned int i = 0; i < shapes; ++i )
+			shape_row[i] = scene->shapeAtIndex( i );
+		for ( unsigned int l = 0; l < lights; ++l )
+			light_row[l] = scene->lightAtIndex( l );
+		for ( unsigned int c = 0; c < columns; ++c )
+		{
+			const bool light = c >= shapes * SHAPE_COMPONENTS;
+			const unsigned int column = light ? c - shapes * SHAPE_COMPONENTS : c;
+			const unsigned int components = light ? LIGHT_COMPONENTS : SHAPE_COMPONENTS;
+			const float value = *field( target( light, column / components, column % components ), shape_row, light_row );
+			if ( k == 0 )
+				first[c] = value;
+			else if ( value != first[c] )
+				varies[c] = true;
+		}
+	}
+
+	std::vector<unsigned int> targets;
+	for ( unsigned int c = 0; c < columns; ++c )
+	{
+		if ( !varies[c] )
+			continue;
+		const bool light = c >= shapes * SHAPE_COMPONENTS;
+		const unsigned int column = light ? c - shapes * SHAPE_COMPONENTS : c;
+		const unsigned int components = light ? LIGHT_COMPONENTS : SHAPE_COMPONENTS;
+		targets.push_back( target( light, column / components, column % components ) );
+	}
+	if ( targets.empty() )
+		return false;
+
+	std::vector<float> values( keys * targets.size() );
+	for ( unsigned int k = 0; k < keys; ++k )
+	{
+		scene->animate( times[k] );
+		for ( unsigned int i = 0; i < shapes; ++i )
+			shape_row[i] = scene->shapeAtIndex( i );
+		for ( unsigned int l = 0; l < lights; ++l )
+			light_row[l] = scene->lightAtIndex( l );
+		for ( unsigned int c = 0; c < targets.size(); ++c )
+			values[c * keys + k] = *field( targets[c], shape_row, light_row );
+	}
+	scene->animate( 0.0f );
+
+	//the scene's own animation need not repeat after seconds, so a loop of it
+	//may jump at the end
+	addClip( false, true, times, targets, values );
+	return true;
+}
+
+void CAnimation::clear()
+{
+	_clips.clear();
+	_shape_mask.clear();
+	_light_mask.clear();
+}
+
+bool CAnimation::fits( const SceneDelegate *scene ) const
+{
+	for ( unsigned int c = 0; c < _clips.size(); ++c )
+	{
+		for ( unsigned int t = 0; t < _clips[c].channels; ++t )
+		{
+			const unsigned int target = _clips[c].targets[t];
+			if ( ( target >> 4 ) >= ( ( target & 8 ) != 0 ? scene->numberOfLights() : scene->numberOfShapes() ) )
+				return false;
+		}
+	}
+	return true;
+}
+
+void CAnimation::findStaticShapes( unsigned int shapes, std::vector<bool> *is_static ) const
+{
+	is_static->assign( shapes, true );
+	for ( unsigned int c = 0; c < _clips.size(); ++c )
+	{
+		for ( unsigned int t = 0; t < _clips[c].channels; ++t )
+		{
+			const unsigned int target = _clips[c].targets[t];
+			if ( ( target & 8 ) == 0 && ( target >> 4 ) < shapes )
+				(*is_static)[target >> 4] = false;
+		}
+	}
+}
+
+unsigned int CAnimation::channels() const
+{
+	unsigned int total = 0;
+	for ( unsigned int c = 0; c < _clips.size(); ++c )
+		total += _clips[c].channels;
+	return total;
+}
+
+//Blocks of four channels of one clip, as a job. The segment's ends and its
+//neighbours are blended as the first end plus weighted differences from it, so
+//channels that hold still give exactly the value they held
+void CAnimation::evaluateBlocks( void *data, unsigned int begin, unsigned int end )
+{
+	const Evaluation *e = (const Evaluation*)data;
+	if ( e->cubic )
+	{
+		const __m128 w0 = _mm_set1_ps( e->weights[0] ), w2 = _mm_set1_ps( e->weights[2] ), w3 = _mm_set1_ps( e->weights[3] );
+		for ( unsigned int b = begin; b < end; ++b )
+		{
+			const unsigned int c = b * 4;
+			const __m128 p1 = _mm_loadu_ps( e->keys[1] + c );
+			__m128 v = _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( e->keys[0] + c ), p1 ), w0 );
+			v = _mm_add_ps( v, _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( e->keys[2] + c ), p1 ), w2 ) );
+			v = _mm_add_ps( v, _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( e->keys[3] + c ), p1 ), w3 ) );
+			v = _mm_add_ps( p1, v );
+
+			e->changed[b] = (unsigned char)_mm_movemask_ps( _mm_cmpneq_ps( v, _mm_loadu_ps( e->output + c ) ) );
+			_mm_storeu_ps( e->output + c, v );
+		}
+	}
+	else
+	{
+		const __m128 t = _mm_set1_ps( e->t );
+		for ( unsigned int b = begin; b < end; ++b )
+		{
+			const unsigned int c = b * 4;
+			const __m128 p1 = _mm_loadu_ps( e->keys[1] + c );
+			const __m128 v = _mm_add_ps( p1, _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( e->keys[2] + c ), p1 ), t ) );
+
+			e->changed[b] = (unsigned char)_mm_movemask_ps( _mm_cmpneq_ps( v, _mm_loadu_ps( e->output + c ) ) );
+			_mm_storeu_ps( e->output + c, v );
+		}
+	}
+}
+
+void CAnimation::evaluate( Clip *clip, float time )
+{
+	const std::vector<float> &times = clip->times;
+	const unsigned int keys = times.size();
+
+	//repeat, or hold the ends
+	const float first = times.front(), length = times.back() - first;
+	if ( clip->loop && length > 0.0f )
+		time -= floor( ( time - first ) / length ) * length;
+	time = std::min( std::max( time, first ), times.back() );
+
+	//the segment time is in, and how far along it
+	unsigned int k1 = 0;
+	if ( keys > 1 )
+		k1 = std::min( (unsigned int)( std::upper_bound( times.begin(), times.end(), time ) - times.begin() ), keys - 1 ) - 1;
+	const unsigned int k2 = std::min( k1 + 1, keys - 1 );
+	const float t = k2 > k1 ? ( time - times[k1] ) / ( times[k2] - times[k1] ) : 0.0f;
+
+	//the neighbours past the ends are the ends themselves
+	Evaluation e;
+	const unsigned int k0 = k1 > 0 ? k1 - 1 : k1, k3 = std::min( k2 + 1, keys - 1 );
+	e.keys[0] = &clip->values[k0 * clip->padded];
+	e.keys[1] = &clip->values[k1 * clip->padded];
+	e.keys[2] = &clip->values[k2 * clip->padded];
+	e.keys[3] = &clip->values[k3 * clip->padded];
+	e.t = t;
+	e.cubic = clip->cubic;
+	const float t2 = t * t, t3 = t2 * t;
+	e.weights[0] = 0.5f * ( -t3 + 2.0f * t2 - t );
+	e.weights[1] = 0.5f * ( 3.0f * t3 - 5.0f * t2 + 2.0f );
+	e.weights[2] = 0.5f * ( -3.0f * t3 + 4.0f * t2 + t );
+	e.weights[3] = 0.5f * ( t3 - t2 );
+	e.output = &clip->output[0];
+	e.changed = &clip->changed[0];
+
+	const unsigned int blocks = clip->padded / 4;
+	if ( _jobs != NULL && blocks > ANIMATION_BLOCKS_PER_JOB )
+		_jobs->parallelFor( evaluateBlocks, &e, blocks, ANIMATION_BLOCKS_PER_JOB );
+	else
+		evaluateBlocks( &e, 0, blocks );
+}
+
+void CAnimation::animate( float time, std::vector<Shape> &shapes, std::vector<Light> &lights )
+{
+	LARGE_INTEGER start, end;
+	QueryPerformanceCounter( &start );
+
+	_shape_mask.assign( ( shapes.size() + 31 ) / 32, 0 );
+	_light_mask.assign( ( lights.size() + 31 ) / 32, 0 );
+	unsigned int changed = 0;
+	for ( unsigned int c = 0; c < _clips.size(); ++c )
+	{
+		Clip &clip = _clips[c];
+		if ( clip.channels == 0 )
+			continue;
+		evaluate( &clip, time );
+
+		//only the channels that changed are written back, most blocks of a
+		//scene that is mostly still having none
+		for ( unsigned int b = 0; b < clip.changed.size(); ++b )
+		{
+			unsigned int bits = clip.changed[b];
+			while ( bits != 0 )
+			{
+				const unsigned int channel = b * 4 + ( bits & 1 ? 0 : bits & 2 ? 1 : bits & 4 ? 2 : 3 );
+				bits &= bits - 1;
+				if ( channel >= clip.channels )
+					continue;
+
+				const unsigned int target = clip.targets[channel];
+				float *value = field( target, shapes, lights );
+				if ( value == NULL )
+					continue;
+				*value = clip.output[channel];
+				std::vector<unsigned int> &mask = ( target & 8 ) != 0 ? _light_mask : _shape_mask;
+				mask[( target >> 4 ) / 32] |= 1u << ( ( target >> 4 ) % 32 );
+				changed++;
+			}
+		}
+	}
+
+	//blended directions come out short, so the lights that moved are made unit again
+	for ( unsigned int l = 0; l < lights.size(); ++l )
+	{
+		if ( !lightChanged( l ) )
+			continue;
+		Float3 &d = lights[l].direction;
+		const float length = sqrt( d.x * d.x + d.y * d.y + d.z * d.z );
+		if ( length > 0.0f )
+			d = Float3( d.x / length, d.y / length, d.z / length );
+	}
+
+	QueryPerformanceCounter( &end );
+	_evaluations++;
+	_evaluate_ms += ( end.QuadPart - start.QuadPart ) * 1000.0 / _frequency.QuadPart;
+	_changed_channels += changed;
+	for ( unsigned int w = 0; w < _shape_mask.size(); ++w )
+	{
+		for ( unsigned int bits = _shape_mask[w]; bits != 0; bits &= bits - 1 )
+			_changed_shapes++;
+	}
+}
+
+void CAnimation::resetStats()
+{
+	_evaluations = 0;
+	_evaluate_ms = 0.0;
+	_changed_channels = 0.0;
+	_changed_shapes = 0.0;
+}
+
+void CAnimation::print( std::ostream &out ) const
+{
+	unsigned int keys = 0, bytes = 0;
+	for ( unsigned int c = 0; c < _clips.size(); ++c )
+	{
+		keys += _clips[c].times.size();
+		bytes += _clips[c].values.size() * sizeof(float);
+	}
+	out << "Animation: " << _clips.size() << " clips, " << channels() << " channels, " << keys << " keys, "
+		<< bytes / 1024 << " KB of values\n";
+	if ( _evaluations > 0 )
+	{
+		out << "  " << _evaluations << " evaluations, " << _evaluate_ms / _evaluations << " ms, "
+			<< _changed_channels / _evaluations << " channels and " << _changed_shapes / _evaluations << " shapes changed each\n";
+	}
+}
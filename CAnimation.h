@@ -0,0 +1,102 @@
+#pragma once
+#include <windows.h>
+#include <iostream>
+#include <cassert>
+#include <vector>
+#include "SceneDelegate.hpp"
+#include "CJobSystem.h"
+
+//Channels evaluated together in one job
+#define ANIMATION_BLOCKS_PER_JOB 256
+
+//Keyframed tracks for the shapes and lights of a scene, played in place of
+//its own animation. A clip is any number of channels, each one float of a
+//shape or light, sharing one set of key times, so the segment and its weights
+//are found once per clip and every channel is then blended four at a time.
+//Each evaluation also records which channels changed since the last, so the
+//shapes and lights that did not move can be told apart from those that did.
+class CAnimation : public SceneAnimator {
+private:
+	struct Clip {
+		bool cubic; // Catmull-Rom through the keys, rather than straight between them
+		bool loop; // repeat after the last key, rather than holding it
+		std::vector<float> times; // increasing
+		unsigned int channels, padded; // padded up to a multiple of four
+		std::vector<unsigned int> targets; // what each channel moves, see target()
+		std::vector<float> values; // key by key, padded channels a key
+		std::vector<float> output; // as last evaluated
+		std::vector<unsigned char> changed; // by the last evaluation, a bit per channel of each block of four
+	};
+
+	//one clip's evaluation, shared by the jobs doing its blocks
+	struct Evaluation {
+		const float *keys[4]; // the key before the segment, its two ends and the key after
+		float t; // how far along the segment
+		float weights[4]; // Catmull-Rom's, for each of keys
+		bool cubic;
+		float *output;
+		unsigned char *changed;
+	};
+
+	std::vector<Clip> _clips;
+	std::vector<unsigned int> _shape_mask, _light_mask; // changed by the last evaluation, 32 a word
+	CJobSystem *_jobs; // shares the blocks out, NULL to do them all here
+	LARGE_INTEGER _frequency;
+
+	//since the last resetStats
+	unsigned int _evaluations;
+	double _evaluate_ms, _changed_channels, _changed_shapes;
+
+	//a channel's target packs the shape or light index above a bit for which
+	//and three for the component: position then rotation xyz for shapes, and
+	//position xyz, direction xyz, cone then intensity for lights
+	static unsigned int target( bool light, unsigned int index, unsigned int component ) { return ( index << 4 ) | ( light ? 8 : 0 ) | component; }
+	static bool parseTarget( const char *kind, unsigned int index, const char *property, unsigned int *target );
+	static float *field( unsigned int target, std::vector<Shape> &shapes, std::vector<Light> &lights );
+	static void evaluateBlocks( void *evaluation, unsigned int begin, unsigned int end );
+
+	//values are channel by channel, one for each of times
+	void addClip( bool cubic, bool loop, const std::vector<float> &times, const std::vector<unsigned int> &targets, const std::vector<float> &values );
+	void evaluate( Clip *clip, float time );
+
+public:
+	CAnimation();
+
+	//clips in text, lines starting with # skipped:
+	//  clip linear|cubic [once]
+	//  keys t0 t1 ...
+	//  shape <index> position.x|y|z|rotation.x|y|z v0 v1 ...
+	//  light <index> position.x|y|z|direction.x|y|z|cone|intensity v0 v1 ...
+	//where each shape and light line is a channel of the clip above, with a
+	//value for each of its keys
+	bool load( const char *path );
+
+	//sample whatever moves the scene now at rate keys a second for seconds,
+	//keeping only the channels that vary, as one linear clip that loops
+	bool bake( SceneDelegate *scene, float seconds, float rate );
+
+	void clear();
+
+	//whether every channel has a shape or light to move in scene
+	bool fits( const SceneDelegate *scene ) const;
+
+	//flag every one of shapes no channel moves. Exact, where sampling animate
+	//could miss keys between samples or after the last
+	void findStaticShapes( unsigned int shapes, std::vector<bool> *is_static ) const;
+
+	void setJobs( CJobSystem *jobs ) { _jobs = jobs; }
+
+	void animate( float time, std::vector<Shape> &shapes, std::vector<Light> &lights );
+
+	//what the last animate changed
+	bool shapeChanged( unsigned int i ) const { return i / 32 < _shape_mask.size() && ( _shape_mask[i / 32] & ( 1u << ( i % 32 ) ) ) != 0; }
+	bool lightChanged( unsigned int l ) const { return l / 32 < _light_mask.size() && ( _light_mask[l / 32] & ( 1u << ( l % 32 ) ) ) != 0; }
+	const std::vector<unsigned int> &shapeMask() const { return _shape_mask; }
+	const std::vector<unsigned int> &lightMask() const { return _light_mask; }
+
+	bool empty() const { return _clips.empty(); }
+	unsigned int channels() const;
+
+	void resetStats();
+	void print( std::ostream &out ) const;
+};
@@ -0,0 +1,80 @@
+#include "CCameraPath.h"
+#include <cstdio>
+#include <cmath>
+
+bool CCameraPath::load( const char *path )
+{
+	FILE *file = fopen( path, "r" );
+	if ( file == NULL )
+		return false;
+
+	_keys.clear();
+	bool ordered = true;
+	char line[256];
+	while ( fgets( line, sizeof(line), file ) != NULL )
+	{
+		CameraKey key;
+		if ( line[0] == '#' || sscanf( line, "%f %f %f %f %f %f %f", &key.time,
+			&key.position.x, &key.position.y, &key.position.z,
+			&key.rotation.x, &key.rotation.y, &key.rotation.z ) != 7 )
+			continue;
+
+		if ( !_keys.empty() && key.time <= _keys.back().time )
+			ordered = false;
+		_keys.push_back( key );
+	}
+	fclose( file );
+
+	if ( !ordered )
+	{
+		std::cerr << "Camera path " << path << " has keys out of time order\n";
+		_keys.clear();
+	}
+	return !_keys.empty();
+}
+
+void CCameraPath::makeOrbit( const D3DXVECTOR3 &centre, float radius, float height, float pitch, float seconds )
+{
+	//close enough together that moving straight between them looks round
+	const unsigned int keys = 64;
+	_keys.resize( keys + 1 );
+	for ( unsigned int i = 0; i <= keys; ++i )
+	{
+		//the camera looks down -look, and yaw turns look from +y, so facing the
+		//centre is a quarter turn behind the angle around it. yaw keeps rising
+		//rather than wrapping so the keys can be blended
+		const float angle = 2.0f * D3DX_PI * i / keys;
+		CameraKey &key = _keys[i];
+		key.time = seconds * i / keys;
+		key.position = centre + D3DXVECTOR3( radius * cosf( angle ), radius * sinf( angle ), height );
+		key.rotation = D3DXVECTOR3( pitch, angle - 0.5f * D3DX_PI, 0.0f );
+	}
+}
+
+void CCameraPath::apply( double time, CFirstPersonCamera *camera ) const
+{
+	if ( _keys.empty() )
+		return;
+
+	//repeat the path
+	const double length = duration();
+	if ( length > 0.0 )
+		time -= floor( time / length ) * length;
+
+	unsigned int next = 0;
+	while ( next < _keys.size() && _keys[next].time <= time )
+		next++;
+
+	if ( next == 0 || next == _keys.size() )
+	{
+		const CameraKey &key = _keys[next == 0 ? 0 : next - 1];
+		camera->setPosition( key.position );
+		camera->setRotation( key.rotation );
+		return;
+	}
+
+	const CameraKey &a = _keys[next - 1], &b = _keys[next];
+	const float t = (float)( ( time - a.time ) / ( b.time - a.time ) );
+	camera->setPosition( a.position + ( b.position - a.position ) * t );
+	camera->setRotation( a.rotation + ( b.rotation - a.rotation ) * t );
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <windows.h>
+#include <d3d9.h>
+#include <d3dx9.h>
+#include <iostream>
+#include <cassert>
+#include <vector>
+#include "CFirstPersonCamera.h"
+
+//Where the camera is at one time along a path
+struct CameraKey {
+	float time; // seconds from the start of the path
+	D3DXVECTOR3 position;
+	D3DXVECTOR3 rotation; // as CFirstPersonCamera takes it: pitch, yaw and roll
+};
+
+//A scripted camera flight, for runs that must see the same frames every time.
+//The camera is placed between the keys either side of the time asked for,
+//and the path repeats once the last key is passed.
+class CCameraPath {
+private:
+	std::vector<CameraKey> _keys; // by time
+
+public:
+	//one key a line, "time x y z pitch yaw roll", in increasing time. lines
+	//starting with # are skipped
+	bool load( const char *path );
+
+	//once around centre in seconds, looking in at it from radius away and height above
+	void makeOrbit( const D3DXVECTOR3 &centre, float radius, float height, float pitch, float seconds );
+
+	bool empty() const { return _keys.empty(); }
+	float duration() const { return _keys.empty() ? 0.0f : _keys.back().time; }
+
+	void apply( double time, CFirstPersonCamera *camera ) const;
+};
@@ -0,0 +1,119 @@
+#include "CClock.h"
+#include <cmath>
+#include <cstring>
+
+CClock::CClock()
+{
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency( &frequency );
+	_frequency = frequency.QuadPart;
+	reset();
+}
+
+void CClock::reset()
+{
+	LARGE_INTEGER now;
+	QueryPerformanceCounter( &now );
+	_start = now.QuadPart;
+}
+
+LONGLONG CClock::ticks() const
+{
+	LARGE_INTEGER now;
+	QueryPerformanceCounter( &now );
+	return now.QuadPart - _start;
+}
+
+CFixedTimestep::CFixedTimestep() : _step( 1 ), _pending( 0 ), _last( 0 ), _steps( 0 ), _max_steps( 1 ), _dropped( 0 ), _seconds( 0.0 )
+{
+}
+
+void CFixedTimestep::init( const CClock &clock, double step_seconds, unsigned int max_steps )
+{
+	assert( step_seconds > 0.0 && max_steps > 0 );
+	_step = clock.fromSeconds( step_seconds );
+	if ( _step < 1 )
+		_step = 1;
+	_seconds = step_seconds;
+	_max_steps = max_steps;
+	_pending = 0;
+	_last = clock.ticks();
+	_steps = 0;
+	_dropped = 0;
+}
+
+void CFixedTimestep::advance( LONGLONG now )
+{
+	_pending += now - _last;
+	_last = now;
+
+	//after a long stall, such as a window drag, skip ahead rather than spend
+	//frames catching up, which would only make the next frame later still
+	const LONGLONG limit = _step * _max_steps;
+	if ( _pending > limit )
+	{
+		const LONGLONG dropped = ( _pending - limit ) / _step;
+		_dropped += (unsigned int)dropped;
+		_pending -= dropped * _step;
+	}
+}
+
+bool CFixedTimestep::step()
+{
+	if ( _pending < _step )
+		return false;
+
+	_pending -= _step;
+	_steps++;
+	return true;
+}
+
+CFramePacing::CFramePacing() : _count( 0 ), _mean( 0.0 ), _m2( 0.0 ), _min( 0.0 ), _max( 0.0 )
+{
+	memset( _buckets, 0, sizeof(_buckets) );
+}
+
+void CFramePacing::add( double ms )
+{
+	if ( _count == 0 || ms < _min )
+		_min = ms;
+	if ( _count == 0 || ms > _max )
+		_max = ms;
+
+	_count++;
+	const double delta = ms - _mean;
+	_mean += delta / _count;
+	_m2 += delta * ( ms - _mean );
+
+	unsigned int bucket = (unsigned int)( ms * 10.0 );
+	if ( bucket >= BUCKETS )
+		bucket = BUCKETS - 1;
+	_buckets[bucket]++;
+}
+
+void CFramePacing::print( std::ostream &out ) const
+{
+	if ( _count < 2 )
+	{
+		out << "Frame pacing: too few frames\n";
+		return;
+	}
+
+	//the 99th percentile to the nearest bucket, and the frames well over the mean
+	const unsigned long long p99_count = _count - _count / 100;
+	const unsigned int slow_bucket = (unsigned int)( _mean * 1.5 * 10.0 );
+	unsigned long long seen = 0, slow = 0;
+	unsigned int p99 = BUCKETS;
+	for ( unsigned int b = 0; b < BUCKETS; ++b )
+	{
+		seen += _buckets[b];
+		if ( p99 == BUCKETS && seen >= p99_count )
+			p99 = b;
+		if ( b >= slow_bucket )
+			slow += _buckets[b];
+	}
+
+	out << "Frame pacing over " << _count << " frames: mean " << _mean << " ms, jitter (std dev) "
+		<< sqrt( _m2 / ( _count - 1 ) ) << " ms, min " << _min << " ms, p99 " << ( p99 + 1 ) * 0.1
+		<< " ms, max " << _max << " ms, " << slow << " over " << _mean * 1.5 << " ms\n";
+}
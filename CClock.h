@@ -0,0 +1,83 @@
+#pragma once
+#include <windows.h>
+#include <iostream>
+#include <cassert>
+
+//Time from the performance counter, kept in whole ticks so it never loses
+//precision however long it runs
+class CClock {
+private:
+	LONGLONG _frequency; // ticks per second
+	LONGLONG _start;
+
+public:
+	CClock();
+
+	void reset();
+
+	//since construction or the last reset
+	LONGLONG ticks() const;
+	double seconds() const { return toSeconds( ticks() ); }
+
+	LONGLONG frequency() const { return _frequency; }
+	double toSeconds( LONGLONG ticks ) const { return (double)ticks / _frequency; }
+	double toMs( LONGLONG ticks ) const { return ticks * 1000.0 / _frequency; }
+	LONGLONG fromSeconds( double seconds ) const { return (LONGLONG)( seconds * _frequency + 0.5 ); }
+};
+
+//Runs a simulation in steps of a fixed length, however long frames take.
+//Steps are counted rather than times added up, so the time of step n is
+//exact, and what is left over between steps is how far the frame drawn is
+//from the last step to the next.
+class CFixedTimestep {
+private:
+	LONGLONG _step; // ticks
+	LONGLONG _pending; // ticks not yet simulated
+	LONGLONG _last; // clock ticks when last advanced
+	unsigned long long _steps; // taken so far
+	unsigned int _max_steps; // in one frame, beyond which time is dropped rather than caught up
+	unsigned int _dropped; // steps skipped after stalls
+	double _seconds; // one step
+
+public:
+	CFixedTimestep();
+
+	//steps of step_seconds on clock, catching up at most max_steps a frame
+	void init( const CClock &clock, double step_seconds, unsigned int max_steps );
+
+	//add the time since the last call, up to max_steps of it
+	void advance( LONGLONG now );
+
+	//take a step if one is due
+	bool step();
+
+	//the time of the last step taken, and of step n
+	double time() const { return _steps * _seconds; }
+	double stepSeconds() const { return _seconds; }
+	unsigned long long steps() const { return _steps; }
+	unsigned int dropped() const { return _dropped; }
+
+	//how far from the last step to the next the present is, in [0, 1)
+	float alpha() const { return (float)( (double)_pending / _step ); }
+};
+
+//How evenly frames are presented, kept as running totals so it costs the same
+//over an hour as over a minute
+class CFramePacing {
+private:
+	static const unsigned int BUCKETS = 1000; // of 0.1 ms, the last taking everything longer
+	unsigned int _buckets[BUCKETS];
+	unsigned long long _count;
+	double _mean, _m2; // Welford's running mean and sum of squared differences
+	double _min, _max;
+
+public:
+	CFramePacing();
+
+	//the time since the last frame began
+	void add( double ms );
+
+	//interval mean, standard deviation, min, 99th percentile and max, and how
+	//many frames took over half as long again as the mean
+	void print( std::ostream &out ) const;
+};
@@ -0,0 +1,49 @@
+#include "CCommandLine.h"
+#include <cstdlib>
+
+CCommandLine::CCommandLine( int argc, char* argv[] )
+{
+	//skip the program name
+	for ( int i = 1; i < argc; ++i )
+		_args.push_back( argv[i] );
+}
+
+CCommandLine::~CCommandLine()
+{
+}
+
+int CCommandLine::find( const char *name ) const
+{
+	for ( unsigned int i = 0; i < _args.size(); ++i )
+	{
+		if ( _args[i] == name )
+			return (int)i;
+	}
+	return -1;
+}
+
+bool CCommandLine::hasFlag( const char *name ) const
+{
+	return find( name ) != -1;
+}
+
+const char *CCommandLine::getString( const char *name, const char *default_value ) const
+{
+	//the value is the argument straight after the name
+	const int i = find( name );
+	if ( i == -1 || i + 1 >= (int)_args.size() )
+		return default_value;
+	return _args[i + 1].c_str();
+}
+
+int CCommandLine::getInt( const char *name, int default_value ) const
+{
+	const char *value = getString( name, NULL );
+	return value != NULL ? atoi( value ) : default_value;
+}
+
+float CCommandLine::getFloat( const char *name, float default_value ) const
+{
+	const char *value = getString( name, NULL );
+	return value != NULL ? (float)atof( value ) : default_value;
+}
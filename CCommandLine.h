@@ -0,0 +1,20 @@
+#pragma once
+#include <string>
+#include <vector>
+
+//Simple access to "-flag" and "-name value" style program arguments
+class CCommandLine {
+private:
+	std::vector<std::string> _args;
+
+	int find( const char *name ) const;
+
+public:
+	CCommandLine( int argc, char* argv[] );
+	~CCommandLine();
+
+	bool hasFlag( const char *name ) const;
+	const char *getString( const char *name, const char *default_value ) const;
+	int getInt( const char *name, int default_value ) const;
+	float getFloat( const char *name, float default_value ) const;
+};
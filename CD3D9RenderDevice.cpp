@@ -0,0 +1,199 @@
+#include "CD3D9RenderDevice.h"
+
+CD3D9RenderDevice::CD3D9RenderDevice( IDirect3DDevice9 *dev )
+{
+	assert( dev != NULL );
+	_dev = dev;
+}
+
+CD3D9RenderDevice::~CD3D9RenderDevice()
+{
+	_dev->Release();
+	_dev = NULL;
+}
+
+HRESULT CD3D9RenderDevice::TestCooperativeLevel()
+{
+	return _dev->TestCooperativeLevel();
+}
+
+HRESULT CD3D9RenderDevice::Reset( D3DPRESENT_PARAMETERS *pp )
+{
+	return _dev->Reset( pp );
+}
+
+HRESULT CD3D9RenderDevice::Present( const RECT *source, const RECT *dest, HWND window, const void *dirty )
+{
+	return _dev->Present( source, dest, window, (const RGNDATA*)dirty );
+}
+
+HRESULT CD3D9RenderDevice::BeginScene()
+{
+	return _dev->BeginScene();
+}
+
+HRESULT CD3D9RenderDevice::EndScene()
+{
+	return _dev->EndScene();
+}
+
+HRESULT CD3D9RenderDevice::Clear( DWORD count, const D3DRECT *rects, DWORD flags, D3DCOLOR colour, float z, DWORD stencil )
+{
+	return _dev->Clear( count, rects, flags, colour, z, stencil );
+}
+
+HRESULT CD3D9RenderDevice::GetViewport( D3DVIEWPORT9 *viewport )
+{
+	return _dev->GetViewport( viewport );
+}
+
+///////////////////////
+//Resource creation  //
+///////////////////////
+
+HRESULT CD3D9RenderDevice::GetRenderTarget( DWORD index, IDirect3DSurface9 **surface )
+{
+	return _dev->GetRenderTarget( index, surface );
+}
+
+HRESULT CD3D9RenderDevice::GetDepthStencilSurface( IDirect3DSurface9 **surface )
+{
+	return _dev->GetDepthStencilSurface( surface );
+}
+
+HRESULT CD3D9RenderDevice::CreateDepthStencilSurface( UINT width, UINT height, D3DFORMAT format, D3DMULTISAMPLE_TYPE multisample, DWORD quality, BOOL discard, IDirect3DSurface9 **surface, HANDLE *shared )
+{
+	return _dev->CreateDepthStencilSurface( width, height, format, multisample, quality, discard, surface, shared );
+}
+
+HRESULT CD3D9RenderDevice::CreateTexture( UINT width, UINT height, UINT levels, DWORD usage, D3DFORMAT format, D3DPOOL pool, IDirect3DTexture9 **texture, HANDLE *shared )
+{
+	return _dev->CreateTexture( width, height, levels, usage, format, pool, texture, shared );
+}
+
+HRESULT CD3D9RenderDevice::CreateVertexBuffer( UINT length, DWORD usage, DWORD fvf, D3DPOOL pool, IDirect3DVertexBuffer9 **buffer, HANDLE *shared )
+{
+	return _dev->CreateVertexBuffer( length, usage, fvf, pool, buffer, shared );
+}
+
+HRESULT CD3D9RenderDevice::CreateIndexBuffer( UINT length, DWORD usage, D3DFORMAT format, D3DPOOL pool, IDirect3DIndexBuffer9 **buffer, HANDLE *shared )
+{
+	return _dev->CreateIndexBuffer( length, usage, format, pool, buffer, shared );
+}
+
+HRESULT CD3D9RenderDevice::CreateVertexDeclaration( const D3DVERTEXELEMENT9 *elements, IDirect3DVertexDeclaration9 **declaration )
+{
+	return _dev->CreateVertexDeclaration( elements, declaration );
+}
+
+HRESULT CD3D9RenderDevice::CreateVertexShader( const DWORD *function, IDirect3DVertexShader9 **shader )
+{
+	return _dev->CreateVertexShader( function, shader );
+}
+
+HRESULT CD3D9RenderDevice::CreatePixelShader( const DWORD *function, IDirect3DPixelShader9 **shader )
+{
+	return _dev->CreatePixelShader( function, shader );
+}
+
+//////////////////////
+//Pipeline state    //
+//////////////////////
+
+HRESULT CD3D9RenderDevice::SetRenderTarget( DWORD index, IDirect3DSurface9 *surface )
+{
+	return _dev->SetRenderTarget( index, surface );
+}
+
+HRESULT CD3D9RenderDevice::SetDepthStencilSurface( IDirect3DSurface9 *surface )
+{
+	return _dev->SetDepthStencilSurface( surface );
+}
+
+HRESULT CD3D9RenderDevice::SetVertexDeclaration( IDirect3DVertexDeclaration9 *declaration )
+{
+	return _dev->SetVertexDeclaration( declaration );
+}
+
+HRESULT CD3D9RenderDevice::SetStreamSource( UINT stream, IDirect3DVertexBuffer9 *buffer, UINT offset, UINT stride )
+{
+	return _dev->SetStreamSource( stream, buffer, offset, stride );
+}
+
+HRESULT CD3D9RenderDevice::SetStreamSourceFreq( UINT stream, UINT setting )
+{
+	return _dev->SetStreamSourceFreq( stream, setting );
+}
+
+HRESULT CD3D9RenderDevice::SetIndices( IDirect3DIndexBuffer9 *buffer )
+{
+	return _dev->SetIndices( buffer );
+}
+
+HRESULT CD3D9RenderDevice::SetVertexShader( IDirect3DVertexShader9 *shader )
+{
+	return _dev->SetVertexShader( shader );
+}
+
+HRESULT CD3D9RenderDevice::SetPixelShader( IDirect3DPixelShader9 *shader )
+{
+	return _dev->SetPixelShader( shader );
+}
+
+HRESULT CD3D9RenderDevice::SetRenderState( D3DRENDERSTATETYPE state, DWORD value )
+{
+	return _dev->SetRenderState( state, value );
+}
+
+HRESULT CD3D9RenderDevice::SetSamplerState( DWORD sampler, D3DSAMPLERSTATETYPE state, DWORD value )
+{
+	return _dev->SetSamplerState( sampler, state, value );
+}
+
+HRESULT CD3D9RenderDevice::SetTexture( DWORD stage, IDirect3DBaseTexture9 *texture )
+{
+	return _dev->SetTexture( stage, texture );
+}
+
+////////////////////////
+//Shader constants    //
+////////////////////////
+
+HRESULT CD3D9RenderDevice::SetMatrix( ID3DXConstantTable *table, D3DXHANDLE constant, const D3DXMATRIX *matrix )
+{
+	return table->SetMatrix( _dev, constant, matrix );
+}
+
+HRESULT CD3D9RenderDevice::SetVector( ID3DXConstantTable *table, D3DXHANDLE constant, const D3DXVECTOR4 *vector )
+{
+	return table->SetVector( _dev, constant, vector );
+}
+
+HRESULT CD3D9RenderDevice::SetFloat( ID3DXConstantTable *table, D3DXHANDLE constant, float value )
+{
+	return table->SetFloat( _dev, constant, value );
+}
+
+HRESULT CD3D9RenderDevice::SetFloatArray( ID3DXConstantTable *table, D3DXHANDLE constant, const float *values, UINT count )
+{
+	return table->SetFloatArray( _dev, constant, values, count );
+}
+
+HRESULT CD3D9RenderDevice::DrawIndexedPrimitive( D3DPRIMITIVETYPE type, INT base_vertex, UINT min_index, UINT num_vertices, UINT start_index, UINT primitive_count )
+{
+	return _dev->DrawIndexedPrimitive( type, base_vertex, min_index, num_vertices, start_index, primitive_count );
+}
+
+void CD3D9RenderDevice::BeginEvent( const char *name )
+{
+	//PIX wants a wide string
+	WCHAR wide[64];
+	MultiByteToWideChar( CP_ACP, 0, name, -1, wide, 64 );
+	wide[63] = 0;
+	D3DPERF_BeginEvent( D3DCOLOR_XRGB(255,255,255), wide );
+}
+
+void CD3D9RenderDevice::EndEvent()
+{
+	D3DPERF_EndEvent();
+}
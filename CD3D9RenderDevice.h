@@ -0,0 +1,55 @@
+#pragma once
+#include "CRenderDevice.h"
+
+//Forwards every call straight on to a Direct3D 9 device.
+class CD3D9RenderDevice : public CRenderDevice {
+private:
+	IDirect3DDevice9 *_dev; // the real device, owned by this object
+
+public:
+	CD3D9RenderDevice( IDirect3DDevice9 *dev );
+	~CD3D9RenderDevice();
+
+	IDirect3DDevice9 *device() { return _dev; }
+
+	HRESULT TestCooperativeLevel();
+	HRESULT Reset( D3DPRESENT_PARAMETERS *pp );
+	HRESULT Present( const RECT *source, const RECT *dest, HWND window, const void *dirty );
+
+	HRESULT BeginScene();
+	HRESULT EndScene();
+	HRESULT Clear( DWORD count, const D3DRECT *rects, DWORD flags, D3DCOLOR colour, float z, DWORD stencil );
+	HRESULT GetViewport( D3DVIEWPORT9 *viewport );
+
+	HRESULT GetRenderTarget( DWORD index, IDirect3DSurface9 **surface );
+	HRESULT GetDepthStencilSurface( IDirect3DSurface9 **surface );
+	HRESULT CreateDepthStencilSurface( UINT width, UINT height, D3DFORMAT format, D3DMULTISAMPLE_TYPE multisample, DWORD quality, BOOL discard, IDirect3DSurface9 **surface, HANDLE *shared );
+	HRESULT CreateTexture( UINT width, UINT height, UINT levels, DWORD usage, D3DFORMAT format, D3DPOOL pool, IDirect3DTexture9 **texture, HANDLE *shared );
+	HRESULT CreateVertexBuffer( UINT length, DWORD usage, DWORD fvf, D3DPOOL pool, IDirect3DVertexBuffer9 **buffer, HANDLE *shared );
+	HRESULT CreateIndexBuffer( UINT length, DWORD usage, D3DFORMAT format, D3DPOOL pool, IDirect3DIndexBuffer9 **buffer, HANDLE *shared );
+	HRESULT CreateVertexDeclaration( const D3DVERTEXELEMENT9 *elements, IDirect3DVertexDeclaration9 **declaration );
+	HRESULT CreateVertexShader( const DWORD *function, IDirect3DVertexShader9 **shader );
+	HRESULT CreatePixelShader( const DWORD *function, IDirect3DPixelShader9 **shader );
+
+	HRESULT SetRenderTarget( DWORD index, IDirect3DSurface9 *surface );
+	HRESULT SetDepthStencilSurface( IDirect3DSurface9 *surface );
+	HRESULT SetVertexDeclaration( IDirect3DVertexDeclaration9 *declaration );
+	HRESULT SetStreamSource( UINT stream, IDirect3DVertexBuffer9 *buffer, UINT offset, UINT stride );
+	HRESULT SetStreamSourceFreq( UINT stream, UINT setting );
+	HRESULT SetIndices( IDirect3DIndexBuffer9 *buffer );
+	HRESULT SetVertexShader( IDirect3DVertexShader9 *shader );
+	HRESULT SetPixelShader( IDirect3DPixelShader9 *shader );
+	HRESULT SetRenderState( D3DRENDERSTATETYPE state, DWORD value );
+	HRESULT SetSamplerState( DWORD sampler, D3DSAMPLERSTATETYPE state, DWORD value );
+	HRESULT SetTexture( DWORD stage, IDirect3DBaseTexture9 *texture );
+
+	HRESULT SetMatrix( ID3DXConstantTable *table, D3DXHANDLE constant, const D3DXMATRIX *matrix );
+	HRESULT SetVector( ID3DXConstantTable *table, D3DXHANDLE constant, const D3DXVECTOR4 *vector );
+	HRESULT SetFloat( ID3DXConstantTable *table, D3DXHANDLE constant, float value );
+	HRESULT SetFloatArray( ID3DXConstantTable *table, D3DXHANDLE constant, const float *values, UINT count );
+
+	HRESULT DrawIndexedPrimitive( D3DPRIMITIVETYPE type, INT base_vertex, UINT min_index, UINT num_vertices, UINT start_index, UINT primitive_count );
+
+	void BeginEvent( const char *name );
+	void EndEvent();
+};
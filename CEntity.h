@@ -7,50 +7,48 @@
 #include <cassert>
 #include "SceneDelegate.hpp"
 
-#include "CFirstPersonCamera.h"
-#include "CShader.h"
-#include "CLight.h"
-
+#include <vector>
+#include "CMesh.h"
+
+//Where a pass looks from, for choosing levels of detail and culling meshlets
+struct LodView {
+	unsigned int index; // 0 for the camera, 1 + the light index for a shadow map
+	D3DXVECTOR3 eye;
+	float pixel_scale; // pixels one world unit covers at a distance of one unit
+	D3DXMATRIX view_projection;
+};
+
+//One shape in the scene: a shared mesh placed by its own transform
 class CEntity {
 private:
 
-	IDirect3DVertexDeclaration9* _vertex_declaration; // specifies how the vertex buffer(s) are layed out
-
-	// C++ version of our vertex layout
-	struct Vertex
-	{
-		D3DXVECTOR3 position;
-		D3DXVECTOR3 normal;
-	};
-
-	unsigned int _num_triangles; // the number of triangles in the shape
-	unsigned int _num_vertices; // the number of vertices in the shape
-	IDirect3DVertexBuffer9* _vertex_buffer; // holds vertex data for the shape
-	IDirect3DIndexBuffer9* _index_buffer; // holds the index data for the shape
-
-	CShader *_light, *_shadow, *_ambient;
+	CMesh *_mesh; // the mesh this entity draws, owned by the mesh cache
 
 	D3DXVECTOR3 _position, _rotation; // holds the entitys translations
+	D3DXMATRIX _world[2]; // world transform built from the above, as drawn and as the next frame will be
+	std::vector<unsigned char> _lods; // level of detail last used by each view, sized by init
 
-	template<typename T>
-	void Release(T** ptr) {
-		if ( *ptr != 0 ) {
-			(*ptr)->Release();
-			*ptr = 0;
-		}
-	}
+	static unsigned int s_drawn; // which of _world every entity is drawn with
+
+	void updateWorld();
 
 public:
 	CEntity();
 	~CEntity();
-	bool init( IDirect3DDevice9 *dev, const Mesh *mesh, const Shape &shape );
+	//views is how many LodView indices there are, 1 + the number of lights
+	bool init( CMesh *mesh, const Shape &shape, unsigned int views );
 
-	void drawAmbient( IDirect3DDevice9 *dev, CFirstPersonCamera *camera );
-	void draw( IDirect3DDevice9 *dev, CFirstPersonCamera *camera, CLight *light, IDirect3DTexture9 *shadow_map );
-	void drawShadows( IDirect3DDevice9 *dev, CLight *light );
-	
+	//placed for the next frame, leaving the one being drawn as it is, so the
+	//next frame can be simulated while this one is drawn
 	void update( const Shape &shape );
 
-	void setshaders( CShader *light, CShader *shadow, CShader *ambient );
+	//make the frame every entity was last updated for the one drawn
+	static void flip() { s_drawn ^= 1; }
+
+	//pick the level of detail to draw in a view, remembering it for next time
+	unsigned int selectLod( const LodView &view );
+
+	CMesh *mesh() { return _mesh; }
+	const D3DXMATRIX &world() const { return _world[s_drawn]; }
 
-};
\ No newline at end of file
+};
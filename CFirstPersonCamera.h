@@ -25,6 +25,7 @@ public:
 
 	void move( D3DXVECTOR3 amount );
 	void turn( D3DXVECTOR3 amount );
+	void setPosition( D3DXVECTOR3 pos ) { m_position = pos; }
 	void setRotation( D3DXVECTOR3 rot ) { m_rotation = rot; }
 
 	void setLastMouseXY( int x, int y ) { m_last_mouse_position.x = (float)x; m_last_mouse_position.y = (float)y; }
@@ -0,0 +1,78 @@
+#include "CFrameArena.h"
+
+CFrameArena::CFrameArena() : _base( NULL ), _capacity( 0 ), _used( 0 ), _peak( 0 ), _spilled( 0 ), _frames( 0 ), _spill_frames( 0 ), _grows( 0 )
+{
+	InitializeCriticalSection( &_spill_lock );
+}
+
+CFrameArena::~CFrameArena()
+{
+	reset();
+	delete [] _base;
+	DeleteCriticalSection( &_spill_lock );
+}
+
+bool CFrameArena::init( size_t capacity )
+{
+	assert( "CFrameArena::init already performed" && _base == NULL );
+
+	//the extra lets the first allocation be aligned however new placed the block
+	_base = new unsigned char[capacity + FRAME_ARENA_ALIGNMENT];
+	_capacity = capacity;
+	_used = 0;
+	return _base != NULL;
+}
+
+void *CFrameArena::allocate( size_t bytes )
+{
+	//aligned by address, as the block itself may not be. Another thread may
+	//claim the same space first, in which case try again after it
+	while ( _base != NULL )
+	{
+		const LONG used = _used;
+		const UINT_PTR start = ( (UINT_PTR)( _base + used ) + FRAME_ARENA_ALIGNMENT - 1 ) & ~(UINT_PTR)( FRAME_ARENA_ALIGNMENT - 1 );
+		const size_t end = (size_t)( start - (UINT_PTR)_base ) + bytes;
+		if ( end > _capacity + FRAME_ARENA_ALIGNMENT )
+			break;
+		if ( InterlockedCompareExchange( &_used, (LONG)end, used ) == used )
+			return (void*)start;
+	}
+
+	//out of room, this frame makes do with the heap
+	unsigned char *spill = new unsigned char[bytes + FRAME_ARENA_ALIGNMENT];
+	EnterCriticalSection( &_spill_lock );
+	_spills.push_back( spill );
+	_spilled += bytes + FRAME_ARENA_ALIGNMENT;
+	LeaveCriticalSection( &_spill_lock );
+	return (void*)( ( (UINT_PTR)spill + FRAME_ARENA_ALIGNMENT - 1 ) & ~(UINT_PTR)( FRAME_ARENA_ALIGNMENT - 1 ) );
+}
+
+void CFrameArena::reset()
+{
+	if ( used() > _peak )
+		_peak = used();
+
+	if ( !_spills.empty() )
+	{
+		for ( unsigned int s = 0; s < _spills.size(); ++s )
+			delete [] _spills[s];
+		_spills.clear();
+		_spill_frames++;
+
+		//grow so a frame like this one fits, with room for it to grow a little
+		delete [] _base;
+		_capacity = _peak + _peak / 2;
+		_base = new unsigned char[_capacity + FRAME_ARENA_ALIGNMENT];
+		_grows++;
+	}
+
+	_used = 0;
+	_spilled = 0;
+	_frames++;
+}
+
+void CFrameArena::print( std::ostream &out ) const
+{
+	out << "Frame arena: " << _capacity / 1024 << " KB, peak " << _peak / 1024 << " KB, "
+		<< _spill_frames << " of " << _frames << " frames spilled onto the heap, grown " << _grows << " times\n";
+}
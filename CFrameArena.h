@@ -0,0 +1,47 @@
+#pragma once
+#include <windows.h>
+#include <iostream>
+#include <cassert>
+#include <vector>
+
+//Alignment of everything the arena hands out, enough for SSE
+#define FRAME_ARENA_ALIGNMENT 16
+
+//Memory for what one frame works out and throws away, such as draw lists
+//and light tables. Allocating bumps a pointer and reset frees everything at
+//once, so nothing is freed piece by piece. A frame that needs more than the
+//arena holds takes the rest from the heap, counted as a spill, and the
+//arena grows to that frame's peak at the next reset, so steady frames
+//allocate nothing. Any thread may allocate, as the passes' jobs do, but
+//reset only while none is
+class CFrameArena {
+private:
+	unsigned char *_base;
+	size_t _capacity;
+	volatile LONG _used; // claimed by swapping in the new end
+	size_t _peak; // most a frame has asked for, spills included
+	size_t _spilled; // bytes this frame took from the heap
+	std::vector<unsigned char*> _spills; // freed at reset
+	CRITICAL_SECTION _spill_lock; // guards _spills and _spilled
+	unsigned int _frames, _spill_frames, _grows;
+
+public:
+	CFrameArena();
+	~CFrameArena();
+
+	bool init( size_t capacity );
+
+	//aligned to FRAME_ARENA_ALIGNMENT, valid until the next reset
+	void *allocate( size_t bytes );
+
+	template<typename T>
+	T *allocate( unsigned int count ) { return (T*)allocate( count * sizeof( T ) ); }
+
+	//free everything allocated since the last reset
+	void reset();
+
+	size_t capacity() const { return _capacity; }
+	size_t used() const { return (size_t)_used + _spilled; }
+
+	void print( std::ostream &out ) const;
+};
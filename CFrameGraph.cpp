@@ -0,0 +1,394 @@
+#include "CFrameGraph.h"
+#include "CProfiler.h"
+
+#define NO_SLOT 0xFFFFFFFF
+
+CFrameGraph::CFrameGraph()
+{
+	_compiled = false;
+}
+
+CFrameGraph::~CFrameGraph()
+{
+}
+
+void CFrameGraph::clear()
+{
+	_resources.clear();
+	_passes.clear();
+	_order.clear();
+	_compiled = false;
+}
+
+/////////////////
+//Resources    //
+/////////////////
+
+FrameResource CFrameGraph::importTarget( const char *name, bool depth )
+{
+	Resource resource;
+	resource.name = name;
+	resource.desc.width = resource.desc.height = 0;
+	resource.desc.format = D3DFMT_UNKNOWN;
+	resource.desc.depth = depth;
+	resource.imported = true;
+	resource.output = false;
+	resource.surface = NULL;
+	resource.slot = NO_SLOT;
+	_resources.push_back( resource );
+	return _resources.size() - 1;
+}
+
+void CFrameGraph::setImported( FrameResource resource, IDirect3DSurface9 *surface )
+{
+	assert( _resources[resource].imported );
+	_resources[resource].surface = surface;
+}
+
+FrameResource CFrameGraph::createTarget( const char *name, const RenderTargetDesc &desc )
+{
+	Resource resource;
+	resource.name = name;
+	resource.desc = desc;
+	resource.imported = false;
+	resource.output = false;
+	resource.surface = NULL;
+	resource.slot = NO_SLOT;
+	_resources.push_back( resource );
+	return _resources.size() - 1;
+}
+
+void CFrameGraph::markOutput( FrameResource resource )
+{
+	_resources[resource].output = true;
+	_compiled = false;
+}
+
+//////////////
+//Passes    //
+//////////////
+
+unsigned int CFrameGraph::addPass( const char *name, CRenderPass *pass )
+{
+	Pass node;
+	node.name = name;
+	node.pass = pass;
+	node.colour = NO_FRAME_RESOURCE;
+	node.depth = NO_FRAME_RESOURCE;
+	node.clear_flags = 0;
+	node.clear_colour = 0;
+	node.culled = false;
+	_passes.push_back( node );
+	_compiled = false;
+	return _passes.size() - 1;
+}
+
+void CFrameGraph::read( unsigned int pass, FrameResource resource )
+{
+	//reads see whatever the most recently declared writer produced
+	Access access;
+	access.resource = resource;
+	access.version = _resources[resource].writers.size();
+	_passes[pass].reads.push_back( access );
+}
+
+void CFrameGraph::write( unsigned int pass, FrameResource resource )
+{
+	//every write produces a new version of the resource
+	Resource &target = _resources[resource];
+	target.writers.push_back( pass );
+
+	Access access;
+	access.resource = resource;
+	access.version = target.writers.size();
+	_passes[pass].writes.push_back( access );
+}
+
+void CFrameGraph::setTarget( unsigned int pass, FrameResource colour, FrameResource depth, DWORD clear_flags, D3DCOLOR clear_colour )
+{
+	Pass &node = _passes[pass];
+	node.colour = colour;
+	node.depth = depth;
+	node.clear_flags = clear_flags;
+	node.clear_colour = clear_colour;
+
+	//a target that is not cleared is loaded, so the pass builds on the previous contents
+	if ( colour != NO_FRAME_RESOURCE )
+	{
+		if ( !(clear_flags & D3DCLEAR_TARGET) )
+			read( pass, colour );
+		write( pass, colour );
+	}
+	if ( depth != NO_FRAME_RESOURCE )
+	{
+		if ( !(clear_flags & D3DCLEAR_ZBUFFER) )
+			read( pass, depth );
+		write( pass, depth );
+	}
+	_compiled = false;
+}
+
+///////////////////
+//Compilation    //
+///////////////////
+
+void CFrameGraph::cull()
+{
+	for ( unsigned int i = 0; i < _passes.size(); ++i )
+		_passes[i].culled = true;
+
+	//start from the final writers of every output and walk back through what they read
+	std::vector<unsigned int> stack;
+	for ( unsigned int r = 0; r < _resources.size(); ++r )
+	{
+		if ( _resources[r].output && !_resources[r].writers.empty() )
+			stack.push_back( _resources[r].writers.back() );
+	}
+
+	while ( !stack.empty() )
+	{
+		const unsigned int p = stack.back();
+		stack.pop_back();
+		if ( !_passes[p].culled )
+			continue;
+		_passes[p].culled = false;
+
+		for ( unsigned int a = 0; a < _passes[p].reads.size(); ++a )
+		{
+			const Access &access = _passes[p].reads[a];
+			if ( access.version > 0 )
+				stack.push_back( _resources[access.resource].writers[access.version - 1] );
+		}
+	}
+}
+
+bool CFrameGraph::sort()
+{
+	const unsigned int count = _passes.size();
+	std::vector< std::vector<unsigned int> > edges( count );
+	std::vector<unsigned int> incoming( count, 0 );
+
+	for ( unsigned int p = 0; p < count; ++p )
+	{
+		if ( _passes[p].culled )
+			continue;
+
+		for ( unsigned int a = 0; a < _passes[p].reads.size(); ++a )
+		{
+			const Access &access = _passes[p].reads[a];
+			const Resource &resource = _resources[access.resource];
+
+			//read after write: the producer runs first
+			if ( access.version > 0 )
+			{
+				const unsigned int producer = resource.writers[access.version - 1];
+				if ( producer != p )
+				{
+					edges[producer].push_back( p );
+					incoming[p]++;
+				}
+			}
+
+			//write after read: the next writer waits for this read
+			if ( access.version < resource.writers.size() )
+			{
+				const unsigned int next = resource.writers[access.version];
+				if ( next != p && !_passes[next].culled )
+				{
+					edges[p].push_back( next );
+					incoming[next]++;
+				}
+			}
+		}
+
+		//write after write: keep successive writes in order
+		for ( unsigned int a = 0; a < _passes[p].writes.size(); ++a )
+		{
+			const Access &access = _passes[p].writes[a];
+			if ( access.version > 1 )
+			{
+				const unsigned int previous = _resources[access.resource].writers[access.version - 2];
+				if ( previous != p && !_passes[previous].culled )
+				{
+					edges[previous].push_back( p );
+					incoming[p]++;
+				}
+			}
+		}
+	}
+
+	//Kahn's algorithm, taking the earliest declared ready pass first
+	std::vector<bool> done( count, false );
+	_order.clear();
+	for ( ;; )
+	{
+		unsigned int next = count;
+		for ( unsigned int p = 0; p < count; ++p )
+		{
+			if ( !done[p] && !_passes[p].culled && incoming[p] == 0 )
+			{
+				next = p;
+				break;
+			}
+		}
+		if ( next == count )
+			break;
+
+		done[next] = true;
+		_order.push_back( next );
+		for ( unsigned int e = 0; e < edges[next].size(); ++e )
+			incoming[edges[next][e]]--;
+	}
+
+	//anything left over is part of a cycle
+	for ( unsigned int p = 0; p < count; ++p )
+	{
+		if ( !_passes[p].culled && !done[p] )
+			return false;
+	}
+	return true;
+}
+
+void CFrameGraph::assignTargets()
+{
+	const unsigned int count = _resources.size();
+	std::vector<int> first( count, -1 ), last( count, -1 );
+
+	//lifetime of each transient resource, in execution order
+	for ( unsigned int i = 0; i < _order.size(); ++i )
+	{
+		const Pass &pass = _passes[_order[i]];
+		for ( unsigned int a = 0; a < pass.reads.size() + pass.writes.size(); ++a )
+		{
+			const Access &access = a < pass.reads.size() ? pass.reads[a] : pass.writes[a - pass.reads.size()];
+			if ( first[access.resource] == -1 )
+				first[access.resource] = i;
+			last[access.resource] = i;
+		}
+	}
+
+	//hand out pool slots, returning them as soon as their last user has run
+	_pool.beginAssignment();
+	for ( unsigned int r = 0; r < count; ++r )
+		_resources[r].slot = NO_SLOT;
+
+	for ( int i = 0; i < (int)_order.size(); ++i )
+	{
+		for ( unsigned int r = 0; r < count; ++r )
+		{
+			if ( !_resources[r].imported && first[r] == i )
+				_resources[r].slot = _pool.acquire( _resources[r].desc );
+		}
+		for ( unsigned int r = 0; r < count; ++r )
+		{
+			if ( !_resources[r].imported && last[r] == i )
+				_pool.release( _resources[r].slot );
+		}
+	}
+	_pool.endAssignment();
+}
+
+bool CFrameGraph::compile()
+{
+	cull();
+	if ( !sort() )
+	{
+		std::cerr << "Error - Frame graph contains a cycle\n";
+		return false;
+	}
+	assignTargets();
+
+	_compiled = true;
+	return true;
+}
+
+bool CFrameGraph::allocate( CRenderDevice *dev )
+{
+	return _pool.allocate( dev );
+}
+
+void CFrameGraph::releaseTargets()
+{
+	//the pool keeps its slots so the same targets are recreated after a reset
+	_pool.releaseAll();
+	for ( unsigned int r = 0; r < _resources.size(); ++r )
+	{
+		if ( _resources[r].imported )
+			_resources[r].surface = NULL;
+	}
+}
+
+/////////////////
+//Execution    //
+/////////////////
+
+void CFrameGraph::execute( CRenderDevice *dev )
+{
+	assert( "CFrameGraph::compile not performed" && _compiled );
+
+	IDirect3DSurface9 *bound_colour = NULL;
+	IDirect3DSurface9 *bound_depth = NULL;
+
+	dev->BeginScene();
+
+	for ( unsigned int i = 0; i < _order.size(); ++i )
+	{
+		const Pass &pass = _passes[_order[i]];
+		PROFILE_PASS( pass.name.c_str() );
+		dev->BeginEvent( pass.name.c_str() );
+
+		//only rebind targets that actually change between passes
+		if ( pass.colour != NO_FRAME_RESOURCE && ( i == 0 || surface( pass.colour ) != bound_colour ) )
+		{
+			bound_colour = surface( pass.colour );
+			dev->SetRenderTarget( 0, bound_colour );
+		}
+		if ( pass.depth != NO_FRAME_RESOURCE && ( i == 0 || surface( pass.depth ) != bound_depth ) )
+		{
+			bound_depth = surface( pass.depth );
+			dev->SetDepthStencilSurface( bound_depth );
+		}
+		if ( pass.clear_flags != 0 )
+			dev->Clear( 0, NULL, pass.clear_flags, pass.clear_colour, 1.0f, 0 );
+
+		pass.pass->execute( dev, this );
+		dev->EndEvent();
+	}
+
+	dev->EndScene();
+}
+
+IDirect3DTexture9 *CFrameGraph::texture( FrameResource resource ) const
+{
+	const Resource &r = _resources[resource];
+	if ( r.imported || r.slot == NO_SLOT )
+		return NULL;
+	return _pool.texture( r.slot );
+}
+
+IDirect3DSurface9 *CFrameGraph::surface( FrameResource resource ) const
+{
+	const Resource &r = _resources[resource];
+	if ( r.imported )
+		return r.surface;
+	if ( r.slot == NO_SLOT )
+		return NULL;
+	return _pool.surface( r.slot );
+}
+
+void CFrameGraph::print( std::ostream &out ) const
+{
+	unsigned int transient = 0;
+	for ( unsigned int r = 0; r < _resources.size(); ++r )
+	{
+		if ( !_resources[r].imported && _resources[r].slot != NO_SLOT )
+			transient++;
+	}
+
+	out << "Frame graph: " << _order.size() << " of " << _passes.size() << " passes ("
+		<< _passes.size() - _order.size() << " culled), "
+		<< transient << " transient targets in " << _pool.count() << " pooled ("
+		<< _pool.bytes() / 1024 << " KB)\n";
+	for ( unsigned int i = 0; i < _order.size(); ++i )
+		out << "  " << i << ": " << _passes[_order[i]].name << "\n";
+}
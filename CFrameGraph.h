@@ -0,0 +1,96 @@
+#pragma once
+#include <windows.h>
+#include <d3d9.h>
+#include <d3dx9.h>
+#include <iostream>
+#include <cassert>
+#include <string>
+#include <vector>
+#include "CRenderDevice.h"
+#include "CRenderTargetPool.h"
+
+typedef unsigned int FrameResource;
+#define NO_FRAME_RESOURCE 0xFFFFFFFF
+
+class CFrameGraph;
+
+//A unit of rendering work scheduled by the frame graph.
+//The graph binds the pass's targets (and clears them) before execute is called.
+class CRenderPass {
+public:
+	virtual ~CRenderPass() {}
+	virtual void execute( CRenderDevice *dev, CFrameGraph *graph ) = 0;
+};
+
+//Schedules the frame's render passes from the resources they read and write.
+//compile() orders the passes by their dependencies, culls passes whose results
+//never reach an output, and places transient targets in a shared pool so
+//targets with disjoint lifetimes alias the same memory. The graph only needs
+//rebuilding when its shape changes; device resets just release and reallocate
+//the pooled targets.
+class CFrameGraph {
+private:
+	struct Resource {
+		std::string name;
+		RenderTargetDesc desc;
+		bool imported; // owned outside the graph, e.g. the back buffer
+		bool output; // must be produced every frame
+		IDirect3DSurface9 *surface; // imported resources only
+		unsigned int slot; // pool slot of a transient resource
+		std::vector<unsigned int> writers; // the pass producing each version
+	};
+
+	struct Access {
+		FrameResource resource;
+		unsigned int version; // 0 is the contents before any pass wrote it
+	};
+
+	struct Pass {
+		std::string name;
+		CRenderPass *pass;
+		std::vector<Access> reads;
+		std::vector<Access> writes;
+		FrameResource colour, depth;
+		DWORD clear_flags;
+		D3DCOLOR clear_colour;
+		bool culled;
+	};
+
+	std::vector<Resource> _resources;
+	std::vector<Pass> _passes;
+	std::vector<unsigned int> _order; // passes to execute, in order
+	CRenderTargetPool _pool;
+	bool _compiled;
+
+	void write( unsigned int pass, FrameResource resource );
+	void cull();
+	bool sort();
+	void assignTargets();
+
+public:
+	CFrameGraph();
+	~CFrameGraph();
+
+	void clear();
+
+	//resources
+	FrameResource importTarget( const char *name, bool depth );
+	void setImported( FrameResource resource, IDirect3DSurface9 *surface );
+	FrameResource createTarget( const char *name, const RenderTargetDesc &desc );
+	void markOutput( FrameResource resource );
+
+	//passes
+	unsigned int addPass( const char *name, CRenderPass *pass );
+	void read( unsigned int pass, FrameResource resource );
+	void setTarget( unsigned int pass, FrameResource colour, FrameResource depth, DWORD clear_flags = 0, D3DCOLOR clear_colour = 0 );
+
+	bool compile();
+	bool allocate( CRenderDevice *dev );
+	void releaseTargets();
+	void execute( CRenderDevice *dev );
+
+	IDirect3DTexture9 *texture( FrameResource resource ) const;
+	IDirect3DSurface9 *surface( FrameResource resource ) const;
+
+	void print( std::ostream &out ) const;
+};
@@ -0,0 +1,47 @@
+#include "CFrameLog.h"
+#include <fstream>
+#include <algorithm>
+
+bool CFrameLog::writeCsv( const char *path ) const
+{
+	std::ofstream out( path, std::ios::trunc );
+	if ( !out )
+		return false;
+
+	out << "frame,time,frame_ms,update_ms,draw_ms,draw_calls,primitives,state_changes,"
+		"meshlets,meshlets_culled,triangles,triangles_culled,shadow_meshlets,shadow_meshlets_culled\n";
+	for ( unsigned int i = 0; i < _frames.size(); ++i )
+	{
+		const FrameRecord &f = _frames[i];
+		out << f.frame << ',' << f.time << ',' << f.frame_ms << ',' << f.update_ms << ',' << f.draw_ms << ','
+			<< f.draw_calls << ',' << f.primitives << ',' << f.state_changes << ','
+			<< f.meshlets << ',' << f.meshlets_culled << ',' << f.triangles << ',' << f.triangles_culled << ','
+			<< f.shadow_meshlets << ',' << f.shadow_meshlets_culled << '\n';
+	}
+	return !out.fail();
+}
+
+void CFrameLog::printSummary( std::ostream &out ) const
+{
+	if ( _frames.empty() )
+	{
+		out << "Benchmark: no frames\n";
+		return;
+	}
+
+	std::vector<double> ms( _frames.size() );
+	double total = 0.0, draws = 0.0;
+	for ( unsigned int i = 0; i < _frames.size(); ++i )
+	{
+		ms[i] = _frames[i].frame_ms;
+		total += ms[i];
+		draws += _frames[i].draw_calls;
+	}
+	std::sort( ms.begin(), ms.end() );
+	const unsigned int p99 = (unsigned int)( ( ms.size() - 1 ) * 0.99 );
+
+	out << "Benchmark: " << _frames.size() << " frames in " << total / 1000.0 << " s, "
+		<< 1000.0 * _frames.size() / total << " fps, frame min " << ms.front() << " ms, avg "
+		<< total / _frames.size() << " ms, p99 " << ms[p99] << " ms, max " << ms.back() << " ms, "
+		<< draws / _frames.size() << " draws\n";
+}
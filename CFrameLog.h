@@ -0,0 +1,35 @@
+#pragma once
+#include <windows.h>
+#include <iostream>
+#include <cassert>
+#include <vector>
+
+//What one frame of a benchmark did and how long it took
+struct FrameRecord {
+	unsigned int frame;
+	double time; // simulated seconds
+	double frame_ms, update_ms, draw_ms; // on the CPU, the frame including present
+	unsigned int draw_calls, primitives, state_changes; // zero unless the device is recorded
+	unsigned int meshlets, meshlets_culled; // tested against the camera, and culled by frustum or cone
+	unsigned long long triangles, triangles_culled;
+	unsigned int shadow_meshlets, shadow_meshlets_culled; // the same for every shadow map
+};
+
+//Every frame of a benchmark, kept in memory so writing them out does not
+//slow the frames being measured
+class CFrameLog {
+private:
+	std::vector<FrameRecord> _frames;
+
+public:
+	void reserve( unsigned int frames ) { _frames.reserve( frames ); }
+	void add( const FrameRecord &frame ) { _frames.push_back( frame ); }
+	unsigned int size() const { return _frames.size(); }
+	const FrameRecord &frame( unsigned int i ) const { return _frames[i]; }
+
+	//a header line then one line per frame
+	bool writeCsv( const char *path ) const;
+
+	//frames per second, and the frame time's min, average, 99th percentile and max
+	void printSummary( std::ostream &out ) const;
+};
@@ -0,0 +1,40 @@
+#include "CFrustum.h"
+
+CFrustum::CFrustum()
+{
+}
+
+CFrustum::CFrustum( const D3DXMATRIX &view_projection )
+{
+	set( view_projection );
+}
+
+void CFrustum::set( const D3DXMATRIX &m )
+{
+	//Gribb/Hartmann plane extraction for row vectors and a 0..1 depth range
+	_planes[0] = D3DXPLANE( m._14 + m._11, m._24 + m._21, m._34 + m._31, m._44 + m._41 ); // left
+	_planes[1] = D3DXPLANE( m._14 - m._11, m._24 - m._21, m._34 - m._31, m._44 - m._41 ); // right
+	_planes[2] = D3DXPLANE( m._14 + m._12, m._24 + m._22, m._34 + m._32, m._44 + m._42 ); // bottom
+	_planes[3] = D3DXPLANE( m._14 - m._12, m._24 - m._22, m._34 - m._32, m._44 - m._42 ); // top
+	_planes[4] = D3DXPLANE( m._13, m._23, m._33, m._43 ); // near
+	_planes[5] = D3DXPLANE( m._14 - m._13, m._24 - m._23, m._34 - m._33, m._44 - m._43 ); // far
+
+	for ( int i = 0; i < 6; ++i )
+		D3DXPlaneNormalize( &_planes[i], &_planes[i] );
+}
+
+void CFrustum::set( const D3DXPLANE *planes )
+{
+	for ( int i = 0; i < 6; ++i )
+		_planes[i] = planes[i];
+}
+
+bool CFrustum::intersectsSphere( const D3DXVECTOR3 &centre, float radius ) const
+{
+	for ( int i = 0; i < 6; ++i )
+	{
+		if ( D3DXPlaneDotCoord( &_planes[i], &centre ) < -radius )
+			return false;
+	}
+	return true;
+}
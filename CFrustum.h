@@ -0,0 +1,21 @@
+#pragma once
+#include <windows.h>
+#include <d3d9.h>
+#include <d3dx9.h>
+
+//The six clip planes of a view projection matrix, for culling bounding spheres
+class CFrustum {
+private:
+	D3DXPLANE _planes[6]; // normalised, pointing inwards
+
+public:
+	CFrustum();
+	CFrustum( const D3DXMATRIX &view_projection );
+
+	void set( const D3DXMATRIX &view_projection );
+
+	//planes already extracted and normalised, in the order set makes them
+	void set( const D3DXPLANE *planes );
+
+	bool intersectsSphere( const D3DXVECTOR3 &centre, float radius ) const;
+};
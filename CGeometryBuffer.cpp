@@ -0,0 +1,424 @@
+#include "CGeometryBuffer.h"
+#include "CVertexConvert.h"
+#include <algorithm>
+#include <cstring>
+
+float GeometryRangeStats::fragmentation() const
+{
+	const unsigned int available = capacity - used;
+	return available > 0 ? 1.0f - (float)largest_free / (float)available : 0.0f;
+}
+
+unsigned int GeometryStats::bytes() const
+{
+	return vertices.used * vertex_stride
+		+ indices[INDEX_16].used * sizeof(unsigned short)
+		+ indices[INDEX_32].used * sizeof(unsigned int);
+}
+
+void GeometryStats::print( std::ostream &out ) const
+{
+	out << "Geometry buffer: " << allocations << " allocations, " << bytes() / 1024 << " KB\n"
+		<< "  vertices   " << vertices.used << " / " << vertices.capacity
+		<< ", " << vertices.free_ranges << " free ranges, fragmentation " << vertices.fragmentation() * 100.0f << "%\n"
+		<< "  16 bit indices " << indices[INDEX_16].used << " / " << indices[INDEX_16].capacity
+		<< ", " << indices[INDEX_16].free_ranges << " free ranges, fragmentation " << indices[INDEX_16].fragmentation() * 100.0f << "%\n"
+		<< "  32 bit indices " << indices[INDEX_32].used << " / " << indices[INDEX_32].capacity
+		<< ", " << indices[INDEX_32].free_ranges << " free ranges, fragmentation " << indices[INDEX_32].fragmentation() * 100.0f << "%\n";
+}
+
+CGeometryBuffer::CGeometryBuffer()
+{
+	_bound_indices = -1;
+	for ( int w = 0; w < INDEX_WIDTHS; ++w )
+		_indices[w].buffer = NULL;
+}
+
+CGeometryBuffer::~CGeometryBuffer()
+{
+	release();
+}
+
+bool CGeometryBuffer::create( CRenderDevice *dev, const unsigned int *vertex_strides, unsigned int streams, unsigned int vertex_capacity, unsigned int index_capacity )
+{
+	release();
+	_vertex_strides.assign( vertex_strides, vertex_strides + streams );
+	_vertex_buffers.assign( streams, (IDirect3DVertexBuffer9*)NULL );
+
+	for ( unsigned int s = 0; s < streams; ++s )
+	{
+		if ( FAILED( dev->CreateVertexBuffer( vertex_capacity * _vertex_strides[s], D3DUSAGE_WRITEONLY, 0, D3DPOOL_MANAGED, &_vertex_buffers[s], 0 ) ) )
+			return false;
+	}
+	_vertices.reset( vertex_capacity );
+
+	//most meshes are small, the 32 bit buffer starts empty and is created on first use
+	if ( FAILED( dev->CreateIndexBuffer( index_capacity * indexSize( INDEX_16 ), D3DUSAGE_WRITEONLY, indexFormat( INDEX_16 ), D3DPOOL_MANAGED, &_indices[INDEX_16].buffer, 0 ) ) )
+		return false;
+	_indices[INDEX_16].ranges.reset( index_capacity );
+	_indices[INDEX_32].ranges.reset( 0 );
+	return true;
+}
+
+void CGeometryBuffer::release()
+{
+	for ( unsigned int s = 0; s < _vertex_buffers.size(); ++s )
+		Release( &_vertex_buffers[s] );
+	_vertex_buffers.clear();
+	_vertex_strides.clear();
+	_vertices.reset( 0 );
+	for ( int w = 0; w < INDEX_WIDTHS; ++w )
+	{
+		Release( &_indices[w].buffer );
+		_indices[w].ranges.reset( 0 );
+	}
+	_allocations.clear();
+	_live.clear();
+	_free_handles.clear();
+	_bound_indices = -1;
+}
+
+bool CGeometryBuffer::growVertices( CRenderDevice *dev, unsigned int capacity )
+{
+	//every stream's new buffer is made before any is swapped in, so a failure
+	//leaves them all as they were, at the same capacity
+	std::vector<IDirect3DVertexBuffer9*> grown( _vertex_buffers.size(), (IDirect3DVertexBuffer9*)NULL );
+	for ( unsigned int s = 0; s < _vertex_buffers.size(); ++s )
+	{
+		if ( FAILED( dev->CreateVertexBuffer( capacity * _vertex_strides[s], D3DUSAGE_WRITEONLY, 0, D3DPOOL_MANAGED, &grown[s], 0 ) ) )
+		{
+			for ( unsigned int r = 0; r < grown.size(); ++r )
+				Release( &grown[r] );
+			return false;
+		}
+	}
+
+	//managed buffers keep a system memory copy, so the old contents can be read back
+	for ( unsigned int s = 0; s < _vertex_buffers.size(); ++s )
+	{
+		IDirect3DVertexBuffer9 *buffer = grown[s];
+		void *src, *dst;
+		if ( _vertex_buffers[s] && buffer && SUCCEEDED(_vertex_buffers[s]->Lock( 0, 0, &src, D3DLOCK_READONLY )) )
+		{
+			if ( SUCCEEDED(buffer->Lock( 0, 0, &dst, 0 )) )
+			{
+				memcpy( dst, src, _vertices.capacity() * _vertex_strides[s] );
+				buffer->Unlock();
+			}
+			_vertex_buffers[s]->Unlock();
+		}
+
+		Release( &_vertex_buffers[s] );
+		_vertex_buffers[s] = buffer;
+	}
+	_vertices.grow( capacity );
+	return true;
+}
+
+bool CGeometryBuffer::growIndices( CRenderDevice *dev, IndexWidth width, unsigned int capacity )
+{
+	IndexPool &pool = _indices[width];
+
+	IDirect3DIndexBuffer9 *buffer = NULL;
+	if ( FAILED( dev->CreateIndexBuffer( capacity * indexSize( width ), D3DUSAGE_WRITEONLY, indexFormat( width ), D3DPOOL_MANAGED, &buffer, 0 ) ) )
+		return false;
+
+	void *src, *dst;
+	if ( pool.buffer && buffer && pool.ranges.capacity() > 0 && SUCCEEDED(pool.buffer->Lock( 0, 0, &src, D3DLOCK_READONLY )) )
+	{
+		if ( SUCCEEDED(buffer->Lock( 0, 0, &dst, 0 )) )
+		{
+			memcpy( dst, src, pool.ranges.capacity() * indexSize( width ) );
+			buffer->Unlock();
+		}
+		pool.buffer->Unlock();
+	}
+
+	Release( &pool.buffer );
+	pool.buffer = buffer;
+	pool.ranges.grow( capacity );
+	if ( _bound_indices == width )
+		_bound_indices = -1;
+	return true;
+}
+
+GeometryHandle CGeometryBuffer::allocate( CRenderDevice *dev, unsigned int num_vertices, unsigned int num_indices )
+{
+	//there is nothing to draw without vertices. no indices is allowed, and
+	//takes no room, as the range allocator has no empty ranges to give
+	if ( num_vertices == 0 )
+		return INVALID_GEOMETRY;
+
+	//indices are relative to the base vertex, so only the mesh's own size matters
+	const IndexWidth width = indexWidth( num_vertices );
+	CRangeAllocator &indices = _indices[width].ranges;
+
+	//try the free lists, then packing the existing data, then growing
+	unsigned int base_vertex = _vertices.allocate( num_vertices );
+	unsigned int start_index = num_indices > 0 ? indices.allocate( num_indices ) : 0;
+	if ( base_vertex == INVALID_RANGE || start_index == INVALID_RANGE )
+	{
+		if ( base_vertex != INVALID_RANGE )
+			_vertices.free( base_vertex, num_vertices );
+		if ( start_index != INVALID_RANGE )
+			indices.free( start_index, num_indices );
+
+		if ( ( _vertices.available() >= num_vertices && _vertices.largestFree() < num_vertices ) ||
+			( indices.available() >= num_indices && indices.largestFree() < num_indices ) )
+			defragment();
+
+		//grow to at least double, so repeated uploads do not copy the buffers every time
+		if ( _vertices.largestFree() < num_vertices )
+		{
+			const unsigned int needed = _vertices.used() + num_vertices;
+			if ( !growVertices( dev, needed > _vertices.capacity() * 2 ? needed : _vertices.capacity() * 2 ) )
+				return INVALID_GEOMETRY;
+		}
+		if ( indices.largestFree() < num_indices )
+		{
+			const unsigned int needed = indices.used() + num_indices;
+			if ( !growIndices( dev, width, needed > indices.capacity() * 2 ? needed : indices.capacity() * 2 ) )
+				return INVALID_GEOMETRY;
+		}
+
+		base_vertex = _vertices.allocate( num_vertices );
+		start_index = num_indices > 0 ? indices.allocate( num_indices ) : 0;
+		if ( base_vertex == INVALID_RANGE || start_index == INVALID_RANGE )
+		{
+			assert( !"CGeometryBuffer::allocate; no room after growing" );
+			if ( base_vertex != INVALID_RANGE )
+				_vertices.free( base_vertex, num_vertices );
+			if ( start_index != INVALID_RANGE )
+				indices.free( start_index, num_indices );
+			return INVALID_GEOMETRY;
+		}
+	}
+
+	GeometryAllocation allocation;
+	allocation.base_vertex = base_vertex;
+	allocation.num_vertices = num_vertices;
+	allocation.start_index = start_index;
+	allocation.num_indices = num_indices;
+	allocation.index_width = width;
+
+	//reuse a freed handle when there is one
+	GeometryHandle handle;
+	if ( !_free_handles.empty() )
+	{
+		handle = _free_handles.back();
+		_free_handles.pop_back();
+		_allocations[handle] = allocation;
+		_live[handle] = true;
+	}
+	else
+	{
+		handle = _allocations.size();
+		_allocations.push_back( allocation );
+		_live.push_back( true );
+	}
+	return handle;
+}
+
+void CGeometryBuffer::free( GeometryHandle handle )
+{
+	assert( _live[handle] );
+	const GeometryAllocation &allocation = _allocations[handle];
+	_vertices.free( allocation.base_vertex, allocation.num_vertices );
+	_indices[allocation.index_width].ranges.free( allocation.start_index, allocation.num_indices );
+	_live[handle] = false;
+	_free_handles.push_back( handle );
+}
+
+//orders handles by where their data currently starts
+struct GeometryOrder {
+	const std::vector<GeometryAllocation> *allocations;
+	bool vertices;
+	bool operator()( GeometryHandle a, GeometryHandle b ) const {
+		return vertices ? (*allocations)[a].base_vertex < (*allocations)[b].base_vertex
+			: (*allocations)[a].start_index < (*allocations)[b].start_index;
+	}
+};
+
+bool CGeometryBuffer::defragment()
+{
+	bool fragmented = _vertices.freeRanges() > 1;
+	for ( int w = 0; w < INDEX_WIDTHS; ++w )
+		fragmented = fragmented || _indices[w].ranges.freeRanges() > 1;
+	if ( !fragmented )
+		return false;
+
+	std::vector<GeometryHandle> live;
+	for ( GeometryHandle h = 0; h < _allocations.size(); ++h )
+	{
+		if ( _live[h] )
+			live.push_back( h );
+	}
+
+	GeometryOrder order;
+	order.allocations = &_allocations;
+
+	//slide vertex ranges down to the front, lowest first so nothing is overwritten early.
+	//every stream moves the same way
+	order.vertices = true;
+	std::sort( live.begin(), live.end(), order );
+	std::vector<unsigned char*> vptr( _vertex_buffers.size(), (unsigned char*)NULL );
+	for ( unsigned int s = 0; s < _vertex_buffers.size(); ++s )
+	{
+		if ( _vertex_buffers[s] )
+			_vertex_buffers[s]->Lock( 0, 0, (void**)&vptr[s], 0 );
+	}
+	unsigned int cursor = 0;
+	for ( unsigned int i = 0; i < live.size(); ++i )
+	{
+		GeometryAllocation &allocation = _allocations[live[i]];
+		for ( unsigned int s = 0; s < vptr.size(); ++s )
+		{
+			const unsigned int stride = _vertex_strides[s];
+			if ( vptr[s] && allocation.base_vertex != cursor )
+				memmove( vptr[s] + cursor * stride, vptr[s] + allocation.base_vertex * stride, allocation.num_vertices * stride );
+		}
+		allocation.base_vertex = cursor;
+		cursor += allocation.num_vertices;
+	}
+	for ( unsigned int s = 0; s < vptr.size(); ++s )
+	{
+		if ( vptr[s] )
+			_vertex_buffers[s]->Unlock();
+	}
+	_vertices.compact( cursor );
+
+	//and the same for each index buffer
+	order.vertices = false;
+	std::sort( live.begin(), live.end(), order );
+	for ( int w = 0; w < INDEX_WIDTHS; ++w )
+	{
+		IndexPool &pool = _indices[w];
+		const unsigned int size = indexSize( (IndexWidth)w );
+
+		unsigned char *iptr = NULL;
+		if ( pool.buffer )
+			pool.buffer->Lock( 0, 0, (void**)&iptr, 0 );
+		cursor = 0;
+		for ( unsigned int i = 0; i < live.size(); ++i )
+		{
+			GeometryAllocation &allocation = _allocations[live[i]];
+			if ( allocation.index_width != w )
+				continue;
+			if ( iptr && allocation.start_index != cursor )
+				memmove( iptr + cursor * size, iptr + allocation.start_index * size, allocation.num_indices * size );
+			allocation.start_index = cursor;
+			cursor += allocation.num_indices;
+		}
+		if ( iptr )
+			pool.buffer->Unlock();
+		pool.ranges.compact( cursor );
+	}
+
+	return true;
+}
+
+void *CGeometryBuffer::lockVertices( GeometryHandle handle, unsigned int stream )
+{
+	const GeometryAllocation &allocation = _allocations[handle];
+	const unsigned int stride = _vertex_strides[stream];
+	void *ptr;
+	if ( _vertex_buffers[stream] && SUCCEEDED(_vertex_buffers[stream]->Lock( allocation.base_vertex * stride, allocation.num_vertices * stride, &ptr, 0 )) )
+		return ptr;
+	return NULL;
+}
+
+void CGeometryBuffer::unlockVertices( unsigned int stream )
+{
+	if ( _vertex_buffers[stream] )
+		_vertex_buffers[stream]->Unlock();
+}
+
+void *CGeometryBuffer::lockIndices( GeometryHandle handle )
+{
+	const GeometryAllocation &allocation = _allocations[handle];
+	IndexPool &pool = _indices[allocation.index_width];
+	const unsigned int size = indexSize( allocation.index_width );
+
+	void *ptr;
+	if ( pool.buffer && SUCCEEDED(pool.buffer->Lock( allocation.start_index * size, allocation.num_indices * size, &ptr, 0 )) )
+		return ptr;
+	return NULL;
+}
+
+void CGeometryBuffer::unlockIndices( GeometryHandle handle )
+{
+	IndexPool &pool = _indices[_allocations[handle].index_width];
+	if ( pool.buffer )
+		pool.buffer->Unlock();
+}
+
+void CGeometryBuffer::writeIndices( GeometryHandle handle, const unsigned int *indices )
+{
+	const GeometryAllocation &allocation = _allocations[handle];
+	void *ptr = lockIndices( handle );
+	if ( !ptr )
+		return;
+
+	if ( allocation.index_width == INDEX_16 )
+	{
+		CVertexConvert::narrowIndices( indices, allocation.num_indices, (unsigned short*)ptr );
+	}
+	else
+	{
+		memcpy( ptr, indices, allocation.num_indices * sizeof(unsigned int) );
+	}
+	unlockIndices( handle );
+}
+
+void CGeometryBuffer::bind( CRenderDevice *dev, unsigned int streams )
+{
+	assert( streams <= _vertex_buffers.size() );
+	for ( unsigned int s = 0; s < _vertex_buffers.size(); ++s )
+	{
+		if ( s < streams )
+			dev->SetStreamSource( s, _vertex_buffers[s], 0, _vertex_strides[s] );
+		else
+			dev->SetStreamSource( s, NULL, 0, 0 );
+	}
+	_bound_indices = -1;
+}
+
+void CGeometryBuffer::draw( CRenderDevice *dev, GeometryHandle handle )
+{
+	draw( dev, handle, 0, _allocations[handle].num_indices / 3 );
+}
+
+void CGeometryBuffer::draw( CRenderDevice *dev, GeometryHandle handle, unsigned int first_index, unsigned int num_triangles )
+{
+	const GeometryAllocation &allocation = _allocations[handle];
+	assert( first_index + num_triangles * 3 <= allocation.num_indices );
+	if ( _bound_indices != allocation.index_width )
+	{
+		dev->SetIndices( _indices[allocation.index_width].buffer );
+		_bound_indices = allocation.index_width;
+	}
+	dev->DrawIndexedPrimitive( D3DPT_TRIANGLELIST, allocation.base_vertex, 0, allocation.num_vertices, allocation.start_index + first_index, num_triangles );
+}
+
+static GeometryRangeStats rangeStats( const CRangeAllocator &ranges )
+{
+	GeometryRangeStats stats;
+	stats.capacity = ranges.capacity();
+	stats.used = ranges.used();
+	stats.largest_free = ranges.largestFree();
+	stats.free_ranges = ranges.freeRanges();
+	return stats;
+}
+
+GeometryStats CGeometryBuffer::stats() const
+{
+	GeometryStats stats;
+	stats.allocations = _allocations.size() - _free_handles.size();
+	stats.vertex_stride = 0;
+	for ( unsigned int s = 0; s < _vertex_strides.size(); ++s )
+		stats.vertex_stride += _vertex_strides[s];
+	stats.vertices = rangeStats( _vertices );
+	for ( int w = 0; w < INDEX_WIDTHS; ++w )
+		stats.indices[w] = rangeStats( _indices[w].ranges );
+	return stats;
+}
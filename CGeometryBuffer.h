@@ -0,0 +1,130 @@
+#pragma once
+#include <windows.h>
+#include <d3d9.h>
+#include <d3dx9.h>
+#include <iostream>
+#include <cassert>
+#include <vector>
+#include "CRenderDevice.h"
+#include "CRangeAllocator.h"
+
+typedef unsigned int GeometryHandle;
+#define INVALID_GEOMETRY 0xFFFFFFFF
+
+//Which index buffer an allocation lives in
+enum IndexWidth {
+	INDEX_16, // meshes of up to 65536 vertices
+	INDEX_32,
+	INDEX_WIDTHS
+};
+
+//Where one mesh lives inside the shared buffers
+struct GeometryAllocation {
+	unsigned int base_vertex; // added to every index by DrawIndexedPrimitive
+	unsigned int num_vertices;
+	unsigned int start_index;
+	unsigned int num_indices;
+	IndexWidth index_width;
+};
+
+//Usage of one of the shared buffers, in elements
+struct GeometryRangeStats {
+	unsigned int capacity, used, largest_free, free_ranges;
+
+	//0 when all free space is one block, approaching 1 as it splinters
+	float fragmentation() const;
+};
+
+//Allocation statistics
+struct GeometryStats {
+	unsigned int allocations;
+	unsigned int vertex_stride; // summed over every stream
+	GeometryRangeStats vertices;
+	GeometryRangeStats indices[INDEX_WIDTHS];
+
+	unsigned int bytes() const; // of buffer memory in use
+	void print( std::ostream &out ) const;
+};
+
+//One vertex buffer per stream and two index buffers (16 and 32 bit) holding
+//all static mesh data. A vertex occupies the same slot in every stream, so a
+//pass can bind only the streams its declaration reads. Meshes are sub-allocated from them and referenced by handle, so
+//the buffers are bound once per pass and draws differ only in base vertex and
+//start index. Meshes small enough for 16 bit indices get them automatically.
+//Freed space is reused, the buffers grow when full, and defragment() packs
+//live allocations together (handles stay valid, as indices are relative to
+//the base vertex nothing needs rewriting).
+class CGeometryBuffer {
+private:
+	struct IndexPool {
+		IDirect3DIndexBuffer9* buffer;
+		CRangeAllocator ranges;
+	};
+
+	std::vector<IDirect3DVertexBuffer9*> _vertex_buffers; // one per stream
+	std::vector<unsigned int> _vertex_strides; // bytes per vertex in each stream
+	CRangeAllocator _vertices;
+
+	IndexPool _indices[INDEX_WIDTHS];
+	int _bound_indices; // index buffer set on the device since bind(), -1 for none
+
+	std::vector<GeometryAllocation> _allocations; // indexed by handle
+	std::vector<bool> _live; // whether each handle is in use
+	std::vector<GeometryHandle> _free_handles; // handles available for reuse
+
+	static D3DFORMAT indexFormat( IndexWidth width ) { return width == INDEX_16 ? D3DFMT_INDEX16 : D3DFMT_INDEX32; }
+
+	bool growVertices( CRenderDevice *dev, unsigned int capacity );
+	bool growIndices( CRenderDevice *dev, IndexWidth width, unsigned int capacity );
+
+	template<typename T>
+	void Release(T** ptr) {
+		if ( *ptr != 0 ) {
+			(*ptr)->Release();
+			*ptr = 0;
+		}
+	}
+
+public:
+	CGeometryBuffer();
+	~CGeometryBuffer();
+
+	bool create( CRenderDevice *dev, const unsigned int *vertex_strides, unsigned int streams, unsigned int vertex_capacity, unsigned int index_capacity );
+	void release();
+
+	//INVALID_GEOMETRY for no vertices, or if the buffers could not grow to fit
+	GeometryHandle allocate( CRenderDevice *dev, unsigned int num_vertices, unsigned int num_indices );
+	void free( GeometryHandle handle );
+	bool defragment();
+
+	//lock just the vertex range belonging to a handle in one stream, NULL if there is nothing to lock
+	void *lockVertices( GeometryHandle handle, unsigned int stream );
+	void unlockVertices( unsigned int stream );
+
+	//copy a handle's indices in, narrowing them if it uses the 16 bit buffer
+	void writeIndices( GeometryHandle handle, const unsigned int *indices );
+
+	//lock a handle's index range to write it as stored, at its index_width. NULL if there is nothing to lock
+	void *lockIndices( GeometryHandle handle );
+	void unlockIndices( GeometryHandle handle );
+
+	//the index buffer a mesh of this many vertices is given
+	static IndexWidth indexWidth( unsigned int num_vertices ) { return num_vertices <= 65536 ? INDEX_16 : INDEX_32; }
+	static unsigned int indexSize( IndexWidth width ) { return width == INDEX_16 ? sizeof(unsigned short) : sizeof(unsigned int); }
+
+	const GeometryAllocation &allocation( GeometryHandle handle ) const { return _allocations[handle]; }
+
+	//bind the first few vertex streams, from stream 0, and unbind the rest
+	void bind( CRenderDevice *dev, unsigned int streams );
+
+	unsigned int streams() const { return _vertex_buffers.size(); }
+	unsigned int stride( unsigned int stream ) const { return _vertex_strides[stream]; }
+
+	//draw one allocation as a triangle list, setting its index buffer if it is not already
+	void draw( CRenderDevice *dev, GeometryHandle handle );
+
+	//as above for part of it, first_index counts from the allocation's first index
+	void draw( CRenderDevice *dev, GeometryHandle handle, unsigned int first_index, unsigned int num_triangles );
+
+	GeometryStats stats() const;
+};
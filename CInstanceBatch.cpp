@@ -0,0 +1,115 @@
+#include "CInstanceBatch.h"
+
+CInstanceBatch::CInstanceBatch( CMesh *mesh )
+{
+	_mesh = mesh;
+	_selected = NULL;
+	_offsets = _fill = NULL;
+	_ranges = NULL;
+}
+
+CInstanceBatch::~CInstanceBatch()
+{
+}
+
+void CInstanceBatch::selectLods( void *data, unsigned int begin, unsigned int end )
+{
+	LodSelection *selection = (LodSelection*)data;
+	CInstanceBatch *batch = selection->batch;
+	for ( unsigned int i = begin; i < end; ++i )
+		batch->_selected[i] = (unsigned char)batch->_instances[i]->selectLod( *selection->view );
+}
+
+void CInstanceBatch::draw( CRenderDevice *dev, CInstanceBuffer *instances, const LodView &view, ID3DXConstantTable *vertex_constants, MeshletCullStats *culling, CJobSystem *jobs, CFrameArena *arena )
+{
+	if ( _instances.empty() )
+		return;
+
+	//each instance's level depends only on itself, so large batches choose them in parallel
+	_selected = arena->allocate<unsigned char>( _instances.size() );
+	LodSelection selection = { this, &view };
+	if ( jobs != NULL && _instances.size() >= BATCH_PARALLEL_INSTANCES )
+		jobs->parallelFor( selectLods, &selection, _instances.size() );
+	else
+		selectLods( &selection, 0, _instances.size() );
+
+	//count the instances at each level, then lay them out level by level
+	const unsigned int lods = _mesh->lods();
+	_offsets = arena->allocate<unsigned int>( lods + 1 );
+	for ( unsigned int l = 0; l <= lods; ++l )
+		_offsets[l] = 0;
+	for ( unsigned int i = 0; i < _instances.size(); ++i )
+		_offsets[_selected[i] + 1]++;
+	for ( unsigned int l = 0; l < lods; ++l )
+		_offsets[l + 1] += _offsets[l];
+
+	unsigned int first;
+	D3DXMATRIX *matrices = instances->lock( _instances.size(), &first );
+	_fill = arena->allocate<unsigned int>( lods );
+	for ( unsigned int l = 0; l < lods; ++l )
+		_fill[l] = _offsets[l];
+	for ( unsigned int i = 0; i < _instances.size(); ++i )
+		matrices[_fill[_selected[i]]++] = _instances[i]->world();
+	instances->unlock();
+
+	// configure the pipeline - vertex shader
+	_mesh->setDecode( dev, vertex_constants );
+
+	for ( unsigned int l = 0; l < lods; ++l )
+	{
+		const unsigned int count = _offsets[l + 1] - _offsets[l];
+		if ( count == 0 )
+			continue;
+
+		if ( l == 0 && !_mesh->meshlets().empty() )
+		{
+			drawCulled( dev, instances, first, view, culling, arena );
+			continue;
+		}
+
+		// configure the pipeline - primitive assembly
+		// the mesh is repeated once per instance, stepping the instance stream each time;
+		// the shared geometry buffer is already bound by the pass
+		instances->bind( dev, first + _offsets[l] );
+		for ( unsigned int stream = 0; stream < MESH_STREAMS; ++stream )
+			dev->SetStreamSourceFreq( stream, D3DSTREAMSOURCE_INDEXEDDATA | count );
+		dev->SetStreamSourceFreq( INSTANCE_STREAM, D3DSTREAMSOURCE_INSTANCEDATA | 1 );
+
+		// draw (execute the pipeline)
+		_mesh->draw( dev, l );
+	}
+}
+
+void CInstanceBatch::drawCulled( CRenderDevice *dev, CInstanceBuffer *instances, unsigned int first, const LodView &view, MeshletCullStats *culling, CFrameArena *arena )
+{
+	const std::vector<Meshlet> &meshlets = _mesh->meshlets();
+	_ranges = arena->allocate<IndexRange>( meshlets.size() );
+
+	for ( unsigned int stream = 0; stream < MESH_STREAMS; ++stream )
+		dev->SetStreamSourceFreq( stream, D3DSTREAMSOURCE_INDEXEDDATA | 1 );
+	dev->SetStreamSourceFreq( INSTANCE_STREAM, D3DSTREAMSOURCE_INSTANCEDATA | 1 );
+
+	//level 0 instances were appended first, in the same order as _instances
+	unsigned int slot = first;
+	for ( unsigned int i = 0; i < _instances.size(); ++i )
+	{
+		if ( _selected[i] != 0 )
+			continue;
+
+		//cull in the mesh's own space, where the meshlet bounds are
+		const D3DXMATRIX &world = _instances[i]->world();
+		D3DXMATRIX inverse;
+		D3DXMatrixInverse( &inverse, NULL, &world );
+		D3DXVECTOR3 eye;
+		D3DXVec3TransformCoord( &eye, &view.eye, &inverse );
+		const CFrustum frustum( world * view.view_projection );
+
+		const unsigned int ranges = CMeshlets::cull( &meshlets[0], meshlets.size(), frustum, eye, _ranges, culling );
+		if ( ranges > 0 )
+		{
+			instances->bind( dev, slot );
+			_mesh->draw( dev, _ranges, ranges );
+		}
+		slot++;
+	}
+}
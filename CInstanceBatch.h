@@ -0,0 +1,54 @@
+#pragma once
+#include <windows.h>
+#include <d3d9.h>
+#include <d3dx9.h>
+#include <iostream>
+#include <cassert>
+#include <vector>
+#include "CRenderDevice.h"
+#include "CMesh.h"
+#include "CEntity.h"
+#include "CInstanceBuffer.h"
+#include "CJobSystem.h"
+#include "CFrameArena.h"
+
+//Batches with at least this many instances choose their levels of detail on the job system
+#define BATCH_PARALLEL_INSTANCES 256
+
+//Every entity sharing one mesh, drawn with one instanced call per level of
+//detail in use by the pass
+class CInstanceBatch {
+private:
+	CMesh *_mesh;
+	std::vector<CEntity*> _instances;
+	unsigned char *_selected; // level chosen for each instance by the current draw, in the frame arena
+	unsigned int *_offsets; // where each level's instances start in what the draw appends
+	unsigned int *_fill; // next free slot for each level while appending
+	IndexRange *_ranges; // what is left of one instance after culling its meshlets, in the frame arena
+
+	void drawCulled( CRenderDevice *dev, CInstanceBuffer *instances, unsigned int first, const LodView &view, MeshletCullStats *culling, CFrameArena *arena );
+
+	//a range of instances' levels for a view, as a job
+	struct LodSelection {
+		CInstanceBatch *batch;
+		const LodView *view;
+	};
+	static void selectLods( void *selection, unsigned int begin, unsigned int end );
+
+public:
+	CInstanceBatch( CMesh *mesh );
+	~CInstanceBatch();
+
+	void add( CEntity *entity ) { _instances.push_back( entity ); }
+
+	CMesh *mesh() { return _mesh; }
+	unsigned int count() const { return _instances.size(); }
+
+	//choose each instance's level of detail for the view, append their world
+	//matrices to the instance buffer grouped by level and draw each group.
+	//instances at level 0 of a mesh with meshlets are culled and drawn one by one,
+	//adding to culling. vertex_constants receive the mesh's position decode.
+	//jobs, if not NULL, shares out choosing the levels of a large batch. The
+	//draw's lists are made in arena
+	void draw( CRenderDevice *dev, CInstanceBuffer *instances, const LodView &view, ID3DXConstantTable *vertex_constants, MeshletCullStats *culling, CJobSystem *jobs, CFrameArena *arena );
+};
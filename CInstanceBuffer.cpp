@@ -0,0 +1,70 @@
+#include "CInstanceBuffer.h"
+
+CInstanceBuffer::CInstanceBuffer()
+{
+	_buffer = NULL;
+	_capacity = 0;
+	_cursor = 0;
+	_discards = 0;
+	_locked = false;
+}
+
+CInstanceBuffer::~CInstanceBuffer()
+{
+	release();
+}
+
+bool CInstanceBuffer::create( CRenderDevice *dev, unsigned int capacity )
+{
+	release();
+	_capacity = capacity > 0 ? capacity : 1;
+	_cursor = 0;
+	_scratch.resize( _capacity );
+
+	return SUCCEEDED( dev->CreateVertexBuffer( _capacity * sizeof(D3DXMATRIX), D3DUSAGE_DYNAMIC | D3DUSAGE_WRITEONLY, 0,
+		D3DPOOL_DEFAULT, &_buffer, 0 ) );
+}
+
+void CInstanceBuffer::release()
+{
+	Release( &_buffer );
+	_locked = false;
+}
+
+D3DXMATRIX *CInstanceBuffer::lock( unsigned int count, unsigned int *first )
+{
+	assert( count <= _capacity );
+
+	//append behind the draws already issued, the GPU may still be reading them.
+	//when the ring is full start again in a fresh buffer the driver renames for us
+	DWORD flags = D3DLOCK_NOOVERWRITE;
+	if ( _cursor == 0 || _cursor + count > _capacity )
+	{
+		flags = D3DLOCK_DISCARD;
+		_cursor = 0;
+		_discards++;
+	}
+	*first = _cursor;
+	_cursor += count;
+
+	D3DXMATRIX *ptr;
+	_locked = _buffer && SUCCEEDED(_buffer->Lock( *first * sizeof(D3DXMATRIX), count * sizeof(D3DXMATRIX), (void**)&ptr, flags ));
+	if ( _locked )
+		return ptr;
+
+	//the null device has nothing to lock, keep the CPU work the same anyway
+	return &_scratch[*first];
+}
+
+void CInstanceBuffer::unlock()
+{
+	//a failed lock wrote to _scratch, and the buffer was never locked
+	if ( _locked )
+		_buffer->Unlock();
+	_locked = false;
+}
+
+void CInstanceBuffer::bind( CRenderDevice *dev, unsigned int first )
+{
+	dev->SetStreamSource( INSTANCE_STREAM, _buffer, first * sizeof(D3DXMATRIX), sizeof(D3DXMATRIX) );
+}
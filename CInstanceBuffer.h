@@ -0,0 +1,50 @@
+#pragma once
+#include <windows.h>
+#include <d3d9.h>
+#include <d3dx9.h>
+#include <iostream>
+#include <cassert>
+#include <vector>
+#include "CRenderDevice.h"
+
+//The vertex stream instance data is bound to, after the mesh streams
+#define INSTANCE_STREAM 2
+
+//A dynamic vertex buffer of per-instance world matrices, used as a ring:
+//each pass appends what it draws behind what earlier draws used (NOOVERWRITE)
+//and the buffer is only discarded when it wraps. It lives in D3DPOOL_DEFAULT,
+//so it is created and released with the other unmanaged resources.
+class CInstanceBuffer {
+private:
+	IDirect3DVertexBuffer9* _buffer;
+	unsigned int _capacity; // in instances
+	unsigned int _cursor; // where the next append goes
+	unsigned int _discards; // times the ring has wrapped
+	bool _locked; // the last lock got the buffer, rather than _scratch
+	std::vector<D3DXMATRIX> _scratch; // written instead when the device gives us no buffer
+
+	template<typename T>
+	void Release(T** ptr) {
+		if ( *ptr != 0 ) {
+			(*ptr)->Release();
+			*ptr = 0;
+		}
+	}
+
+public:
+	CInstanceBuffer();
+	~CInstanceBuffer();
+
+	bool create( CRenderDevice *dev, unsigned int capacity );
+	void release();
+
+	//space for count matrices, first receives the index of the first one
+	D3DXMATRIX *lock( unsigned int count, unsigned int *first );
+	void unlock();
+
+	//bind the instances starting at first to the instance stream
+	void bind( CRenderDevice *dev, unsigned int first );
+
+	unsigned int capacity() const { return _capacity; }
+	unsigned int discards() const { return _discards; }
+};
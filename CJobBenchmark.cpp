@@ -0,0 +1,93 @@
+#include "CJobBenchmark.h"
+#include "CJobSystem.h"
+#include <vector>
+#include <cmath>
+
+//transforms updated each pass, and passes timed at each thread count with the fastest kept
+#define JOB_BENCH_TRANSFORMS 200000
+#define JOB_BENCH_REPEATS 10
+
+struct BenchTransform {
+	D3DXVECTOR3 position, rotation;
+	D3DXMATRIX world, inverse;
+};
+
+static double now()
+{
+	LARGE_INTEGER frequency, counter;
+	QueryPerformanceFrequency( &frequency );
+	QueryPerformanceCounter( &counter );
+	return counter.QuadPart * 1000.0 / frequency.QuadPart;
+}
+
+//as CEntity builds its world matrix, and the inverse meshlet culling takes
+static void update( void *data, unsigned int begin, unsigned int end )
+{
+	BenchTransform *transforms = (BenchTransform*)data;
+	for ( unsigned int i = begin; i < end; ++i )
+	{
+		BenchTransform &t = transforms[i];
+		D3DXMATRIX rotation_x, rotation_y, rotation_z, translation;
+		D3DXMatrixRotationX( &rotation_x, t.rotation.x );
+		D3DXMatrixRotationY( &rotation_y, t.rotation.y );
+		D3DXMatrixRotationZ( &rotation_z, t.rotation.z );
+		D3DXMatrixTranslation( &translation, t.position.x, t.position.y, t.position.z );
+		t.world = ( rotation_z * rotation_x * rotation_y ) * translation;
+		D3DXMatrixInverse( &t.inverse, NULL, &t.world );
+	}
+}
+
+static double time( CJobSystem *jobs, std::vector<BenchTransform> &transforms )
+{
+	double best = 0.0;
+	for ( unsigned int r = 0; r < JOB_BENCH_REPEATS; ++r )
+	{
+		const double start = now();
+		if ( jobs != NULL )
+			jobs->parallelFor( update, &transforms[0], transforms.size() );
+		else
+			update( &transforms[0], 0, transforms.size() );
+		const double ms = now() - start;
+		if ( r == 0 || ms < best )
+			best = ms;
+	}
+	return best;
+}
+
+void CJobBenchmark::run( unsigned int max_threads, std::ostream &out )
+{
+	std::vector<BenchTransform> transforms( JOB_BENCH_TRANSFORMS );
+	for ( unsigned int i = 0; i < transforms.size(); ++i )
+	{
+		transforms[i].position = D3DXVECTOR3( (float)( i % 500 ), (float)( i / 500 ), sinf( i * 0.1f ) );
+		transforms[i].rotation = D3DXVECTOR3( i * 0.01f, i * 0.02f, i * 0.03f );
+	}
+
+	SYSTEM_INFO info;
+	GetSystemInfo( &info );
+	if ( max_threads > JOB_MAX_THREADS )
+		max_threads = JOB_MAX_THREADS;
+	out << "Job scaling, " << transforms.size() << " transforms on " << info.dwNumberOfProcessors << " cores:\n";
+
+	const double serial = time( NULL, transforms );
+	out << "  1 thread: " << serial << " ms\n";
+
+	//the calling thread helps, so n threads is n - 1 workers
+	for ( unsigned int threads = 2; threads <= max_threads; threads *= 2 )
+	{
+		CJobSystem jobs;
+		if ( !jobs.init( threads - 1 ) )
+		{
+			out << "  " << threads << " threads: could not start the workers\n";
+			break;
+		}
+		const double ms = time( &jobs, transforms );
+
+		unsigned int added, stolen, contended;
+		jobs.totals( &added, &stolen, &contended );
+		out << "  " << threads << " threads: " << ms << " ms, " << serial / ms << "x, "
+			<< 100.0 * serial / ( ms * threads ) << "% efficient, " << added / JOB_BENCH_REPEATS << " jobs with "
+			<< stolen / JOB_BENCH_REPEATS << " stolen and " << contended / JOB_BENCH_REPEATS << " lock waits a pass\n";
+		jobs.shutdown();
+	}
+}
@@ -0,0 +1,14 @@
+#pragma once
+#include <windows.h>
+#include <d3d9.h>
+#include <d3dx9.h>
+#include <iostream>
+#include <cassert>
+
+//Times the job system on work like a frame's entity updates, on one thread
+//and then on 2, 4, 8 and so on up to max_threads, to show how it scales and
+//how often its queues are fought over
+class CJobBenchmark {
+public:
+	static void run( unsigned int max_threads, std::ostream &out );
+};
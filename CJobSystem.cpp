@@ -0,0 +1,462 @@
+#include "CJobSystem.h"
+#include "CProfiler.h"
+#include "CAllocationCounter.h"
+#include <process.h>
+#include <climits>
+
+//Jobs are made this many at a time when the pool runs dry
+#define JOB_BLOCK_SIZE 256
+
+struct Job {
+	JobFunction function;
+	void *data;
+	unsigned int begin, end;
+	JobCounter *counter; // or NULL
+	bool background; // run alongside frames rather than as part of one
+	Job *next; // in the free list, or a counter's waiting list
+};
+
+JobCounter::JobCounter() : _pending( 0 ), _waiting( NULL )
+{
+	InitializeCriticalSection( &_lock );
+}
+
+JobCounter::~JobCounter()
+{
+	assert( "JobCounter destroyed with jobs pending" && _pending == 0 );
+	DeleteCriticalSection( &_lock );
+}
+
+CJobSystem::CJobSystem() : _queues( NULL ), _num_queues( 0 ), _wake( NULL ), _quit( 0 ), _slot( TLS_OUT_OF_INDEXES ),
+	_background( NULL ), _background_tail( NULL ), _free( NULL )
+{
+	InitializeCriticalSection( &_background_lock );
+	InitializeCriticalSection( &_free_lock );
+}
+
+CJobSystem::~CJobSystem()
+{
+	shutdown();
+	for ( unsigned int b = 0; b < _blocks.size(); ++b )
+		delete [] _blocks[b];
+	DeleteCriticalSection( &_background_lock );
+	DeleteCriticalSection( &_free_lock );
+}
+
+bool CJobSystem::init( unsigned int threads )
+{
+	assert( "CJobSystem::init already performed" && _queues == NULL );
+
+	if ( threads == 0 )
+	{
+		SYSTEM_INFO info;
+		GetSystemInfo( &info );
+		threads = info.dwNumberOfProcessors > 1 ? info.dwNumberOfProcessors - 1 : 0;
+	}
+	if ( threads > JOB_MAX_THREADS - 1 )
+		threads = JOB_MAX_THREADS - 1;
+
+	_slot = TlsAlloc();
+	if ( _slot == TLS_OUT_OF_INDEXES )
+		return false;
+	_wake = CreateSemaphore( NULL, 0, LONG_MAX, NULL );
+	if ( _wake == NULL )
+		return false;
+
+	_num_queues = threads + 1;
+	_queues = new Queue[_num_queues];
+	for ( unsigned int q = 0; q < _num_queues; ++q )
+	{
+		Queue &queue = _queues[q];
+		InitializeCriticalSection( &queue.lock );
+		queue.head = queue.tail = 0;
+		queue.victim = ( q + 1 ) % _num_queues;
+		queue.system = this;
+		queue.index = q;
+	}
+	resetStats();
+
+	_quit = 0;
+	for ( unsigned int t = 0; t < threads; ++t )
+	{
+		//_beginthreadex rather than CreateThread, the workers use the C runtime
+		HANDLE thread = (HANDLE)_beginthreadex( NULL, 0, worker, &_queues[t], 0, NULL );
+		if ( thread == NULL )
+			return false;
+		_threads.push_back( thread );
+	}
+	return true;
+}
+
+void CJobSystem::shutdown()
+{
+	InterlockedExchange( &_quit, 1 );
+	if ( !_threads.empty() )
+	{
+		ReleaseSemaphore( _wake, _threads.size(), NULL );
+		WaitForMultipleObjects( _threads.size(), &_threads[0], TRUE, INFINITE );
+		for ( unsigned int t = 0; t < _threads.size(); ++t )
+			CloseHandle( _threads[t] );
+		_threads.clear();
+	}
+	if ( _wake != NULL )
+		CloseHandle( _wake );
+	_wake = NULL;
+
+	//whatever is still queued is run here, so no counter is left waiting
+	if ( _queues != NULL )
+	{
+		for ( Job *job = take( home() ); job != NULL; job = take( home() ) )
+			execute( job );
+		for ( Job *job = takeBackground( NULL ); job != NULL; job = takeBackground( NULL ) )
+			execute( job );
+		for ( unsigned int q = 0; q < _num_queues; ++q )
+			DeleteCriticalSection( &_queues[q].lock );
+		delete [] _queues;
+		_queues = NULL;
+		_num_queues = 0;
+	}
+
+	if ( _slot != TLS_OUT_OF_INDEXES )
+		TlsFree( _slot );
+	_slot = TLS_OUT_OF_INDEXES;
+}
+
+unsigned __stdcall CJobSystem::worker( void *param )
+{
+	Queue *queue = (Queue*)param;
+	CJobSystem *system = queue->system;
+	TlsSetValue( system->_slot, (LPVOID)(UINT_PTR)( queue->index + 1 ) );
+	PROFILE_THREAD( "jobs" );
+
+	//frames' jobs run here, so what they allocate is the frame's
+	CAllocationCounter::countThisThread( true );
+
+	//each wake is for one job, but take what there is while awake. background
+	//jobs first, they are long and something will be waiting on them
+	while ( WaitForSingleObject( system->_wake, INFINITE ) == WAIT_OBJECT_0 && system->_quit == 0 )
+	{
+		for ( ;; )
+		{
+			Job *job = system->takeBackground( NULL );
+			if ( job == NULL )
+				job = system->take( queue->index );
+			if ( job == NULL )
+				break;
+			system->execute( job );
+		}
+	}
+	CAllocationCounter::forgetThisThread();
+	return 0;
+}
+
+unsigned int CJobSystem::home() const
+{
+	const UINT_PTR slot = (UINT_PTR)TlsGetValue( _slot );
+	return slot != 0 ? (unsigned int)slot - 1 : _num_queues - 1;
+}
+
+void CJobSystem::lock( Queue *queue )
+{
+	if ( !TryEnterCriticalSection( &queue->lock ) )
+	{
+		InterlockedIncrement( &queue->contended );
+		EnterCriticalSection( &queue->lock );
+	}
+}
+
+Job *CJobSystem::allocate()
+{
+	EnterCriticalSection( &_free_lock );
+	if ( _free == NULL )
+	{
+		Job *block = new Job[JOB_BLOCK_SIZE];
+		_blocks.push_back( block );
+		for ( unsigned int j = 0; j < JOB_BLOCK_SIZE; ++j )
+		{
+			block[j].next = _free;
+			_free = &block[j];
+		}
+	}
+	Job *job = _free;
+	_free = job->next;
+	LeaveCriticalSection( &_free_lock );
+	return job;
+}
+
+void CJobSystem::release( Job *job )
+{
+	EnterCriticalSection( &_free_lock );
+	job->next = _free;
+	_free = job;
+	LeaveCriticalSection( &_free_lock );
+}
+
+void CJobSystem::push( Job *job )
+{
+	Queue *queue = &_queues[home()];
+	lock( queue );
+	if ( queue->tail - queue->head == JOB_QUEUE_SIZE )
+	{
+		//full, so there is plenty for the others to be getting on with
+		queue->overflowed++;
+		LeaveCriticalSection( &queue->lock );
+		execute( job );
+		return;
+	}
+	queue->jobs[queue->tail % JOB_QUEUE_SIZE] = job;
+	queue->tail++;
+	queue->pushed++;
+	LeaveCriticalSection( &queue->lock );
+
+	ReleaseSemaphore( _wake, 1, NULL );
+}
+
+Job *CJobSystem::take( unsigned int home )
+{
+	//the newest job in the thread's own queue, whose data is likely still in cache.
+	//head and tail are read unlocked first, so empty queues are passed over cheaply
+	Queue *own = &_queues[home];
+	if ( own->tail != own->head )
+	{
+		lock( own );
+		if ( own->tail != own->head )
+		{
+			own->tail--;
+			Job *job = own->jobs[own->tail % JOB_QUEUE_SIZE];
+			own->popped++;
+			LeaveCriticalSection( &own->lock );
+			return job;
+		}
+		LeaveCriticalSection( &own->lock );
+	}
+
+	//or the oldest in another's, going back to the last queue that had any
+	for ( unsigned int n = 0; n < _num_queues; ++n )
+	{
+		const unsigned int v = ( own->victim + n ) % _num_queues;
+		Queue *victim = &_queues[v];
+		if ( v == home || victim->tail == victim->head )
+			continue;
+
+		lock( victim );
+		if ( victim->tail != victim->head )
+		{
+			Job *job = victim->jobs[victim->head % JOB_QUEUE_SIZE];
+			victim->head++;
+			victim->stolen++;
+			LeaveCriticalSection( &victim->lock );
+			own->victim = v;
+			return job;
+		}
+		LeaveCriticalSection( &victim->lock );
+	}
+	return NULL;
+}
+
+//The oldest background job, or with a counter the oldest that counter counts,
+//wherever it is in the list, so a wait can always help with its own
+Job *CJobSystem::takeBackground( const JobCounter *counter )
+{
+	if ( _background == NULL )
+		return NULL;
+
+	EnterCriticalSection( &_background_lock );
+	Job *previous = NULL, *job = _background;
+	while ( job != NULL && counter != NULL && job->counter != counter )
+	{
+		previous = job;
+		job = job->next;
+	}
+	if ( job != NULL )
+	{
+		if ( previous != NULL )
+			previous->next = job->next;
+		else
+			_background = job->next;
+		if ( _background_tail == job )
+			_background_tail = previous;
+		job->next = NULL;
+	}
+	LeaveCriticalSection( &_background_lock );
+	return job;
+}
+
+void CJobSystem::execute( Job *job )
+{
+	//background jobs allocate as they like, whichever thread helps with them
+	if ( job->background )
+	{
+		const bool counted = CAllocationCounter::countThisThread( false );
+		job->function( job->data, job->begin, job->end );
+		CAllocationCounter::countThisThread( counted );
+	}
+	else
+		job->function( job->data, job->begin, job->end );
+	JobCounter *counter = job->counter;
+	release( job );
+	if ( counter == NULL )
+		return;
+
+	//the count reaches zero under the lock, so once wait has taken the lock
+	//after seeing zero, nothing here touches the counter again
+	Job *waiting = NULL;
+	EnterCriticalSection( &counter->_lock );
+	if ( InterlockedDecrement( &counter->_pending ) == 0 )
+	{
+		waiting = counter->_waiting;
+		counter->_waiting = NULL;
+	}
+	LeaveCriticalSection( &counter->_lock );
+
+	while ( waiting != NULL )
+	{
+		Job *next = waiting->next;
+		push( waiting );
+		waiting = next;
+	}
+}
+
+void CJobSystem::run( JobFunction function, void *data, unsigned int begin, unsigned int end, JobCounter *counter, JobCounter *after )
+{
+	Job *job = allocate();
+	job->function = function;
+	job->data = data;
+	job->begin = begin;
+	job->end = end;
+	job->counter = counter;
+	job->background = false;
+	job->next = NULL;
+	if ( counter != NULL )
+		InterlockedIncrement( &counter->_pending );
+
+	//without workers every job is run as it is added, so after is already done
+	if ( _queues == NULL )
+	{
+		execute( job );
+		return;
+	}
+
+	if ( after != NULL )
+	{
+		EnterCriticalSection( &after->_lock );
+		if ( after->_pending > 0 )
+		{
+			job->next = after->_waiting;
+			after->_waiting = job;
+			LeaveCriticalSection( &after->_lock );
+			return;
+		}
+		LeaveCriticalSection( &after->_lock );
+	}
+	push( job );
+}
+
+void CJobSystem::runInBackground( JobFunction function, void *data, JobCounter *counter )
+{
+	Job *job = allocate();
+	job->function = function;
+	job->data = data;
+	job->begin = 0;
+	job->end = 1;
+	job->counter = counter;
+	job->background = true;
+	job->next = NULL;
+	if ( counter != NULL )
+		InterlockedIncrement( &counter->_pending );
+
+	if ( _queues == NULL )
+	{
+		execute( job );
+		return;
+	}
+
+	//without workers it waits for whoever waits on its counter
+	EnterCriticalSection( &_background_lock );
+	if ( _background_tail != NULL )
+		_background_tail->next = job;
+	else
+		_background = job;
+	_background_tail = job;
+	LeaveCriticalSection( &_background_lock );
+
+	ReleaseSemaphore( _wake, 1, NULL );
+}
+
+void CJobSystem::wait( JobCounter *counter )
+{
+	if ( _queues != NULL )
+	{
+		const unsigned int queue = home();
+		while ( counter->_pending > 0 )
+		{
+			//help with anything queued, but only with background jobs counter counts
+			Job *job = takeBackground( counter );
+			if ( job == NULL )
+				job = take( queue );
+			if ( job != NULL )
+				execute( job );
+			else
+				SwitchToThread(); // nothing left to help with, the last jobs are running elsewhere
+		}
+	}
+
+	//the last job may still be letting go of the counter
+	EnterCriticalSection( &counter->_lock );
+	LeaveCriticalSection( &counter->_lock );
+}
+
+void CJobSystem::parallelFor( JobFunction function, void *data, unsigned int count, unsigned int grain )
+{
+	if ( count == 0 )
+		return;
+
+	//a few ranges for each thread, so one held up by another job does not hold up the rest
+	if ( grain == 0 )
+	{
+		grain = count / ( 4 * ( threads() + 1 ) );
+		if ( grain == 0 )
+			grain = 1;
+	}
+
+	JobCounter counter;
+	for ( unsigned int begin = 0; begin < count; begin += grain )
+		run( function, data, begin, begin + grain < count ? begin + grain : count, &counter );
+	wait( &counter );
+}
+
+void CJobSystem::print( std::ostream &out ) const
+{
+	out << "Jobs on " << threads() << " workers:\n";
+	for ( unsigned int q = 0; q < _num_queues; ++q )
+	{
+		const Queue &queue = _queues[q];
+		if ( q + 1 < _num_queues )
+			out << "  worker " << q;
+		else
+			out << "  other threads";
+		out << ": " << queue.pushed << " added, " << queue.popped << " run by its own thread, " << queue.stolen << " stolen, "
+			<< queue.contended << " waits for the lock, " << queue.overflowed << " run when full\n";
+	}
+}
+
+void CJobSystem::totals( unsigned int *added, unsigned int *stolen, unsigned int *contended ) const
+{
+	*added = *stolen = *contended = 0;
+	for ( unsigned int q = 0; q < _num_queues; ++q )
+	{
+		*added += _queues[q].pushed;
+		*stolen += _queues[q].stolen;
+		*contended += _queues[q].contended;
+	}
+}
+
+void CJobSystem::resetStats()
+{
+	for ( unsigned int q = 0; q < _num_queues; ++q )
+	{
+		Queue &queue = _queues[q];
+		queue.pushed = queue.popped = queue.stolen = queue.overflowed = 0;
+		queue.contended = 0;
+	}
+}
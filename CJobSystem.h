@@ -0,0 +1,113 @@
+#pragma once
+#include <windows.h>
+#include <iostream>
+#include <cassert>
+#include <vector>
+
+//Jobs a queue holds before more are run by whoever adds them
+#define JOB_QUEUE_SIZE 4096
+#define JOB_MAX_THREADS 64
+
+//Does items [begin, end) of whatever data points at
+typedef void (*JobFunction)( void *data, unsigned int begin, unsigned int end );
+
+struct Job;
+
+//Counts the jobs run against it that are yet to finish. Jobs may also be run
+//after a counter, to start once it reaches zero. A counter must not be
+//destroyed until CJobSystem::wait has returned for it
+class JobCounter {
+private:
+	friend class CJobSystem;
+	volatile LONG _pending;
+	CRITICAL_SECTION _lock; // guards _waiting, and _pending reaching zero
+	Job *_waiting; // started when _pending reaches zero
+
+public:
+	JobCounter();
+	~JobCounter();
+
+	bool done() const { return _pending == 0; }
+};
+
+//A pool of worker threads, each with its own queue of jobs. A thread adds
+//jobs to the back of its own queue and takes them from the back too, while
+//threads with nothing to do steal from the front of the others', so work
+//spreads by itself and each thread mostly works on what it just added.
+//Every other thread - the loader, water and NURBS run as jobs, so that is
+//only the render thread - shares one more queue, and helps with any job
+//while it waits.
+class CJobSystem {
+private:
+	struct Queue {
+		CRITICAL_SECTION lock;
+		Job *jobs[JOB_QUEUE_SIZE];
+		volatile unsigned int head, tail; // thieves take at head, the owner at tail
+		unsigned int victim; // the queue the owner tries stealing from next
+		CJobSystem *system; // for the worker starting on this queue
+		unsigned int index;
+
+		//under lock, but contended is counted before the lock is taken
+		unsigned int pushed, popped, stolen, overflowed;
+		volatile LONG contended;
+	};
+
+	std::vector<HANDLE> _threads;
+	Queue *_queues; // one per worker, then one for every other thread
+	unsigned int _num_queues;
+	HANDLE _wake; // counts jobs added, so a sleeping worker wakes for each
+	volatile LONG _quit;
+	DWORD _slot; // thread local, the worker's queue index + 1, or 0 for other threads
+
+	CRITICAL_SECTION _background_lock; // guards the background list
+	Job *_background, *_background_tail; // oldest first, for workers between jobs
+
+	CRITICAL_SECTION _free_lock; // guards _free
+	Job *_free; // jobs not in use, reused so a steady frame allocates none
+	std::vector<Job*> _blocks; // the memory they are in
+
+	static unsigned __stdcall worker( void *queue );
+
+	unsigned int home() const;
+	static void lock( Queue *queue );
+	Job *allocate();
+	void release( Job *job );
+	void push( Job *job );
+	Job *take( unsigned int home );
+	Job *takeBackground( const JobCounter *counter );
+	void execute( Job *job );
+
+public:
+	CJobSystem();
+	~CJobSystem();
+
+	//threads of 0 uses one per core but one, and there may be none; the
+	//threads waiting on jobs then run them all
+	bool init( unsigned int threads );
+	void shutdown();
+
+	unsigned int threads() const { return _threads.size(); }
+
+	//run function over [begin, end), counted by counter, once after has
+	//reached zero if given. Before init, or with a full queue, the job is run
+	//there and then
+	void run( JobFunction function, void *data, unsigned int begin, unsigned int end, JobCounter *counter, JobCounter *after = NULL );
+
+	//a long job for a worker to start between jobs, so it overlaps whatever the
+	//calling thread does next. Threads waiting on other counters never help
+	//with it, so it cannot end up run inside their waits; waiting on counter
+	//may, and with no workers that is the only way it is run. What it allocates
+	//is not counted towards frames, wherever it runs
+	void runInBackground( JobFunction function, void *data, JobCounter *counter );
+
+	//run jobs until counter reaches zero
+	void wait( JobCounter *counter );
+
+	//function over [0, count) in ranges of grain, 0 to pick one, returning when all are done
+	void parallelFor( JobFunction function, void *data, unsigned int count, unsigned int grain = 0 );
+
+	//jobs added, run and stolen on each queue, and how often taking its lock had to wait
+	void print( std::ostream &out ) const;
+	void totals( unsigned int *added, unsigned int *stolen, unsigned int *contended ) const;
+	void resetStats();
+};
@@ -6,6 +6,13 @@ CLight::CLight( SceneDelegate* scene, int light_index )
 	m_up = D3DXVECTOR3 (scene->worldUpDirection().x, scene->worldUpDirection().y, scene->worldUpDirection().z);
 }
 
+//a light as it is drawn, which may be between two of the scene's states
+CLight::CLight( const Light &light, const Float3 &up )
+{
+	m_light = light;
+	m_up = D3DXVECTOR3( up.x, up.y, up.z );
+}
+
 CLight::~CLight()
 {
 }
@@ -28,7 +35,7 @@ D3DXMATRIX CLight::getViewProjection()
 		&m_up );    // the up direction
 
 	D3DXMATRIX proj_xform;
-	D3DXMatrixPerspectiveFovRH( &proj_xform, m_light.coneAngle * 2.0f, 1.0f, 0.1f, 100.0f );
+	D3DXMatrixPerspectiveFovRH( &proj_xform, m_light.coneAngle * 2.0f, 1.0f, LIGHT_NEAR, LIGHT_FAR );
 
 	return view_xform * proj_xform;
 }
@@ -8,12 +8,17 @@
 
 #define MAP_SIZE	1024
 
+//Depth range of a light's projection
+#define LIGHT_NEAR	0.1f
+#define LIGHT_FAR	100.0f
+
 class CLight {
 private:
 	Light m_light;
 	D3DXVECTOR3 m_up;
 public:
 	CLight( SceneDelegate* scene, int light_index );
+	CLight( const Light &light, const Float3 &up );
 	~CLight( );
 
 	D3DXVECTOR4 getPosition();
@@ -0,0 +1,185 @@
+#include "CLightTable.h"
+#include <xmmintrin.h>
+#include <cmath>
+
+CLightTable::CLightTable() : _count( 0 ), _padded( 0 )
+{
+}
+
+void CLightTable::build( const std::vector<Light> &lights, const Float3 &up, CFrameArena *arena )
+{
+	_count = lights.size();
+	_padded = ( _count + 3 ) & ~3u;
+
+	_x = arena->allocate<float>( _padded );
+	_y = arena->allocate<float>( _padded );
+	_z = arena->allocate<float>( _padded );
+	_dx = arena->allocate<float>( _padded );
+	_dy = arena->allocate<float>( _padded );
+	_dz = arena->allocate<float>( _padded );
+	_scale = arena->allocate<float>( _padded );
+	_cos_outer = arena->allocate<float>( _padded );
+	_cos_inner = arena->allocate<float>( _padded );
+	_intensity = arena->allocate<float>( _padded );
+	_view = arena->allocate<D3DXMATRIX>( _padded );
+	_projection = arena->allocate<D3DXMATRIX>( _padded );
+	_view_projection = arena->allocate<D3DXMATRIX>( _padded );
+	_frustums = arena->allocate<CFrustum>( _padded );
+	_constants = arena->allocate<LightConstants>( _padded );
+
+	//the last block is filled out with copies of the last light, so every block is whole.
+	//SSE has no trigonometry, so the cone's is done here a light at a time
+	for ( unsigned int l = 0; l < _padded; ++l )
+	{
+		const Light &light = lights[l < _count ? l : _count - 1];
+		_x[l] = light.position.x;
+		_y[l] = light.position.y;
+		_z[l] = light.position.z;
+		_dx[l] = light.direction.x;
+		_dy[l] = light.direction.y;
+		_dz[l] = light.direction.z;
+		_scale[l] = 1.0f / tanf( light.coneAngle );
+		_cos_outer[l] = cosf( light.coneAngle );
+		_cos_inner[l] = cosf( light.coneAngle * LIGHT_INNER_CONE );
+		_intensity[l] = light.intensity;
+	}
+
+	//a light looking straight along up has no way round, so takes whichever axis is least like it
+	const D3DXVECTOR3 world_up( up.x, up.y, up.z );
+	const D3DXVECTOR3 fallback_up = fabsf( up.x ) < 0.9f ? D3DXVECTOR3( 1.0f, 0.0f, 0.0f ) : D3DXVECTOR3( 0.0f, 1.0f, 0.0f );
+	for ( unsigned int first = 0; first < _padded; first += 4 )
+		buildBlock( first, world_up, fallback_up );
+}
+
+//r[0] to r[3] hold the same element of four lights, stored as that element of each
+static void storeTransposed( __m128 r0, __m128 r1, __m128 r2, __m128 r3, float *a, float *b, float *c, float *d )
+{
+	_MM_TRANSPOSE4_PS( r0, r1, r2, r3 );
+	_mm_storeu_ps( a, r0 );
+	_mm_storeu_ps( b, r1 );
+	_mm_storeu_ps( c, r2 );
+	_mm_storeu_ps( d, r3 );
+}
+
+//m[row][column], each holding four lights, into each light's matrix
+static void storeMatrices( __m128 m[4][4], D3DXMATRIX *out )
+{
+	for ( int row = 0; row < 4; ++row )
+		storeTransposed( m[row][0], m[row][1], m[row][2], m[row][3], &out[0]._11 + row * 4, &out[1]._11 + row * 4, &out[2]._11 + row * 4, &out[3]._11 + row * 4 );
+}
+
+static __m128 dot3( __m128 ax, __m128 ay, __m128 az, __m128 bx, __m128 by, __m128 bz )
+{
+	return _mm_add_ps( _mm_add_ps( _mm_mul_ps( ax, bx ), _mm_mul_ps( ay, by ) ), _mm_mul_ps( az, bz ) );
+}
+
+static __m128 inverseLength( __m128 x, __m128 y, __m128 z )
+{
+	//a true divide rather than the estimate, to match D3DX
+	return _mm_div_ps( _mm_set1_ps( 1.0f ), _mm_sqrt_ps( dot3( x, y, z, x, y, z ) ) );
+}
+
+void CLightTable::buildBlock( unsigned int first, const D3DXVECTOR3 &up, const D3DXVECTOR3 &fallback_up )
+{
+	const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps( 1.0f );
+	const __m128 ex = _mm_load_ps( _x + first ), ey = _mm_load_ps( _y + first ), ez = _mm_load_ps( _z + first );
+
+	//as D3DXMatrixLookAtRH: z points back along the light, x is up across z, and y completes them
+	__m128 zx = _mm_sub_ps( zero, _mm_load_ps( _dx + first ) );
+	__m128 zy = _mm_sub_ps( zero, _mm_load_ps( _dy + first ) );
+	__m128 zz = _mm_sub_ps( zero, _mm_load_ps( _dz + first ) );
+	__m128 inv = inverseLength( zx, zy, zz );
+	zx = _mm_mul_ps( zx, inv );
+	zy = _mm_mul_ps( zy, inv );
+	zz = _mm_mul_ps( zz, inv );
+
+	const __m128 ux = _mm_set1_ps( up.x ), uy = _mm_set1_ps( up.y ), uz = _mm_set1_ps( up.z );
+	__m128 xx = _mm_sub_ps( _mm_mul_ps( uy, zz ), _mm_mul_ps( uz, zy ) );
+	__m128 xy = _mm_sub_ps( _mm_mul_ps( uz, zx ), _mm_mul_ps( ux, zz ) );
+	__m128 xz = _mm_sub_ps( _mm_mul_ps( ux, zy ), _mm_mul_ps( uy, zx ) );
+
+	//lights looking along up take the fallback instead
+	const __m128 parallel = _mm_cmplt_ps( dot3( xx, xy, xz, xx, xy, xz ), _mm_set1_ps( 1e-12f ) );
+	if ( _mm_movemask_ps( parallel ) != 0 )
+	{
+		const __m128 fx = _mm_set1_ps( fallback_up.x ), fy = _mm_set1_ps( fallback_up.y ), fz = _mm_set1_ps( fallback_up.z );
+		const __m128 ax = _mm_sub_ps( _mm_mul_ps( fy, zz ), _mm_mul_ps( fz, zy ) );
+		const __m128 ay = _mm_sub_ps( _mm_mul_ps( fz, zx ), _mm_mul_ps( fx, zz ) );
+		const __m128 az = _mm_sub_ps( _mm_mul_ps( fx, zy ), _mm_mul_ps( fy, zx ) );
+		xx = _mm_or_ps( _mm_and_ps( parallel, ax ), _mm_andnot_ps( parallel, xx ) );
+		xy = _mm_or_ps( _mm_and_ps( parallel, ay ), _mm_andnot_ps( parallel, xy ) );
+		xz = _mm_or_ps( _mm_and_ps( parallel, az ), _mm_andnot_ps( parallel, xz ) );
+	}
+	inv = inverseLength( xx, xy, xz );
+	xx = _mm_mul_ps( xx, inv );
+	xy = _mm_mul_ps( xy, inv );
+	xz = _mm_mul_ps( xz, inv );
+
+	const __m128 yx = _mm_sub_ps( _mm_mul_ps( zy, xz ), _mm_mul_ps( zz, xy ) );
+	const __m128 yy = _mm_sub_ps( _mm_mul_ps( zz, xx ), _mm_mul_ps( zx, xz ) );
+	const __m128 yz = _mm_sub_ps( _mm_mul_ps( zx, xy ), _mm_mul_ps( zy, xx ) );
+
+	const __m128 tx = _mm_sub_ps( zero, dot3( xx, xy, xz, ex, ey, ez ) );
+	const __m128 ty = _mm_sub_ps( zero, dot3( yx, yy, yz, ex, ey, ez ) );
+	const __m128 tz = _mm_sub_ps( zero, dot3( zx, zy, zz, ex, ey, ez ) );
+
+	//as D3DXMatrixPerspectiveFovRH, square, with the cone as the field of view
+	const __m128 s = _mm_load_ps( _scale + first );
+	const __m128 q = _mm_set1_ps( LIGHT_FAR / ( LIGHT_NEAR - LIGHT_FAR ) );
+	const __m128 qn = _mm_set1_ps( LIGHT_NEAR * LIGHT_FAR / ( LIGHT_NEAR - LIGHT_FAR ) );
+	const __m128 minus_one = _mm_set1_ps( -1.0f );
+
+	__m128 view[4][4] = {
+		{ xx, yx, zx, zero },
+		{ xy, yy, zy, zero },
+		{ xz, yz, zz, zero },
+		{ tx, ty, tz, one } };
+	__m128 projection[4][4] = {
+		{ s, zero, zero, zero },
+		{ zero, s, zero, zero },
+		{ zero, zero, q, minus_one },
+		{ zero, zero, qn, zero } };
+
+	//the projection is mostly zeros, so their product is written out
+	__m128 vp[4][4];
+	for ( int row = 0; row < 4; ++row )
+	{
+		vp[row][0] = _mm_mul_ps( view[row][0], s );
+		vp[row][1] = _mm_mul_ps( view[row][1], s );
+		vp[row][2] = _mm_add_ps( _mm_mul_ps( view[row][2], q ), _mm_mul_ps( view[row][3], qn ) );
+		vp[row][3] = _mm_sub_ps( zero, view[row][2] );
+	}
+
+	storeMatrices( view, _view + first );
+	storeMatrices( projection, _projection + first );
+	storeMatrices( vp, _view_projection + first );
+
+	//the frustum planes, as CFrustum::set extracts them, columns added and taken away
+	__m128 planes[6][4];
+	for ( int i = 0; i < 4; ++i )
+	{
+		planes[0][i] = _mm_add_ps( vp[i][3], vp[i][0] ); // left
+		planes[1][i] = _mm_sub_ps( vp[i][3], vp[i][0] ); // right
+		planes[2][i] = _mm_add_ps( vp[i][3], vp[i][1] ); // bottom
+		planes[3][i] = _mm_sub_ps( vp[i][3], vp[i][1] ); // top
+		planes[4][i] = vp[i][2]; // near
+		planes[5][i] = _mm_sub_ps( vp[i][3], vp[i][2] ); // far
+	}
+	D3DXPLANE light_planes[4][6];
+	for ( int p = 0; p < 6; ++p )
+	{
+		inv = inverseLength( planes[p][0], planes[p][1], planes[p][2] );
+		storeTransposed( _mm_mul_ps( planes[p][0], inv ), _mm_mul_ps( planes[p][1], inv ), _mm_mul_ps( planes[p][2], inv ), _mm_mul_ps( planes[p][3], inv ),
+			&light_planes[0][p].a, &light_planes[1][p].a, &light_planes[2][p].a, &light_planes[3][p].a );
+	}
+	for ( int k = 0; k < 4; ++k )
+		_frustums[first + k].set( light_planes[k] );
+
+	//and the constants the lighting shader takes, the direction made unit length
+	LightConstants *c = _constants + first;
+	storeTransposed( ex, ey, ez, one, &c[0].position.x, &c[1].position.x, &c[2].position.x, &c[3].position.x );
+	storeTransposed( _mm_sub_ps( zero, zx ), _mm_sub_ps( zero, zy ), _mm_sub_ps( zero, zz ), zero,
+		&c[0].direction.x, &c[1].direction.x, &c[2].direction.x, &c[3].direction.x );
+	storeTransposed( _mm_load_ps( _cos_outer + first ), _mm_load_ps( _cos_inner + first ), _mm_load_ps( _intensity + first ), zero,
+		&c[0].cos_outer, &c[1].cos_outer, &c[2].cos_outer, &c[3].cos_outer );
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <windows.h>
+#include <d3d9.h>
+#include <d3dx9.h>
+#include <iostream>
+#include <cassert>
+#include <vector>
+#include "SceneDelegate.hpp"
+#include "CLight.h"
+#include "CFrustum.h"
+#include "CFrameArena.h"
+
+//Where a spotlight reaches full strength, as a fraction of its cone
+#define LIGHT_INNER_CONE 0.002f
+
+//A light's constants for the lighting shader, laid out to be set as they are
+struct LightConstants {
+	D3DXVECTOR4 position; // w is 1
+	D3DXVECTOR4 direction; // unit length, w is 0
+	float cos_outer, cos_inner; // of the cone's half angle, and of where it is at full strength
+	float intensity;
+	float pad;
+};
+
+//Everything the passes need of every light, worked out once a frame rather
+//than by each pass that wants it. The inputs are kept a component to an
+//array so the matrices, frustum planes and shader constants are made four
+//lights at a time with SSE, then stored a light at a time for the passes to
+//read. Matches what CLight gives, with the same near and far planes. The
+//arrays are in the frame arena, so are gone when it is next reset
+class CLightTable {
+private:
+	unsigned int _count, _padded; // lights, and rounded up to whole blocks of four
+
+	//by component, 16 byte aligned
+	float *_x, *_y, *_z; // position
+	float *_dx, *_dy, *_dz; // direction, not yet unit length
+	float *_scale; // of the projection, 1 / tan of the cone's half angle
+	float *_cos_outer, *_cos_inner, *_intensity;
+
+	//by light
+	D3DXMATRIX *_view, *_projection, *_view_projection;
+	CFrustum *_frustums;
+	LightConstants *_constants;
+
+	void buildBlock( unsigned int first, const D3DXVECTOR3 &up, const D3DXVECTOR3 &fallback_up );
+
+public:
+	CLightTable();
+
+	//every light's matrices and constants, up being the world's
+	void build( const std::vector<Light> &lights, const Float3 &up, CFrameArena *arena );
+
+	unsigned int count() const { return _count; }
+
+	const D3DXMATRIX &view( unsigned int l ) const { return _view[l]; }
+	const D3DXMATRIX &projection( unsigned int l ) const { return _projection[l]; }
+	const D3DXMATRIX &viewProjection( unsigned int l ) const { return _view_projection[l]; }
+	const CFrustum &frustum( unsigned int l ) const { return _frustums[l]; }
+	const LightConstants &constants( unsigned int l ) const { return _constants[l]; }
+
+	D3DXVECTOR3 position( unsigned int l ) const { return D3DXVECTOR3( _x[l], _y[l], _z[l] ); }
+
+	//pixels of a shadow map one world unit covers at a distance of one unit
+	float pixelScale( unsigned int l ) const { return MAP_SIZE * 0.5f * _scale[l]; }
+};
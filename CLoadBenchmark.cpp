@@ -0,0 +1,165 @@
+#include "CLoadBenchmark.h"
+#include "CVertexConvert.h"
+#include "CMesh.h"
+#include <vector>
+#include <cmath>
+#include <cstring>
+
+//each mesh is converted this many times, and the fastest time kept
+#define LOAD_BENCH_REPEATS 5
+
+//vertices along each side of the synthetic mesh
+#define LOAD_BENCH_GRID 512
+
+//Where the converted mesh goes, standing in for the locked buffers
+struct LoadTarget {
+	std::vector<CMesh::Position> positions;
+	std::vector<CMesh::Attributes> attributes;
+	std::vector<unsigned short> indices;
+};
+
+static double now()
+{
+	LARGE_INTEGER frequency, counter;
+	QueryPerformanceFrequency( &frequency );
+	QueryPerformanceCounter( &counter );
+	return counter.QuadPart * 1000.0 / frequency.QuadPart;
+}
+
+//the bounds the positions are packed against
+static void bounds( const MeshView &view, D3DXVECTOR3 *centre, D3DXVECTOR3 *half )
+{
+	D3DXVECTOR3 lo( 0.0f, 0.0f, 0.0f ), hi = lo;
+	for ( unsigned int i = 0; i < view.numberOfVertices; ++i )
+	{
+		const D3DXVECTOR3 p( view.vertexArray[i].x, view.vertexArray[i].y, view.vertexArray[i].z );
+		if ( i == 0 )
+			lo = hi = p;
+		D3DXVec3Minimize( &lo, &lo, &p );
+		D3DXVec3Maximize( &hi, &hi, &p );
+	}
+	*centre = ( lo + hi ) * 0.5f;
+	*half = ( hi - lo ) * 0.5f;
+	if ( half->x <= 0.0f ) half->x = 1.0f;
+	if ( half->y <= 0.0f ) half->y = 1.0f;
+	if ( half->z <= 0.0f ) half->z = 1.0f;
+}
+
+//the old way: a copy of the mesh, then each element converted on its own
+static void convertCopy( const SceneDelegate *scene, unsigned int index, const MeshView &view, const D3DXVECTOR3 &centre, const D3DXVECTOR3 &half, LoadTarget *target )
+{
+	Mesh mesh;
+	if ( scene )
+		scene->getMeshAtIndex( index, &mesh );
+	else
+	{
+		mesh.vertexArray.assign( view.vertexArray, view.vertexArray + view.numberOfVertices );
+		mesh.normalArray.assign( view.normalArray, view.normalArray + view.numberOfVertices );
+		mesh.indexArray.assign( view.indexArray, view.indexArray + view.numberOfIndices );
+	}
+
+	for ( unsigned int i = 0; i < mesh.vertexArray.size(); ++i )
+	{
+		CMesh::Position &vertex = target->positions[i];
+		vertex.position[0] = CMesh::packSnorm( ( mesh.vertexArray[i].x - centre.x ) / half.x );
+		vertex.position[1] = CMesh::packSnorm( ( mesh.vertexArray[i].y - centre.y ) / half.y );
+		vertex.position[2] = CMesh::packSnorm( ( mesh.vertexArray[i].z - centre.z ) / half.z );
+		vertex.position[3] = 32767;
+
+		D3DXVECTOR3 n( mesh.normalArray[i].x, mesh.normalArray[i].y, mesh.normalArray[i].z );
+		D3DXVec3Normalize( &n, &n );
+		CMesh::packNormal( n, target->attributes[i].normal );
+	}
+	for ( unsigned int i = 0; i < target->indices.size(); ++i )
+		target->indices[i] = (unsigned short)mesh.indexArray[i];
+}
+
+//the new way: the kernels read the view and write the target directly
+static void convertView( const MeshView &view, const D3DXVECTOR3 &centre, const D3DXVECTOR3 &half, LoadTarget *target )
+{
+	if ( view.numberOfVertices > 0 )
+	{
+		CVertexConvert::packPositions( view.vertexArray, view.numberOfVertices, centre, half, &target->positions[0] );
+		CVertexConvert::packNormals( view.normalArray, view.numberOfVertices, &target->attributes[0] );
+	}
+	if ( !target->indices.empty() )
+		CVertexConvert::narrowIndices( view.indexArray, target->indices.size(), &target->indices[0] );
+}
+
+//time one mesh both ways and report it. scene is NULL for a mesh that is not in a delegate
+static void benchmark( const char *name, const SceneDelegate *scene, unsigned int index, const MeshView &view, std::ostream &out )
+{
+	D3DXVECTOR3 centre, half;
+	bounds( view, &centre, &half );
+
+	//only indices that fit in 16 bits are narrowed, as the buffers would
+	unsigned int narrow = 0;
+	while ( narrow < view.numberOfIndices && view.indexArray[narrow] < 65536 )
+		++narrow;
+
+	LoadTarget copied, viewed;
+	copied.positions.resize( view.numberOfVertices );
+	copied.attributes.resize( view.numberOfVertices );
+	copied.indices.resize( narrow );
+	viewed = copied;
+
+	double copy_ms = 0.0, view_ms = 0.0;
+	for ( unsigned int r = 0; r < LOAD_BENCH_REPEATS; ++r )
+	{
+		double start = now();
+		convertCopy( scene, index, view, centre, half, &copied );
+		const double copy = now() - start;
+
+		start = now();
+		convertView( view, centre, half, &viewed );
+		const double viewing = now() - start;
+
+		if ( r == 0 || copy < copy_ms ) copy_ms = copy;
+		if ( r == 0 || viewing < view_ms ) view_ms = viewing;
+	}
+
+	const bool same = copied.positions.empty() || ( memcmp( &copied.positions[0], &viewed.positions[0], copied.positions.size() * sizeof(CMesh::Position) ) == 0
+		&& memcmp( &copied.attributes[0], &viewed.attributes[0], copied.attributes.size() * sizeof(CMesh::Attributes) ) == 0
+		&& ( copied.indices.empty() || memcmp( &copied.indices[0], &viewed.indices[0], copied.indices.size() * sizeof(unsigned short) ) == 0 ) );
+
+	const unsigned int copy_bytes = view.numberOfVertices * 2 * sizeof(Float3) + view.numberOfIndices * sizeof(unsigned int);
+	out << name << " " << index << ": " << view.numberOfVertices << " vertices, " << view.numberOfIndices << " indices, copy "
+		<< copy_ms << " ms, view " << view_ms << " ms, " << copy_bytes / 1024.0f << " KB copy avoided"
+		<< ( same ? "" : ", OUTPUT DIFFERS" ) << "\n";
+}
+
+void CLoadBenchmark::run( const SceneDelegate *scene, std::ostream &out )
+{
+	for ( unsigned int i = 0; i < scene->numberOfMeshes(); ++i )
+		benchmark( "mesh", scene, i, scene->meshViewAtIndex( i ), out );
+
+	//a bumpy grid, standing in for a scene with large meshes
+	Mesh grid;
+	grid.vertexArray.resize( LOAD_BENCH_GRID * LOAD_BENCH_GRID );
+	grid.normalArray.resize( grid.vertexArray.size() );
+	for ( unsigned int y = 0; y < LOAD_BENCH_GRID; ++y )
+	{
+		for ( unsigned int x = 0; x < LOAD_BENCH_GRID; ++x )
+		{
+			grid.vertexArray[y * LOAD_BENCH_GRID + x] = Float3( (float)x, sinf( x * 0.1f ) * cosf( y * 0.1f ), (float)y );
+			grid.normalArray[y * LOAD_BENCH_GRID + x] = Float3( -cosf( x * 0.1f ) * cosf( y * 0.1f ) * 0.1f, 1.0f, sinf( x * 0.1f ) * sinf( y * 0.1f ) * 0.1f );
+		}
+	}
+	for ( unsigned int y = 0; y + 1 < LOAD_BENCH_GRID; ++y )
+	{
+		for ( unsigned int x = 0; x + 1 < LOAD_BENCH_GRID; ++x )
+		{
+			const unsigned int v = y * LOAD_BENCH_GRID + x;
+			const unsigned int quad[6] = { v, v + LOAD_BENCH_GRID, v + 1, v + 1, v + LOAD_BENCH_GRID, v + LOAD_BENCH_GRID + 1 };
+			grid.indexArray.insert( grid.indexArray.end(), quad, quad + 6 );
+		}
+	}
+
+	MeshView view;
+	view.vertexArray = &grid.vertexArray[0];
+	view.normalArray = &grid.normalArray[0];
+	view.numberOfVertices = grid.vertexArray.size();
+	view.indexArray = &grid.indexArray[0];
+	view.numberOfIndices = grid.indexArray.size();
+	benchmark( "synthetic", NULL, 0, view, out );
+}
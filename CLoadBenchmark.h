@@ -0,0 +1,16 @@
+#pragma once
+#include <windows.h>
+#include <d3d9.h>
+#include <d3dx9.h>
+#include <iostream>
+#include <cassert>
+#include "SceneDelegate.hpp"
+
+//Times getting each mesh from the scene into the form the buffers hold, two
+//ways: copying the mesh out of the delegate and converting it element by
+//element, against converting its view in place with the SSE2 kernels.
+//A large synthetic mesh is timed too, as the scene's own meshes are small
+class CLoadBenchmark {
+public:
+	static void run( const SceneDelegate *scene, std::ostream &out );
+};
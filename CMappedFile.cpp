@@ -0,0 +1,55 @@
+#include "CMappedFile.h"
+
+CMappedFile::CMappedFile()
+{
+	_file = INVALID_HANDLE_VALUE;
+	_mapping = NULL;
+	_data = NULL;
+	_size = 0;
+}
+
+CMappedFile::~CMappedFile()
+{
+	close();
+}
+
+bool CMappedFile::open( const char *path )
+{
+	close();
+
+	_file = CreateFileA( path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+	if ( _file == INVALID_HANDLE_VALUE )
+		return false;
+
+	//an empty file cannot be mapped
+	LARGE_INTEGER size;
+	if ( GetFileSizeEx( _file, &size ) && size.QuadPart > 0 && size.QuadPart < 0xFFFFFFFF )
+	{
+		_size = (unsigned int)size.QuadPart;
+		_mapping = CreateFileMappingA( _file, NULL, PAGE_READONLY, 0, 0, NULL );
+	}
+	if ( _mapping != NULL )
+		_data = (const unsigned char*)MapViewOfFile( _mapping, FILE_MAP_READ, 0, 0, 0 );
+
+	if ( _data == NULL )
+	{
+		close();
+		return false;
+	}
+	return true;
+}
+
+void CMappedFile::close()
+{
+	if ( _data != NULL )
+		UnmapViewOfFile( _data );
+	if ( _mapping != NULL )
+		CloseHandle( _mapping );
+	if ( _file != INVALID_HANDLE_VALUE )
+		CloseHandle( _file );
+
+	_file = INVALID_HANDLE_VALUE;
+	_mapping = NULL;
+	_data = NULL;
+	_size = 0;
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include <windows.h>
+#include <cassert>
+
+//A whole file mapped read-only into memory, to be read where it lies
+class CMappedFile {
+private:
+	HANDLE _file, _mapping;
+	const unsigned char *_data; // NULL when closed
+	unsigned int _size;
+
+public:
+	CMappedFile();
+	~CMappedFile();
+
+	//false if the file is missing, empty, or too big for 32 bit offsets
+	bool open( const char *path );
+	void close();
+	bool isOpen() const { return _data != NULL; }
+
+	const unsigned char *data() const { return _data; }
+	unsigned int size() const { return _size; }
+};
@@ -0,0 +1,333 @@
+#include "CMesh.h"
+#include "CVertexConvert.h"
+#include <cmath>
+#include <cstring>
+
+void MeshCompressionStats::print( std::ostream &out ) const
+{
+	out << raw_bytes / 1024.0f << " KB -> " << packed_bytes / 1024.0f << " KB ("
+		<< ( raw_bytes - packed_bytes ) * 100.0f / raw_bytes << "% saved), max position error "
+		<< max_position_error << ", max normal error " << max_normal_error << " deg\n";
+}
+
+CMesh::CMesh()
+{
+	_geometry = NULL;
+	_centre = D3DXVECTOR3( 0.0f, 0.0f, 0.0f );
+	_radius = 0.0f;
+	_position_scale = D3DXVECTOR4( 1.0f, 1.0f, 1.0f, 1.0f );
+	_position_bias = D3DXVECTOR4( 0.0f, 0.0f, 0.0f, 0.0f );
+	memset( &_compression, 0, sizeof(_compression) );
+}
+
+CMesh::~CMesh()
+{
+	//hand the space back for reuse
+	for ( unsigned int l = 0; l < _lods.size(); ++l )
+	{
+		if ( _lods[l].handle != INVALID_GEOMETRY )
+			_geometry->free( _lods[l].handle );
+	}
+}
+
+short CMesh::packSnorm( float value )
+{
+	if ( value > 1.0f ) value = 1.0f;
+	if ( value < -1.0f ) value = -1.0f;
+	//round to nearest, the cast truncates towards zero
+	return (short)( value >= 0.0f ? value * 32767.0f + 0.5f : value * 32767.0f - 0.5f );
+}
+
+float CMesh::unpackSnorm( short value )
+{
+	//-32768 and -32767 both decode to -1, as the hardware does
+	float f = value / 32767.0f;
+	return f < -1.0f ? -1.0f : f;
+}
+
+//fold the unit sphere onto an octahedron and flatten it to a square
+void CMesh::packNormal( const D3DXVECTOR3 &normal, short *packed )
+{
+	const float l1 = fabsf( normal.x ) + fabsf( normal.y ) + fabsf( normal.z );
+	float x = l1 > 0.0f ? normal.x / l1 : 0.0f;
+	float y = l1 > 0.0f ? normal.y / l1 : 0.0f;
+	if ( normal.z < 0.0f )
+	{
+		const float fx = ( 1.0f - fabsf( y ) ) * ( x >= 0.0f ? 1.0f : -1.0f );
+		const float fy = ( 1.0f - fabsf( x ) ) * ( y >= 0.0f ? 1.0f : -1.0f );
+		x = fx;
+		y = fy;
+	}
+	packed[0] = packSnorm( x );
+	packed[1] = packSnorm( y );
+}
+
+D3DXVECTOR3 CMesh::unpackNormal( const short *packed )
+{
+	D3DXVECTOR3 n( unpackSnorm( packed[0] ), unpackSnorm( packed[1] ), 0.0f );
+	n.z = 1.0f - fabsf( n.x ) - fabsf( n.y );
+	if ( n.z < 0.0f )
+	{
+		const float x = ( 1.0f - fabsf( n.y ) ) * ( n.x >= 0.0f ? 1.0f : -1.0f );
+		const float y = ( 1.0f - fabsf( n.x ) ) * ( n.y >= 0.0f ? 1.0f : -1.0f );
+		n.x = x;
+		n.y = y;
+	}
+	D3DXVec3Normalize( &n, &n );
+	return n;
+}
+
+//Append a blob to a packed block at the next 16 byte boundary, returning its offset
+static unsigned int appendBlob( std::vector<unsigned char> *block, const void *data, unsigned int bytes )
+{
+	const unsigned int offset = ( block->size() + 15 ) & ~15u;
+	block->resize( offset + bytes );
+	if ( bytes > 0 )
+		memcpy( &(*block)[offset], data, bytes );
+	return offset;
+}
+
+//Make room for a blob at the next 16 byte boundary, to be written in place
+static unsigned int reserveBlob( std::vector<unsigned char> *block, unsigned int bytes )
+{
+	const unsigned int offset = ( block->size() + 15 ) & ~15u;
+	block->resize( offset + bytes );
+	return offset;
+}
+
+void CMesh::pack( const std::vector<Mesh> &levels, const std::vector<float> &errors, const MeshOptimizeReport &optimized, std::vector<unsigned char> *block )
+{
+	assert( !levels.empty() && levels.size() == errors.size() );
+
+	//the header and level table go first, and are filled in once the blobs are placed
+	PackedMeshHeader header;
+	memset( &header, 0, sizeof(header) );
+	std::vector<PackedLevel> table( levels.size() );
+	block->clear();
+	appendBlob( block, &header, sizeof(header) );
+	header.num_levels = levels.size();
+	header.levels = appendBlob( block, &table[0], table.size() * sizeof(PackedLevel) );
+	header.optimized = optimized;
+
+	//positions are stored relative to the centre of the bounds, scaled to -1..1.
+	//the bounds take in every level, as simplifying may place vertices outside
+	//level 0's, and they share the one scale and bias
+	const Mesh &mesh = levels[0];
+	D3DXVECTOR3 lo( 0.0f, 0.0f, 0.0f ), hi = lo;
+	bool first = true;
+	for ( unsigned int l = 0; l < levels.size(); ++l )
+	{
+		for ( UINT i = 0; i < levels[l].vertexArray.size(); ++i )
+		{
+			D3DXVECTOR3 p( levels[l].vertexArray[i].x, levels[l].vertexArray[i].y, levels[l].vertexArray[i].z );
+			if ( first )
+				lo = hi = p;
+			first = false;
+			D3DXVec3Minimize( &lo, &lo, &p );
+			D3DXVec3Maximize( &hi, &hi, &p );
+		}
+	}
+	const D3DXVECTOR3 centre = ( lo + hi ) * 0.5f;
+	D3DXVECTOR3 half = ( hi - lo ) * 0.5f;
+	//a flat axis still needs a non-zero scale
+	if ( half.x <= 0.0f ) half.x = 1.0f;
+	if ( half.y <= 0.0f ) half.y = 1.0f;
+	if ( half.z <= 0.0f ) half.z = 1.0f;
+	header.position_scale = D3DXVECTOR4( half.x, half.y, half.z, 0.0f );
+	header.position_bias = D3DXVECTOR4( centre.x, centre.y, centre.z, 1.0f );
+
+	//bounding sphere for choosing levels of detail, around every level too
+	header.centre = centre;
+	header.radius = 0.0f;
+	for ( unsigned int l = 0; l < levels.size(); ++l )
+	{
+		for ( UINT i = 0; i < levels[l].vertexArray.size(); ++i )
+		{
+			const D3DXVECTOR3 offset = D3DXVECTOR3( levels[l].vertexArray[i].x, levels[l].vertexArray[i].y, levels[l].vertexArray[i].z ) - centre;
+			const float distance = D3DXVec3Length( &offset );
+			if ( distance > header.radius )
+				header.radius = distance;
+		}
+	}
+
+	for ( unsigned int l = 0; l < levels.size(); ++l )
+	{
+		const Mesh &level = levels[l];
+		const unsigned int num_vertices = level.vertexArray.size();
+		const unsigned int num_indices = level.indexArray.size();
+		const IndexWidth width = CGeometryBuffer::indexWidth( num_vertices );
+
+		header.compression.raw_bytes += num_vertices * 2 * sizeof(D3DXVECTOR3) + num_indices * sizeof(unsigned int);
+		header.compression.packed_bytes += num_vertices * ( sizeof(Position) + sizeof(Attributes) )
+			+ num_indices * CGeometryBuffer::indexSize( width );
+
+		table[l].num_vertices = num_vertices;
+		table[l].num_indices = num_indices;
+		table[l].error = errors[l];
+		table[l].positions = reserveBlob( block, num_vertices * sizeof(Position) );
+		table[l].attributes = reserveBlob( block, num_vertices * sizeof(Attributes) );
+		table[l].indices = reserveBlob( block, num_indices * CGeometryBuffer::indexSize( width ) );
+
+		// pack the vertices and indices straight into the block. indices stay relative
+		// to the mesh's base vertex, in the width the geometry buffer will use
+		Position *positions = (Position*)&(*block)[table[l].positions];
+		Attributes *attributes = (Attributes*)&(*block)[table[l].attributes];
+		if ( num_vertices > 0 )
+		{
+			CVertexConvert::packPositions( &level.vertexArray[0], num_vertices, centre, half, positions );
+			CVertexConvert::packNormals( &level.normalArray[0], num_vertices, attributes );
+		}
+		if ( num_indices > 0 )
+		{
+			if ( width == INDEX_16 )
+				CVertexConvert::narrowIndices( &level.indexArray[0], num_indices, (unsigned short*)&(*block)[table[l].indices] );
+			else
+				memcpy( &(*block)[table[l].indices], &level.indexArray[0], num_indices * sizeof(unsigned int) );
+		}
+
+		// measure what the packing loses
+		for ( UINT i = 0; i < num_vertices; ++i )
+		{
+			const Position &vertex = positions[i];
+			const D3DXVECTOR3 p( level.vertexArray[i].x, level.vertexArray[i].y, level.vertexArray[i].z );
+			D3DXVECTOR3 n( level.normalArray[i].x, level.normalArray[i].y, level.normalArray[i].z );
+			D3DXVec3Normalize( &n, &n );
+
+			const D3DXVECTOR3 decoded( unpackSnorm( vertex.position[0] ) * half.x + centre.x,
+				unpackSnorm( vertex.position[1] ) * half.y + centre.y,
+				unpackSnorm( vertex.position[2] ) * half.z + centre.z );
+			const D3DXVECTOR3 error = decoded - p;
+			const float position_error = D3DXVec3Length( &error );
+			if ( position_error > header.compression.max_position_error )
+				header.compression.max_position_error = position_error;
+
+			const D3DXVECTOR3 decoded_normal = unpackNormal( attributes[i].normal );
+			float cosine = D3DXVec3Dot( &decoded_normal, &n );
+			if ( cosine > 1.0f ) cosine = 1.0f;
+			const float normal_error = D3DXToDegree( acosf( cosine ) );
+			if ( normal_error > header.compression.max_normal_error )
+				header.compression.max_normal_error = normal_error;
+		}
+	}
+
+	//the full mesh is also split into meshlets, when it is big enough to cull in parts
+	if ( mesh.indexArray.size() / 3 >= MESHLET_MIN_TRIANGLES )
+	{
+		std::vector<D3DXVECTOR3> points( mesh.vertexArray.size() ), normals( mesh.normalArray.size() );
+		for ( UINT i = 0; i < points.size(); ++i )
+			points[i] = D3DXVECTOR3( mesh.vertexArray[i].x, mesh.vertexArray[i].y, mesh.vertexArray[i].z );
+		for ( UINT i = 0; i < normals.size(); ++i )
+			normals[i] = D3DXVECTOR3( mesh.normalArray[i].x, mesh.normalArray[i].y, mesh.normalArray[i].z );
+
+		std::vector<Meshlet> meshlets;
+		CMeshlets::build( points, normals, mesh.indexArray, &meshlets );
+		header.num_meshlets = meshlets.size();
+		header.meshlets = appendBlob( block, meshlets.empty() ? NULL : &meshlets[0], meshlets.size() * sizeof(Meshlet) );
+	}
+
+	header.size = block->size();
+	memcpy( &(*block)[0], &header, sizeof(header) );
+	memcpy( &(*block)[header.levels], &table[0], table.size() * sizeof(PackedLevel) );
+}
+
+bool CMesh::init( CRenderDevice *dev, CGeometryBuffer *geometry, const PackedMeshHeader *packed )
+{
+	const unsigned char *base = (const unsigned char*)packed;
+	const PackedLevel *levels = (const PackedLevel*)( base + packed->levels );
+	if ( packed->num_levels == 0 || levels[0].num_vertices == 0 )
+		return false;
+	_geometry = geometry;
+
+	_position_scale = packed->position_scale;
+	_position_bias = packed->position_bias;
+	_centre = packed->centre;
+	_radius = packed->radius;
+	_compression = packed->compression;
+
+	const Meshlet *meshlets = (const Meshlet*)( base + packed->meshlets );
+	_meshlets.assign( meshlets, meshlets + packed->num_meshlets );
+
+	//the blobs are already in the buffers' formats, so they are copied straight in
+	_lods.clear();
+	for ( unsigned int l = 0; l < packed->num_levels; ++l )
+	{
+		const PackedLevel &level = levels[l];
+		Lod lod;
+		lod.num_vertices = level.num_vertices;
+		lod.num_triangles = level.num_indices / 3;
+		lod.error = level.error;
+		lod.handle = _geometry->allocate( dev, level.num_vertices, level.num_indices );
+		if ( lod.handle == INVALID_GEOMETRY )
+		{
+			//hand back the levels already in, so a failed mesh holds nothing
+			for ( unsigned int f = 0; f < _lods.size(); ++f )
+				_geometry->free( _lods[f].handle );
+			_lods.clear();
+			return false;
+		}
+		_lods.push_back( lod );
+		assert( _geometry->allocation( lod.handle ).index_width == CGeometryBuffer::indexWidth( level.num_vertices ) );
+
+		void *ptr = _geometry->lockVertices( lod.handle, POSITION_STREAM );
+		if ( ptr )
+		{
+			memcpy( ptr, base + level.positions, level.num_vertices * sizeof(Position) );
+			_geometry->unlockVertices( POSITION_STREAM );
+		}
+		ptr = _geometry->lockVertices( lod.handle, ATTRIBUTE_STREAM );
+		if ( ptr )
+		{
+			memcpy( ptr, base + level.attributes, level.num_vertices * sizeof(Attributes) );
+			_geometry->unlockVertices( ATTRIBUTE_STREAM );
+		}
+		ptr = level.num_indices > 0 ? _geometry->lockIndices( lod.handle ) : NULL;
+		if ( ptr )
+		{
+			memcpy( ptr, base + level.indices, level.num_indices * CGeometryBuffer::indexSize( CGeometryBuffer::indexWidth( level.num_vertices ) ) );
+			_geometry->unlockIndices( lod.handle );
+		}
+	}
+
+	return true;
+}
+
+void CMesh::setDecode( CRenderDevice *dev, ID3DXConstantTable *vertex_constants )
+{
+	dev->SetVector( vertex_constants, "position_scale", &_position_scale );
+	dev->SetVector( vertex_constants, "position_bias", &_position_bias );
+}
+
+void CMesh::draw( CRenderDevice *dev, unsigned int lod )
+{
+	_geometry->draw( dev, _lods[lod].handle );
+}
+
+void CMesh::draw( CRenderDevice *dev, const IndexRange *ranges, unsigned int count )
+{
+	for ( unsigned int r = 0; r < count; ++r )
+		_geometry->draw( dev, _lods[0].handle, ranges[r].first_index, ranges[r].num_triangles );
+}
+
+unsigned int CMesh::selectLod( unsigned int current, float pixels_per_unit ) const
+{
+	if ( current >= _lods.size() )
+		current = 0;
+
+	//coarsest levels that pass the threshold and the stricter switching threshold
+	unsigned int allowed = 0, preferred = 0;
+	for ( unsigned int l = 1; l < _lods.size(); ++l )
+	{
+		const float pixels = _lods[l].error * pixels_per_unit;
+		if ( pixels <= LOD_PIXEL_ERROR )
+			allowed = l;
+		if ( pixels <= LOD_PIXEL_ERROR * LOD_HYSTERESIS )
+			preferred = l;
+	}
+
+	//refine as soon as the current level is too coarse, coarsen only once well clear
+	if ( current > allowed )
+		return allowed;
+	if ( preferred > current )
+		return preferred;
+	return current;
+}
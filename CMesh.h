@@ -0,0 +1,131 @@
+#pragma once
+#include <windows.h>
+#include <d3d9.h>
+#include <d3dx9.h>
+#include <iostream>
+#include <cassert>
+#include "SceneDelegate.hpp"
+#include "CRenderDevice.h"
+#include <vector>
+#include "CGeometryBuffer.h"
+#include "CMeshlets.h"
+#include "CMeshOptimizer.h"
+
+//a level of detail may be used while its error covers less than this many pixels
+#define LOD_PIXEL_ERROR 1.0f
+
+//and is only switched to once its error is below this fraction of that, so an
+//entity sitting on a threshold does not flicker between levels
+#define LOD_HYSTERESIS 0.75f
+
+//How well a mesh packed, against the float vertices and 32 bit indices it came as
+struct MeshCompressionStats {
+	unsigned int raw_bytes, packed_bytes;
+	float max_position_error; // in mesh units
+	float max_normal_error; // in degrees
+
+	void print( std::ostream &out ) const;
+};
+
+//One level of detail in a packed mesh. Offsets are in bytes from the start of
+//the block, indices are 16 bit when CGeometryBuffer::indexWidth says so
+struct PackedLevel {
+	unsigned int num_vertices, num_indices;
+	unsigned int positions, attributes, indices; // offsets of the stream and index blobs
+	float error;
+};
+
+//A mesh packed ready for the GPU as one block of memory that can be stored
+//and mapped back as it is. Every blob starts on a 16 byte boundary
+struct PackedMeshHeader {
+	unsigned int size; // of the whole block, header included
+	unsigned int num_levels, levels; // count and offset of the PackedLevel table
+	unsigned int num_meshlets, meshlets; // of level 0, offset of the Meshlet array
+	D3DXVECTOR4 position_scale, position_bias;
+	D3DXVECTOR3 centre; // bounding sphere in mesh units
+	float radius;
+	MeshCompressionStats compression; // over every level
+	MeshOptimizeReport optimized; // what reordering level 0 achieved
+};
+
+//The vertex streams a mesh is split over. Depth-only passes bind just the
+//positions, the instance stream always comes after the mesh streams
+enum MeshStream {
+	POSITION_STREAM,
+	ATTRIBUTE_STREAM,
+	MESH_STREAMS
+};
+
+//One scene Mesh, stored in the shared geometry buffer and used by every
+//entity that references it, as a chain of levels of detail
+class CMesh {
+public:
+	// C++ version of our vertex layout, 12 bytes rather than two float3s.
+	// positions are SHORT4N relative to the mesh bounds, decoded with
+	// the scale and bias constants; normals are octahedral SHORT2N
+	struct Position
+	{
+		short position[4];
+	};
+	struct Attributes
+	{
+		short normal[2];
+	};
+
+private:
+	//one level of detail, 0 is the full mesh
+	struct Lod {
+		GeometryHandle handle; // where it is in the shared buffers
+		unsigned int num_triangles;
+		unsigned int num_vertices;
+		float error; // how far its surface strays from level 0, in mesh units
+	};
+
+	CGeometryBuffer *_geometry; // the shared buffers the mesh lives in
+	std::vector<Lod> _lods;
+	D3DXVECTOR3 _centre; // bounding sphere in mesh units
+	float _radius;
+	std::vector<Meshlet> _meshlets; // of level 0, empty for meshes too small to bother
+
+	D3DXVECTOR4 _position_scale, _position_bias; // turn a SHORT4N position back into mesh units
+	MeshCompressionStats _compression; // over every level
+
+public:
+	CMesh();
+	~CMesh();
+	//copy a packed block's blobs straight into the shared buffers
+	bool init( CRenderDevice *dev, CGeometryBuffer *geometry, const PackedMeshHeader *packed );
+
+	//pack levels and errors as made by CMeshSimplifier::buildChain into one block,
+	//level 0 sets the packing bounds and is split into meshlets
+	static void pack( const std::vector<Mesh> &levels, const std::vector<float> &errors, const MeshOptimizeReport &optimized, std::vector<unsigned char> *block );
+
+	//set the decode constants for the mesh in a vertex shader
+	void setDecode( CRenderDevice *dev, ID3DXConstantTable *vertex_constants );
+
+	//the geometry buffer must already be bound
+	void draw( CRenderDevice *dev, unsigned int lod );
+
+	//draw just the parts of level 0 that survived culling its meshlets
+	void draw( CRenderDevice *dev, const IndexRange *ranges, unsigned int count );
+
+	//the coarsest level that looks right when one mesh unit covers pixels_per_unit
+	//pixels, moving away from current only when clearly past a threshold
+	unsigned int selectLod( unsigned int current, float pixels_per_unit ) const;
+
+	unsigned int lods() const { return _lods.size(); }
+	float lodError( unsigned int lod ) const { return _lods[lod].error; }
+	unsigned int triangles( unsigned int lod = 0 ) const { return _lods[lod].num_triangles; }
+	unsigned int vertices( unsigned int lod = 0 ) const { return _lods[lod].num_vertices; }
+	GeometryHandle handle( unsigned int lod = 0 ) const { return _lods[lod].handle; }
+	const std::vector<Meshlet> &meshlets() const { return _meshlets; }
+	const D3DXVECTOR3 &centre() const { return _centre; }
+	float radius() const { return _radius; }
+	const MeshCompressionStats &compression() const { return _compression; }
+
+	//quantisation shared with anything else packing vertices the same way
+	static short packSnorm( float value );
+	static float unpackSnorm( short value );
+	static void packNormal( const D3DXVECTOR3 &normal, short *packed );
+	static D3DXVECTOR3 unpackNormal( const short *packed );
+};
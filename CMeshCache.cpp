@@ -0,0 +1,196 @@
+#include "CMeshCache.h"
+#include <cstring>
+
+CMeshCache::CMeshCache()
+{
+	_vertex_declaration = NULL;
+	_position_declaration = NULL;
+	_scene_cache = NULL;
+	_uploads = 0;
+}
+
+CMeshCache::~CMeshCache()
+{
+	clear();
+}
+
+bool CMeshCache::init( CRenderDevice *dev, SceneDelegate *scene, const CSceneCache *scene_cache )
+{
+	_scene_cache = scene_cache != NULL && scene_cache->isOpen() ? scene_cache : NULL;
+
+	//Create a vertex decloration
+	//stream 0 is the mesh positions, stream 1 the normals,
+	//stream 2 holds a world matrix per instance
+	D3DVERTEXELEMENT9 vertex_elements[] = {
+		{ POSITION_STREAM, 0, D3DDECLTYPE_SHORT4N, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_POSITION, 0 }, // a quantised xyz position
+		{ ATTRIBUTE_STREAM, 0, D3DDECLTYPE_SHORT2N, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_NORMAL, 0 },  // an octahedral normal
+		{ INSTANCE_STREAM, 0, D3DDECLTYPE_FLOAT4, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_TEXCOORD, 0 }, // world matrix rows
+		{ INSTANCE_STREAM, 16, D3DDECLTYPE_FLOAT4, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_TEXCOORD, 1 },
+		{ INSTANCE_STREAM, 32, D3DDECLTYPE_FLOAT4, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_TEXCOORD, 2 },
+		{ INSTANCE_STREAM, 48, D3DDECLTYPE_FLOAT4, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_TEXCOORD, 3 },
+		D3DDECL_END() 
+	};
+	if ( FAILED( dev->CreateVertexDeclaration( vertex_elements, &_vertex_declaration ) ) )
+		return false;
+
+	//the same without the normals, for passes that only need depth
+	D3DVERTEXELEMENT9 position_elements[] = {
+		{ POSITION_STREAM, 0, D3DDECLTYPE_SHORT4N, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_POSITION, 0 },
+		{ INSTANCE_STREAM, 0, D3DDECLTYPE_FLOAT4, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_TEXCOORD, 0 },
+		{ INSTANCE_STREAM, 16, D3DDECLTYPE_FLOAT4, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_TEXCOORD, 1 },
+		{ INSTANCE_STREAM, 32, D3DDECLTYPE_FLOAT4, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_TEXCOORD, 2 },
+		{ INSTANCE_STREAM, 48, D3DDECLTYPE_FLOAT4, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_TEXCOORD, 3 },
+		D3DDECL_END() 
+	};
+	if ( FAILED( dev->CreateVertexDeclaration( position_elements, &_position_declaration ) ) )
+		return false;
+
+	//start with room for a modest scene, the buffers grow as needed
+	const unsigned int strides[MESH_STREAMS] = { sizeof(CMesh::Position), sizeof(CMesh::Attributes) };
+	if ( !_geometry.create( dev, strides, MESH_STREAMS, 65536, 65536 * 3 ) )
+		return false;
+
+	_meshes.assign( scene->numberOfMeshes(), (CMesh*)NULL );
+	_optimized.resize( scene->numberOfMeshes() );
+	_packed.resize( scene->numberOfMeshes() );
+	return true;
+}
+
+void CMeshCache::clear()
+{
+	for ( unsigned int i = 0; i < _meshes.size(); ++i )
+		delete _meshes[i];
+	_meshes.clear();
+	_optimized.clear();
+	_packed.clear();
+	_scene_cache = NULL;
+	_uploads = 0;
+
+	_geometry.release();
+	Release( &_vertex_declaration );
+	Release( &_position_declaration );
+}
+
+CMesh *CMeshCache::get( CRenderDevice *dev, SceneDelegate *scene, unsigned int mesh_index )
+{
+	assert( mesh_index < _meshes.size() );
+
+	//upload on first use only
+	if ( _meshes[mesh_index] == NULL )
+		upload( dev, mesh_index, pack( scene, mesh_index ) );
+	return _meshes[mesh_index];
+}
+
+CMesh *CMeshCache::upload( CRenderDevice *dev, unsigned int mesh_index, const PackedMeshHeader *packed )
+{
+	assert( mesh_index < _meshes.size() && _meshes[mesh_index] == NULL );
+	_optimized[mesh_index] = packed->optimized;
+
+	//a mesh with nothing to draw, or no room for it, is left out
+	CMesh *mesh = new CMesh();
+	if ( !mesh->init( dev, &_geometry, packed ) )
+	{
+		delete mesh;
+		return NULL;
+	}
+	_meshes[mesh_index] = mesh;
+	_uploads++;
+	return mesh;
+}
+
+const PackedMeshHeader *CMeshCache::pack( SceneDelegate *scene, unsigned int mesh_index )
+{
+	assert( mesh_index < _meshes.size() );
+
+	//already done and stored
+	if ( _scene_cache != NULL )
+		return _scene_cache->packedMesh( mesh_index );
+
+	if ( _packed[mesh_index].empty() )
+	{
+		Mesh mesh;
+		scene->getMeshAtIndex( mesh_index, &mesh );
+		const MeshOptimizeReport optimized = CMeshOptimizer::optimize( &mesh );
+
+		//a chain of coarser versions, picked between per pass by size on screen
+		std::vector<Mesh> levels;
+		std::vector<float> errors;
+		CMeshSimplifier::buildChain( mesh, MAX_LODS, &levels, &errors );
+
+		CMesh::pack( levels, errors, optimized, &_packed[mesh_index] );
+	}
+	return (const PackedMeshHeader*)&_packed[mesh_index][0];
+}
+
+void CMeshCache::packerSettings( std::vector<float> *values )
+{
+	values->push_back( MAX_LODS );
+	values->push_back( MESHLET_MAX_VERTICES );
+	values->push_back( MESHLET_MAX_TRIANGLES );
+	values->push_back( MESHLET_CONE_SPLIT );
+	values->push_back( MESHLET_MIN_TRIANGLES );
+	values->push_back( sizeof(CMesh::Position) );
+	values->push_back( sizeof(CMesh::Attributes) );
+	CMeshOptimizer::settings( values );
+	CMeshSimplifier::settings( values );
+}
+
+bool CMeshCache::writeCache( const char *path, SceneDelegate *scene, const std::vector<Shape> &shapes, const std::vector<Light> &lights, unsigned int source_hash )
+{
+	std::vector<const PackedMeshHeader*> packed( _meshes.size() );
+	for ( unsigned int i = 0; i < _meshes.size(); ++i )
+		packed[i] = pack( scene, i );
+
+	const bool written = CSceneCache::write( path, scene, shapes, lights, packed, source_hash );
+
+	//the packed blocks were only kept to be written
+	std::vector< std::vector<unsigned char> >( _meshes.size() ).swap( _packed );
+	return written;
+}
+
+void CMeshCache::printOptimization( std::ostream &out ) const
+{
+	for ( unsigned int i = 0; i < _meshes.size(); ++i )
+	{
+		if ( _meshes[i] == NULL )
+			continue;
+
+		out << "  mesh " << i << ": ";
+		_optimized[i].print( out );
+
+		out << "    lods:";
+		for ( unsigned int l = 0; l < _meshes[i]->lods(); ++l )
+			out << " " << _meshes[i]->triangles( l ) << " tris (" << _meshes[i]->lodError( l ) << ")";
+		out << ", " << _meshes[i]->meshlets().size() << " meshlets\n";
+	}
+}
+
+void CMeshCache::printCompression( std::ostream &out ) const
+{
+	MeshCompressionStats total;
+	memset( &total, 0, sizeof(total) );
+
+	for ( unsigned int i = 0; i < _meshes.size(); ++i )
+	{
+		if ( _meshes[i] == NULL )
+			continue;
+
+		const MeshCompressionStats &mesh = _meshes[i]->compression();
+		out << "  mesh " << i << ": " << _meshes[i]->vertices() << " vertices, "
+			<< ( _geometry.allocation( _meshes[i]->handle() ).index_width == INDEX_16 ? "16" : "32" ) << " bit indices, ";
+		mesh.print( out );
+
+		total.raw_bytes += mesh.raw_bytes;
+		total.packed_bytes += mesh.packed_bytes;
+		if ( mesh.max_position_error > total.max_position_error )
+			total.max_position_error = mesh.max_position_error;
+		if ( mesh.max_normal_error > total.max_normal_error )
+			total.max_normal_error = mesh.max_normal_error;
+	}
+
+	if ( total.raw_bytes > 0 )
+	{
+		out << "  all meshes: ";
+		total.print( out );
+	}
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include <windows.h>
+#include <d3d9.h>
+#include <d3dx9.h>
+#include <iostream>
+#include <cassert>
+#include <vector>
+#include "SceneDelegate.hpp"
+#include "CRenderDevice.h"
+#include "CMesh.h"
+#include "CGeometryBuffer.h"
+#include "CInstanceBuffer.h"
+#include "CMeshOptimizer.h"
+#include "CMeshSimplifier.h"
+#include "CSceneCache.h"
+
+#define MAX_LODS 5 // levels of detail built per mesh, including the original
+
+//Uploads each scene mesh once, keyed by Shape::meshIndex, into one shared
+//geometry buffer, reordering it for the vertex cache on the way. Also owns the vertex declarations they are drawn with.
+//Meshes are packed into blocks ready to copy into the buffers, which come
+//straight from the scene cache when there is one.
+class CMeshCache {
+private:
+	std::vector<CMesh*> _meshes; // indexed by mesh index, NULL until first requested
+	std::vector<MeshOptimizeReport> _optimized; // what reordering each uploaded mesh achieved
+	std::vector< std::vector<unsigned char> > _packed; // blocks packed here rather than read from the scene cache
+	const CSceneCache *_scene_cache; // NULL when meshes are packed here
+	IDirect3DVertexDeclaration9* _vertex_declaration; // mesh streams plus per-instance world matrices
+	IDirect3DVertexDeclaration9* _position_declaration; // as above without the attribute stream
+	CGeometryBuffer _geometry; // every mesh's vertices and indices
+	unsigned int _uploads; // number of meshes uploaded
+
+	template<typename T>
+	void Release(T** ptr) {
+		if ( *ptr != 0 ) {
+			(*ptr)->Release();
+			*ptr = 0;
+		}
+	}
+
+public:
+	CMeshCache();
+	~CMeshCache();
+
+	//scene_cache may be NULL, or not open, to pack every mesh from the scene
+	bool init( CRenderDevice *dev, SceneDelegate *scene, const CSceneCache *scene_cache );
+	void clear();
+
+	//NULL if the mesh is empty or could not be uploaded
+	CMesh *get( CRenderDevice *dev, SceneDelegate *scene, unsigned int mesh_index );
+
+	//a mesh optimised, simplified and packed, without uploading it. safe to
+	//call from several threads at once as long as each has its own mesh
+	const PackedMeshHeader *pack( SceneDelegate *scene, unsigned int mesh_index );
+
+	//upload a mesh already packed, on the thread that owns the device. NULL,
+	//with nothing kept, if it is empty or the geometry buffer could not hold it
+	CMesh *upload( CRenderDevice *dev, unsigned int mesh_index, const PackedMeshHeader *packed );
+	bool uploaded( unsigned int mesh_index ) const { return _meshes[mesh_index] != NULL; }
+
+	//every constant packing depends on, the levels, meshlets, vertex layout
+	//and optimiser's, so a scene cache made with others is not used
+	static void packerSettings( std::vector<float> *values );
+
+	//write every mesh, packed, and the scene's shapes and lights as it was made
+	//to a scene cache file, marked with the hash of its SceneCacheKey
+	bool writeCache( const char *path, SceneDelegate *scene, const std::vector<Shape> &shapes, const std::vector<Light> &lights, unsigned int source_hash );
+
+	IDirect3DVertexDeclaration9 *declaration() { return _vertex_declaration; }
+	IDirect3DVertexDeclaration9 *positionDeclaration() { return _position_declaration; }
+	CGeometryBuffer *geometry() { return &_geometry; }
+	unsigned int uploads() const { return _uploads; }
+
+	//memory saved and precision lost by the vertex packing, per mesh
+	void printCompression( std::ostream &out ) const;
+
+	//vertex cache efficiency before and after optimising, and the
+	//triangles and error of each level of detail and the meshlet count, per mesh
+	void printOptimization( std::ostream &out ) const;
+};
@@ -0,0 +1,730 @@
+#include "CMeshImporter.h"
+#include "CMappedFile.h"
+#include <cstring>
+#include <cmath>
+
+//a corner with no normal of its own, given one made from the faces
+#define NO_NORMAL 0xFFFFFFFF
+
+void ImportStats::print( std::ostream &out ) const
+{
+	const double total_ms = parse_ms + build_ms;
+	out << bytes / ( 1024.0f * 1024.0f ) << " MB, " << vertices_read << " vertices and " << triangles_read << " triangles read, "
+		<< vertices << " vertices after merging. parse " << parse_ms << " ms in " << chunks << " chunks ("
+		<< ( parse_ms > 0.0 ? bytes / ( 1024.0 * 1024.0 ) / ( parse_ms * 0.001 ) : 0.0 ) << " MB/s), build "
+		<< build_ms << " ms, " << ( total_ms > 0.0 ? bytes / ( 1024.0 * 1024.0 ) / ( total_ms * 0.001 ) : 0.0 ) << " MB/s overall\n";
+}
+
+static double now()
+{
+	LARGE_INTEGER frequency, counter;
+	QueryPerformanceFrequency( &frequency );
+	QueryPerformanceCounter( &counter );
+	return counter.QuadPart * 1000.0 / frequency.QuadPart;
+}
+
+//Work on each of count items laid out stride bytes apart, as jobs
+struct ParallelItems {
+	void (*work)( void *item );
+	unsigned char *items;
+	unsigned int stride;
+};
+
+static void runItems( void *data, unsigned int begin, unsigned int end )
+{
+	const ParallelItems *parallel = (const ParallelItems*)data;
+	for ( unsigned int i = begin; i < end; ++i )
+		parallel->work( parallel->items + i * parallel->stride );
+}
+
+//Run work once for each of count items, a job each, and wait for them all. This
+//thread helps rather than only waiting
+static void runParallel( CJobSystem *jobs, void (*work)( void* ), void *items, unsigned int stride, unsigned int count )
+{
+	ParallelItems parallel = { work, (unsigned char*)items, stride };
+	jobs->parallelFor( runItems, &parallel, count, 1 );
+}
+
+static unsigned int defaultChunks( const CJobSystem *jobs, unsigned int chunks )
+{
+	return chunks > 0 ? chunks : jobs->threads() + 1;
+}
+
+static bool isSpace( char c ) { return c == ' ' || c == '\t' || c == '\r'; }
+static bool isDigit( char c ) { return c >= '0' && c <= '9'; }
+
+static const char *skipSpaces( const char *p, const char *end )
+{
+	while ( p < end && isSpace( *p ) )
+		++p;
+	return p;
+}
+
+static const char *nextLine( const char *p, const char *end )
+{
+	while ( p < end && *p != '\n' )
+		++p;
+	return p < end ? p + 1 : end;
+}
+
+//A decimal such as -1.25e-3. Up to 19 significant digits are gathered into an
+//integer and scaled by a power of ten once, exactly when the power is small
+//enough. NULL if there is no number at p
+static const char *parseFloat( const char *p, const char *end, float *value )
+{
+	static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+	p = skipSpaces( p, end );
+	bool negative = false;
+	if ( p < end && ( *p == '-' || *p == '+' ) )
+		negative = *p++ == '-';
+
+	unsigned long long digits = 0;
+	unsigned int count = 0;
+	int exponent = 0;
+	bool any = false;
+	for ( ; p < end && isDigit( *p ); ++p, any = true )
+	{
+		if ( count < 19 )
+		{
+			digits = digits * 10 + ( *p - '0' );
+			count += digits > 0;
+		}
+		else
+			exponent++;
+	}
+	if ( p < end && *p == '.' )
+	{
+		for ( ++p; p < end && isDigit( *p ); ++p, any = true )
+		{
+			if ( count < 19 )
+			{
+				digits = digits * 10 + ( *p - '0' );
+				count += digits > 0;
+				exponent--;
+			}
+		}
+	}
+	if ( !any )
+		return NULL;
+
+	if ( p < end && ( *p == 'e' || *p == 'E' ) )
+	{
+		const char *q = p + 1;
+		bool negative_exponent = false;
+		if ( q < end && ( *q == '-' || *q == '+' ) )
+			negative_exponent = *q++ == '-';
+		if ( q < end && isDigit( *q ) )
+		{
+			int e = 0;
+			for ( ; q < end && isDigit( *q ); ++q )
+				if ( e < 10000 ) e = e * 10 + ( *q - '0' );
+			exponent += negative_exponent ? -e : e;
+			p = q;
+		}
+	}
+
+	double v = (double)digits;
+	if ( exponent >= -22 && exponent <= 22 )
+		v = exponent < 0 ? v / powers[-exponent] : v * powers[exponent];
+	else
+		v *= pow( 10.0, exponent );
+	*value = (float)( negative ? -v : v );
+	return p;
+}
+
+static const char *parseInt( const char *p, const char *end, int *value )
+{
+	bool negative = false;
+	if ( p < end && ( *p == '-' || *p == '+' ) )
+		negative = *p++ == '-';
+	if ( p >= end || !isDigit( *p ) )
+		return NULL;
+
+	int v = 0;
+	for ( ; p < end && isDigit( *p ); ++p )
+		v = v * 10 + ( *p - '0' );
+	*value = negative ? -v : v;
+	return p;
+}
+
+//Smooth normals from the faces around each vertex, weighted by their area
+static void computeNormals( const std::vector<Float3> &positions, const std::vector<unsigned int> &indices, std::vector<Float3> *normals )
+{
+	std::vector<D3DXVECTOR3> sums( positions.size(), D3DXVECTOR3( 0.0f, 0.0f, 0.0f ) );
+	for ( unsigned int i = 0; i + 2 < indices.size(); i += 3 )
+	{
+		const Float3 &a = positions[indices[i]], &b = positions[indices[i + 1]], &c = positions[indices[i + 2]];
+		const D3DXVECTOR3 ab( b.x - a.x, b.y - a.y, b.z - a.z ), ac( c.x - a.x, c.y - a.y, c.z - a.z );
+		D3DXVECTOR3 face;
+		D3DXVec3Cross( &face, &ab, &ac );
+		for ( unsigned int k = 0; k < 3; ++k )
+			sums[indices[i + k]] += face;
+	}
+
+	normals->resize( positions.size() );
+	for ( unsigned int i = 0; i < sums.size(); ++i )
+	{
+		const float length = D3DXVec3Length( &sums[i] );
+		(*normals)[i] = length > 0.0f ? Float3( sums[i].x / length, sums[i].y / length, sums[i].z / length ) : Float3( 0.0f, 0.0f, 1.0f );
+	}
+}
+
+//Normals in files are not always unit length
+static void normalize( std::vector<Float3> *normals )
+{
+	for ( unsigned int i = 0; i < normals->size(); ++i )
+	{
+		Float3 &n = (*normals)[i];
+		const float length = sqrtf( n.x * n.x + n.y * n.y + n.z * n.z );
+		n = length > 0.0f ? Float3( n.x / length, n.y / length, n.z / length ) : Float3( 0.0f, 0.0f, 1.0f );
+	}
+}
+
+bool CMeshImporter::import( const char *path, CJobSystem *jobs, unsigned int chunks, Mesh *mesh, ImportStats *stats )
+{
+	memset( stats, 0, sizeof(ImportStats) );
+	mesh->vertexArray.clear();
+	mesh->normalArray.clear();
+	mesh->indexArray.clear();
+
+	const char *extension = strrchr( path, '.' );
+	const bool obj = extension != NULL && _stricmp( extension, ".obj" ) == 0;
+	const bool ply = extension != NULL && _stricmp( extension, ".ply" ) == 0;
+	if ( !obj && !ply )
+	{
+		std::cout << "Error - " << path << " is neither an OBJ nor a PLY file\n";
+		return false;
+	}
+
+	CMappedFile file;
+	if ( !file.open( path ) )
+	{
+		std::cout << "Error - Could not open " << path << "\n";
+		return false;
+	}
+	stats->bytes = file.size();
+	stats->chunks = defaultChunks( jobs, chunks );
+
+	const char *data = (const char*)file.data();
+	const bool imported = obj ? importObj( data, file.size(), jobs, stats->chunks, mesh, stats )
+		: importPly( data, file.size(), jobs, stats->chunks, mesh, stats );
+	if ( !imported )
+		std::cout << "Error - Could not import " << path << "\n";
+	return imported;
+}
+
+//One corner of a face as written, before the chunk it came from is placed.
+//Relative indices only know what came before them in the chunk, so they are
+//kept relative to the chunk's start, and may reach back into earlier chunks
+struct ObjCorner {
+	int position, normal;
+	bool relative_position, relative_normal;
+	bool has_normal;
+};
+
+//A run of whole lines, parsed as a job of its own
+struct ObjChunk {
+	const char *begin, *end;
+	std::vector<Float3> positions, normals;
+	std::vector<ObjCorner> corners; // three per triangle, polygons already split into fans
+	bool failed;
+};
+
+//Turn an index as written into an ObjCorner index, given how many came before it in the chunk
+static bool objIndex( int written, unsigned int before, int *index, bool *relative )
+{
+	*relative = written < 0;
+	*index = written > 0 ? written - 1 : (int)before + written;
+	return written != 0;
+}
+
+static void parseObjChunk( void *param )
+{
+	ObjChunk *chunk = (ObjChunk*)param;
+	const char *p = chunk->begin, *end = chunk->end;
+	ObjCorner polygon[3]; // the fan's first corner, and the last two
+
+	while ( p < end )
+	{
+		p = skipSpaces( p, end );
+		if ( p + 1 < end && p[0] == 'v' && isSpace( p[1] ) )
+		{
+			Float3 v;
+			if ( !( p = parseFloat( p + 1, end, &v.x ) ) || !( p = parseFloat( p, end, &v.y ) ) || !( p = parseFloat( p, end, &v.z ) ) )
+				break;
+			chunk->positions.push_back( v );
+		}
+		else if ( p + 2 < end && p[0] == 'v' && p[1] == 'n' && isSpace( p[2] ) )
+		{
+			Float3 n;
+			if ( !( p = parseFloat( p + 2, end, &n.x ) ) || !( p = parseFloat( p, end, &n.y ) ) || !( p = parseFloat( p, end, &n.z ) ) )
+				break;
+			chunk->normals.push_back( n );
+		}
+		else if ( p + 1 < end && p[0] == 'f' && isSpace( p[1] ) )
+		{
+			//corners are v, v/vt, v//vn or v/vt/vn, texture coordinates are ignored
+			unsigned int corners = 0;
+			for ( p = skipSpaces( p + 1, end ); p != NULL && p < end && *p != '\n' && *p != '#'; p = skipSpaces( p, end ) )
+			{
+				ObjCorner corner;
+				int written;
+				corner.normal = 0;
+				corner.relative_normal = false;
+				corner.has_normal = false;
+				if ( !( p = parseInt( p, end, &written ) ) || !objIndex( written, chunk->positions.size(), &corner.position, &corner.relative_position ) )
+				{
+					p = NULL;
+					break;
+				}
+				if ( p < end && *p == '/' )
+				{
+					++p;
+					if ( p < end && *p != '/' && !( p = parseInt( p, end, &written ) ) )
+						break;
+					if ( p < end && *p == '/' )
+					{
+						if ( !( p = parseInt( p + 1, end, &written ) ) || !objIndex( written, chunk->normals.size(), &corner.normal, &corner.relative_normal ) )
+						{
+							p = NULL;
+							break;
+						}
+						corner.has_normal = true;
+					}
+				}
+
+				//fan out from the first corner
+				if ( corners < 3 )
+					polygon[corners] = corner;
+				else
+				{
+					polygon[1] = polygon[2];
+					polygon[2] = corner;
+				}
+				if ( ++corners >= 3 )
+					chunk->corners.insert( chunk->corners.end(), polygon, polygon + 3 );
+			}
+			if ( p == NULL )
+				break;
+		}
+		p = nextLine( p, end );
+	}
+
+	chunk->failed = p == NULL;
+}
+
+bool CMeshImporter::importObj( const char *data, unsigned int size, CJobSystem *jobs, unsigned int threads, Mesh *mesh, ImportStats *stats )
+{
+	double start = now();
+
+	//cut the file into a chunk per thread, each ending at the end of a line
+	std::vector<ObjChunk> chunks( threads );
+	const char *end = data + size;
+	const char *p = data;
+	for ( unsigned int t = 0; t < threads; ++t )
+	{
+		chunks[t].begin = p;
+		p = t + 1 == threads ? end : nextLine( data + (unsigned long long)size * ( t + 1 ) / threads, end );
+		if ( p < chunks[t].begin )
+			p = chunks[t].begin;
+		chunks[t].end = p;
+		chunks[t].failed = false;
+	}
+	runParallel( jobs, parseObjChunk, &chunks[0], sizeof(ObjChunk), threads );
+	stats->parse_ms = now() - start;
+	start = now();
+
+	//where each chunk's positions and normals start once they are joined
+	std::vector<unsigned int> position_base( threads ), normal_base( threads );
+	std::vector<Float3> positions, normals;
+	unsigned int num_corners = 0;
+	for ( unsigned int t = 0; t < threads; ++t )
+	{
+		if ( chunks[t].failed )
+			return false;
+		position_base[t] = positions.size();
+		normal_base[t] = normals.size();
+		positions.insert( positions.end(), chunks[t].positions.begin(), chunks[t].positions.end() );
+		normals.insert( normals.end(), chunks[t].normals.begin(), chunks[t].normals.end() );
+		std::vector<Float3>().swap( chunks[t].positions );
+		std::vector<Float3>().swap( chunks[t].normals );
+		num_corners += chunks[t].corners.size();
+	}
+	stats->vertices_read = positions.size();
+	stats->triangles_read = num_corners / 3;
+
+	//resolve every corner to global indices
+	std::vector<unsigned int> corner_positions( num_corners ), corner_normals( num_corners );
+	bool missing_normals = false;
+	unsigned int c = 0;
+	for ( unsigned int t = 0; t < threads; ++t )
+	{
+		for ( unsigned int i = 0; i < chunks[t].corners.size(); ++i, ++c )
+		{
+			const ObjCorner &corner = chunks[t].corners[i];
+			const unsigned int position = corner.relative_position ? position_base[t] + corner.position : corner.position;
+			unsigned int normal = NO_NORMAL;
+			if ( corner.has_normal )
+				normal = corner.relative_normal ? normal_base[t] + corner.normal : corner.normal;
+
+			if ( position >= positions.size() || ( normal != NO_NORMAL && normal >= normals.size() ) )
+				return false;
+			corner_positions[c] = position;
+			corner_normals[c] = normal;
+			missing_normals |= normal == NO_NORMAL;
+		}
+		std::vector<ObjCorner>().swap( chunks[t].corners );
+	}
+
+	//corners without a normal share one made from the faces around their position
+	std::vector<Float3> made_normals;
+	if ( missing_normals )
+		computeNormals( positions, corner_positions, &made_normals );
+
+	//merge corners with the same position and normal into one vertex, through an
+	//open addressed hash table keyed on the pair, at most half full
+	unsigned int capacity = 16;
+	while ( capacity < num_corners * 2 )
+		capacity *= 2;
+	const unsigned long long empty = ~0ull;
+	std::vector<unsigned long long> keys( capacity, empty );
+	std::vector<unsigned int> values( capacity );
+
+	mesh->indexArray.resize( num_corners );
+	for ( unsigned int i = 0; i < num_corners; ++i )
+	{
+		const unsigned long long key = ( (unsigned long long)corner_positions[i] << 32 ) | corner_normals[i];
+		unsigned int slot = (unsigned int)( ( key * 0x9E3779B97F4A7C15ull ) >> 32 ) & ( capacity - 1 );
+		while ( keys[slot] != empty && keys[slot] != key )
+			slot = ( slot + 1 ) & ( capacity - 1 );
+
+		if ( keys[slot] == empty )
+		{
+			keys[slot] = key;
+			values[slot] = mesh->vertexArray.size();
+			mesh->vertexArray.push_back( positions[corner_positions[i]] );
+			mesh->normalArray.push_back( corner_normals[i] == NO_NORMAL ? made_normals[corner_positions[i]] : normals[corner_normals[i]] );
+		}
+		mesh->indexArray[i] = values[slot];
+	}
+
+	normalize( &mesh->normalArray );
+	stats->vertices = mesh->vertexArray.size();
+	stats->build_ms = now() - start;
+	return !mesh->indexArray.empty();
+}
+
+enum PlyType { PLY_NONE, PLY_INT8, PLY_UINT8, PLY_INT16, PLY_UINT16, PLY_INT32, PLY_UINT32, PLY_FLOAT32, PLY_FLOAT64 };
+
+static const unsigned int ply_sizes[] = { 0, 1, 1, 2, 2, 4, 4, 4, 8 };
+
+struct PlyProperty {
+	PlyType type;
+	PlyType count_type; // PLY_NONE unless a list, when type is the type of each item
+	const char *name;
+	unsigned int name_length;
+};
+
+struct PlyElement {
+	const char *name;
+	unsigned int name_length;
+	unsigned int count;
+	std::vector<PlyProperty> properties;
+};
+
+//The next word on the line, or false at its end
+static bool plyWord( const char **p, const char *end, const char **word, unsigned int *length )
+{
+	*p = skipSpaces( *p, end );
+	*word = *p;
+	while ( *p < end && !isSpace( **p ) && **p != '\n' )
+		++*p;
+	*length = *p - *word;
+	return *length > 0;
+}
+
+static bool plyIs( const char *word, unsigned int length, const char *name )
+{
+	return strlen( name ) == length && memcmp( word, name, length ) == 0;
+}
+
+static PlyType plyType( const char *word, unsigned int length )
+{
+	if ( plyIs( word, length, "char" ) || plyIs( word, length, "int8" ) ) return PLY_INT8;
+	if ( plyIs( word, length, "uchar" ) || plyIs( word, length, "uint8" ) ) return PLY_UINT8;
+	if ( plyIs( word, length, "short" ) || plyIs( word, length, "int16" ) ) return PLY_INT16;
+	if ( plyIs( word, length, "ushort" ) || plyIs( word, length, "uint16" ) ) return PLY_UINT16;
+	if ( plyIs( word, length, "int" ) || plyIs( word, length, "int32" ) ) return PLY_INT32;
+	if ( plyIs( word, length, "uint" ) || plyIs( word, length, "uint32" ) ) return PLY_UINT32;
+	if ( plyIs( word, length, "float" ) || plyIs( word, length, "float32" ) ) return PLY_FLOAT32;
+	if ( plyIs( word, length, "double" ) || plyIs( word, length, "float64" ) ) return PLY_FLOAT64;
+	return PLY_NONE;
+}
+
+//One binary value, swapped first when the file's byte order is not ours
+static double plyRead( const unsigned char *p, PlyType type, bool swap )
+{
+	unsigned char bytes[8];
+	const unsigned int size = ply_sizes[type];
+	for ( unsigned int i = 0; i < size; ++i )
+		bytes[i] = swap ? p[size - 1 - i] : p[i];
+
+	switch ( type )
+	{
+	case PLY_INT8: return (signed char)bytes[0];
+	case PLY_UINT8: return bytes[0];
+	case PLY_INT16: { short v; memcpy( &v, bytes, 2 ); return v; }
+	case PLY_UINT16: { unsigned short v; memcpy( &v, bytes, 2 ); return v; }
+	case PLY_INT32: { int v; memcpy( &v, bytes, 4 ); return v; }
+	case PLY_UINT32: { unsigned int v; memcpy( &v, bytes, 4 ); return v; }
+	case PLY_FLOAT32: { float v; memcpy( &v, bytes, 4 ); return v; }
+	case PLY_FLOAT64: { double v; memcpy( &v, bytes, 8 ); return v; }
+	default: return 0.0;
+	}
+}
+
+//Where a fixed size element's x, y, z and normal live, and a range of its
+//records to read on one thread
+struct PlyVertexRange {
+	const unsigned char *data; // the first record of the range
+	unsigned int first, count;
+	unsigned int stride;
+	unsigned int offsets[6]; // x y z nx ny nz within a record
+	PlyType types[6];
+	bool has_normals, swap;
+	Mesh *mesh;
+};
+
+static void parsePlyVertices( void *param )
+{
+	const PlyVertexRange *range = (const PlyVertexRange*)param;
+	if ( range->count == 0 )
+		return;
+	Float3 *positions = &range->mesh->vertexArray[range->first];
+	Float3 *normals = range->has_normals ? &range->mesh->normalArray[range->first] : NULL;
+	const unsigned char *record = range->data;
+
+	for ( unsigned int i = 0; i < range->count; ++i, record += range->stride )
+	{
+		positions[i] = Float3( (float)plyRead( record + range->offsets[0], range->types[0], range->swap ),
+			(float)plyRead( record + range->offsets[1], range->types[1], range->swap ),
+			(float)plyRead( record + range->offsets[2], range->types[2], range->swap ) );
+		if ( range->has_normals )
+		{
+			normals[i] = Float3( (float)plyRead( record + range->offsets[3], range->types[3], range->swap ),
+				(float)plyRead( record + range->offsets[4], range->types[4], range->swap ),
+				(float)plyRead( record + range->offsets[5], range->types[5], range->swap ) );
+		}
+	}
+}
+
+//Step over one record of an element, false if it runs off the end of the file
+static bool plySkip( const PlyElement &element, bool swap, const unsigned char **p, const unsigned char *end )
+{
+	for ( unsigned int k = 0; k < element.properties.size(); ++k )
+	{
+		const PlyProperty &property = element.properties[k];
+		unsigned int bytes = ply_sizes[property.type];
+		if ( property.count_type != PLY_NONE )
+		{
+			if ( *p + ply_sizes[property.count_type] > end )
+				return false;
+			const unsigned int count = (unsigned int)plyRead( *p, property.count_type, swap );
+			*p += ply_sizes[property.count_type];
+			bytes *= count;
+		}
+		if ( *p + bytes > end )
+			return false;
+		*p += bytes;
+	}
+	return true;
+}
+
+bool CMeshImporter::importPly( const char *data, unsigned int size, CJobSystem *jobs, unsigned int threads, Mesh *mesh, ImportStats *stats )
+{
+	double start = now();
+	const char *end = data + size;
+	const char *p = data;
+	const char *word;
+	unsigned int length;
+
+	//the header is text, one statement a line, up to end_header
+	if ( !plyWord( &p, end, &word, &length ) || !plyIs( word, length, "ply" ) )
+		return false;
+
+	bool swap = false, binary = false;
+	std::vector<PlyElement> elements;
+	for ( p = nextLine( p, end ); p < end; p = nextLine( p, end ) )
+	{
+		if ( !plyWord( &p, end, &word, &length ) )
+			continue;
+		if ( plyIs( word, length, "end_header" ) )
+		{
+			p = nextLine( p, end );
+			break;
+		}
+		if ( plyIs( word, length, "format" ) && plyWord( &p, end, &word, &length ) )
+		{
+			binary = !plyIs( word, length, "ascii" );
+			swap = plyIs( word, length, "binary_big_endian" );
+			if ( !binary )
+			{
+				std::cout << "Error - Only binary PLY files are supported\n";
+				return false;
+			}
+		}
+		else if ( plyIs( word, length, "element" ) )
+		{
+			PlyElement element;
+			int count = 0;
+			if ( !plyWord( &p, end, &element.name, &element.name_length ) || !parseInt( skipSpaces( p, end ), end, &count ) || count < 0 )
+				return false;
+			element.count = count;
+			elements.push_back( element );
+		}
+		else if ( plyIs( word, length, "property" ) && !elements.empty() )
+		{
+			PlyProperty property;
+			property.count_type = PLY_NONE;
+			if ( !plyWord( &p, end, &word, &length ) )
+				return false;
+			if ( plyIs( word, length, "list" ) )
+			{
+				if ( !plyWord( &p, end, &word, &length ) || ( property.count_type = plyType( word, length ) ) == PLY_NONE || !plyWord( &p, end, &word, &length ) )
+					return false;
+			}
+			if ( ( property.type = plyType( word, length ) ) == PLY_NONE || !plyWord( &p, end, &property.name, &property.name_length ) )
+				return false;
+			elements.back().properties.push_back( property );
+		}
+	}
+	if ( !binary )
+		return false;
+
+	//the data follows in element order
+	const unsigned char *body = (const unsigned char*)p, *body_end = (const unsigned char*)end;
+	bool have_vertices = false, have_faces = false;
+	for ( unsigned int e = 0; e < elements.size(); ++e )
+	{
+		const PlyElement &element = elements[e];
+		if ( plyIs( element.name, element.name_length, "vertex" ) && !have_vertices )
+		{
+			//find x y z and the normal, and make sure every record is the same size
+			static const char *names[6] = { "x", "y", "z", "nx", "ny", "nz" };
+			PlyVertexRange layout;
+			memset( &layout, 0, sizeof(layout) );
+			bool found[6] = { false, false, false, false, false, false };
+			for ( unsigned int k = 0; k < element.properties.size(); ++k )
+			{
+				const PlyProperty &property = element.properties[k];
+				if ( property.count_type != PLY_NONE )
+					return false;
+				for ( unsigned int n = 0; n < 6; ++n )
+				{
+					if ( plyIs( property.name, property.name_length, names[n] ) )
+					{
+						layout.offsets[n] = layout.stride;
+						layout.types[n] = property.type;
+						found[n] = true;
+					}
+				}
+				layout.stride += ply_sizes[property.type];
+			}
+			if ( !found[0] || !found[1] || !found[2] || (unsigned long long)element.count * layout.stride > (unsigned long long)( body_end - body ) )
+				return false;
+			layout.has_normals = found[3] && found[4] && found[5];
+			layout.swap = swap;
+			layout.mesh = mesh;
+
+			mesh->vertexArray.resize( element.count );
+			if ( layout.has_normals )
+				mesh->normalArray.resize( element.count );
+
+			//records are all the same size, so the vertices split evenly between threads
+			std::vector<PlyVertexRange> ranges( threads, layout );
+			for ( unsigned int t = 0; t < threads; ++t )
+			{
+				ranges[t].first = (unsigned long long)element.count * t / threads;
+				ranges[t].count = (unsigned long long)element.count * ( t + 1 ) / threads - ranges[t].first;
+				ranges[t].data = body + (unsigned long long)ranges[t].first * layout.stride;
+			}
+			runParallel( jobs, parsePlyVertices, &ranges[0], sizeof(PlyVertexRange), threads );
+			body += (unsigned long long)element.count * layout.stride;
+			have_vertices = true;
+		}
+		else if ( plyIs( element.name, element.name_length, "face" ) && !have_faces )
+		{
+			//faces vary in size, so are read in order on this thread
+			unsigned int list = element.properties.size();
+			for ( unsigned int k = 0; k < element.properties.size(); ++k )
+			{
+				const PlyProperty &property = element.properties[k];
+				if ( property.count_type != PLY_NONE && ( plyIs( property.name, property.name_length, "vertex_indices" )
+					|| plyIs( property.name, property.name_length, "vertex_index" ) ) )
+					list = k;
+			}
+			if ( list == element.properties.size() )
+				return false;
+
+			mesh->indexArray.reserve( element.count * 3 );
+			for ( unsigned int f = 0; f < element.count; ++f )
+			{
+				for ( unsigned int k = 0; k < element.properties.size(); ++k )
+				{
+					const PlyProperty &property = element.properties[k];
+					const unsigned int count_size = property.count_type != PLY_NONE ? ply_sizes[property.count_type] : 0;
+					if ( body + count_size > body_end )
+						return false;
+					const unsigned int count = count_size ? (unsigned int)plyRead( body, property.count_type, swap ) : 1;
+					body += count_size;
+					const unsigned int item_size = ply_sizes[property.type];
+					if ( body + (unsigned long long)count * item_size > body_end )
+						return false;
+
+					//split polygons into fans
+					if ( k == list )
+					{
+						for ( unsigned int i = 2; i < count; ++i )
+						{
+							mesh->indexArray.push_back( (unsigned int)plyRead( body, property.type, swap ) );
+							mesh->indexArray.push_back( (unsigned int)plyRead( body + ( i - 1 ) * item_size, property.type, swap ) );
+							mesh->indexArray.push_back( (unsigned int)plyRead( body + i * item_size, property.type, swap ) );
+						}
+					}
+					body += count * item_size;
+				}
+			}
+			have_faces = true;
+		}
+		else
+		{
+			for ( unsigned int r = 0; r < element.count; ++r )
+			{
+				if ( !plySkip( element, swap, &body, body_end ) )
+					return false;
+			}
+		}
+	}
+	if ( !have_vertices || !have_faces || mesh->indexArray.empty() )
+		return false;
+
+	for ( unsigned int i = 0; i < mesh->indexArray.size(); ++i )
+	{
+		if ( mesh->indexArray[i] >= mesh->vertexArray.size() )
+			return false;
+	}
+	stats->vertices_read = stats->vertices = mesh->vertexArray.size();
+	stats->triangles_read = mesh->indexArray.size() / 3;
+	stats->parse_ms = now() - start;
+	start = now();
+
+	//vertices in a PLY are already shared, so only missing normals need making
+	if ( mesh->normalArray.empty() )
+		computeNormals( mesh->vertexArray, mesh->indexArray, &mesh->normalArray );
+	else
+		normalize( &mesh->normalArray );
+	stats->build_ms = now() - start;
+	return true;
+}
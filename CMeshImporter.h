@@ -0,0 +1,37 @@
+#pragma once
+#include <windows.h>
+#include <d3d9.h>
+#include <d3dx9.h>
+#include <iostream>
+#include <cassert>
+#include <vector>
+#include "SceneDelegate.hpp"
+#include "CJobSystem.h"
+
+//What one import read and how long it took
+struct ImportStats {
+	unsigned int bytes; // size of the file
+	unsigned int chunks; // it was parsed in, side by side
+	unsigned int vertices_read, triangles_read; // as they are in the file
+	unsigned int vertices; // in the mesh made, after duplicates are merged
+	double parse_ms; // reading the file
+	double build_ms; // merging vertices and making any missing normals
+
+	void print( std::ostream &out ) const;
+};
+
+//Reads a mesh from a Wavefront OBJ or a binary PLY file, as large as needed.
+//The file is memory mapped and parsed where it lies, split into chunks that
+//are parsed as jobs of their own, with no strings made along the way.
+//Polygons are split into fans, and normals are made from the faces when the
+//file has none.
+class CMeshImporter {
+private:
+	static bool importObj( const char *data, unsigned int size, CJobSystem *jobs, unsigned int threads, Mesh *mesh, ImportStats *stats );
+	static bool importPly( const char *data, unsigned int size, CJobSystem *jobs, unsigned int threads, Mesh *mesh, ImportStats *stats );
+
+public:
+	//chosen by the file's extension. chunks of 0 uses one per job worker and
+	//one for the calling thread, which helps
+	static bool import( const char *path, CJobSystem *jobs, unsigned int chunks, Mesh *mesh, ImportStats *stats );
+};
@@ -0,0 +1,91 @@
+#include "CMeshLoader.h"
+#include "CProfiler.h"
+
+CMeshLoader::CMeshLoader()
+{
+	_scene = NULL;
+	_cache = NULL;
+	_jobs = NULL;
+	_packers = 0;
+	_next = 0;
+	_cancel = 0;
+	_taken = 0;
+}
+
+CMeshLoader::~CMeshLoader()
+{
+	stop();
+}
+
+void CMeshLoader::start( SceneDelegate *scene, CMeshCache *cache, CJobSystem *jobs, const std::vector<unsigned int> &order, unsigned int packers )
+{
+	stop();
+	_scene = scene;
+	_cache = cache;
+	_jobs = jobs;
+	_order = order;
+	_next = 0;
+	_cancel = 0;
+	_taken = 0;
+
+	if ( packers == 0 )
+		packers = jobs->threads() > 0 ? jobs->threads() : 1;
+	//no more packers than meshes
+	if ( packers > _order.size() )
+		packers = _order.size();
+	_packers = packers;
+
+	//in the background, so the render thread never packs meshes inside the
+	//waits of its frame's jobs
+	for ( unsigned int p = 0; p < _packers; ++p )
+		_jobs->runInBackground( packMeshes, this, &_packing );
+}
+
+void CMeshLoader::stop()
+{
+	InterlockedExchange( &_cancel, 1 );
+	if ( _jobs != NULL )
+		_jobs->wait( &_packing );
+
+	//anything packed but never taken
+	while ( LoadedMesh *mesh = (LoadedMesh*)_ready.pop() )
+		delete mesh;
+}
+
+void CMeshLoader::packMeshes( void *data, unsigned int, unsigned int )
+{
+	CMeshLoader *loader = (CMeshLoader*)data;
+
+	//claim meshes one at a time until they run out, so a slow mesh only holds
+	//up the packer that has it
+	while ( loader->_cancel == 0 )
+	{
+		const LONG next = InterlockedIncrement( &loader->_next ) - 1;
+		if ( next >= (LONG)loader->_order.size() )
+			break;
+
+		PROFILE_SCOPE( "pack mesh" );
+		LoadedMesh *mesh = new LoadedMesh();
+		mesh->mesh_index = loader->_order[next];
+		mesh->packed = loader->_cache->pack( loader->_scene, mesh->mesh_index );
+
+		//the exchange in push publishes the packed block along with the node
+		loader->_ready.push( &mesh->node );
+	}
+}
+
+LoadedMesh *CMeshLoader::take()
+{
+	LoadedMesh *mesh = (LoadedMesh*)_ready.pop();
+
+	//without workers the packers only run when waited on
+	if ( mesh == NULL && _jobs != NULL && _jobs->threads() == 0 && !_packing.done() )
+	{
+		_jobs->wait( &_packing );
+		mesh = (LoadedMesh*)_ready.pop();
+	}
+
+	if ( mesh != NULL )
+		_taken++;
+	return mesh;
+}
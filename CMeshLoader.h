@@ -0,0 +1,57 @@
+#pragma once
+#include <windows.h>
+#include <d3d9.h>
+#include <d3dx9.h>
+#include <iostream>
+#include <cassert>
+#include <vector>
+#include "SceneDelegate.hpp"
+#include "CMeshCache.h"
+#include "CMpscQueue.h"
+#include "CJobSystem.h"
+
+//A mesh packed by a worker, waiting for the render thread to upload it
+struct LoadedMesh {
+	QueueNode node; // first, so a popped node is the LoadedMesh
+	unsigned int mesh_index;
+	const PackedMeshHeader *packed;
+};
+
+//Packs a scene's meshes as background jobs, in the order given, handing each
+//to the render thread through a lock-free queue as soon as it is ready. Only
+//the render thread touches the device, so the uploads themselves are left to
+//whoever pops the meshes, as many per frame as it can afford.
+class CMeshLoader {
+private:
+	SceneDelegate *_scene;
+	CMeshCache *_cache;
+	CJobSystem *_jobs; // NULL until started
+	std::vector<unsigned int> _order; // mesh indices, in the order to pack them
+	unsigned int _packers; // jobs packing meshes side by side
+	volatile LONG _next; // the next entry of _order to claim
+	volatile LONG _cancel; // non-zero to make the packers stop early
+	JobCounter _packing; // the packers still running
+	CMpscQueue _ready;
+	unsigned int _taken; // meshes popped by the render thread
+
+	static void packMeshes( void *loader, unsigned int begin, unsigned int end );
+
+public:
+	CMeshLoader();
+	~CMeshLoader();
+
+	//packers of 0 uses one per job system worker. With no workers there is no
+	//one to run them in the background, so the first take packs every mesh
+	void start( SceneDelegate *scene, CMeshCache *cache, CJobSystem *jobs, const std::vector<unsigned int> &order, unsigned int packers );
+
+	//cancel whatever is left and wait for the packers, dropping anything not taken
+	void stop();
+
+	//the next packed mesh, or NULL if none is ready yet. the caller deletes it
+	LoadedMesh *take();
+
+	unsigned int taken() const { return _taken; }
+	unsigned int total() const { return _order.size(); }
+	bool finished() const { return _taken == _order.size(); }
+	unsigned int packers() const { return _packers; }
+};
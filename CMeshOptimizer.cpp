@@ -0,0 +1,361 @@
+#include "CMeshOptimizer.h"
+#include <algorithm>
+#include <cmath>
+
+//the cache the measurements model, a typical size for D3D9 era hardware
+#define MEASURE_CACHE_SIZE 16
+
+//Forsyth's scoring constants
+#define FORSYTH_CACHE_SIZE 32
+#define FORSYTH_DECAY_POWER 1.5f
+#define FORSYTH_LAST_TRIANGLE_SCORE 0.75f
+#define FORSYTH_VALENCE_SCALE 2.0f
+#define FORSYTH_VALENCE_POWER 0.5f
+
+VertexCacheStats VertexCacheStats::measure( const std::vector<unsigned int> &indices, unsigned int num_vertices, unsigned int cache_size )
+{
+	VertexCacheStats stats;
+	stats.acmr = stats.atvr = 0.0f;
+	if ( indices.empty() )
+		return stats;
+
+	//the time each vertex entered the cache, a FIFO only cares about that
+	std::vector<unsigned int> entered( num_vertices, 0 );
+	std::vector<bool> used( num_vertices, false );
+	unsigned int misses = 0, unique = 0;
+	for ( unsigned int i = 0; i < indices.size(); ++i )
+	{
+		const unsigned int v = indices[i];
+		if ( !used[v] )
+		{
+			used[v] = true;
+			unique++;
+		}
+		if ( entered[v] == 0 || misses - ( entered[v] - 1 ) > cache_size )
+		{
+			misses++;
+			entered[v] = misses; // 1 based so 0 means never
+		}
+	}
+
+	stats.acmr = (float)misses / ( indices.size() / 3 );
+	stats.atvr = (float)misses / unique;
+	return stats;
+}
+
+void MeshOptimizeReport::print( std::ostream &out ) const
+{
+	out << vertices_before << " -> " << vertices_after << " vertices, ACMR "
+		<< before.acmr << " -> " << after.acmr << ", ATVR "
+		<< before.atvr << " -> " << after.atvr << "\n";
+}
+
+void CMeshOptimizer::settings( std::vector<float> *values )
+{
+	values->push_back( FORSYTH_CACHE_SIZE );
+	values->push_back( FORSYTH_DECAY_POWER );
+	values->push_back( FORSYTH_LAST_TRIANGLE_SCORE );
+	values->push_back( FORSYTH_VALENCE_SCALE );
+	values->push_back( FORSYTH_VALENCE_POWER );
+}
+
+MeshOptimizeReport CMeshOptimizer::optimize( Mesh *mesh )
+{
+	MeshOptimizeReport report;
+	report.vertices_before = mesh->vertexArray.size();
+	report.before = VertexCacheStats::measure( mesh->indexArray, mesh->vertexArray.size(), MEASURE_CACHE_SIZE );
+
+	weld( mesh );
+	optimizeVertexCache( mesh->indexArray, mesh->vertexArray.size() );
+	optimizeOverdraw( *mesh, mesh->indexArray );
+	optimizeVertexFetch( mesh );
+
+	report.vertices_after = mesh->vertexArray.size();
+	report.after = VertexCacheStats::measure( mesh->indexArray, mesh->vertexArray.size(), MEASURE_CACHE_SIZE );
+	return report;
+}
+
+//orders vertex numbers by position then normal, bit for bit
+struct VertexOrder {
+	const Mesh *mesh;
+	bool operator()( unsigned int a, unsigned int b ) const {
+		const Float3 &pa = mesh->vertexArray[a], &pb = mesh->vertexArray[b];
+		if ( pa.x != pb.x ) return pa.x < pb.x;
+		if ( pa.y != pb.y ) return pa.y < pb.y;
+		if ( pa.z != pb.z ) return pa.z < pb.z;
+		const Float3 &na = mesh->normalArray[a], &nb = mesh->normalArray[b];
+		if ( na.x != nb.x ) return na.x < nb.x;
+		if ( na.y != nb.y ) return na.y < nb.y;
+		return na.z < nb.z;
+	}
+};
+
+unsigned int CMeshOptimizer::weld( Mesh *mesh )
+{
+	const unsigned int num_vertices = mesh->vertexArray.size();
+	if ( num_vertices == 0 )
+		return 0;
+
+	//sort so identical vertices sit together, then point each run at its first member
+	std::vector<unsigned int> sorted( num_vertices );
+	for ( unsigned int i = 0; i < num_vertices; ++i )
+		sorted[i] = i;
+	VertexOrder order;
+	order.mesh = mesh;
+	std::sort( sorted.begin(), sorted.end(), order );
+
+	std::vector<unsigned int> remap( num_vertices );
+	unsigned int removed = 0;
+	remap[sorted[0]] = sorted[0];
+	for ( unsigned int i = 1; i < num_vertices; ++i )
+	{
+		if ( !order( sorted[i - 1], sorted[i] ) )
+		{
+			remap[sorted[i]] = remap[sorted[i - 1]];
+			removed++;
+		}
+		else
+			remap[sorted[i]] = sorted[i];
+	}
+
+	for ( unsigned int i = 0; i < mesh->indexArray.size(); ++i )
+		mesh->indexArray[i] = remap[mesh->indexArray[i]];
+
+	//the now unreferenced duplicates are dropped by optimizeVertexFetch
+	return removed;
+}
+
+static float forsythVertexScore( int cache_position, unsigned int remaining )
+{
+	if ( remaining == 0 )
+		return -1.0f;
+
+	float score = 0.0f;
+	if ( cache_position >= 0 )
+	{
+		//the last triangle's vertices get a fixed score so its neighbours are not favoured too strongly
+		if ( cache_position < 3 )
+			score = FORSYTH_LAST_TRIANGLE_SCORE;
+		else
+			score = powf( 1.0f - (float)( cache_position - 3 ) / ( FORSYTH_CACHE_SIZE - 3 ), FORSYTH_DECAY_POWER );
+	}
+
+	//boost vertices with few triangles left so they are finished off
+	return score + FORSYTH_VALENCE_SCALE * powf( (float)remaining, -FORSYTH_VALENCE_POWER );
+}
+
+void CMeshOptimizer::optimizeVertexCache( std::vector<unsigned int> &indices, unsigned int num_vertices )
+{
+	const unsigned int num_triangles = indices.size() / 3;
+	if ( num_triangles == 0 )
+		return;
+
+	//triangles using each vertex, packed into one array
+	std::vector<unsigned int> offsets( num_vertices + 1, 0 );
+	for ( unsigned int i = 0; i < num_triangles * 3; ++i )
+		offsets[indices[i] + 1]++;
+	for ( unsigned int v = 0; v < num_vertices; ++v )
+		offsets[v + 1] += offsets[v];
+	std::vector<unsigned int> adjacency( num_triangles * 3 );
+	std::vector<unsigned int> fill( offsets.begin(), offsets.end() - 1 );
+	for ( unsigned int t = 0; t < num_triangles; ++t )
+	{
+		for ( int k = 0; k < 3; ++k )
+			adjacency[fill[indices[t * 3 + k]]++] = t;
+	}
+
+	std::vector<unsigned int> remaining( num_vertices );
+	std::vector<int> cache_position( num_vertices, -1 );
+	std::vector<float> vertex_score( num_vertices );
+	for ( unsigned int v = 0; v < num_vertices; ++v )
+	{
+		remaining[v] = offsets[v + 1] - offsets[v];
+		vertex_score[v] = forsythVertexScore( -1, remaining[v] );
+	}
+
+	std::vector<bool> emitted( num_triangles, false );
+	std::vector<float> triangle_score( num_triangles );
+	for ( unsigned int t = 0; t < num_triangles; ++t )
+		triangle_score[t] = vertex_score[indices[t * 3]] + vertex_score[indices[t * 3 + 1]] + vertex_score[indices[t * 3 + 2]];
+
+	std::vector<unsigned int> output;
+	output.reserve( indices.size() );
+	std::vector<unsigned int> cache, next_cache;
+	unsigned int scan = 0; // where to look for a fresh start when the cache has nothing useful
+
+	for ( unsigned int emitted_count = 0; emitted_count < num_triangles; ++emitted_count )
+	{
+		//best triangle touching the cache
+		int best = -1;
+		float best_score = -1.0f;
+		for ( unsigned int c = 0; c < cache.size(); ++c )
+		{
+			const unsigned int v = cache[c];
+			for ( unsigned int a = offsets[v]; a < offsets[v + 1]; ++a )
+			{
+				const unsigned int t = adjacency[a];
+				if ( !emitted[t] && triangle_score[t] > best_score )
+				{
+					best = t;
+					best_score = triangle_score[t];
+				}
+			}
+		}
+
+		//otherwise the next triangle not yet drawn
+		if ( best < 0 )
+		{
+			while ( emitted[scan] )
+				scan++;
+			best = scan;
+		}
+
+		emitted[best] = true;
+		const unsigned int *tri = &indices[best * 3];
+		output.push_back( tri[0] );
+		output.push_back( tri[1] );
+		output.push_back( tri[2] );
+
+		//the triangle's vertices move to the front of the LRU cache
+		next_cache.clear();
+		for ( int k = 0; k < 3; ++k )
+		{
+			next_cache.push_back( tri[k] );
+			remaining[tri[k]]--;
+		}
+		for ( unsigned int c = 0; c < cache.size(); ++c )
+		{
+			if ( cache[c] != tri[0] && cache[c] != tri[1] && cache[c] != tri[2] )
+				next_cache.push_back( cache[c] );
+		}
+
+		//rescore everything that was or is in the cache, and the triangles they belong to
+		for ( unsigned int c = 0; c < next_cache.size(); ++c )
+		{
+			const unsigned int v = next_cache[c];
+			cache_position[v] = c < FORSYTH_CACHE_SIZE ? (int)c : -1;
+			vertex_score[v] = forsythVertexScore( cache_position[v], remaining[v] );
+		}
+		for ( unsigned int c = 0; c < next_cache.size(); ++c )
+		{
+			const unsigned int v = next_cache[c];
+			for ( unsigned int a = offsets[v]; a < offsets[v + 1]; ++a )
+			{
+				const unsigned int t = adjacency[a];
+				if ( !emitted[t] )
+					triangle_score[t] = vertex_score[indices[t * 3]] + vertex_score[indices[t * 3 + 1]] + vertex_score[indices[t * 3 + 2]];
+			}
+		}
+
+		if ( next_cache.size() > FORSYTH_CACHE_SIZE )
+			next_cache.resize( FORSYTH_CACHE_SIZE );
+		cache.swap( next_cache );
+	}
+
+	indices.swap( output );
+}
+
+//a run of triangles and how likely it is to hide what is drawn after it
+struct OverdrawCluster {
+	unsigned int start, end; // in triangles
+	float occlusion;
+	bool operator<( const OverdrawCluster &other ) const { return occlusion > other.occlusion; }
+};
+
+void CMeshOptimizer::optimizeOverdraw( const Mesh &mesh, std::vector<unsigned int> &indices )
+{
+	const unsigned int num_triangles = indices.size() / 3;
+	if ( num_triangles == 0 )
+		return;
+
+	//cut wherever every vertex of a triangle misses the cache, the cache is
+	//cold there anyway so reordering the clusters costs almost nothing
+	std::vector<OverdrawCluster> clusters;
+	std::vector<unsigned int> entered( mesh.vertexArray.size(), 0 );
+	unsigned int misses = 0;
+	OverdrawCluster cluster;
+	cluster.start = 0;
+	for ( unsigned int t = 0; t < num_triangles; ++t )
+	{
+		unsigned int triangle_misses = 0;
+		for ( int k = 0; k < 3; ++k )
+		{
+			const unsigned int v = indices[t * 3 + k];
+			if ( entered[v] == 0 || misses - ( entered[v] - 1 ) > MEASURE_CACHE_SIZE )
+			{
+				misses++;
+				entered[v] = misses;
+				triangle_misses++;
+			}
+		}
+		if ( triangle_misses == 3 && t > cluster.start )
+		{
+			cluster.end = t;
+			clusters.push_back( cluster );
+			cluster.start = t;
+		}
+	}
+	cluster.end = num_triangles;
+	clusters.push_back( cluster );
+	if ( clusters.size() < 2 )
+		return;
+
+	//clusters facing away from the middle of the mesh are on its outside,
+	//so drawing them first lets the depth test reject what they cover
+	Float3 centre;
+	for ( unsigned int v = 0; v < mesh.vertexArray.size(); ++v )
+	{
+		centre.x += mesh.vertexArray[v].x;
+		centre.y += mesh.vertexArray[v].y;
+		centre.z += mesh.vertexArray[v].z;
+	}
+	const float inverse = 1.0f / mesh.vertexArray.size();
+	centre.x *= inverse; centre.y *= inverse; centre.z *= inverse;
+
+	for ( unsigned int c = 0; c < clusters.size(); ++c )
+	{
+		Float3 position, normal;
+		for ( unsigned int i = clusters[c].start * 3; i < clusters[c].end * 3; ++i )
+		{
+			const Float3 &p = mesh.vertexArray[indices[i]];
+			const Float3 &n = mesh.normalArray[indices[i]];
+			position.x += p.x; position.y += p.y; position.z += p.z;
+			normal.x += n.x; normal.y += n.y; normal.z += n.z;
+		}
+		const float count = 1.0f / ( ( clusters[c].end - clusters[c].start ) * 3 );
+		clusters[c].occlusion = ( position.x * count - centre.x ) * normal.x
+			+ ( position.y * count - centre.y ) * normal.y
+			+ ( position.z * count - centre.z ) * normal.z;
+	}
+	std::stable_sort( clusters.begin(), clusters.end() );
+
+	std::vector<unsigned int> output;
+	output.reserve( indices.size() );
+	for ( unsigned int c = 0; c < clusters.size(); ++c )
+		output.insert( output.end(), indices.begin() + clusters[c].start * 3, indices.begin() + clusters[c].end * 3 );
+	indices.swap( output );
+}
+
+void CMeshOptimizer::optimizeVertexFetch( Mesh *mesh )
+{
+	const unsigned int unused = 0xFFFFFFFF;
+	std::vector<unsigned int> remap( mesh->vertexArray.size(), unused );
+	std::vector<Float3> positions, normals;
+	positions.reserve( mesh->vertexArray.size() );
+	normals.reserve( mesh->normalArray.size() );
+
+	for ( unsigned int i = 0; i < mesh->indexArray.size(); ++i )
+	{
+		unsigned int &v = mesh->indexArray[i];
+		if ( remap[v] == unused )
+		{
+			remap[v] = positions.size();
+			positions.push_back( mesh->vertexArray[v] );
+			normals.push_back( mesh->normalArray[v] );
+		}
+		v = remap[v];
+	}
+
+	mesh->vertexArray.swap( positions );
+	mesh->normalArray.swap( normals );
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <windows.h>
+#include <iostream>
+#include <cassert>
+#include <vector>
+#include "SceneDelegate.hpp"
+
+//Post-transform cache efficiency of an index buffer, simulated with a FIFO cache
+struct VertexCacheStats {
+	float acmr; // vertices transformed per triangle, 0.5 is ideal for a large grid, 3 the worst
+	float atvr; // vertices transformed per unique vertex, 1 is ideal
+
+	static VertexCacheStats measure( const std::vector<unsigned int> &indices, unsigned int num_vertices, unsigned int cache_size );
+};
+
+//What optimising one mesh achieved
+struct MeshOptimizeReport {
+	unsigned int vertices_before, vertices_after;
+	VertexCacheStats before, after;
+
+	void print( std::ostream &out ) const;
+};
+
+//Reorders a scene Mesh for the GPU before it is uploaded:
+//identical vertices are welded, triangles ordered for the post-transform
+//cache (Forsyth's algorithm) then, cluster by cluster, for less overdraw,
+//and vertices renumbered in the order they are first used.
+//The mesh draws exactly the same triangles with the same winding.
+class CMeshOptimizer {
+public:
+	static MeshOptimizeReport optimize( Mesh *mesh );
+
+	//merge vertices with identical positions and normals, returns the number removed
+	static unsigned int weld( Mesh *mesh );
+
+	//Forsyth's linear-speed vertex cache optimisation
+	static void optimizeVertexCache( std::vector<unsigned int> &indices, unsigned int num_vertices );
+
+	//split a cache-ordered index list where the cache runs cold, and draw the
+	//clusters most likely to occlude the others first
+	static void optimizeOverdraw( const Mesh &mesh, std::vector<unsigned int> &indices );
+
+	//renumber vertices in the order the indices first reference them, dropping unused ones
+	static void optimizeVertexFetch( Mesh *mesh );
+
+	//the constants its output depends on, for whatever stores optimised meshes
+	static void settings( std::vector<float> *values );
+};
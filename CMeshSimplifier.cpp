@@ -0,0 +1,334 @@
+#include "CMeshSimplifier.h"
+#include "CMeshOptimizer.h"
+#include <algorithm>
+#include <queue>
+#include <cmath>
+
+//stop building levels below this, draw calls cost more than the triangles
+#define MIN_LOD_TRIANGLES 32
+
+//a level must drop at least this fraction of the previous one's triangles
+#define MIN_LOD_REDUCTION 0.25f
+
+//symmetric 4x4 matrix of a weighted sum of squared plane distances
+struct Quadric {
+	double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+	double weight; // total of the weights, to turn the sum into a mean
+
+	Quadric() : a2(0), ab(0), ac(0), ad(0), b2(0), bc(0), bd(0), c2(0), cd(0), d2(0), weight(0) {}
+
+	Quadric( double a, double b, double c, double d, double w )
+		: a2(a*a*w), ab(a*b*w), ac(a*c*w), ad(a*d*w), b2(b*b*w),
+		bc(b*c*w), bd(b*d*w), c2(c*c*w), cd(c*d*w), d2(d*d*w), weight(w) {}
+
+	void add( const Quadric &q ) {
+		a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad; b2 += q.b2;
+		bc += q.bc; bd += q.bd; c2 += q.c2; cd += q.cd; d2 += q.d2;
+		weight += q.weight;
+	}
+
+	//mean squared distance of p from the planes
+	double evaluate( const Float3 &p ) const {
+		if ( weight <= 0.0 )
+			return 0.0;
+		const double x = p.x, y = p.y, z = p.z;
+		const double sum = a2*x*x + 2*ab*x*y + 2*ac*x*z + 2*ad*x + b2*y*y + 2*bc*y*z + 2*bd*y + c2*z*z + 2*cd*z + d2;
+		return sum / weight;
+	}
+};
+
+//a candidate collapse of vertex from onto vertex to
+struct Collapse {
+	double cost;
+	unsigned int from, to;
+	unsigned int stamp; // from's stamp when queued, stale if it has changed since
+	bool operator<( const Collapse &other ) const { return cost > other.cost; } // smallest cost on top
+};
+
+static Float3 sub( const Float3 &a, const Float3 &b ) { return Float3( a.x - b.x, a.y - b.y, a.z - b.z ); }
+static Float3 cross( const Float3 &a, const Float3 &b ) { return Float3( a.y*b.z - a.z*b.y, a.z*b.x - a.x*b.z, a.x*b.y - a.y*b.x ); }
+static float dot( const Float3 &a, const Float3 &b ) { return a.x*b.x + a.y*b.y + a.z*b.z; }
+
+//orders vertex numbers by position
+struct PositionOrder {
+	const Mesh *mesh;
+	bool operator()( unsigned int a, unsigned int b ) const {
+		const Float3 &pa = mesh->vertexArray[a], &pb = mesh->vertexArray[b];
+		if ( pa.x != pb.x ) return pa.x < pb.x;
+		if ( pa.y != pb.y ) return pa.y < pb.y;
+		return pa.z < pb.z;
+	}
+};
+
+void CMeshSimplifier::simplify( const Mesh &mesh, unsigned int target_triangles, Mesh *result, float *error )
+{
+	const unsigned int num_vertices = mesh.vertexArray.size();
+	const unsigned int num_triangles = mesh.indexArray.size() / 3;
+	std::vector<unsigned int> indices( mesh.indexArray.begin(), mesh.indexArray.begin() + num_triangles * 3 );
+	*error = 0.0f;
+
+	//triangles around each vertex, dead triangles are skipped rather than removed
+	std::vector< std::vector<unsigned int> > adjacent( num_vertices );
+	std::vector<Quadric> quadrics( num_vertices );
+	for ( unsigned int t = 0; t < num_triangles; ++t )
+	{
+		const Float3 &p0 = mesh.vertexArray[indices[t*3]];
+		Float3 n = cross( sub( mesh.vertexArray[indices[t*3+1]], p0 ), sub( mesh.vertexArray[indices[t*3+2]], p0 ) );
+		const float length = sqrtf( dot( n, n ) );
+		if ( length > 0.0f )
+		{
+			//area weighted, so big triangles resist moving more than slivers
+			Quadric plane( n.x / length, n.y / length, n.z / length, -dot( n, p0 ) / length, length * 0.5f );
+			for ( int k = 0; k < 3; ++k )
+				quadrics[indices[t*3+k]].add( plane );
+		}
+		for ( int k = 0; k < 3; ++k )
+			adjacent[indices[t*3+k]].push_back( t );
+	}
+
+	//lock seams: positions used by more than one vertex
+	std::vector<bool> locked( num_vertices, false );
+	std::vector<unsigned int> sorted( num_vertices );
+	for ( unsigned int v = 0; v < num_vertices; ++v )
+		sorted[v] = v;
+	PositionOrder order;
+	order.mesh = &mesh;
+	std::sort( sorted.begin(), sorted.end(), order );
+	for ( unsigned int i = 1; i < num_vertices; ++i )
+	{
+		if ( !order( sorted[i-1], sorted[i] ) )
+			locked[sorted[i-1]] = locked[sorted[i]] = true;
+	}
+
+	//and open borders: an edge only one triangle uses
+	std::vector< std::pair<unsigned int, unsigned int> > edges;
+	edges.reserve( num_triangles * 3 );
+	for ( unsigned int t = 0; t < num_triangles; ++t )
+	{
+		for ( int k = 0; k < 3; ++k )
+		{
+			unsigned int a = indices[t*3+k], b = indices[t*3+(k+1)%3];
+			edges.push_back( a < b ? std::make_pair( a, b ) : std::make_pair( b, a ) );
+		}
+	}
+	std::sort( edges.begin(), edges.end() );
+	for ( unsigned int i = 0; i < edges.size(); )
+	{
+		unsigned int j = i + 1;
+		while ( j < edges.size() && edges[j] == edges[i] )
+			j++;
+		if ( j - i == 1 )
+			locked[edges[i].first] = locked[edges[i].second] = true;
+		i = j;
+	}
+
+	std::vector<bool> removed( num_vertices, false );
+	std::vector<bool> dead( num_triangles, false );
+	std::vector<unsigned int> stamp( num_vertices, 0 );
+	std::priority_queue<Collapse> queue;
+
+	//queue both directions of every edge, unless the vertex that would move is locked
+	for ( unsigned int i = 0; i < edges.size(); ++i )
+	{
+		if ( i > 0 && edges[i] == edges[i-1] )
+			continue;
+		for ( int direction = 0; direction < 2; ++direction )
+		{
+			Collapse c;
+			c.from = direction ? edges[i].second : edges[i].first;
+			c.to = direction ? edges[i].first : edges[i].second;
+			if ( locked[c.from] )
+				continue;
+			Quadric q = quadrics[c.from];
+			q.add( quadrics[c.to] );
+			c.cost = q.evaluate( mesh.vertexArray[c.to] );
+			c.stamp = 0;
+			queue.push( c );
+		}
+	}
+
+	unsigned int live_triangles = num_triangles;
+	double max_cost = 0.0;
+	std::vector<unsigned int> neighbours;
+	while ( live_triangles > target_triangles && !queue.empty() )
+	{
+		const Collapse c = queue.top();
+		queue.pop();
+		if ( removed[c.from] || removed[c.to] || c.stamp != stamp[c.from] )
+			continue;
+
+		//reject collapses that fold a triangle over
+		bool flips = false, shares = false;
+		const Float3 &target = mesh.vertexArray[c.to];
+		for ( unsigned int a = 0; a < adjacent[c.from].size() && !flips; ++a )
+		{
+			const unsigned int t = adjacent[c.from][a];
+			if ( dead[t] )
+				continue;
+			const unsigned int *tri = &indices[t*3];
+			if ( tri[0] == c.to || tri[1] == c.to || tri[2] == c.to )
+			{
+				shares = true;
+				continue;
+			}
+			Float3 before[3], after[3];
+			for ( int k = 0; k < 3; ++k )
+			{
+				before[k] = mesh.vertexArray[tri[k]];
+				after[k] = tri[k] == c.from ? target : before[k];
+			}
+			const Float3 n0 = cross( sub( before[1], before[0] ), sub( before[2], before[0] ) );
+			const Float3 n1 = cross( sub( after[1], after[0] ), sub( after[2], after[0] ) );
+			if ( dot( n0, n1 ) <= 0.0f )
+				flips = true;
+		}
+		//the edge may have gone since it was queued
+		if ( flips || !shares )
+			continue;
+
+		//move from's triangles onto to, dropping the ones that become degenerate
+		for ( unsigned int a = 0; a < adjacent[c.from].size(); ++a )
+		{
+			const unsigned int t = adjacent[c.from][a];
+			if ( dead[t] )
+				continue;
+			unsigned int *tri = &indices[t*3];
+			if ( tri[0] == c.to || tri[1] == c.to || tri[2] == c.to )
+			{
+				dead[t] = true;
+				live_triangles--;
+				continue;
+			}
+			for ( int k = 0; k < 3; ++k )
+			{
+				if ( tri[k] == c.from )
+					tri[k] = c.to;
+			}
+			adjacent[c.to].push_back( t );
+		}
+		removed[c.from] = true;
+		quadrics[c.to].add( quadrics[c.from] );
+		if ( c.cost > max_cost )
+			max_cost = c.cost;
+
+		//the costs around to have changed, queue them again
+		neighbours.clear();
+		for ( unsigned int a = 0; a < adjacent[c.to].size(); ++a )
+		{
+			const unsigned int t = adjacent[c.to][a];
+			if ( dead[t] )
+				continue;
+			for ( int k = 0; k < 3; ++k )
+			{
+				if ( indices[t*3+k] != c.to )
+					neighbours.push_back( indices[t*3+k] );
+			}
+		}
+		std::sort( neighbours.begin(), neighbours.end() );
+		neighbours.erase( std::unique( neighbours.begin(), neighbours.end() ), neighbours.end() );
+
+		stamp[c.to]++;
+		for ( unsigned int n = 0; n < neighbours.size(); ++n )
+		{
+			const unsigned int w = neighbours[n];
+			stamp[w]++;
+			Quadric q = quadrics[c.to];
+			q.add( quadrics[w] );
+
+			Collapse next;
+			if ( !locked[c.to] )
+			{
+				next.from = c.to;
+				next.to = w;
+				next.cost = q.evaluate( mesh.vertexArray[w] );
+				next.stamp = stamp[c.to];
+				queue.push( next );
+			}
+			if ( !locked[w] )
+			{
+				next.from = w;
+				next.to = c.to;
+				next.cost = q.evaluate( mesh.vertexArray[c.to] );
+				next.stamp = stamp[w];
+				queue.push( next );
+			}
+		}
+		//w's other edges were invalidated by its new stamp, so queue them again too
+		for ( unsigned int n = 0; n < neighbours.size(); ++n )
+		{
+			const unsigned int w = neighbours[n];
+			if ( locked[w] )
+				continue;
+			for ( unsigned int a = 0; a < adjacent[w].size(); ++a )
+			{
+				const unsigned int t = adjacent[w][a];
+				if ( dead[t] )
+					continue;
+				for ( int k = 0; k < 3; ++k )
+				{
+					const unsigned int x = indices[t*3+k];
+					if ( x == w || x == c.to )
+						continue;
+					Quadric q = quadrics[w];
+					q.add( quadrics[x] );
+					Collapse next;
+					next.from = w;
+					next.to = x;
+					next.cost = q.evaluate( mesh.vertexArray[x] );
+					next.stamp = stamp[w];
+					queue.push( next );
+				}
+			}
+		}
+	}
+
+	//the quadric gives a mean squared distance, so this is a distance
+	*error = (float)sqrt( max_cost > 0.0 ? max_cost : 0.0 );
+
+	result->vertexArray = mesh.vertexArray;
+	result->normalArray = mesh.normalArray;
+	result->indexArray.clear();
+	result->indexArray.reserve( live_triangles * 3 );
+	for ( unsigned int t = 0; t < num_triangles; ++t )
+	{
+		if ( !dead[t] )
+			result->indexArray.insert( result->indexArray.end(), indices.begin() + t*3, indices.begin() + t*3 + 3 );
+	}
+
+	//drop the collapsed vertices and restore cache order
+	CMeshOptimizer::optimizeVertexCache( result->indexArray, result->vertexArray.size() );
+	CMeshOptimizer::optimizeVertexFetch( result );
+}
+
+void CMeshSimplifier::settings( std::vector<float> *values )
+{
+	values->push_back( MIN_LOD_TRIANGLES );
+	values->push_back( MIN_LOD_REDUCTION );
+}
+
+void CMeshSimplifier::buildChain( const Mesh &mesh, unsigned int max_levels, std::vector<Mesh> *levels, std::vector<float> *errors )
+{
+	levels->clear();
+	errors->clear();
+	levels->push_back( mesh );
+	errors->push_back( 0.0f );
+
+	while ( levels->size() < max_levels )
+	{
+		const Mesh &previous = levels->back();
+		const unsigned int triangles = previous.indexArray.size() / 3;
+		if ( triangles / 2 < MIN_LOD_TRIANGLES )
+			break;
+
+		Mesh level;
+		float error;
+		simplify( previous, triangles / 2, &level, &error );
+		if ( level.indexArray.size() / 3 > triangles * ( 1.0f - MIN_LOD_REDUCTION ) )
+			break;
+
+		//each level is made from the one before, so how far it strays from level 0
+		//is at most the sum of the steps down to it
+		levels->push_back( level );
+		errors->push_back( errors->back() + error );
+	}
+}
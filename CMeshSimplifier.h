@@ -0,0 +1,25 @@
+#pragma once
+#include <windows.h>
+#include <iostream>
+#include <cassert>
+#include <vector>
+#include "SceneDelegate.hpp"
+
+//Quadric error metric simplification (Garland and Heckbert) by half-edge
+//collapse, so surviving vertices keep their exact position and normal.
+//Vertices on open borders and on normal seams (a position shared by several
+//vertices) are locked, so flat shaded shapes keep their silhouette and never crack.
+class CMeshSimplifier {
+public:
+	//collapse edges until the mesh has at most target_triangles, or nothing
+	//more can go. error receives the largest (RMS) distance a surface moved, in mesh units
+	static void simplify( const Mesh &mesh, unsigned int target_triangles, Mesh *result, float *error );
+
+	//level 0 is the mesh itself, each next level aims for half the triangles of the one before.
+	//stops at max_levels, or once a level would save too little to be worth drawing.
+	//each error bounds how far that level strays from level 0
+	static void buildChain( const Mesh &mesh, unsigned int max_levels, std::vector<Mesh> *levels, std::vector<float> *errors );
+
+	//the constants the chain depends on, for whatever stores it
+	static void settings( std::vector<float> *values );
+};
@@ -0,0 +1,202 @@
+#include "CMeshlets.h"
+#include <cmath>
+#include <cstring>
+
+//The bounds and normal cone of the triangles in [first_index, first_index + 3 * num_triangles)
+static void computeBounds( const std::vector<D3DXVECTOR3> &positions, const std::vector<D3DXVECTOR3> &facing,
+	const std::vector<unsigned int> &indices, Meshlet *meshlet )
+{
+	const unsigned int first = meshlet->first_index, last = first + meshlet->num_triangles * 3;
+
+	D3DXVECTOR3 lo = positions[indices[first]], hi = lo;
+	for ( unsigned int i = first + 1; i < last; ++i )
+	{
+		D3DXVec3Minimize( &lo, &lo, &positions[indices[i]] );
+		D3DXVec3Maximize( &hi, &hi, &positions[indices[i]] );
+	}
+	meshlet->centre = ( lo + hi ) * 0.5f;
+	meshlet->radius = 0.0f;
+	for ( unsigned int i = first; i < last; ++i )
+	{
+		const D3DXVECTOR3 offset = positions[indices[i]] - meshlet->centre;
+		const float distance = D3DXVec3Length( &offset );
+		if ( distance > meshlet->radius )
+			meshlet->radius = distance;
+	}
+
+	//the cone around the average facing that holds every triangle's facing
+	D3DXVECTOR3 axis( 0.0f, 0.0f, 0.0f );
+	for ( unsigned int t = first / 3; t < last / 3; ++t )
+		axis += facing[t];
+	meshlet->cone_axis = D3DXVECTOR3( 0.0f, 0.0f, 0.0f );
+	meshlet->cone_cutoff = 1.0f;
+	if ( D3DXVec3Length( &axis ) <= 0.0f )
+		return;
+	D3DXVec3Normalize( &meshlet->cone_axis, &axis );
+
+	float min_cosine = 1.0f;
+	for ( unsigned int t = first / 3; t < last / 3; ++t )
+	{
+		//degenerate triangles have no facing and cannot be seen anyway
+		if ( D3DXVec3Length( &facing[t] ) <= 0.0f )
+			continue;
+		const float cosine = D3DXVec3Dot( &facing[t], &meshlet->cone_axis );
+		if ( cosine < min_cosine )
+			min_cosine = cosine;
+	}
+
+	//a cone near a hemisphere or wider can never be wholly turned away
+	if ( min_cosine > 0.1f )
+		meshlet->cone_cutoff = sqrtf( 1.0f - min_cosine * min_cosine );
+}
+
+void CMeshlets::build( const std::vector<D3DXVECTOR3> &positions, const std::vector<D3DXVECTOR3> &normals,
+	const std::vector<unsigned int> &indices, std::vector<Meshlet> *meshlets )
+{
+	meshlets->clear();
+	const unsigned int num_triangles = indices.size() / 3;
+	if ( num_triangles == 0 )
+		return;
+
+	//which way each triangle faces, the side its vertex normals are on
+	std::vector<D3DXVECTOR3> facing( num_triangles );
+	for ( unsigned int t = 0; t < num_triangles; ++t )
+	{
+		const unsigned int a = indices[t * 3], b = indices[t * 3 + 1], c = indices[t * 3 + 2];
+		const D3DXVECTOR3 ab = positions[b] - positions[a], ac = positions[c] - positions[a];
+		D3DXVECTOR3 face;
+		D3DXVec3Cross( &face, &ab, &ac );
+
+		const D3DXVECTOR3 vertex_normals = normals[a] + normals[b] + normals[c];
+		if ( D3DXVec3Dot( &face, &vertex_normals ) < 0.0f )
+			face = -face;
+
+		if ( D3DXVec3Length( &face ) > 0.0f )
+			D3DXVec3Normalize( &facing[t], &face );
+		else
+			facing[t] = D3DXVECTOR3( 0.0f, 0.0f, 0.0f );
+	}
+
+	//greedily take triangles in order until a limit is hit or one faces too far away
+	std::vector<unsigned int> stamp( positions.size(), 0 );
+	unsigned int current = 1, num_vertices = 0;
+	D3DXVECTOR3 facing_sum( 0.0f, 0.0f, 0.0f );
+
+	Meshlet meshlet;
+	memset( &meshlet, 0, sizeof(meshlet) );
+	for ( unsigned int t = 0; t < num_triangles; ++t )
+	{
+		unsigned int new_vertices = 0;
+		for ( unsigned int k = 0; k < 3; ++k )
+		{
+			if ( stamp[indices[t * 3 + k]] != current )
+				new_vertices++;
+		}
+
+		bool split = false;
+		if ( meshlet.num_triangles > 0 )
+		{
+			split = num_vertices + new_vertices > MESHLET_MAX_VERTICES || meshlet.num_triangles >= MESHLET_MAX_TRIANGLES;
+
+			D3DXVECTOR3 average;
+			if ( !split && D3DXVec3Length( &facing_sum ) > 0.0f && D3DXVec3Length( &facing[t] ) > 0.0f )
+			{
+				D3DXVec3Normalize( &average, &facing_sum );
+				split = D3DXVec3Dot( &average, &facing[t] ) < MESHLET_CONE_SPLIT;
+			}
+		}
+
+		if ( split )
+		{
+			computeBounds( positions, facing, indices, &meshlet );
+			meshlets->push_back( meshlet );
+
+			meshlet.first_index = t * 3;
+			meshlet.num_triangles = 0;
+			num_vertices = 0;
+			facing_sum = D3DXVECTOR3( 0.0f, 0.0f, 0.0f );
+			current++;
+		}
+
+		for ( unsigned int k = 0; k < 3; ++k )
+		{
+			if ( stamp[indices[t * 3 + k]] != current )
+			{
+				stamp[indices[t * 3 + k]] = current;
+				num_vertices++;
+			}
+		}
+		facing_sum += facing[t];
+		meshlet.num_triangles++;
+	}
+
+	computeBounds( positions, facing, indices, &meshlet );
+	meshlets->push_back( meshlet );
+}
+
+bool CMeshlets::culled( const Meshlet &meshlet, const CFrustum &frustum, const D3DXVECTOR3 &eye, MeshletCullStats *stats )
+{
+	stats->meshlets++;
+	stats->triangles += meshlet.num_triangles;
+
+	if ( !frustum.intersectsSphere( meshlet.centre, meshlet.radius ) )
+	{
+		stats->frustum_culled++;
+		stats->triangles_culled += meshlet.num_triangles;
+		return true;
+	}
+
+	//every point of the sphere is seen from behind every normal in the cone
+	const D3DXVECTOR3 to_centre = meshlet.centre - eye;
+	if ( meshlet.cone_cutoff < 1.0f &&
+		D3DXVec3Dot( &to_centre, &meshlet.cone_axis ) >= meshlet.cone_cutoff * D3DXVec3Length( &to_centre ) + meshlet.radius )
+	{
+		stats->cone_culled++;
+		stats->triangles_culled += meshlet.num_triangles;
+		return true;
+	}
+
+	return false;
+}
+
+unsigned int CMeshlets::cull( const Meshlet *meshlets, unsigned int count, const CFrustum &frustum, const D3DXVECTOR3 &eye,
+	IndexRange *ranges, MeshletCullStats *stats )
+{
+	unsigned int num_ranges = 0;
+	bool extend = false;
+	for ( unsigned int i = 0; i < count; ++i )
+	{
+		if ( culled( meshlets[i], frustum, eye, stats ) )
+		{
+			extend = false;
+			continue;
+		}
+
+		//meshlets are stored in index order, so a run of survivors is one range
+		if ( extend )
+		{
+			ranges[num_ranges - 1].num_triangles += meshlets[i].num_triangles;
+			continue;
+		}
+
+		ranges[num_ranges].first_index = meshlets[i].first_index;
+		ranges[num_ranges].num_triangles = meshlets[i].num_triangles;
+		num_ranges++;
+		stats->ranges++;
+		extend = true;
+	}
+	return num_ranges;
+}
+
+void MeshletCullStats::print( std::ostream &out, unsigned int frames ) const
+{
+	if ( frames == 0 )
+		frames = 1;
+
+	const float culled = meshlets > 0 ? 100.0f * ( frustum_culled + cone_culled ) / meshlets : 0.0f;
+	const float triangles_ratio = triangles > 0 ? 100.0f * (float)triangles_culled / (float)triangles : 0.0f;
+	out << meshlets / frames << " meshlets per frame, " << culled << "% culled ("
+		<< frustum_culled / frames << " by frustum, " << cone_culled / frames << " by cone), "
+		<< triangles_ratio << "% of " << triangles / frames << " triangles culled, "
+		<< ranges / frames << " draws\n";
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <windows.h>
+#include <d3d9.h>
+#include <d3dx9.h>
+#include <iostream>
+#include <cassert>
+#include <vector>
+#include "CFrustum.h"
+
+//Limits on one meshlet, small enough to cull finely but not so small that the
+//surviving ranges turn into a flood of draw calls
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_TRIANGLES 64
+
+//a meshlet is closed once a triangle faces more than this (cosine, about 45
+//degrees) away from its average normal, so cones stay narrow enough to cull
+#define MESHLET_CONE_SPLIT 0.7f
+
+//meshes with fewer triangles are drawn whole, culling them would cost more than it saves
+#define MESHLET_MIN_TRIANGLES 256
+
+//A run of consecutive triangles in a mesh's index list, with bounds to cull it by
+struct Meshlet {
+	unsigned int first_index; // from the start of the mesh's indices
+	unsigned int num_triangles;
+	D3DXVECTOR3 centre; // bounding sphere
+	float radius;
+	D3DXVECTOR3 cone_axis; // average facing of the triangles
+	float cone_cutoff; // sine of the cone's half angle, 1 when it is too wide to cull by
+};
+
+//Part of a mesh's index list left to draw after culling
+struct IndexRange {
+	unsigned int first_index;
+	unsigned int num_triangles;
+};
+
+//What culling meshlets removed, summed over every view it was done for
+struct MeshletCullStats {
+	unsigned int meshlets, frustum_culled, cone_culled;
+	unsigned long long triangles, triangles_culled;
+	unsigned int ranges; // draws issued for the survivors
+
+	void print( std::ostream &out, unsigned int frames ) const;
+};
+
+//Splits an index list into meshlets, and culls them against a view
+class CMeshlets {
+public:
+	//cut the triangles, in the order given, into meshlets. normals are only used
+	//to tell which way each triangle faces, whatever the winding order
+	static void build( const std::vector<D3DXVECTOR3> &positions, const std::vector<D3DXVECTOR3> &normals,
+		const std::vector<unsigned int> &indices, std::vector<Meshlet> *meshlets );
+
+	//outside the frustum, or facing away from eye across the whole meshlet
+	static bool culled( const Meshlet &meshlet, const CFrustum &frustum, const D3DXVECTOR3 &eye, MeshletCullStats *stats );
+
+	//write the index ranges that survive, merging neighbours into one, and
+	//return how many. ranges needs room for one per meshlet
+	static unsigned int cull( const Meshlet *meshlets, unsigned int count, const CFrustum &frustum, const D3DXVECTOR3 &eye,
+		IndexRange *ranges, MeshletCullStats *stats );
+};
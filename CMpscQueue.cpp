@@ -0,0 +1,53 @@
+#include "CMpscQueue.h"
+
+CMpscQueue::CMpscQueue()
+{
+	_stub.next = NULL;
+	_head = &_stub;
+	_tail = &_stub;
+}
+
+void CMpscQueue::push( QueueNode *node )
+{
+	node->next = NULL;
+	//claim the head, then link the old head to us. between the two the
+	//consumer sees the list end early and simply stops there
+	QueueNode *previous = (QueueNode*)InterlockedExchangePointer( (void* volatile*)&_head, node );
+	previous->next = node;
+}
+
+QueueNode *CMpscQueue::pop()
+{
+	QueueNode *tail = _tail;
+	QueueNode *next = tail->next;
+
+	//step past the stub
+	if ( tail == &_stub )
+	{
+		if ( next == NULL )
+			return NULL;
+		_tail = next;
+		tail = next;
+		next = next->next;
+	}
+
+	if ( next != NULL )
+	{
+		_tail = next;
+		return tail;
+	}
+
+	//tail is the last node linked in. unless a push is under way, put the stub
+	//back behind it so tail can be handed out without emptying the list
+	if ( tail != _head )
+		return NULL;
+	push( &_stub );
+
+	next = tail->next;
+	if ( next != NULL )
+	{
+		_tail = next;
+		return tail;
+	}
+	return NULL;
+}
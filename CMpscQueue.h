@@ -0,0 +1,28 @@
+#pragma once
+#include <windows.h>
+#include <cassert>
+
+//Embedded at the start of anything put on a CMpscQueue
+struct QueueNode {
+	QueueNode * volatile next;
+};
+
+//A queue many threads push to and one thread pops from, without locks.
+//Pushing is one atomic exchange; popping only touches the consumer's end,
+//so the two sides never wait on each other. Nodes are owned by the caller.
+class CMpscQueue {
+private:
+	QueueNode * volatile _head; // the node pushed last
+	QueueNode *_tail; // the next to pop, only touched by the consumer
+	QueueNode _stub; // keeps the list non-empty so push never looks at _tail
+
+public:
+	CMpscQueue();
+
+	//any thread
+	void push( QueueNode *node );
+
+	//the consumer only. NULL when empty, or when a push has started but not
+	//yet linked its node in, in which case it is returned on a later call
+	QueueNode *pop();
+};
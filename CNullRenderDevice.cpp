@@ -0,0 +1,115 @@
+#include "CNullRenderDevice.h"
+
+CNullRenderDevice::CNullRenderDevice( UINT width, UINT height )
+{
+	_viewport.X = 0;
+	_viewport.Y = 0;
+	_viewport.Width = width;
+	_viewport.Height = height;
+	_viewport.MinZ = 0.0f;
+	_viewport.MaxZ = 1.0f;
+}
+
+CNullRenderDevice::~CNullRenderDevice()
+{
+}
+
+HRESULT CNullRenderDevice::TestCooperativeLevel()
+{
+	//a null device is never lost
+	return D3D_OK;
+}
+
+HRESULT CNullRenderDevice::Reset( D3DPRESENT_PARAMETERS *pp )
+{
+	//follow the back buffer size like a real device would
+	_viewport.Width = pp->BackBufferWidth;
+	_viewport.Height = pp->BackBufferHeight;
+	return D3D_OK;
+}
+
+HRESULT CNullRenderDevice::Present( const RECT *source, const RECT *dest, HWND window, const void *dirty )
+{
+	return D3D_OK;
+}
+
+HRESULT CNullRenderDevice::BeginScene()
+{
+	return D3D_OK;
+}
+
+HRESULT CNullRenderDevice::EndScene()
+{
+	return D3D_OK;
+}
+
+HRESULT CNullRenderDevice::Clear( DWORD count, const D3DRECT *rects, DWORD flags, D3DCOLOR colour, float z, DWORD stencil )
+{
+	return D3D_OK;
+}
+
+HRESULT CNullRenderDevice::GetViewport( D3DVIEWPORT9 *viewport )
+{
+	*viewport = _viewport;
+	return D3D_OK;
+}
+
+///////////////////////
+//Resource creation  //
+///////////////////////
+
+//Every creation call "succeeds" with a NULL object
+
+HRESULT CNullRenderDevice::GetRenderTarget( DWORD index, IDirect3DSurface9 **surface )
+{
+	*surface = NULL;
+	return D3D_OK;
+}
+
+HRESULT CNullRenderDevice::GetDepthStencilSurface( IDirect3DSurface9 **surface )
+{
+	*surface = NULL;
+	return D3D_OK;
+}
+
+HRESULT CNullRenderDevice::CreateDepthStencilSurface( UINT width, UINT height, D3DFORMAT format, D3DMULTISAMPLE_TYPE multisample, DWORD quality, BOOL discard, IDirect3DSurface9 **surface, HANDLE *shared )
+{
+	*surface = NULL;
+	return D3D_OK;
+}
+
+HRESULT CNullRenderDevice::CreateTexture( UINT width, UINT height, UINT levels, DWORD usage, D3DFORMAT format, D3DPOOL pool, IDirect3DTexture9 **texture, HANDLE *shared )
+{
+	*texture = NULL;
+	return D3D_OK;
+}
+
+HRESULT CNullRenderDevice::CreateVertexBuffer( UINT length, DWORD usage, DWORD fvf, D3DPOOL pool, IDirect3DVertexBuffer9 **buffer, HANDLE *shared )
+{
+	*buffer = NULL;
+	return D3D_OK;
+}
+
+HRESULT CNullRenderDevice::CreateIndexBuffer( UINT length, DWORD usage, D3DFORMAT format, D3DPOOL pool, IDirect3DIndexBuffer9 **buffer, HANDLE *shared )
+{
+	*buffer = NULL;
+	return D3D_OK;
+}
+
+HRESULT CNullRenderDevice::CreateVertexDeclaration( const D3DVERTEXELEMENT9 *elements, IDirect3DVertexDeclaration9 **declaration )
+{
+	*declaration = NULL;
+	return D3D_OK;
+}
+
+HRESULT CNullRenderDevice::CreateVertexShader( const DWORD *function, IDirect3DVertexShader9 **shader )
+{
+	*shader = NULL;
+	return D3D_OK;
+}
+
+HRESULT CNullRenderDevice::CreatePixelShader( const DWORD *function, IDirect3DPixelShader9 **shader )
+{
+	*shader = NULL;
+	return D3D_OK;
+}
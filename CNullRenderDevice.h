@@ -0,0 +1,56 @@
+#pragma once
+#include "CRenderDevice.h"
+
+//A device that accepts and discards all work.
+//Resource creation succeeds but hands back NULL objects, which the rest of the
+//framework already treats as "nothing to lock or bind", so a full frame can be
+//driven on the CPU without a GPU, a driver or a window.
+class CNullRenderDevice : public CRenderDevice {
+private:
+	D3DVIEWPORT9 _viewport; // reported back so aspect ratios still make sense
+
+public:
+	CNullRenderDevice( UINT width, UINT height );
+	~CNullRenderDevice();
+
+	HRESULT TestCooperativeLevel();
+	HRESULT Reset( D3DPRESENT_PARAMETERS *pp );
+	HRESULT Present( const RECT *source, const RECT *dest, HWND window, const void *dirty );
+
+	HRESULT BeginScene();
+	HRESULT EndScene();
+	HRESULT Clear( DWORD count, const D3DRECT *rects, DWORD flags, D3DCOLOR colour, float z, DWORD stencil );
+	HRESULT GetViewport( D3DVIEWPORT9 *viewport );
+
+	HRESULT GetRenderTarget( DWORD index, IDirect3DSurface9 **surface );
+	HRESULT GetDepthStencilSurface( IDirect3DSurface9 **surface );
+	HRESULT CreateDepthStencilSurface( UINT width, UINT height, D3DFORMAT format, D3DMULTISAMPLE_TYPE multisample, DWORD quality, BOOL discard, IDirect3DSurface9 **surface, HANDLE *shared );
+	HRESULT CreateTexture( UINT width, UINT height, UINT levels, DWORD usage, D3DFORMAT format, D3DPOOL pool, IDirect3DTexture9 **texture, HANDLE *shared );
+	HRESULT CreateVertexBuffer( UINT length, DWORD usage, DWORD fvf, D3DPOOL pool, IDirect3DVertexBuffer9 **buffer, HANDLE *shared );
+	HRESULT CreateIndexBuffer( UINT length, DWORD usage, D3DFORMAT format, D3DPOOL pool, IDirect3DIndexBuffer9 **buffer, HANDLE *shared );
+	HRESULT CreateVertexDeclaration( const D3DVERTEXELEMENT9 *elements, IDirect3DVertexDeclaration9 **declaration );
+	HRESULT CreateVertexShader( const DWORD *function, IDirect3DVertexShader9 **shader );
+	HRESULT CreatePixelShader( const DWORD *function, IDirect3DPixelShader9 **shader );
+
+	HRESULT SetRenderTarget( DWORD index, IDirect3DSurface9 *surface ) { return D3D_OK; }
+	HRESULT SetDepthStencilSurface( IDirect3DSurface9 *surface ) { return D3D_OK; }
+	HRESULT SetVertexDeclaration( IDirect3DVertexDeclaration9 *declaration ) { return D3D_OK; }
+	HRESULT SetStreamSource( UINT stream, IDirect3DVertexBuffer9 *buffer, UINT offset, UINT stride ) { return D3D_OK; }
+	HRESULT SetStreamSourceFreq( UINT stream, UINT setting ) { return D3D_OK; }
+	HRESULT SetIndices( IDirect3DIndexBuffer9 *buffer ) { return D3D_OK; }
+	HRESULT SetVertexShader( IDirect3DVertexShader9 *shader ) { return D3D_OK; }
+	HRESULT SetPixelShader( IDirect3DPixelShader9 *shader ) { return D3D_OK; }
+	HRESULT SetRenderState( D3DRENDERSTATETYPE state, DWORD value ) { return D3D_OK; }
+	HRESULT SetSamplerState( DWORD sampler, D3DSAMPLERSTATETYPE state, DWORD value ) { return D3D_OK; }
+	HRESULT SetTexture( DWORD stage, IDirect3DBaseTexture9 *texture ) { return D3D_OK; }
+
+	HRESULT SetMatrix( ID3DXConstantTable *table, D3DXHANDLE constant, const D3DXMATRIX *matrix ) { return D3D_OK; }
+	HRESULT SetVector( ID3DXConstantTable *table, D3DXHANDLE constant, const D3DXVECTOR4 *vector ) { return D3D_OK; }
+	HRESULT SetFloat( ID3DXConstantTable *table, D3DXHANDLE constant, float value ) { return D3D_OK; }
+	HRESULT SetFloatArray( ID3DXConstantTable *table, D3DXHANDLE constant, const float *values, UINT count ) { return D3D_OK; }
+
+	HRESULT DrawIndexedPrimitive( D3DPRIMITIVETYPE type, INT base_vertex, UINT min_index, UINT num_vertices, UINT start_index, UINT primitive_count ) { return D3D_OK; }
+
+	void BeginEvent( const char *name ) {}
+	void EndEvent() {}
+};
@@ -0,0 +1,383 @@
+#include "CNurbsSurfaces.h"
+#include "CFrustum.h"
+#include "CProfiler.h"
+#include <algorithm>
+#include <cfloat>
+#include <climits>
+
+//Views nearer a patch's bounds than this are treated as this near
+#define NURBS_NEAREST 0.5f
+
+void NurbsStats::print( std::ostream &out, unsigned int frames ) const
+{
+	if ( frames == 0 )
+		frames = 1;
+	out << "NURBS: " << tessellations << " tessellations (" << triangles << " triangles) taking "
+		<< tessellate_ms << " ms in jobs, " << upload_ms / frames << " ms a frame uploading, "
+		<< (float)draws / frames << " patches drawn a frame, " << fallbacks << " at a stand-in level, "
+		<< level_changes << " level changes, " << evictions << " evicted\n";
+}
+
+CNurbsSurfaces::CNurbsSurfaces()
+{
+	_vertex_declaration = NULL;
+	_tolerance = 1.0f;
+	_frame = 0;
+	memset( &_stats, 0, sizeof(NurbsStats) );
+	_jobs = NULL;
+
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency( &frequency );
+	_frequency = frequency.QuadPart / 1000.0;
+}
+
+CNurbsSurfaces::~CNurbsSurfaces()
+{
+	clear();
+}
+
+void CNurbsSurfaces::makeSheet( unsigned int points, float size, float height, unsigned int seed, const D3DXVECTOR3 &position, NurbsPatch *patch )
+{
+	if ( points < 4 )
+		points = 4;
+
+	//clamped uniform knots, so the sheet reaches its edge control points
+	patch->ucount = patch->vcount = points;
+	patch->uknot.clear();
+	for ( unsigned int k = 0; k < points + 4; ++k )
+		patch->uknot.push_back( (float)std::min( std::max( (int)k - 3, 0 ), (int)points - 3 ) );
+	patch->vknot = patch->uknot;
+	patch->umin = patch->vmin = 0.0f;
+	patch->umax = patch->vmax = (float)( points - 3 );
+
+	patch->control_points.clear();
+	for ( unsigned int j = 0; j < points; ++j )
+	{
+		for ( unsigned int i = 0; i < points; ++i )
+		{
+			seed = seed * 1664525 + 1013904223;
+			const float raise = height * ( seed >> 8 ) / 16777216.0f;
+			patch->control_points.push_back( tsl::Vector4( size * i / ( points - 1 ), size * j / ( points - 1 ), raise, 1.0f ) );
+		}
+	}
+
+	D3DXMatrixTranslation( &patch->world, position.x, position.y, position.z );
+}
+
+unsigned int CNurbsSurfaces::add( const NurbsPatch &patch )
+{
+	assert( patch.control_points.size() == patch.ucount * patch.vcount );
+
+	Surface *surface = new Surface();
+	surface->patch = patch;
+	surface->levels.clear();
+
+	//the surface lies inside the hull of its control points
+	D3DXVECTOR3 lo( FLT_MAX, FLT_MAX, FLT_MAX ), hi( -FLT_MAX, -FLT_MAX, -FLT_MAX );
+	for ( unsigned int p = 0; p < patch.control_points.size(); ++p )
+	{
+		const D3DXVECTOR3 c( patch.control_points[p].x, patch.control_points[p].y, patch.control_points[p].z );
+		D3DXVec3Minimize( &lo, &lo, &c );
+		D3DXVec3Maximize( &hi, &hi, &c );
+	}
+	const D3DXVECTOR3 centre = ( lo + hi ) * 0.5f;
+	const D3DXVECTOR3 half = ( hi - lo ) * 0.5f;
+	surface->radius = D3DXVec3Length( &half );
+	D3DXVec3TransformCoord( &surface->centre, &centre, &patch.world );
+
+	//how far the control net bends, along either direction. the surface's second
+	//derivative is about that times the square of the net's spans, and a chord
+	//across 1/n of it strays from the surface by an eighth of it over n squared
+	float bend = 0.0f;
+	for ( unsigned int j = 0; j < patch.vcount; ++j )
+	{
+		for ( unsigned int i = 0; i < patch.ucount; ++i )
+		{
+			const tsl::Vector4 &p = patch.control_points[j * patch.ucount + i];
+			if ( i > 0 && i + 1 < patch.ucount )
+			{
+				const tsl::Vector4 &a = patch.control_points[j * patch.ucount + i - 1];
+				const tsl::Vector4 &b = patch.control_points[j * patch.ucount + i + 1];
+				const D3DXVECTOR3 d( a.x - 2.0f * p.x + b.x, a.y - 2.0f * p.y + b.y, a.z - 2.0f * p.z + b.z );
+				bend = std::max( bend, D3DXVec3Length( &d ) );
+			}
+			if ( j > 0 && j + 1 < patch.vcount )
+			{
+				const tsl::Vector4 &a = patch.control_points[( j - 1 ) * patch.ucount + i];
+				const tsl::Vector4 &b = patch.control_points[( j + 1 ) * patch.ucount + i];
+				const D3DXVECTOR3 d( a.x - 2.0f * p.x + b.x, a.y - 2.0f * p.y + b.y, a.z - 2.0f * p.z + b.z );
+				bend = std::max( bend, D3DXVec3Length( &d ) );
+			}
+		}
+	}
+	const float spans = (float)( std::max( patch.ucount, patch.vcount ) - 1 );
+	surface->error = bend * spans * spans / 8.0f;
+
+	_surfaces.push_back( surface );
+	return _surfaces.size() - 1;
+}
+
+bool CNurbsSurfaces::init( CRenderDevice *dev, CJobSystem *jobs, float tolerance )
+{
+	_jobs = jobs;
+	_tolerance = tolerance > 0.0f ? tolerance : 1.0f;
+	_frame = 0;
+
+	D3DVERTEXELEMENT9 vertex_elements[] = {
+		{ 0, 0, D3DDECLTYPE_FLOAT3, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_POSITION, 0 }, // an xyz position
+		{ 0, 12, D3DDECLTYPE_FLOAT3, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_NORMAL, 0 }, // an xyz normal
+		{ INSTANCE_STREAM, 0, D3DDECLTYPE_FLOAT4, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_TEXCOORD, 0 }, // world matrix rows
+		{ INSTANCE_STREAM, 16, D3DDECLTYPE_FLOAT4, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_TEXCOORD, 1 },
+		{ INSTANCE_STREAM, 32, D3DDECLTYPE_FLOAT4, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_TEXCOORD, 2 },
+		{ INSTANCE_STREAM, 48, D3DDECLTYPE_FLOAT4, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_TEXCOORD, 3 },
+		D3DDECL_END()
+	};
+	if ( FAILED( dev->CreateVertexDeclaration( vertex_elements, &_vertex_declaration ) ) )
+		return false;
+
+	//room for a few patches at the finest level, it grows as needed
+	const unsigned int stride = sizeof(NurbsVertex);
+	const unsigned int finest = NURBS_MIN_SUBDIVISIONS << ( NURBS_LEVELS - 1 );
+	if ( !_geometry.create( dev, &stride, 1, 4 * ( finest + 1 ) * ( finest + 1 ), 4 * 6 * finest * finest ) )
+		return false;
+	return true;
+}
+
+void CNurbsSurfaces::clear()
+{
+	//anything still being made, then finished but never uploaded
+	if ( _jobs != NULL )
+		_jobs->wait( &_tessellating );
+	while ( Tessellation *tessellation = (Tessellation*)_done.pop() )
+		delete tessellation;
+
+	for ( unsigned int s = 0; s < _surfaces.size(); ++s )
+		delete _surfaces[s];
+	_surfaces.clear();
+	_cache.clear();
+	_geometry.release();
+	Release( &_vertex_declaration );
+}
+
+void CNurbsSurfaces::tessellateJob( void *data, unsigned int, unsigned int )
+{
+	Tessellation *tessellation = (Tessellation*)data;
+	PROFILE_SCOPE( "tessellate" );
+	LARGE_INTEGER start, end;
+	QueryPerformanceCounter( &start );
+	tessellate( tessellation );
+	QueryPerformanceCounter( &end );
+	tessellation->ms = ( end.QuadPart - start.QuadPart ) / tessellation->surfaces->_frequency;
+
+	//the exchange in push publishes the tessellation along with the node
+	tessellation->surfaces->_done.push( &tessellation->node );
+}
+
+void CNurbsSurfaces::tessellate( Tessellation *tessellation )
+{
+	const NurbsPatch &patch = tessellation->surface->patch;
+	const unsigned int subdivisions = NURBS_MIN_SUBDIVISIONS << tessellation->level;
+
+	//tsl keeps no state between calls, so patches are made side by side
+	tsl::IndexedMesh mesh;
+	tsl::CreateNurbsSurface( patch.ucount, patch.uknot, patch.umin, patch.umax, patch.vcount, patch.vknot, patch.vmin, patch.vmax,
+		patch.control_points, subdivisions, subdivisions, &mesh );
+	tsl::ConvertPolygonsToTriangles( &mesh );
+
+	const bool has_normals = mesh.normal_array.size() == mesh.vertex_array.size();
+	tessellation->vertices.resize( mesh.vertex_array.size() );
+	for ( unsigned int v = 0; v < mesh.vertex_array.size(); ++v )
+	{
+		tessellation->vertices[v].position = D3DXVECTOR3( mesh.vertex_array[v].x, mesh.vertex_array[v].y, mesh.vertex_array[v].z );
+		tessellation->vertices[v].normal = has_normals ? D3DXVECTOR3( mesh.normal_array[v].x, mesh.normal_array[v].y, mesh.normal_array[v].z ) : D3DXVECTOR3( 0.0f, 0.0f, 1.0f );
+	}
+	tessellation->indices.assign( mesh.index_array.begin(), mesh.index_array.end() );
+}
+
+unsigned int CNurbsSurfaces::chooseLevel( const Surface &surface, const LodView &view ) const
+{
+	//the coarsest level whose error, seen from the nearest point of the bounds, is small enough
+	const D3DXVECTOR3 offset = surface.centre - view.eye;
+	const float distance = std::max( D3DXVec3Length( &offset ) - surface.radius, NURBS_NEAREST );
+	for ( unsigned int level = 0; level + 1 < NURBS_LEVELS; ++level )
+	{
+		const float subdivisions = (float)( NURBS_MIN_SUBDIVISIONS << level );
+		if ( surface.error / ( subdivisions * subdivisions ) * view.pixel_scale / distance <= _tolerance )
+			return level;
+	}
+	return NURBS_LEVELS - 1;
+}
+
+GeometryHandle CNurbsSurfaces::find( unsigned int patch, unsigned int level, bool request )
+{
+	const unsigned int key = patch * NURBS_LEVELS + level;
+	std::map<unsigned int, CacheEntry>::iterator entry = _cache.find( key );
+	if ( entry != _cache.end() )
+	{
+		entry->second.last_used = _frame;
+		return entry->second.handle;
+	}
+	if ( !request )
+		return INVALID_GEOMETRY;
+
+	CacheEntry pending;
+	pending.handle = INVALID_GEOMETRY;
+	pending.last_used = _frame;
+	_cache[key] = pending;
+
+	Tessellation *tessellation = new Tessellation();
+	tessellation->surfaces = this;
+	tessellation->surface = _surfaces[patch];
+	tessellation->patch = patch;
+	tessellation->level = level;
+	tessellation->ms = 0.0;
+
+	//in the background, so the render thread is not held up making it inside
+	//the waits of its frame's jobs
+	_jobs->runInBackground( tessellateJob, tessellation, &_tessellating );
+	return INVALID_GEOMETRY;
+}
+
+void CNurbsSurfaces::update( CRenderDevice *dev )
+{
+	PROFILE_SCOPE( "nurbs update" );
+	LARGE_INTEGER start, end;
+	QueryPerformanceCounter( &start );
+
+	//with no workers, the tessellations asked for last frame are only made when waited on
+	if ( _jobs != NULL && _jobs->threads() == 0 )
+		_jobs->wait( &_tessellating );
+
+	while ( Tessellation *tessellation = (Tessellation*)_done.pop() )
+	{
+		_stats.tessellations++;
+		_stats.triangles += tessellation->indices.size() / 3;
+		_stats.tessellate_ms += tessellation->ms;
+
+		//nothing is evicted while it is being made, so the entry is still there
+		std::map<unsigned int, CacheEntry>::iterator entry = _cache.find( tessellation->patch * NURBS_LEVELS + tessellation->level );
+		assert( entry != _cache.end() );
+
+		GeometryHandle handle = INVALID_GEOMETRY;
+		if ( !tessellation->indices.empty() )
+			handle = _geometry.allocate( dev, tessellation->vertices.size(), tessellation->indices.size() );
+		if ( handle != INVALID_GEOMETRY )
+		{
+			void *vptr = _geometry.lockVertices( handle, 0 );
+			if ( vptr )
+			{
+				memcpy( vptr, &tessellation->vertices[0], tessellation->vertices.size() * sizeof(NurbsVertex) );
+				_geometry.unlockVertices( 0 );
+			}
+			_geometry.writeIndices( handle, &tessellation->indices[0] );
+			entry->second.handle = handle;
+		}
+		else
+		{
+			//asked for again by the next view that wants it
+			_cache.erase( entry );
+		}
+		delete tessellation;
+	}
+
+	//let go of tessellations no view has wanted in a while
+	for ( std::map<unsigned int, CacheEntry>::iterator entry = _cache.begin(); entry != _cache.end(); )
+	{
+		if ( entry->second.handle != INVALID_GEOMETRY && _frame - entry->second.last_used > NURBS_KEEP_FRAMES )
+		{
+			_geometry.free( entry->second.handle );
+			_cache.erase( entry++ );
+			_stats.evictions++;
+		}
+		else
+			++entry;
+	}
+	_frame++;
+
+	QueryPerformanceCounter( &end );
+	_stats.upload_ms += ( end.QuadPart - start.QuadPart ) / _frequency;
+}
+
+void CNurbsSurfaces::draw( CRenderDevice *dev, CInstanceBuffer *instances, const LodView &view )
+{
+	CFrustum frustum( view.view_projection );
+
+	_visible.clear();
+	_handles.clear();
+	for ( unsigned int p = 0; p < _surfaces.size(); ++p )
+	{
+		Surface &surface = *_surfaces[p];
+		if ( !frustum.intersectsSphere( surface.centre, surface.radius ) )
+			continue;
+
+		const unsigned int level = chooseLevel( surface, view );
+		if ( surface.levels.size() <= view.index )
+			surface.levels.resize( view.index + 1, NURBS_LEVELS );
+		if ( surface.levels[view.index] != level )
+		{
+			if ( surface.levels[view.index] != NURBS_LEVELS )
+				_stats.level_changes++;
+			surface.levels[view.index] = level;
+		}
+
+		//while the level wanted is made, draw the nearest there is, finer first
+		GeometryHandle handle = find( p, level, true );
+		for ( unsigned int d = 1; handle == INVALID_GEOMETRY && d < NURBS_LEVELS; ++d )
+		{
+			if ( level + d < NURBS_LEVELS )
+				handle = find( p, level + d, false );
+			if ( handle == INVALID_GEOMETRY && level >= d )
+				handle = find( p, level - d, false );
+			if ( handle != INVALID_GEOMETRY )
+				_stats.fallbacks++;
+		}
+		if ( handle == INVALID_GEOMETRY )
+			continue;
+
+		_visible.push_back( p );
+		_handles.push_back( handle );
+	}
+
+	if ( _visible.empty() )
+		return;
+	_stats.draws += _visible.size();
+
+	unsigned int first_instance;
+	D3DXMATRIX *world = instances->lock( _visible.size(), &first_instance );
+	for ( unsigned int i = 0; i < _visible.size(); ++i )
+		world[i] = _surfaces[_visible[i]]->patch.world;
+	instances->unlock();
+
+	// configure the pipeline - primitive assembly
+	dev->SetVertexDeclaration( _vertex_declaration );
+	_geometry.bind( dev, 1 );
+	dev->SetStreamSourceFreq( 0, D3DSTREAMSOURCE_INDEXEDDATA | 1 );
+	dev->SetStreamSourceFreq( INSTANCE_STREAM, D3DSTREAMSOURCE_INSTANCEDATA | 1 );
+
+	// configure the pipeline - rasterizer
+	// the sheets are seen from both sides
+	dev->SetRenderState( D3DRS_CULLMODE, D3DCULL_NONE );
+
+	// draw (execute the pipeline)
+	for ( unsigned int i = 0; i < _visible.size(); ++i )
+	{
+		instances->bind( dev, first_instance + i );
+		_geometry.draw( dev, _handles[i] );
+	}
+
+	dev->SetRenderState( D3DRS_CULLMODE, D3DCULL_CW );
+	dev->SetStreamSourceFreq( 0, 1 );
+	dev->SetStreamSourceFreq( INSTANCE_STREAM, 1 );
+}
+
+void CNurbsSurfaces::print( std::ostream &out, unsigned int frames ) const
+{
+	unsigned int ready = 0;
+	for ( std::map<unsigned int, CacheEntry>::const_iterator entry = _cache.begin(); entry != _cache.end(); ++entry )
+	{
+		if ( entry->second.handle != INVALID_GEOMETRY )
+			ready++;
+	}
+	out << _surfaces.size() << " NURBS patches, " << ready << " tessellations cached\n";
+	_stats.print( out, frames );
+}
@@ -0,0 +1,142 @@
+#pragma once
+#include <windows.h>
+#include <d3d9.h>
+#include <d3dx9.h>
+#include <iostream>
+#include <cassert>
+#include <vector>
+#include <map>
+#include "tsl/nurbs.hpp"
+#include "CRenderDevice.h"
+#include "CGeometryBuffer.h"
+#include "CInstanceBuffer.h"
+#include "CMpscQueue.h"
+#include "CEntity.h"
+#include "CJobSystem.h"
+
+//Tessellation levels, each doubling the subdivisions of the one before
+#define NURBS_LEVELS 5
+#define NURBS_MIN_SUBDIVISIONS 4
+
+//Frames a tessellation is kept after the last view to ask for it
+#define NURBS_KEEP_FRAMES 120
+
+//One NURBS patch, as tsl::CreateNurbsSurface takes it
+struct NurbsPatch {
+	unsigned int ucount, vcount; // control points in each direction
+	std::vector<float> uknot, vknot;
+	float umin, umax, vmin, vmax;
+	std::vector<tsl::Vector4> control_points; // ucount * vcount, weights near one
+	D3DXMATRIX world; // a rigid placement
+};
+
+//One vertex of a tessellation
+struct NurbsVertex {
+	D3DXVECTOR3 position;
+	D3DXVECTOR3 normal;
+};
+
+//What tessellating and drawing the patches cost
+struct NurbsStats {
+	unsigned int tessellations, triangles; // made by the jobs
+	double tessellate_ms; // in the jobs, summed
+	double upload_ms; // on the render thread
+	unsigned int draws; // patches drawn, over every view
+	unsigned int fallbacks; // of those drawn at another level while theirs was being made
+	unsigned int level_changes; // a view wanting a patch at a new level
+	unsigned int evictions;
+
+	void print( std::ostream &out, unsigned int frames ) const;
+};
+
+//Curved surfaces drawn like entities. Each view picks a patch's level from
+//how large its error would be on screen, or in shadow map texels for a
+//light, and the tessellations are cached by patch and level, so a patch is
+//only tessellated again when a view wants a level it has not got. Missing
+//levels are made by background jobs and uploaded by update on the render
+//thread; until then the nearest level there is is drawn.
+class CNurbsSurfaces {
+private:
+	struct Surface {
+		NurbsPatch patch;
+		D3DXVECTOR3 centre; // bounding sphere in world space
+		float radius;
+		float error; // world space error of one subdivision, shrinking with its square
+		std::vector<unsigned char> levels; // last chosen for each view, NURBS_LEVELS for none
+	};
+
+	struct CacheEntry {
+		GeometryHandle handle; // INVALID_GEOMETRY while it is being tessellated
+		unsigned int last_used; // frame
+	};
+
+	//handed to a job, and back through _done
+	struct Tessellation {
+		QueueNode node; // first, so a popped node is the Tessellation
+		CNurbsSurfaces *surfaces;
+		const Surface *surface;
+		unsigned int patch, level;
+		std::vector<NurbsVertex> vertices;
+		std::vector<unsigned int> indices;
+		double ms;
+	};
+
+	std::vector<Surface*> _surfaces;
+	std::map<unsigned int, CacheEntry> _cache; // by patch * NURBS_LEVELS + level
+	CGeometryBuffer _geometry; // one stream of NurbsVertex
+	IDirect3DVertexDeclaration9* _vertex_declaration; // float position and normal, plus the instance stream
+	float _tolerance; // pixels, or texels, of error allowed
+	unsigned int _frame;
+	NurbsStats _stats;
+	std::vector<unsigned int> _visible; // patches the current draw kept
+	std::vector<GeometryHandle> _handles; // and what each is drawn with
+
+	CJobSystem *_jobs; // NULL until init
+	JobCounter _tessellating; // the tessellations not yet in _done
+	CMpscQueue _done;
+	double _frequency; // performance counter ticks per millisecond
+
+	static void tessellateJob( void *tessellation, unsigned int begin, unsigned int end );
+	static void tessellate( Tessellation *tessellation );
+
+	unsigned int chooseLevel( const Surface &surface, const LodView &view ) const;
+
+	//the handle of a tessellation, INVALID_GEOMETRY if it is not ready. request
+	//starts a job making it when it is not even being made
+	GeometryHandle find( unsigned int patch, unsigned int level, bool request );
+
+	template<typename T>
+	void Release(T** ptr) {
+		if ( *ptr != 0 ) {
+			(*ptr)->Release();
+			*ptr = 0;
+		}
+	}
+
+public:
+	CNurbsSurfaces();
+	~CNurbsSurfaces();
+
+	//a bicubic sheet size across in x and y with points control points a side,
+	//raised by up to height at random
+	static void makeSheet( unsigned int points, float size, float height, unsigned int seed, const D3DXVECTOR3 &position, NurbsPatch *patch );
+
+	//patches may be added before or after init
+	unsigned int add( const NurbsPatch &patch );
+
+	//tolerance is in pixels for the camera and texels for shadow maps
+	bool init( CRenderDevice *dev, CJobSystem *jobs, float tolerance );
+	void clear();
+
+	//upload what the jobs have finished and drop what no view has used in a while
+	void update( CRenderDevice *dev );
+
+	//every patch in the view's frustum at the level it wants, or the nearest one ready.
+	//the caller sets the shaders, which must read float positions and normals
+	void draw( CRenderDevice *dev, CInstanceBuffer *instances, const LodView &view );
+
+	unsigned int numberOfPatches() const { return _surfaces.size(); }
+	const NurbsStats &stats() const { return _stats; }
+
+	void print( std::ostream &out, unsigned int frames ) const;
+};
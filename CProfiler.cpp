@@ -0,0 +1,229 @@
+#include "CProfiler.h"
+#include <vector>
+#include <map>
+#include <string>
+#include <algorithm>
+#include <fstream>
+
+//Written only by its own thread. count is published after the event is, so a
+//reader sees every event below it complete, unless it has since been overwritten
+struct ProfileRing {
+	DWORD thread_id;
+	const char *thread_name;
+	volatile LONG count; // events ever recorded, the newest at ( count - 1 ) % PROFILE_RING_SIZE
+	ProfileEvent events[PROFILE_RING_SIZE];
+};
+
+static DWORD s_ring_slot = TlsAlloc(); // each thread's ProfileRing
+static ProfileRing * volatile s_rings[PROFILE_MAX_THREADS];
+static volatile LONG s_num_rings = 0;
+static const RenderCounters *s_counters = NULL;
+static double s_ticks_per_us = 0.0;
+
+static ProfileRing *threadRing()
+{
+	ProfileRing *ring = (ProfileRing*)TlsGetValue( s_ring_slot );
+	if ( ring != NULL )
+		return ring;
+
+	//a thread past the limit goes unrecorded
+	const LONG slot = InterlockedIncrement( &s_num_rings ) - 1;
+	if ( slot >= PROFILE_MAX_THREADS )
+		return NULL;
+
+	ring = new ProfileRing();
+	ring->thread_id = GetCurrentThreadId();
+	ring->thread_name = NULL;
+	ring->count = 0;
+	s_rings[slot] = ring;
+	TlsSetValue( s_ring_slot, ring );
+	return ring;
+}
+
+LONGLONG CProfiler::now()
+{
+	LARGE_INTEGER now;
+	QueryPerformanceCounter( &now );
+	return now.QuadPart;
+}
+
+void CProfiler::record( const ProfileEvent &event )
+{
+	ProfileRing *ring = threadRing();
+	if ( ring == NULL )
+		return;
+
+	ring->events[ring->count % PROFILE_RING_SIZE] = event;
+	InterlockedIncrement( &ring->count );
+}
+
+void CProfiler::nameThread( const char *name )
+{
+	ProfileRing *ring = threadRing();
+	if ( ring != NULL )
+		ring->thread_name = name;
+}
+
+void CProfiler::setCounters( const RenderCounters *counters )
+{
+	s_counters = counters;
+}
+
+const RenderCounters *CProfiler::counters()
+{
+	return s_counters;
+}
+
+//the events a ring still holds, oldest first
+static void readRing( const ProfileRing *ring, std::vector<ProfileEvent> *events )
+{
+	const LONG count = ring->count;
+	const LONG first = count > PROFILE_RING_SIZE ? count - PROFILE_RING_SIZE : 0;
+	for ( LONG i = first; i < count; ++i )
+		events->push_back( ring->events[i % PROFILE_RING_SIZE] );
+}
+
+static double ticksPerMicrosecond()
+{
+	if ( s_ticks_per_us == 0.0 )
+	{
+		LARGE_INTEGER frequency;
+		QueryPerformanceFrequency( &frequency );
+		s_ticks_per_us = frequency.QuadPart / 1000000.0;
+	}
+	return s_ticks_per_us;
+}
+
+//event names are ours, but keep the JSON valid whatever they hold
+static void writeString( std::ostream &out, const char *s )
+{
+	out << '"';
+	for ( ; *s; ++s )
+	{
+		if ( *s == '"' || *s == '\\' )
+			out << '\\';
+		if ( (unsigned char)*s >= 32 )
+			out << *s;
+	}
+	out << '"';
+}
+
+bool CProfiler::writeTrace( const char *path )
+{
+	std::ofstream out( path );
+	if ( !out )
+		return false;
+
+	const double us = ticksPerMicrosecond();
+	const LONG rings = std::min( (LONG)s_num_rings, (LONG)PROFILE_MAX_THREADS );
+
+	//times are from the earliest event held, so the trace starts at zero
+	LONGLONG origin = 0;
+	bool first_event = true;
+	std::vector< std::vector<ProfileEvent> > events( rings );
+	for ( LONG r = 0; r < rings; ++r )
+	{
+		if ( s_rings[r] == NULL )
+			continue;
+		readRing( s_rings[r], &events[r] );
+		for ( unsigned int e = 0; e < events[r].size(); ++e )
+		{
+			if ( first_event || events[r][e].start < origin )
+				origin = events[r][e].start;
+			first_event = false;
+		}
+	}
+
+	out << "{\"traceEvents\":[\n";
+	bool comma = false;
+	for ( LONG r = 0; r < rings; ++r )
+	{
+		if ( s_rings[r] == NULL )
+			continue;
+		const DWORD tid = s_rings[r]->thread_id;
+
+		if ( s_rings[r]->thread_name != NULL )
+		{
+			out << ( comma ? ",\n" : "" ) << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tid << ",\"args\":{\"name\":";
+			writeString( out, s_rings[r]->thread_name );
+			out << "}}";
+			comma = true;
+		}
+
+		for ( unsigned int e = 0; e < events[r].size(); ++e )
+		{
+			const ProfileEvent &event = events[r][e];
+			out << ( comma ? ",\n" : "" ) << "{\"name\":";
+			writeString( out, event.name );
+			out << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << tid
+				<< ",\"ts\":" << ( event.start - origin ) / us << ",\"dur\":" << ( event.end - event.start ) / us;
+			if ( event.counted )
+			{
+				out << ",\"args\":{\"draws\":" << event.draw_calls << ",\"triangles\":" << event.primitives
+					<< ",\"state changes\":" << event.state_changes << "}";
+			}
+			out << "}";
+			comma = true;
+		}
+	}
+	out << "\n]}\n";
+	return !out.fail();
+}
+
+void CProfiler::printStats( std::ostream &out )
+{
+	//every thread's events, grouped by name
+	struct Stage {
+		std::vector<double> ms;
+		unsigned int counted;
+		double draw_calls, primitives, state_changes;
+		Stage() : counted( 0 ), draw_calls( 0 ), primitives( 0 ), state_changes( 0 ) {}
+	};
+	std::map<std::string, Stage> stages;
+
+	const double ms = ticksPerMicrosecond() * 1000.0;
+	const LONG rings = std::min( (LONG)s_num_rings, (LONG)PROFILE_MAX_THREADS );
+	std::vector<ProfileEvent> events;
+	for ( LONG r = 0; r < rings; ++r )
+	{
+		if ( s_rings[r] == NULL )
+			continue;
+		events.clear();
+		readRing( s_rings[r], &events );
+		for ( unsigned int e = 0; e < events.size(); ++e )
+		{
+			Stage &stage = stages[events[e].name];
+			stage.ms.push_back( ( events[e].end - events[e].start ) / ms );
+			if ( events[e].counted )
+			{
+				stage.counted++;
+				stage.draw_calls += events[e].draw_calls;
+				stage.primitives += events[e].primitives;
+				stage.state_changes += events[e].state_changes;
+			}
+		}
+	}
+
+	out << "Profile, over the last " << PROFILE_RING_SIZE << " events of each thread:\n";
+	for ( std::map<std::string, Stage>::iterator s = stages.begin(); s != stages.end(); ++s )
+	{
+		std::vector<double> &times = s->second.ms;
+		double total = 0.0;
+		for ( unsigned int i = 0; i < times.size(); ++i )
+			total += times[i];
+		const unsigned int p99 = (unsigned int)( ( times.size() - 1 ) * 0.99 );
+		std::nth_element( times.begin(), times.begin() + p99, times.end() );
+		const double p99_ms = times[p99];
+		const double min_ms = *std::min_element( times.begin(), times.end() );
+
+		out << "  " << s->first << ": " << times.size() << " times, min " << min_ms << " ms, avg "
+			<< total / times.size() << " ms, p99 " << p99_ms << " ms";
+		if ( s->second.counted > 0 )
+		{
+			const Stage &stage = s->second;
+			out << ", " << stage.draw_calls / stage.counted << " draws, " << stage.primitives / stage.counted
+				<< " triangles, " << stage.state_changes / stage.counted << " state changes each";
+		}
+		out << "\n";
+	}
+}
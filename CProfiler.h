@@ -0,0 +1,91 @@
+#pragma once
+#include <windows.h>
+#include <iostream>
+#include <cassert>
+#include "CRecordingRenderDevice.h"
+
+//Events kept per thread, the oldest are overwritten
+#define PROFILE_RING_SIZE 16384
+#define PROFILE_MAX_THREADS 64
+
+//One timed scope
+struct ProfileEvent {
+	const char *name; // must outlive the trace, a literal or a string kept until it is written
+	LONGLONG start, end; // performance counter ticks
+	bool counted; // whether the device counts below were taken
+	unsigned int draw_calls, primitives, state_changes; // during the scope, render thread only
+};
+
+//Where scoped timers go. Each thread writes its own ring of events with no
+//locks, and the rings are read back to write a Chrome trace (chrome://tracing)
+//or print the min, average and 99th percentile of each stage over what the
+//rings hold. Reading while other threads record may see their oldest events
+//overwritten, so it is best done once they are idle.
+class CProfiler {
+public:
+	static LONGLONG now();
+
+	//the calling thread's ring, made on first use
+	static void record( const ProfileEvent &event );
+
+	//shown against the calling thread in the trace
+	static void nameThread( const char *name );
+
+	//the recording device's running counts, for scopes on the render thread to
+	//take the draws, triangles and state changes made inside them. NULL for none
+	static void setCounters( const RenderCounters *counters );
+	static const RenderCounters *counters();
+
+	static bool writeTrace( const char *path );
+	static void printStats( std::ostream &out );
+};
+
+//Times the enclosing scope. PROFILE_PASS also takes the device counts, so is
+//for the render thread only
+class CProfileScope {
+private:
+	ProfileEvent _event;
+
+	static unsigned int stateChanges( const RenderCounters &c ) { return c.state_changes + c.shader_changes + c.stream_changes + c.texture_changes + c.target_changes; }
+
+public:
+	CProfileScope( const char *name, bool counted )
+	{
+		_event.name = name;
+		_event.counted = counted && CProfiler::counters() != NULL;
+		if ( _event.counted )
+		{
+			const RenderCounters *c = CProfiler::counters();
+			_event.draw_calls = c->draw_calls;
+			_event.primitives = c->primitives;
+			_event.state_changes = stateChanges( *c );
+		}
+		_event.start = CProfiler::now();
+	}
+
+	~CProfileScope()
+	{
+		_event.end = CProfiler::now();
+		if ( _event.counted )
+		{
+			const RenderCounters *c = CProfiler::counters();
+			_event.draw_calls = c->draw_calls - _event.draw_calls;
+			_event.primitives = c->primitives - _event.primitives;
+			_event.state_changes = stateChanges( *c ) - _event.state_changes;
+		}
+		CProfiler::record( _event );
+	}
+};
+
+#define PROFILE_JOIN2( a, b ) a##b
+#define PROFILE_JOIN( a, b ) PROFILE_JOIN2( a, b )
+
+#ifdef ENABLE_PROFILING
+	#define PROFILE_SCOPE( name ) CProfileScope PROFILE_JOIN( profile_scope_, __LINE__ )( name, false )
+	#define PROFILE_PASS( name ) CProfileScope PROFILE_JOIN( profile_scope_, __LINE__ )( name, true )
+	#define PROFILE_THREAD( name ) CProfiler::nameThread( name )
+#else
+	#define PROFILE_SCOPE( name ) ((void)0)
+	#define PROFILE_PASS( name ) ((void)0)
+	#define PROFILE_THREAD( name ) ((void)0)
+#endif
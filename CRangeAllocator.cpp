@@ -0,0 +1,109 @@
+#include "CRangeAllocator.h"
+#include <cassert>
+
+CRangeAllocator::CRangeAllocator()
+{
+	_capacity = 0;
+	_used = 0;
+}
+
+CRangeAllocator::~CRangeAllocator()
+{
+}
+
+void CRangeAllocator::reset( unsigned int capacity )
+{
+	_free.clear();
+	_capacity = capacity;
+	_used = 0;
+	if ( capacity > 0 )
+	{
+		Range all = { 0, capacity };
+		_free.push_back( all );
+	}
+}
+
+void CRangeAllocator::grow( unsigned int capacity )
+{
+	assert( capacity >= _capacity );
+	const unsigned int old_capacity = _capacity;
+	_capacity = capacity;
+	if ( capacity > old_capacity )
+		free( old_capacity, capacity - old_capacity );
+
+	//free() counted the new space as returned memory
+	_used += capacity - old_capacity;
+}
+
+unsigned int CRangeAllocator::allocate( unsigned int size )
+{
+	if ( size == 0 )
+		return INVALID_RANGE;
+
+	//first fit
+	for ( unsigned int i = 0; i < _free.size(); ++i )
+	{
+		if ( _free[i].size >= size )
+		{
+			const unsigned int offset = _free[i].offset;
+			_free[i].offset += size;
+			_free[i].size -= size;
+			if ( _free[i].size == 0 )
+				_free.erase( _free.begin() + i );
+			_used += size;
+			return offset;
+		}
+	}
+	return INVALID_RANGE;
+}
+
+void CRangeAllocator::free( unsigned int offset, unsigned int size )
+{
+	if ( size == 0 )
+		return;
+	assert( offset + size <= _capacity );
+
+	//find where the range goes in the sorted list
+	unsigned int i = 0;
+	while ( i < _free.size() && _free[i].offset < offset )
+		++i;
+
+	Range range = { offset, size };
+	_free.insert( _free.begin() + i, range );
+	_used -= size;
+
+	//merge with the following range, then the previous one
+	if ( i + 1 < _free.size() && _free[i].offset + _free[i].size == _free[i + 1].offset )
+	{
+		_free[i].size += _free[i + 1].size;
+		_free.erase( _free.begin() + i + 1 );
+	}
+	if ( i > 0 && _free[i - 1].offset + _free[i - 1].size == _free[i].offset )
+	{
+		_free[i - 1].size += _free[i].size;
+		_free.erase( _free.begin() + i );
+	}
+}
+
+void CRangeAllocator::compact( unsigned int used )
+{
+	assert( used <= _capacity );
+	_free.clear();
+	_used = used;
+	if ( used < _capacity )
+	{
+		Range rest = { used, _capacity - used };
+		_free.push_back( rest );
+	}
+}
+
+unsigned int CRangeAllocator::largestFree() const
+{
+	unsigned int largest = 0;
+	for ( unsigned int i = 0; i < _free.size(); ++i )
+	{
+		if ( _free[i].size > largest )
+			largest = _free[i].size;
+	}
+	return largest;
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <vector>
+
+#define INVALID_RANGE 0xFFFFFFFF
+
+//Hands out ranges of a fixed-capacity space (vertices, indices, ...) from a
+//free list kept sorted by offset. Freed ranges are merged with their
+//neighbours, and new requests take the first free range big enough.
+class CRangeAllocator {
+private:
+	struct Range {
+		unsigned int offset;
+		unsigned int size;
+	};
+	std::vector<Range> _free; // sorted by offset, never adjacent
+	unsigned int _capacity;
+	unsigned int _used;
+
+public:
+	CRangeAllocator();
+	~CRangeAllocator();
+
+	void reset( unsigned int capacity );
+	void grow( unsigned int capacity );
+
+	unsigned int allocate( unsigned int size );
+	void free( unsigned int offset, unsigned int size );
+
+	//mark everything below used as allocated and everything above as free,
+	//for after the owner has packed its allocations to the front
+	void compact( unsigned int used );
+
+	unsigned int capacity() const { return _capacity; }
+	unsigned int used() const { return _used; }
+	unsigned int available() const { return _capacity - _used; }
+	unsigned int largestFree() const;
+	unsigned int freeRanges() const { return _free.size(); }
+};
@@ -0,0 +1,381 @@
+#include "CRecordingRenderDevice.h"
+
+void RenderCounters::add( const RenderCounters &other )
+{
+	scenes += other.scenes;
+	clears += other.clears;
+	draw_calls += other.draw_calls;
+	primitives += other.primitives;
+	target_changes += other.target_changes;
+	state_changes += other.state_changes;
+	shader_changes += other.shader_changes;
+	stream_changes += other.stream_changes;
+	texture_changes += other.texture_changes;
+	constant_sets += other.constant_sets;
+	resources_created += other.resources_created;
+	vertex_bytes += other.vertex_bytes;
+}
+
+void RenderCounters::subtract( const RenderCounters &other )
+{
+	scenes -= other.scenes;
+	clears -= other.clears;
+	draw_calls -= other.draw_calls;
+	primitives -= other.primitives;
+	target_changes -= other.target_changes;
+	state_changes -= other.state_changes;
+	shader_changes -= other.shader_changes;
+	stream_changes -= other.stream_changes;
+	texture_changes -= other.texture_changes;
+	constant_sets -= other.constant_sets;
+	resources_created -= other.resources_created;
+	vertex_bytes -= other.vertex_bytes;
+}
+
+void RenderCounters::print( std::ostream &out ) const
+{
+	out << "scenes " << scenes
+		<< ", clears " << clears
+		<< ", draws " << draw_calls
+		<< ", triangles " << primitives
+		<< ", targets " << target_changes
+		<< ", states " << state_changes
+		<< ", shaders " << shader_changes
+		<< ", streams " << stream_changes
+		<< ", textures " << texture_changes
+		<< ", constants " << constant_sets
+		<< ", resources " << resources_created
+		<< ", vertex KB " << vertex_bytes / 1024;
+}
+
+CRecordingRenderDevice::CRecordingRenderDevice( CRenderDevice *inner )
+{
+	assert( inner != NULL );
+	_inner = inner;
+	_log = NULL;
+	_frames = 0;
+
+	StreamState unbound = { false, 0, 1 };
+	_streams.assign( 16, unbound );
+}
+
+CRecordingRenderDevice::~CRecordingRenderDevice()
+{
+	delete _inner;
+	_inner = NULL;
+}
+
+void CRecordingRenderDevice::log( const char *call )
+{
+	if ( _log != NULL )
+		*_log << call << "\n";
+}
+
+void CRecordingRenderDevice::printSummary( std::ostream &out ) const
+{
+	out << "Recorded " << _frames << " frames\n";
+	if ( _frames == 0 )
+		return;
+
+	out << "  last frame: ";
+	_last_frame.print( out );
+	out << "\n  per frame:  draws " << _total.draw_calls / _frames
+		<< ", triangles " << _total.primitives / _frames
+		<< ", states " << _total.state_changes / _frames
+		<< ", constants " << _total.constant_sets / _frames
+		<< ", vertex KB " << _total.vertex_bytes / _frames / 1024 << "\n";
+
+	//events with the same name, such as one shadow pass per light, are summed
+	for ( std::map<std::string, RenderCounters>::const_iterator e = _event_totals.begin(); e != _event_totals.end(); ++e )
+	{
+		out << "  " << e->first << " per frame: draws " << e->second.draw_calls / _frames
+			<< ", triangles " << e->second.primitives / _frames
+			<< ", vertex KB " << e->second.vertex_bytes / _frames / 1024 << "\n";
+	}
+}
+
+HRESULT CRecordingRenderDevice::TestCooperativeLevel()
+{
+	return _inner->TestCooperativeLevel();
+}
+
+HRESULT CRecordingRenderDevice::Reset( D3DPRESENT_PARAMETERS *pp )
+{
+	log( "Reset" );
+	return _inner->Reset( pp );
+}
+
+HRESULT CRecordingRenderDevice::Present( const RECT *source, const RECT *dest, HWND window, const void *dirty )
+{
+	log( "Present" );
+
+	//close off the frame
+	_last_frame = _frame;
+	_total.add( _frame );
+	_frame.reset();
+	_frames++;
+
+	return _inner->Present( source, dest, window, dirty );
+}
+
+HRESULT CRecordingRenderDevice::BeginScene()
+{
+	log( "BeginScene" );
+	_frame.scenes++;
+	return _inner->BeginScene();
+}
+
+HRESULT CRecordingRenderDevice::EndScene()
+{
+	log( "EndScene" );
+	return _inner->EndScene();
+}
+
+HRESULT CRecordingRenderDevice::Clear( DWORD count, const D3DRECT *rects, DWORD flags, D3DCOLOR colour, float z, DWORD stencil )
+{
+	log( "Clear" );
+	_frame.clears++;
+	return _inner->Clear( count, rects, flags, colour, z, stencil );
+}
+
+HRESULT CRecordingRenderDevice::GetViewport( D3DVIEWPORT9 *viewport )
+{
+	return _inner->GetViewport( viewport );
+}
+
+///////////////////////
+//Resource creation  //
+///////////////////////
+
+HRESULT CRecordingRenderDevice::GetRenderTarget( DWORD index, IDirect3DSurface9 **surface )
+{
+	return _inner->GetRenderTarget( index, surface );
+}
+
+HRESULT CRecordingRenderDevice::GetDepthStencilSurface( IDirect3DSurface9 **surface )
+{
+	return _inner->GetDepthStencilSurface( surface );
+}
+
+HRESULT CRecordingRenderDevice::CreateDepthStencilSurface( UINT width, UINT height, D3DFORMAT format, D3DMULTISAMPLE_TYPE multisample, DWORD quality, BOOL discard, IDirect3DSurface9 **surface, HANDLE *shared )
+{
+	log( "CreateDepthStencilSurface" );
+	_frame.resources_created++;
+	return _inner->CreateDepthStencilSurface( width, height, format, multisample, quality, discard, surface, shared );
+}
+
+HRESULT CRecordingRenderDevice::CreateTexture( UINT width, UINT height, UINT levels, DWORD usage, D3DFORMAT format, D3DPOOL pool, IDirect3DTexture9 **texture, HANDLE *shared )
+{
+	log( "CreateTexture" );
+	_frame.resources_created++;
+	return _inner->CreateTexture( width, height, levels, usage, format, pool, texture, shared );
+}
+
+HRESULT CRecordingRenderDevice::CreateVertexBuffer( UINT length, DWORD usage, DWORD fvf, D3DPOOL pool, IDirect3DVertexBuffer9 **buffer, HANDLE *shared )
+{
+	log( "CreateVertexBuffer" );
+	_frame.resources_created++;
+	return _inner->CreateVertexBuffer( length, usage, fvf, pool, buffer, shared );
+}
+
+HRESULT CRecordingRenderDevice::CreateIndexBuffer( UINT length, DWORD usage, D3DFORMAT format, D3DPOOL pool, IDirect3DIndexBuffer9 **buffer, HANDLE *shared )
+{
+	log( "CreateIndexBuffer" );
+	_frame.resources_created++;
+	return _inner->CreateIndexBuffer( length, usage, format, pool, buffer, shared );
+}
+
+HRESULT CRecordingRenderDevice::CreateVertexDeclaration( const D3DVERTEXELEMENT9 *elements, IDirect3DVertexDeclaration9 **declaration )
+{
+	log( "CreateVertexDeclaration" );
+	_frame.resources_created++;
+	return _inner->CreateVertexDeclaration( elements, declaration );
+}
+
+HRESULT CRecordingRenderDevice::CreateVertexShader( const DWORD *function, IDirect3DVertexShader9 **shader )
+{
+	log( "CreateVertexShader" );
+	_frame.resources_created++;
+	return _inner->CreateVertexShader( function, shader );
+}
+
+HRESULT CRecordingRenderDevice::CreatePixelShader( const DWORD *function, IDirect3DPixelShader9 **shader )
+{
+	log( "CreatePixelShader" );
+	_frame.resources_created++;
+	return _inner->CreatePixelShader( function, shader );
+}
+
+//////////////////////
+//Pipeline state    //
+//////////////////////
+
+HRESULT CRecordingRenderDevice::SetRenderTarget( DWORD index, IDirect3DSurface9 *surface )
+{
+	log( "SetRenderTarget" );
+	_frame.target_changes++;
+	return _inner->SetRenderTarget( index, surface );
+}
+
+HRESULT CRecordingRenderDevice::SetDepthStencilSurface( IDirect3DSurface9 *surface )
+{
+	log( "SetDepthStencilSurface" );
+	_frame.target_changes++;
+	return _inner->SetDepthStencilSurface( surface );
+}
+
+HRESULT CRecordingRenderDevice::SetVertexDeclaration( IDirect3DVertexDeclaration9 *declaration )
+{
+	log( "SetVertexDeclaration" );
+	_frame.stream_changes++;
+	return _inner->SetVertexDeclaration( declaration );
+}
+
+HRESULT CRecordingRenderDevice::SetStreamSource( UINT stream, IDirect3DVertexBuffer9 *buffer, UINT offset, UINT stride )
+{
+	log( "SetStreamSource" );
+	_frame.stream_changes++;
+	if ( stream < _streams.size() )
+	{
+		//the null device hands out NULL buffers, so a stream counts as bound by its
+		//stride, which unbinding always sets to zero
+		_streams[stream].bound = buffer != NULL || stride != 0;
+		_streams[stream].stride = stride;
+	}
+	return _inner->SetStreamSource( stream, buffer, offset, stride );
+}
+
+HRESULT CRecordingRenderDevice::SetStreamSourceFreq( UINT stream, UINT setting )
+{
+	log( "SetStreamSourceFreq" );
+	_frame.stream_changes++;
+	if ( stream < _streams.size() )
+		_streams[stream].frequency = setting;
+	return _inner->SetStreamSourceFreq( stream, setting );
+}
+
+HRESULT CRecordingRenderDevice::SetIndices( IDirect3DIndexBuffer9 *buffer )
+{
+	log( "SetIndices" );
+	_frame.stream_changes++;
+	return _inner->SetIndices( buffer );
+}
+
+HRESULT CRecordingRenderDevice::SetVertexShader( IDirect3DVertexShader9 *shader )
+{
+	log( "SetVertexShader" );
+	_frame.shader_changes++;
+	return _inner->SetVertexShader( shader );
+}
+
+HRESULT CRecordingRenderDevice::SetPixelShader( IDirect3DPixelShader9 *shader )
+{
+	log( "SetPixelShader" );
+	_frame.shader_changes++;
+	return _inner->SetPixelShader( shader );
+}
+
+HRESULT CRecordingRenderDevice::SetRenderState( D3DRENDERSTATETYPE state, DWORD value )
+{
+	log( "SetRenderState" );
+	_frame.state_changes++;
+	return _inner->SetRenderState( state, value );
+}
+
+HRESULT CRecordingRenderDevice::SetSamplerState( DWORD sampler, D3DSAMPLERSTATETYPE state, DWORD value )
+{
+	log( "SetSamplerState" );
+	_frame.state_changes++;
+	return _inner->SetSamplerState( sampler, state, value );
+}
+
+HRESULT CRecordingRenderDevice::SetTexture( DWORD stage, IDirect3DBaseTexture9 *texture )
+{
+	log( "SetTexture" );
+	_frame.texture_changes++;
+	return _inner->SetTexture( stage, texture );
+}
+
+////////////////////////
+//Shader constants    //
+////////////////////////
+
+HRESULT CRecordingRenderDevice::SetMatrix( ID3DXConstantTable *table, D3DXHANDLE constant, const D3DXMATRIX *matrix )
+{
+	log( "SetMatrix" );
+	_frame.constant_sets++;
+	return _inner->SetMatrix( table, constant, matrix );
+}
+
+HRESULT CRecordingRenderDevice::SetVector( ID3DXConstantTable *table, D3DXHANDLE constant, const D3DXVECTOR4 *vector )
+{
+	log( "SetVector" );
+	_frame.constant_sets++;
+	return _inner->SetVector( table, constant, vector );
+}
+
+HRESULT CRecordingRenderDevice::SetFloat( ID3DXConstantTable *table, D3DXHANDLE constant, float value )
+{
+	log( "SetFloat" );
+	_frame.constant_sets++;
+	return _inner->SetFloat( table, constant, value );
+}
+
+HRESULT CRecordingRenderDevice::SetFloatArray( ID3DXConstantTable *table, D3DXHANDLE constant, const float *values, UINT count )
+{
+	log( "SetFloatArray" );
+	_frame.constant_sets++;
+	return _inner->SetFloatArray( table, constant, values, count );
+}
+
+HRESULT CRecordingRenderDevice::DrawIndexedPrimitive( D3DPRIMITIVETYPE type, INT base_vertex, UINT min_index, UINT num_vertices, UINT start_index, UINT primitive_count )
+{
+	log( "DrawIndexedPrimitive" );
+	_frame.draw_calls++;
+	_frame.primitives += primitive_count;
+
+	//geometry streams are read once per vertex per instance, instance streams once per instance
+	UINT instances = 1;
+	if ( _streams[0].frequency & D3DSTREAMSOURCE_INDEXEDDATA )
+		instances = _streams[0].frequency & ~( D3DSTREAMSOURCE_INDEXEDDATA | D3DSTREAMSOURCE_INSTANCEDATA );
+	for ( unsigned int s = 0; s < _streams.size(); ++s )
+	{
+		if ( !_streams[s].bound )
+			continue;
+		if ( _streams[s].frequency & D3DSTREAMSOURCE_INSTANCEDATA )
+			_frame.vertex_bytes += (unsigned long long)instances * _streams[s].stride;
+		else
+			_frame.vertex_bytes += (unsigned long long)instances * num_vertices * _streams[s].stride;
+	}
+
+	return _inner->DrawIndexedPrimitive( type, base_vertex, min_index, num_vertices, start_index, primitive_count );
+}
+
+void CRecordingRenderDevice::BeginEvent( const char *name )
+{
+	log( name );
+
+	//names are often std::string buffers rather than literals, so the text at a
+	//pointer is compared before its totals are trusted, and looked up again if it changed
+	std::map<const char*, EventTotals::iterator>::iterator found = _event_names.find( name );
+	if ( found == _event_names.end() )
+		found = _event_names.insert( std::make_pair( name, _event_totals.insert( std::make_pair( std::string( name ), RenderCounters() ) ).first ) ).first;
+	else if ( strcmp( found->second->first.c_str(), name ) != 0 )
+		found->second = _event_totals.insert( std::make_pair( std::string( name ), RenderCounters() ) ).first;
+
+	EventState event;
+	event.total = &found->second->second;
+	event.start = _frame;
+	_events.push_back( event );
+	_inner->BeginEvent( name );
+}
+
+void CRecordingRenderDevice::EndEvent()
+{
+	assert( "CRecordingRenderDevice::EndEvent without BeginEvent" && !_events.empty() );
+	RenderCounters counters = _frame;
+	counters.subtract( _events.back().start );
+	_events.back().total->add( counters );
+	_events.pop_back();
+	_inner->EndEvent();
+}
@@ -0,0 +1,119 @@
+#pragma once
+#include <cstring>
+#include <string>
+#include <vector>
+#include <map>
+#include "CRenderDevice.h"
+
+//Per-frame call counts gathered by CRecordingRenderDevice
+struct RenderCounters {
+	unsigned int scenes; // BeginScene calls
+	unsigned int clears;
+	unsigned int draw_calls;
+	unsigned int primitives; // triangles submitted
+	unsigned int target_changes; // render target and depth surface binds
+	unsigned int state_changes; // render and sampler states
+	unsigned int shader_changes;
+	unsigned int stream_changes; // declarations, vertex streams and index buffers
+	unsigned int texture_changes;
+	unsigned int constant_sets;
+	unsigned int resources_created;
+	unsigned long long vertex_bytes; // fetched by draws from the bound streams, assuming each vertex in range is read once per instance
+
+	RenderCounters() { reset(); }
+	void reset() { memset( this, 0, sizeof(RenderCounters) ); }
+	void add( const RenderCounters &other );
+	void subtract( const RenderCounters &other );
+	void print( std::ostream &out ) const;
+};
+
+//Wraps another device, counting (and optionally logging) every call before
+//passing it on. Wrap a CNullRenderDevice to measure the CPU cost of a frame
+//with the GPU out of the loop, or a CD3D9RenderDevice to see what the real
+//device is being asked to do.
+class CRecordingRenderDevice : public CRenderDevice {
+private:
+	CRenderDevice *_inner; // the device doing the actual work, owned by this object
+	std::ostream *_log; // when set, every call is written here as it happens
+
+	RenderCounters _frame; // counts since the last Present
+	RenderCounters _last_frame; // counts for the most recently presented frame
+	RenderCounters _total; // counts for every presented frame
+	unsigned int _frames; // number of presented frames
+
+	//what draws would fetch, per vertex stream
+	struct StreamState {
+		bool bound; // to a buffer, or on the null device to a non-zero stride
+		UINT stride;
+		UINT frequency;
+	};
+	std::vector<StreamState> _streams;
+
+	//counts per named event, summed over every frame
+	struct EventState {
+		RenderCounters *total; // in _event_totals
+		RenderCounters start; // _frame when the event began
+	};
+	std::vector<EventState> _events; // the events currently open
+	typedef std::map<std::string, RenderCounters> EventTotals;
+	EventTotals _event_totals; // by name, as the events are told apart
+	std::map<const char*, EventTotals::iterator> _event_names; // the totals last found for each pointer a name came in, so steady frames copy no names. Checked against the text, as an address may be reused for another name
+
+	void log( const char *call );
+
+public:
+	CRecordingRenderDevice( CRenderDevice *inner );
+	~CRecordingRenderDevice();
+
+	void setLog( std::ostream *log ) { _log = log; }
+
+	const RenderCounters &frame() const { return _frame; }
+	const RenderCounters &lastFrame() const { return _last_frame; }
+	const RenderCounters &total() const { return _total; }
+	unsigned int frames() const { return _frames; }
+
+	const std::map<std::string, RenderCounters> &eventTotals() const { return _event_totals; }
+
+	void printSummary( std::ostream &out ) const;
+
+	HRESULT TestCooperativeLevel();
+	HRESULT Reset( D3DPRESENT_PARAMETERS *pp );
+	HRESULT Present( const RECT *source, const RECT *dest, HWND window, const void *dirty );
+
+	HRESULT BeginScene();
+	HRESULT EndScene();
+	HRESULT Clear( DWORD count, const D3DRECT *rects, DWORD flags, D3DCOLOR colour, float z, DWORD stencil );
+	HRESULT GetViewport( D3DVIEWPORT9 *viewport );
+
+	HRESULT GetRenderTarget( DWORD index, IDirect3DSurface9 **surface );
+	HRESULT GetDepthStencilSurface( IDirect3DSurface9 **surface );
+	HRESULT CreateDepthStencilSurface( UINT width, UINT height, D3DFORMAT format, D3DMULTISAMPLE_TYPE multisample, DWORD quality, BOOL discard, IDirect3DSurface9 **surface, HANDLE *shared );
+	HRESULT CreateTexture( UINT width, UINT height, UINT levels, DWORD usage, D3DFORMAT format, D3DPOOL pool, IDirect3DTexture9 **texture, HANDLE *shared );
+	HRESULT CreateVertexBuffer( UINT length, DWORD usage, DWORD fvf, D3DPOOL pool, IDirect3DVertexBuffer9 **buffer, HANDLE *shared );
+	HRESULT CreateIndexBuffer( UINT length, DWORD usage, D3DFORMAT format, D3DPOOL pool, IDirect3DIndexBuffer9 **buffer, HANDLE *shared );
+	HRESULT CreateVertexDeclaration( const D3DVERTEXELEMENT9 *elements, IDirect3DVertexDeclaration9 **declaration );
+	HRESULT CreateVertexShader( const DWORD *function, IDirect3DVertexShader9 **shader );
+	HRESULT CreatePixelShader( const DWORD *function, IDirect3DPixelShader9 **shader );
+
+	HRESULT SetRenderTarget( DWORD index, IDirect3DSurface9 *surface );
+	HRESULT SetDepthStencilSurface( IDirect3DSurface9 *surface );
+	HRESULT SetVertexDeclaration( IDirect3DVertexDeclaration9 *declaration );
+	HRESULT SetStreamSource( UINT stream, IDirect3DVertexBuffer9 *buffer, UINT offset, UINT stride );
+	HRESULT SetStreamSourceFreq( UINT stream, UINT setting );
+	HRESULT SetIndices( IDirect3DIndexBuffer9 *buffer );
+	HRESULT SetVertexShader( IDirect3DVertexShader9 *shader );
+	HRESULT SetPixelShader( IDirect3DPixelShader9 *shader );
+	HRESULT SetRenderState( D3DRENDERSTATETYPE state, DWORD value );
+	HRESULT SetSamplerState( DWORD sampler, D3DSAMPLERSTATETYPE state, DWORD value );
+	HRESULT SetTexture( DWORD stage, IDirect3DBaseTexture9 *texture );
+
+	HRESULT SetMatrix( ID3DXConstantTable *table, D3DXHANDLE constant, const D3DXMATRIX *matrix );
+	HRESULT SetVector( ID3DXConstantTable *table, D3DXHANDLE constant, const D3DXVECTOR4 *vector );
+	HRESULT SetFloat( ID3DXConstantTable *table, D3DXHANDLE constant, float value );
+	HRESULT SetFloatArray( ID3DXConstantTable *table, D3DXHANDLE constant, const float *values, UINT count );
+
+	HRESULT DrawIndexedPrimitive( D3DPRIMITIVETYPE type, INT base_vertex, UINT min_index, UINT num_vertices, UINT start_index, UINT primitive_count );
+
+	void BeginEvent( const char *name );
+	void EndEvent();
+};
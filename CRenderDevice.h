@@ -0,0 +1,63 @@
+#pragma once
+#include <windows.h>
+#include <d3d9.h>
+#include <d3dx9.h>
+#include <iostream>
+#include <cassert>
+
+//The subset of IDirect3DDevice9 the framework renders through.
+//Method names and arguments mirror Direct3D so the call sites read the same,
+//but shader constants are also set through the device (rather than handing
+//the constant table an IDirect3DDevice9) so a backend never needs a real one.
+class CRenderDevice {
+public:
+	virtual ~CRenderDevice() {}
+
+	//device lifetime
+	virtual HRESULT TestCooperativeLevel() = 0;
+	virtual HRESULT Reset( D3DPRESENT_PARAMETERS *pp ) = 0;
+	virtual HRESULT Present( const RECT *source, const RECT *dest, HWND window, const void *dirty ) = 0;
+
+	//scene
+	virtual HRESULT BeginScene() = 0;
+	virtual HRESULT EndScene() = 0;
+	virtual HRESULT Clear( DWORD count, const D3DRECT *rects, DWORD flags, D3DCOLOR colour, float z, DWORD stencil ) = 0;
+	virtual HRESULT GetViewport( D3DVIEWPORT9 *viewport ) = 0;
+
+	//resource creation
+	virtual HRESULT GetRenderTarget( DWORD index, IDirect3DSurface9 **surface ) = 0;
+	virtual HRESULT GetDepthStencilSurface( IDirect3DSurface9 **surface ) = 0;
+	virtual HRESULT CreateDepthStencilSurface( UINT width, UINT height, D3DFORMAT format, D3DMULTISAMPLE_TYPE multisample, DWORD quality, BOOL discard, IDirect3DSurface9 **surface, HANDLE *shared ) = 0;
+	virtual HRESULT CreateTexture( UINT width, UINT height, UINT levels, DWORD usage, D3DFORMAT format, D3DPOOL pool, IDirect3DTexture9 **texture, HANDLE *shared ) = 0;
+	virtual HRESULT CreateVertexBuffer( UINT length, DWORD usage, DWORD fvf, D3DPOOL pool, IDirect3DVertexBuffer9 **buffer, HANDLE *shared ) = 0;
+	virtual HRESULT CreateIndexBuffer( UINT length, DWORD usage, D3DFORMAT format, D3DPOOL pool, IDirect3DIndexBuffer9 **buffer, HANDLE *shared ) = 0;
+	virtual HRESULT CreateVertexDeclaration( const D3DVERTEXELEMENT9 *elements, IDirect3DVertexDeclaration9 **declaration ) = 0;
+	virtual HRESULT CreateVertexShader( const DWORD *function, IDirect3DVertexShader9 **shader ) = 0;
+	virtual HRESULT CreatePixelShader( const DWORD *function, IDirect3DPixelShader9 **shader ) = 0;
+
+	//pipeline state
+	virtual HRESULT SetRenderTarget( DWORD index, IDirect3DSurface9 *surface ) = 0;
+	virtual HRESULT SetDepthStencilSurface( IDirect3DSurface9 *surface ) = 0;
+	virtual HRESULT SetVertexDeclaration( IDirect3DVertexDeclaration9 *declaration ) = 0;
+	virtual HRESULT SetStreamSource( UINT stream, IDirect3DVertexBuffer9 *buffer, UINT offset, UINT stride ) = 0;
+	virtual HRESULT SetStreamSourceFreq( UINT stream, UINT setting ) = 0;
+	virtual HRESULT SetIndices( IDirect3DIndexBuffer9 *buffer ) = 0;
+	virtual HRESULT SetVertexShader( IDirect3DVertexShader9 *shader ) = 0;
+	virtual HRESULT SetPixelShader( IDirect3DPixelShader9 *shader ) = 0;
+	virtual HRESULT SetRenderState( D3DRENDERSTATETYPE state, DWORD value ) = 0;
+	virtual HRESULT SetSamplerState( DWORD sampler, D3DSAMPLERSTATETYPE state, DWORD value ) = 0;
+	virtual HRESULT SetTexture( DWORD stage, IDirect3DBaseTexture9 *texture ) = 0;
+
+	//shader constants
+	virtual HRESULT SetMatrix( ID3DXConstantTable *table, D3DXHANDLE constant, const D3DXMATRIX *matrix ) = 0;
+	virtual HRESULT SetVector( ID3DXConstantTable *table, D3DXHANDLE constant, const D3DXVECTOR4 *vector ) = 0;
+	virtual HRESULT SetFloat( ID3DXConstantTable *table, D3DXHANDLE constant, float value ) = 0;
+	virtual HRESULT SetFloatArray( ID3DXConstantTable *table, D3DXHANDLE constant, const float *values, UINT count ) = 0;
+
+	//draw
+	virtual HRESULT DrawIndexedPrimitive( D3DPRIMITIVETYPE type, INT base_vertex, UINT min_index, UINT num_vertices, UINT start_index, UINT primitive_count ) = 0;
+
+	//named regions of a frame, as D3DPERF_BeginEvent/D3DPERF_EndEvent
+	virtual void BeginEvent( const char *name ) = 0;
+	virtual void EndEvent() = 0;
+};
@@ -0,0 +1,133 @@
+#include "CRenderTargetPool.h"
+
+//bytes per texel of the formats the framework renders to
+static unsigned int formatSize( D3DFORMAT format )
+{
+	switch ( format )
+	{
+	case D3DFMT_G32R32F:
+	case D3DFMT_A16B16G16R16F:
+		return 8;
+	default:
+		return 4;
+	}
+}
+
+CRenderTargetPool::CRenderTargetPool()
+{
+}
+
+CRenderTargetPool::~CRenderTargetPool()
+{
+	releaseAll();
+}
+
+void CRenderTargetPool::beginAssignment()
+{
+	for ( unsigned int i = 0; i < _targets.size(); ++i )
+	{
+		_targets[i].claimed = false;
+		_targets[i].used = false;
+	}
+}
+
+unsigned int CRenderTargetPool::acquire( const RenderTargetDesc &desc )
+{
+	//reuse a free slot with a matching description, so its memory is aliased
+	for ( unsigned int i = 0; i < _targets.size(); ++i )
+	{
+		if ( !_targets[i].claimed && _targets[i].desc == desc )
+		{
+			_targets[i].claimed = true;
+			_targets[i].used = true;
+			return i;
+		}
+	}
+
+	//otherwise grow the pool
+	Target target;
+	target.desc = desc;
+	target.texture = NULL;
+	target.surface = NULL;
+	target.claimed = true;
+	target.used = true;
+	_targets.push_back( target );
+	return _targets.size() - 1;
+}
+
+void CRenderTargetPool::release( unsigned int slot )
+{
+	assert( _targets[slot].claimed );
+	_targets[slot].claimed = false;
+}
+
+void CRenderTargetPool::endAssignment()
+{
+	//drop the memory of slots the new graph no longer needs
+	for ( unsigned int i = 0; i < _targets.size(); ++i )
+	{
+		if ( !_targets[i].used )
+		{
+			Release( &_targets[i].surface );
+			Release( &_targets[i].texture );
+		}
+	}
+}
+
+bool CRenderTargetPool::allocate( CRenderDevice *dev )
+{
+	bool ok = true;
+	for ( unsigned int i = 0; i < _targets.size(); ++i )
+	{
+		Target &target = _targets[i];
+		if ( !target.used || target.surface != NULL )
+			continue;
+
+		if ( target.desc.depth )
+		{
+			if ( FAILED( dev->CreateDepthStencilSurface( target.desc.width, target.desc.height,
+				target.desc.format, D3DMULTISAMPLE_NONE, 0, TRUE, &target.surface, NULL ) ) )
+				ok = false;
+		}
+		else
+		{
+			if ( FAILED( dev->CreateTexture( target.desc.width, target.desc.height, 1, D3DUSAGE_RENDERTARGET,
+				target.desc.format, D3DPOOL_DEFAULT, &target.texture, NULL ) ) )
+				ok = false;
+			else if ( target.texture )
+				target.texture->GetSurfaceLevel( 0, &target.surface );
+		}
+	}
+	return ok;
+}
+
+void CRenderTargetPool::releaseAll()
+{
+	for ( unsigned int i = 0; i < _targets.size(); ++i )
+	{
+		Release( &_targets[i].surface );
+		Release( &_targets[i].texture );
+	}
+}
+
+unsigned int CRenderTargetPool::count() const
+{
+	unsigned int count = 0;
+	for ( unsigned int i = 0; i < _targets.size(); ++i )
+	{
+		if ( _targets[i].used )
+			count++;
+	}
+	return count;
+}
+
+unsigned int CRenderTargetPool::bytes() const
+{
+	unsigned int bytes = 0;
+	for ( unsigned int i = 0; i < _targets.size(); ++i )
+	{
+		if ( _targets[i].used )
+			bytes += _targets[i].desc.width * _targets[i].desc.height * formatSize( _targets[i].desc.format );
+	}
+	return bytes;
+}
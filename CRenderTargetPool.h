@@ -0,0 +1,64 @@
+#pragma once
+#include <windows.h>
+#include <d3d9.h>
+#include <d3dx9.h>
+#include <iostream>
+#include <cassert>
+#include <vector>
+#include "CRenderDevice.h"
+
+//Describes a render target the frame graph can place in the pool
+struct RenderTargetDesc {
+	UINT width, height;
+	D3DFORMAT format;
+	bool depth; // a depth stencil surface rather than a colour texture
+
+	bool operator==( const RenderTargetDesc &other ) const {
+		return width == other.width && height == other.height && format == other.format && depth == other.depth;
+	}
+};
+
+//Owns the physical render targets behind the frame graph's transient resources.
+//Slots are handed out by description, so two resources whose lifetimes do not
+//overlap can share one slot. The slot list outlives device resets: only the
+//Direct3D objects are released (D3DPOOL_DEFAULT objects must go before Reset),
+//and they are recreated from the same descriptions afterwards.
+class CRenderTargetPool {
+private:
+	struct Target {
+		RenderTargetDesc desc;
+		IDirect3DTexture9 *texture; // colour targets only
+		IDirect3DSurface9 *surface; // the colour texture's top level, or the depth surface
+		bool claimed; // currently held by a resource while compiling
+		bool used; // claimed at least once by the last compile
+	};
+	std::vector<Target> _targets;
+
+	template<typename T>
+	void Release(T** ptr) {
+		if ( *ptr != 0 ) {
+			(*ptr)->Release();
+			*ptr = 0;
+		}
+	}
+
+public:
+	CRenderTargetPool();
+	~CRenderTargetPool();
+
+	//slot assignment, driven by CFrameGraph::compile
+	void beginAssignment();
+	unsigned int acquire( const RenderTargetDesc &desc );
+	void release( unsigned int slot );
+	void endAssignment();
+
+	//Direct3D object lifetime
+	bool allocate( CRenderDevice *dev );
+	void releaseAll();
+
+	IDirect3DTexture9 *texture( unsigned int slot ) const { return _targets[slot].texture; }
+	IDirect3DSurface9 *surface( unsigned int slot ) const { return _targets[slot].surface; }
+
+	unsigned int count() const;
+	unsigned int bytes() const;
+};
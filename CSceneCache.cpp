@@ -0,0 +1,253 @@
+#include "CSceneCache.h"
+#include <fstream>
+#include <cstring>
+
+CSceneCache::CSceneCache()
+{
+	_data = NULL;
+	_size = 0;
+}
+
+CSceneCache::~CSceneCache()
+{
+	close();
+}
+
+//FNV-1a, carried on from hash
+static unsigned int hashBytes( unsigned int hash, const void *data, unsigned int bytes )
+{
+	const unsigned char *p = (const unsigned char*)data;
+	for ( unsigned int i = 0; i < bytes; ++i )
+		hash = ( hash ^ p[i] ) * 16777619u;
+	return hash;
+}
+
+SceneCacheKey::SceneCacheKey() : _hash( 2166136261u )
+{
+}
+
+void SceneCacheKey::add( const void *data, unsigned int bytes )
+{
+	_hash = hashBytes( _hash, data, bytes );
+}
+
+//with its terminator, so "ab" then "c" is not "a" then "bc"
+void SceneCacheKey::add( const char *text )
+{
+	add( text, strlen( text ) + 1 );
+}
+
+bool SceneCacheKey::addFile( const char *path )
+{
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	if ( !GetFileAttributesEx( path, GetFileExInfoStandard, &attributes ) )
+		return false;
+
+	add( path );
+	add( (unsigned int)attributes.nFileSizeHigh );
+	add( (unsigned int)attributes.nFileSizeLow );
+	add( (unsigned int)attributes.ftLastWriteTime.dwHighDateTime );
+	add( (unsigned int)attributes.ftLastWriteTime.dwLowDateTime );
+	return true;
+}
+
+bool CSceneCache::open( const char *path, unsigned int source_hash )
+{
+	close();
+
+	//too short for a header, or too big for our 32 bit offsets
+	if ( !_file.open( path ) || _file.size() < sizeof(SceneCacheHeader) )
+	{
+		close();
+		return false;
+	}
+	_data = _file.data();
+	_size = _file.size();
+
+	if ( !validate( source_hash ) )
+	{
+		close();
+		return false;
+	}
+	return true;
+}
+
+void CSceneCache::close()
+{
+	_file.close();
+	_data = NULL;
+	_size = 0;
+}
+
+//Whether an array of count elements at offset lies inside a file of size bytes
+static bool fits( unsigned int offset, unsigned int count, unsigned int element, unsigned int size )
+{
+	return offset <= size && count <= ( size - offset ) / element;
+}
+
+//Whether every index of an array is below num_vertices
+template<typename T>
+static bool indicesInRange( const T *indices, unsigned int count, unsigned int num_vertices )
+{
+	for ( unsigned int i = 0; i < count; ++i )
+	{
+		if ( indices[i] >= num_vertices )
+			return false;
+	}
+	return true;
+}
+
+bool CSceneCache::validate( unsigned int source_hash ) const
+{
+	const SceneCacheHeader *h = header();
+	if ( h->magic != SCENE_CACHE_MAGIC || h->version != SCENE_CACHE_VERSION || h->file_size != _size || h->source_hash != source_hash )
+		return false;
+
+	//a build that lays the structures out differently cannot read the file as it is
+	if ( h->shape_size != sizeof(Shape) || h->light_size != sizeof(Light) || h->packed_size != sizeof(PackedMeshHeader)
+		|| h->level_size != sizeof(PackedLevel) || h->meshlet_size != sizeof(Meshlet) )
+		return false;
+
+	if ( h->num_shapes < SCENE_CACHE_MIN_SHAPES || h->num_lights < SCENE_CACHE_MIN_LIGHTS )
+		return false;
+
+	if ( !fits( h->meshes, h->num_meshes, sizeof(SceneCacheMesh), _size )
+		|| !fits( h->shapes, h->num_shapes, sizeof(Shape), _size )
+		|| !fits( h->lights, h->num_lights, sizeof(Light), _size ) )
+		return false;
+
+	for ( unsigned int i = 0; i < h->num_meshes; ++i )
+	{
+		const SceneCacheMesh *m = mesh( i );
+		if ( !fits( m->vertices, m->num_vertices, sizeof(Float3), _size ) || !fits( m->normals, m->num_vertices, sizeof(Float3), _size )
+			|| !fits( m->indices, m->num_indices, sizeof(unsigned int), _size ) || !fits( m->packed, 1, sizeof(PackedMeshHeader), _size ) )
+			return false;
+
+		//anything that would read outside the arrays later fails here instead, and the scene is made again
+		if ( !indicesInRange( (const unsigned int*)( _data + m->indices ), m->num_indices, m->num_vertices ) )
+			return false;
+
+		const PackedMeshHeader *packed = packedMesh( i );
+		if ( packed->size < sizeof(PackedMeshHeader) || !fits( m->packed, packed->size, 1, _size )
+			|| !fits( packed->levels, packed->num_levels, sizeof(PackedLevel), packed->size )
+			|| !fits( packed->meshlets, packed->num_meshlets, sizeof(Meshlet), packed->size ) )
+			return false;
+
+		const PackedLevel *levels = (const PackedLevel*)( (const unsigned char*)packed + packed->levels );
+		for ( unsigned int l = 0; l < packed->num_levels; ++l )
+		{
+			const unsigned int index_size = CGeometryBuffer::indexSize( CGeometryBuffer::indexWidth( levels[l].num_vertices ) );
+			if ( !fits( levels[l].positions, levels[l].num_vertices, sizeof(CMesh::Position), packed->size )
+				|| !fits( levels[l].attributes, levels[l].num_vertices, sizeof(CMesh::Attributes), packed->size )
+				|| !fits( levels[l].indices, levels[l].num_indices, index_size, packed->size ) )
+				return false;
+
+			const unsigned char *indices = (const unsigned char*)packed + levels[l].indices;
+			if ( index_size == sizeof(unsigned short) ? !indicesInRange( (const unsigned short*)indices, levels[l].num_indices, levels[l].num_vertices )
+				: !indicesInRange( (const unsigned int*)indices, levels[l].num_indices, levels[l].num_vertices ) )
+				return false;
+		}
+
+		//meshlets are ranges of level 0's indices
+		const Meshlet *meshlets = (const Meshlet*)( (const unsigned char*)packed + packed->meshlets );
+		for ( unsigned int t = 0; t < packed->num_meshlets; ++t )
+		{
+			if ( packed->num_levels == 0 || meshlets[t].first_index > levels[0].num_indices
+				|| meshlets[t].num_triangles > ( levels[0].num_indices - meshlets[t].first_index ) / 3 )
+				return false;
+		}
+	}
+
+	const Shape *shapes = (const Shape*)( _data + h->shapes );
+	for ( unsigned int i = 0; i < h->num_shapes; ++i )
+	{
+		if ( shapes[i].meshIndex >= h->num_meshes )
+			return false;
+	}
+	return true;
+}
+
+SceneDelegate *CSceneCache::createScene( SceneAnimator *animator ) const
+{
+	assert( isOpen() );
+	const SceneCacheHeader *h = header();
+
+	//the delegate reads the meshes where they lie in the mapping
+	std::vector<MeshView> meshes( h->num_meshes );
+	for ( unsigned int i = 0; i < h->num_meshes; ++i )
+	{
+		const SceneCacheMesh *m = mesh( i );
+		meshes[i].vertexArray = (const Float3*)( _data + m->vertices );
+		meshes[i].normalArray = (const Float3*)( _data + m->normals );
+		meshes[i].numberOfVertices = m->num_vertices;
+		meshes[i].indexArray = (const unsigned int*)( _data + m->indices );
+		meshes[i].numberOfIndices = m->num_indices;
+	}
+
+	const Shape *shapes = (const Shape*)( _data + h->shapes );
+	const Light *lights = (const Light*)( _data + h->lights );
+	return new SceneDelegate( meshes, std::vector<Shape>( shapes, shapes + h->num_shapes ), std::vector<Light>( lights, lights + h->num_lights ), animator );
+}
+
+//Append an array to the file being built at the next 16 byte boundary, returning its offset
+static unsigned int appendArray( std::vector<unsigned char> *file, const void *data, unsigned int bytes )
+{
+	const unsigned int offset = ( file->size() + 15 ) & ~15u;
+	file->resize( offset + bytes );
+	if ( bytes > 0 )
+		memcpy( &(*file)[offset], data, bytes );
+	return offset;
+}
+
+bool CSceneCache::write( const char *path, SceneDelegate *scene, const std::vector<Shape> &shapes, const std::vector<Light> &lights,
+	const std::vector<const PackedMeshHeader*> &packed, unsigned int source_hash )
+{
+	assert( packed.size() == scene->numberOfMeshes() );
+
+	SceneCacheHeader header;
+	memset( &header, 0, sizeof(header) );
+	header.magic = SCENE_CACHE_MAGIC;
+	header.version = SCENE_CACHE_VERSION;
+	header.source_hash = source_hash;
+	header.shape_size = sizeof(Shape);
+	header.light_size = sizeof(Light);
+	header.packed_size = sizeof(PackedMeshHeader);
+	header.level_size = sizeof(PackedLevel);
+	header.meshlet_size = sizeof(Meshlet);
+
+	std::vector<unsigned char> file;
+	appendArray( &file, &header, sizeof(header) );
+
+	//the mesh table is filled in as the meshes are placed
+	std::vector<SceneCacheMesh> table( scene->numberOfMeshes() );
+	header.num_meshes = table.size();
+	header.meshes = appendArray( &file, table.empty() ? NULL : &table[0], table.size() * sizeof(SceneCacheMesh) );
+
+	for ( unsigned int i = 0; i < table.size(); ++i )
+	{
+		const MeshView mesh = scene->meshViewAtIndex( i );
+		table[i].num_vertices = mesh.numberOfVertices;
+		table[i].vertices = appendArray( &file, mesh.vertexArray, mesh.numberOfVertices * sizeof(Float3) );
+		table[i].normals = appendArray( &file, mesh.normalArray, mesh.numberOfVertices * sizeof(Float3) );
+		table[i].num_indices = mesh.numberOfIndices;
+		table[i].indices = appendArray( &file, mesh.indexArray, mesh.numberOfIndices * sizeof(unsigned int) );
+		table[i].packed = appendArray( &file, packed[i], packed[i]->size );
+	}
+
+	header.num_shapes = shapes.size();
+	header.shapes = appendArray( &file, shapes.empty() ? NULL : &shapes[0], shapes.size() * sizeof(Shape) );
+
+	header.num_lights = lights.size();
+	header.lights = appendArray( &file, lights.empty() ? NULL : &lights[0], lights.size() * sizeof(Light) );
+
+	header.file_size = file.size();
+	memcpy( &file[0], &header, sizeof(header) );
+	if ( !table.empty() )
+		memcpy( &file[header.meshes], &table[0], table.size() * sizeof(SceneCacheMesh) );
+
+	std::ofstream out( path, std::ios::binary | std::ios::trunc );
+	if ( !out )
+		return false;
+	out.write( (const char*)&file[0], file.size() );
+	return out.good();
+}
@@ -0,0 +1,97 @@
+#pragma once
+#include <windows.h>
+#include <d3d9.h>
+#include <d3dx9.h>
+#include <iostream>
+#include <cassert>
+#include <vector>
+#include "SceneDelegate.hpp"
+#include "CMesh.h"
+#include "CMappedFile.h"
+
+//Bump whenever the file layout, or the code the mesh cache packs a mesh with,
+//changes. Older files are then regenerated. What the scene is made from, and
+//the packer's constants, are caught by the source hash
+#define SCENE_CACHE_MAGIC 0x43504733 // "3GPC"
+#define SCENE_CACHE_VERSION 4
+
+//The scene's animation reads these, so a cache with fewer is made again
+#define SCENE_CACHE_MIN_SHAPES 4
+#define SCENE_CACHE_MIN_LIGHTS 1
+
+//The start of a scene cache file. Offsets are in bytes from the start of the
+//file, every array starts on a 16 byte boundary
+struct SceneCacheHeader {
+	unsigned int magic, version;
+	unsigned int source_hash; // of what the scene and its packing were made from, see SceneCacheKey
+	unsigned int file_size;
+	unsigned int shape_size, light_size, packed_size, level_size, meshlet_size; // sizeof each stored structure
+	unsigned int num_meshes, meshes; // count and offset of the SceneCacheMesh table
+	unsigned int num_shapes, shapes;
+	unsigned int num_lights, lights;
+};
+
+//One mesh: the scene's own data, and the same packed ready for the GPU
+struct SceneCacheMesh {
+	unsigned int num_vertices, vertices, normals; // Float3 arrays
+	unsigned int num_indices, indices;
+	unsigned int packed; // offset of a PackedMeshHeader block
+};
+
+//What a cached scene was made from, such as the generator's settings or the
+//file imported and when it was last written, and the packer's settings. It is
+//worked out before any of the scene is made, so a hit costs nothing more
+class SceneCacheKey {
+private:
+	unsigned int _hash;
+
+public:
+	SceneCacheKey();
+
+	void add( const void *data, unsigned int bytes );
+	void add( unsigned int value ) { add( &value, sizeof(value) ); }
+	void add( float value ) { add( &value, sizeof(value) ); }
+	void add( const char *text );
+
+	//a file by its path, size and last write time, false if it can not be found
+	bool addFile( const char *path );
+
+	unsigned int hash() const { return _hash; }
+};
+
+//A scene and its meshes as packed by the mesh cache, in one file that is
+//memory mapped and used where it lies: nothing is parsed, and the packed
+//blobs are copied straight from the mapping into the locked buffers.
+class CSceneCache {
+private:
+	CMappedFile _file;
+	const unsigned char *_data; // the mapped file, NULL when closed
+	unsigned int _size;
+
+	const SceneCacheHeader *header() const { return (const SceneCacheHeader*)_data; }
+	const SceneCacheMesh *mesh( unsigned int i ) const { return (const SceneCacheMesh*)( _data + header()->meshes ) + i; }
+
+	bool validate( unsigned int source_hash ) const;
+
+public:
+	CSceneCache();
+	~CSceneCache();
+
+	//map a cache file, false if it is missing, truncated, inconsistent, written
+	//by another version or made from another source than source_hash
+	bool open( const char *path, unsigned int source_hash );
+	void close();
+	bool isOpen() const { return _data != NULL; }
+
+	//a scene delegate reading the stored scene in place, so the cache must stay
+	//open until the delegate is deleted. animator moves it, or 0 for the built in animation
+	SceneDelegate *createScene( SceneAnimator *animator ) const;
+
+	unsigned int numberOfMeshes() const { return header()->num_meshes; }
+	const PackedMeshHeader *packedMesh( unsigned int i ) const { return (const PackedMeshHeader*)( _data + mesh( i )->packed ); }
+
+	//write a scene's meshes out with each one's packed block as made by the mesh
+	//cache, and the shapes and lights as the scene was made, before any animation
+	static bool write( const char *path, SceneDelegate *scene, const std::vector<Shape> &shapes, const std::vector<Light> &lights,
+		const std::vector<const PackedMeshHeader*> &packed, unsigned int source_hash );
+};
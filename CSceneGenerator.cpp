@@ -0,0 +1,168 @@
+#include "CSceneGenerator.h"
+#include "tsl/tsl.hpp"
+#include <cmath>
+
+//meshes besides the floor, one of each primitive
+#define GENERATOR_PRIMITIVES 4
+
+SceneGeneratorSettings::SceneGeneratorSettings() :
+	shapes( 10000 ), scatter( false ), spacing( 4.0f ), moving( 0.1f ),
+	lights( 100 ), min_cone( 0.2f ), max_cone( 0.8f ), seed( 1 )
+{
+}
+
+CSceneGenerator::CSceneGenerator() : _extent( 0.0f ), _random( 1 )
+{
+}
+
+//the same generator as the NURBS sheets, so a seed means the same everywhere
+float CSceneGenerator::random( float low, float high )
+{
+	_random = _random * 1664525 + 1013904223;
+	return low + ( high - low ) * ( _random >> 8 ) / 16777216.0f;
+}
+
+void CSceneGenerator::addMesh( tsl::IndexedMesh *primitive )
+{
+	tsl::ConvertPolygonsToTriangles( primitive );
+
+	_meshes.push_back( Mesh() );
+	Mesh &mesh = _meshes.back();
+	mesh.vertexArray.assign( (const Float3*)&primitive->vertex_array.front(), (const Float3*)&primitive->vertex_array.back() + 1 );
+	mesh.normalArray.assign( (const Float3*)&primitive->normal_array.front(), (const Float3*)&primitive->normal_array.back() + 1 );
+	mesh.indexArray.assign( primitive->index_array.begin(), primitive->index_array.end() );
+
+	for ( unsigned int i = 0; i < mesh.normalArray.size(); ++i )
+	{
+		Float3 &n = mesh.normalArray[i];
+		const float length = sqrtf( n.x * n.x + n.y * n.y + n.z * n.z );
+		if ( length > 0.0f )
+			n = Float3( n.x / length, n.y / length, n.z / length );
+	}
+}
+
+SceneDelegate *CSceneGenerator::generate( const SceneGeneratorSettings &settings )
+{
+	std::vector<Shape> shapes;
+	std::vector<Light> lights;
+	layOut( settings, &shapes, &lights );
+
+	//the floor is the first mesh, its top at zero
+	_meshes.clear();
+	const unsigned int primitives = GENERATOR_PRIMITIVES;
+	tsl::IndexedMesh meshes[1 + primitives];
+	tsl::CreateBox( _extent + settings.spacing, _extent + settings.spacing, 1.0f, 10, &meshes[0] );
+	tsl::CreateCube( 2.0f, 2, &meshes[1] );
+	tsl::CreateSphere( 1.0f, 10, &meshes[2] );
+	tsl::CreateCone( 1.0f, 2.0f, 10, &meshes[3] );
+	tsl::CreateCylinder( 1.0f, 2.0f, 10, &meshes[4] );
+	for ( unsigned int m = 0; m <= primitives; ++m )
+		addMesh( &meshes[m] );
+
+	//views of the meshes, which stay put now they are all made
+	_views.resize( _meshes.size() );
+	for ( unsigned int m = 0; m < _meshes.size(); ++m )
+	{
+		_views[m].vertexArray = &_meshes[m].vertexArray[0];
+		_views[m].normalArray = &_meshes[m].normalArray[0];
+		_views[m].numberOfVertices = _meshes[m].vertexArray.size();
+		_views[m].indexArray = &_meshes[m].indexArray[0];
+		_views[m].numberOfIndices = _meshes[m].indexArray.size();
+	}
+
+	return new SceneDelegate( _views, shapes, lights, this );
+}
+
+void CSceneGenerator::layOut( const SceneGeneratorSettings &settings, std::vector<Shape> *shapes_out, std::vector<Light> *lights_out )
+{
+	assert( settings.shapes > 0 && settings.spacing > 0.0f && settings.min_cone <= settings.max_cone );
+	_settings = settings;
+	_random = settings.seed;
+	_moving.clear();
+	_spotlights.clear();
+
+	//a grid as near square as the shapes allow, and the same area when scattered
+	const unsigned int side = (unsigned int)ceil( sqrt( (double)settings.shapes ) );
+	_extent = side * settings.spacing;
+	const float half = _extent * 0.5f;
+	const unsigned int primitives = GENERATOR_PRIMITIVES;
+
+	std::vector<Shape> &shapes = *shapes_out;
+	shapes.assign( 1 + settings.shapes, Shape() );
+	shapes[0].meshIndex = 0;
+	shapes[0].position = Float3( 0, 0, -0.5f );
+	for ( unsigned int i = 0; i < settings.shapes; ++i )
+	{
+		Shape &shape = shapes[1 + i];
+		shape.meshIndex = 1 + (unsigned int)random( 0.0f, (float)primitives );
+		if ( shape.meshIndex > primitives )
+			shape.meshIndex = primitives;
+
+		//on a cell's centre, or anywhere on the floor
+		if ( settings.scatter )
+			shape.position = Float3( random( -half, half ), random( -half, half ), 1.0f );
+		else
+			shape.position = Float3( ( i % side + 0.5f ) * settings.spacing - half, ( i / side + 0.5f ) * settings.spacing - half, 1.0f );
+		shape.rotation = Float3( 0, 0, random( 0.0f, 2.0f * D3DX_PI ) );
+
+		if ( random( 0.0f, 1.0f ) < settings.moving )
+		{
+			MovingShape moving;
+			moving.shape = 1 + i;
+			moving.position = shape.position;
+			moving.rotation = shape.rotation;
+			moving.height = random( 0.5f, 3.0f );
+			moving.speed = random( 0.5f, 2.0f );
+			moving.phase = random( 0.0f, 2.0f * D3DX_PI );
+			_moving.push_back( moving );
+		}
+	}
+
+	//each light circles a point on the floor, looking down at it
+	std::vector<Light> &lights = *lights_out;
+	lights.assign( settings.lights, Light() );
+	_spotlights.resize( settings.lights );
+	for ( unsigned int l = 0; l < settings.lights; ++l )
+	{
+		Spotlight &spot = _spotlights[l];
+		spot.centre = Float3( random( -half, half ), random( -half, half ), 0.0f );
+		spot.radius = random( 2.0f, 10.0f );
+		spot.height = random( 8.0f, 20.0f );
+		spot.speed = random( 0.1f, 0.5f ) * ( random( 0.0f, 1.0f ) < 0.5f ? -1.0f : 1.0f );
+		spot.phase = random( 0.0f, 2.0f * D3DX_PI );
+
+		lights[l].coneAngle = random( settings.min_cone, settings.max_cone );
+		lights[l].intensity = random( 0.3f, 0.8f );
+	}
+}
+
+void CSceneGenerator::animate( float time, std::vector<Shape> &shapes, std::vector<Light> &lights )
+{
+	for ( unsigned int i = 0; i < _moving.size(); ++i )
+	{
+		const MovingShape &moving = _moving[i];
+		Shape &shape = shapes[moving.shape];
+		const float angle = moving.speed * time + moving.phase;
+		shape.position = Float3( moving.position.x, moving.position.y, moving.position.z + moving.height * fabsf( sinf( angle ) ) );
+		shape.rotation = Float3( moving.rotation.x, moving.rotation.y, moving.rotation.z + angle );
+	}
+
+	for ( unsigned int l = 0; l < _spotlights.size(); ++l )
+	{
+		const Spotlight &spot = _spotlights[l];
+		const float angle = spot.speed * time + spot.phase;
+		const Float3 position( spot.centre.x + spot.radius * cosf( angle ), spot.centre.y + spot.radius * sinf( angle ), spot.height );
+		const Float3 to( spot.centre.x - position.x, spot.centre.y - position.y, spot.centre.z - position.z );
+		const float length = sqrtf( to.x * to.x + to.y * to.y + to.z * to.z );
+		lights[l].position = position;
+		lights[l].direction = Float3( to.x / length, to.y / length, to.z / length );
+	}
+}
+
+void CSceneGenerator::print( std::ostream &out ) const
+{
+	out << "Generated " << _settings.shapes << " shapes, " << _moving.size() << " moving, "
+		<< ( _settings.scatter ? "scattered" : "on a grid" ) << " over " << _extent << " units, under "
+		<< _settings.lights << " spotlights with cones of " << _settings.min_cone << " to " << _settings.max_cone
+		<< " radians, seed " << _settings.seed << "\n";
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <windows.h>
+#include <d3d9.h>
+#include <d3dx9.h>
+#include <iostream>
+#include <cassert>
+#include <vector>
+#include "tsl/geometry.hpp"
+#include "SceneDelegate.hpp"
+
+//How a generated scene is laid out
+struct SceneGeneratorSettings {
+	unsigned int shapes;
+	bool scatter; // placed at random over the floor, rather than on a grid
+	float spacing; // between grid cells, or on average between scattered shapes
+	float moving; // the fraction of shapes that bob and spin, the rest never move
+	unsigned int lights; // spotlights circling above the floor
+	float min_cone, max_cone; // radians, as Light::coneAngle
+	unsigned int seed; // the same seed always makes the same scene
+
+	SceneGeneratorSettings();
+};
+
+//Builds scenes of any size from the tsl primitives, to see how culling,
+//batching and shadows scale. Shapes stand on a floor on a grid or scattered,
+//some moving, under spotlights that circle with cones of varied width. The
+//generator animates the scenes it makes, so must outlive them.
+class CSceneGenerator : public SceneAnimator {
+private:
+	struct MovingShape {
+		unsigned int shape;
+		Float3 position, rotation; // at rest
+		float height, speed, phase; // of the bob, and the spin goes at speed too
+	};
+
+	struct Spotlight {
+		Float3 centre; // on the floor, which the light circles and points at
+		float radius, height, speed, phase;
+	};
+
+	std::vector<Mesh> _meshes; // the floor then one of each primitive
+	std::vector<MeshView> _views;
+	std::vector<MovingShape> _moving;
+	std::vector<Spotlight> _spotlights;
+	SceneGeneratorSettings _settings;
+	float _extent; // across the floor
+	unsigned int _random;
+
+	float random( float low, float high );
+	void addMesh( tsl::IndexedMesh *mesh );
+
+public:
+	CSceneGenerator();
+
+	//the scene it makes reads this generator's meshes, so a second call must
+	//wait until the first scene is gone
+	SceneDelegate *generate( const SceneGeneratorSettings &settings );
+
+	//place the shapes and lights, and plan how they move, without making any
+	//meshes. Enough to animate the same scene read from a cache
+	void layOut( const SceneGeneratorSettings &settings, std::vector<Shape> *shapes, std::vector<Light> *lights );
+
+	void animate( float time, std::vector<Shape> &shapes, std::vector<Light> &lights );
+
+	void print( std::ostream &out ) const;
+};
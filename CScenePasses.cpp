@@ -0,0 +1,227 @@
+#include "CScenePasses.h"
+#include "CProfiler.h"
+
+//Bind the mesh streams the pass reads once, issue one instanced draw per
+//batch, then put the stream frequencies back
+static void drawBatches( CRenderDevice *dev, ScenePassContext *context, std::vector<CInstanceBatch*> &batches, unsigned int streams, const LodView &view, ID3DXConstantTable *vertex_constants, MeshletCullStats *culling )
+{
+	PROFILE_PASS( "draw batches" );
+	context->meshes->geometry()->bind( dev, streams );
+
+	for( std::vector<CInstanceBatch*>::iterator batch = batches.begin(); batch != batches.end(); ++batch ) 
+	{
+		(*batch)->draw( dev, context->instances, view, vertex_constants, culling, context->jobs, context->arena );
+	}
+
+	for ( unsigned int stream = 0; stream < MESH_STREAMS; ++stream )
+		dev->SetStreamSourceFreq( stream, 1 );
+	dev->SetStreamSourceFreq( INSTANCE_STREAM, 1 );
+}
+
+//The water and NURBS surfaces have float vertices, so they are drawn with a
+//variant of the pass's vertex shader and the position decode left as
+//identity. The pixel shader and its constants stay as the pass set them
+static void drawFloatGeometry( CRenderDevice *dev, ScenePassContext *context, CShader *shader, const LodView &view )
+{
+	const bool water = context->water != NULL && context->water->ready();
+	const bool nurbs = context->nurbs != NULL && context->nurbs->numberOfPatches() > 0;
+	if ( !water && !nurbs )
+		return;
+
+	PROFILE_PASS( "draw float geometry" );
+
+	D3DXVECTOR4 unit_scale( 1.0f, 1.0f, 1.0f, 1.0f ), zero_bias( 0.0f, 0.0f, 0.0f, 0.0f );
+	dev->SetVertexShader( shader->vertex() );
+	dev->SetMatrix( shader->vertex_constants(), "view_projection_xform", &view.view_projection );
+	dev->SetVector( shader->vertex_constants(), "position_scale", &unit_scale );
+	dev->SetVector( shader->vertex_constants(), "position_bias", &zero_bias );
+
+	if ( water )
+		context->water->draw( dev, context->instances );
+	if ( nurbs )
+		context->nurbs->draw( dev, context->instances, view );
+}
+
+//Levels of detail for the camera passes are chosen by size on screen,
+//meshlets are culled against the camera's frustum
+static LodView cameraView( CFirstPersonCamera *camera, const D3DVIEWPORT9 &viewport )
+{
+	const D3DXMATRIX projection = camera->ProjectionTransformation( (float)viewport.Width / (float)viewport.Height );
+	const D3DXVECTOR4 position = camera->getPosition();
+
+	LodView view;
+	view.index = 0;
+	view.eye = D3DXVECTOR3( position.x, position.y, position.z );
+	view.pixel_scale = projection._22 * viewport.Height * 0.5f;
+	view.view_projection = camera->ViewTransformation() * projection;
+	return view;
+}
+
+//and for a shadow pass by size in the light's shadow map
+static LodView lightView( const CLightTable &lights, unsigned int light_index )
+{
+	LodView view;
+	view.index = 1 + light_index;
+	view.eye = lights.position( light_index );
+	view.pixel_scale = lights.pixelScale( light_index );
+	view.view_projection = lights.viewProjection( light_index );
+	return view;
+}
+
+void CAmbientPass::execute( CRenderDevice *dev, CFrameGraph *graph )
+{
+	CShader *ambient = _context->ambient;
+	CFirstPersonCamera *camera = _context->camera;
+
+	// if shaders compiled correctly
+	if ( !ambient->isCompiled() )
+		return;
+
+	D3DVIEWPORT9 viewport;
+	dev->GetViewport( &viewport );
+
+	// compute the view and projection matrices using the camera object,
+	// the world matrix comes from each instance
+	D3DXMATRIX view_projection_xform = camera->ViewTransformation( ) * camera->ProjectionTransformation( (float)viewport.Width / (float)viewport.Height );
+
+	// configure the pipeline - primitive assembly
+	dev->SetVertexDeclaration( _context->meshes->declaration() );
+
+	// configure the pipeline - vertex shader
+	dev->SetVertexShader( ambient->vertex() );
+	dev->SetMatrix( ambient->vertex_constants(), "view_projection_xform", &view_projection_xform );
+
+	// configure the pipeline - rasterizer
+	dev->SetRenderState( D3DRS_CULLMODE, D3DCULL_CW );
+
+	dev->SetRenderState(D3DRS_ZENABLE, TRUE);
+	dev->SetRenderState(D3DRS_ZWRITEENABLE, TRUE);
+	dev->SetRenderState(D3DRS_ZFUNC, D3DCMP_LESSEQUAL);
+
+	dev->SetRenderState(D3DRS_ALPHABLENDENABLE, FALSE); 
+
+	// configure the pipeline - pixel shader
+	dev->SetPixelShader( ambient->pixel() );
+	dev->SetVector( ambient->pixel_constants(), "camera_position", &camera->getPosition() );
+
+	// draw (execute the pipeline)
+	const LodView view = cameraView( camera, viewport );
+	drawBatches( dev, _context, *_context->batches, MESH_STREAMS, view, ambient->vertex_constants(), &_context->camera_culling );
+	drawFloatGeometry( dev, _context, _context->float_ambient, view );
+}
+
+void CShadowPass::execute( CRenderDevice *dev, CFrameGraph *graph )
+{
+	CShader *shadow = _context->shadow;
+
+	// if shaders compiled correctly
+	if ( !shadow->isCompiled() )
+		return;
+
+	// the view projection matrix from the lights perspective, made with the rest of the frame's
+	const CLightTable &lights = _context->light_table;
+	const D3DXMATRIX &view_projection_xform = lights.viewProjection( _light_index );
+
+	// configure the pipeline - primitive assembly
+	// only the positions are needed to render depth
+	dev->SetVertexDeclaration( _context->meshes->positionDeclaration() );
+
+	// configure the pipeline - vertex shader
+	dev->SetVertexShader( shadow->vertex() );
+	dev->SetMatrix( shadow->vertex_constants(), "view_projection_xform", &view_projection_xform );
+
+	// configure the pipeline - rasterizer
+	dev->SetRenderState( D3DRS_CULLMODE, D3DCULL_CW );
+
+	dev->SetRenderState(D3DRS_ZENABLE, TRUE);
+	dev->SetRenderState(D3DRS_ZWRITEENABLE, TRUE);
+	dev->SetRenderState(D3DRS_ZFUNC, D3DCMP_LESSEQUAL);
+
+	dev->SetRenderState(D3DRS_ALPHABLENDENABLE, FALSE); 
+
+	// configure the pipeline - pixel shader
+	dev->SetPixelShader( shadow->pixel() );
+
+	// draw (execute the pipeline)
+	const LodView view = lightView( lights, _light_index );
+	drawBatches( dev, _context, *_context->shadow_batches, POSITION_STREAM + 1, view, shadow->vertex_constants(), &_context->shadow_culling );
+
+	// the static casters are already in world space, culled against the light
+	D3DXVECTOR4 unit_scale( 1.0f, 1.0f, 1.0f, 1.0f ), zero_bias( 0.0f, 0.0f, 0.0f, 0.0f );
+	dev->SetVector( shadow->vertex_constants(), "position_scale", &unit_scale );
+	dev->SetVector( shadow->vertex_constants(), "position_bias", &zero_bias );
+	{
+		PROFILE_PASS( "static shadows" );
+		_context->static_shadows->draw( dev, _context->instances, lights.frustum( _light_index ), view.eye, &_context->shadow_culling );
+	}
+	drawFloatGeometry( dev, _context, shadow, view );
+}
+
+void CLightingPass::execute( CRenderDevice *dev, CFrameGraph *graph )
+{
+	CShader *lighting = _context->light;
+	CFirstPersonCamera *camera = _context->camera;
+
+	// if shaders compiled correctly
+	if ( !lighting->isCompiled() )
+		return;
+
+	const CLightTable &lights = _context->light_table;
+	const LightConstants &light = lights.constants( _light_index );
+
+	D3DVIEWPORT9 viewport;
+	dev->GetViewport( &viewport );
+
+	D3DXMATRIX view_projection_xform = camera->ViewTransformation( ) * camera->ProjectionTransformation( (float)viewport.Width / (float)viewport.Height );
+
+	// configure the pipeline - primitive assembly
+	dev->SetVertexDeclaration( _context->meshes->declaration() );
+
+	// configure the pipeline - vertex shader
+	dev->SetVertexShader( lighting->vertex() );
+	dev->SetMatrix( lighting->vertex_constants(), "view_projection_xform", &view_projection_xform );
+
+	// configure the pipeline - rasterizer
+	dev->SetRenderState( D3DRS_CULLMODE, D3DCULL_CW );
+
+	dev->SetRenderState(D3DRS_ZENABLE, TRUE);
+	dev->SetRenderState(D3DRS_ZWRITEENABLE, FALSE);
+	dev->SetRenderState(D3DRS_ZFUNC, D3DCMP_EQUAL);
+
+	dev->SetRenderState(D3DRS_ALPHABLENDENABLE, TRUE); 
+	dev->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_ONE);
+	dev->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_ONE);
+
+	// configure the pipeline - pixel shader
+	ID3DXConstantTable *_pixel_shader_constants = lighting->pixel_constants();
+
+	dev->SetPixelShader( lighting->pixel() );
+	dev->SetVector( _pixel_shader_constants, "camera_position", &camera->getPosition() );
+	dev->SetVector( _pixel_shader_constants, "light_position", &light.position );
+	dev->SetMatrix( _pixel_shader_constants, "light_view_projection_xform", &lights.viewProjection( _light_index ) );
+	dev->SetFloat( _pixel_shader_constants, "texture_size", MAP_SIZE );
+
+	// the spotlight's cone is passed as cosines, so the shader need not work them out per pixel
+	D3DXHANDLE hSpots = _pixel_shader_constants->GetConstantByName(0, "spot_light");
+	D3DXHANDLE hLight = _pixel_shader_constants->GetConstantElement(hSpots, 0);
+	dev->SetFloatArray( _pixel_shader_constants, _pixel_shader_constants->GetConstantByName(hLight, "position"), &light.position.x, 3);
+	dev->SetFloatArray( _pixel_shader_constants, _pixel_shader_constants->GetConstantByName(hLight, "direction"), &light.direction.x, 3);
+	dev->SetFloat( _pixel_shader_constants, _pixel_shader_constants->GetConstantByName(hLight, "cos_outer"), light.cos_outer);
+	dev->SetFloat( _pixel_shader_constants, _pixel_shader_constants->GetConstantByName(hLight, "cos_inner"), light.cos_inner);
+	dev->SetFloat( _pixel_shader_constants, _pixel_shader_constants->GetConstantByName(hLight, "intensity"), light.intensity);
+
+	dev->SetTexture( 0, graph->texture( _shadow_map ) );
+	dev->SetSamplerState( 0, D3DSAMP_ADDRESSU, D3DTADDRESS_BORDER );
+	dev->SetSamplerState( 0, D3DSAMP_ADDRESSV, D3DTADDRESS_BORDER );
+	dev->SetSamplerState( 0, D3DSAMP_MAGFILTER, D3DTEXF_POINT );
+	dev->SetSamplerState( 0, D3DSAMP_MINFILTER, D3DTEXF_POINT );
+	dev->SetSamplerState( 0, D3DSAMP_MIPFILTER, D3DTEXF_NONE );
+
+	// draw (execute the pipeline)
+	const LodView view = cameraView( camera, viewport );
+	drawBatches( dev, _context, *_context->batches, MESH_STREAMS, view, lighting->vertex_constants(), &_context->camera_culling );
+	drawFloatGeometry( dev, _context, _context->float_light, view );
+
+	// the shadow map is about to be rendered to again
+	dev->SetTexture( 0, NULL );
+}
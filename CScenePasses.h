@@ -0,0 +1,72 @@
+#pragma once
+#include <windows.h>
+#include <d3d9.h>
+#include <d3dx9.h>
+#include <iostream>
+#include <cassert>
+#include <vector>
+#include "SceneDelegate.hpp"
+
+#include "CFirstPersonCamera.h"
+#include "CShader.h"
+#include "CLight.h"
+#include "CLightTable.h"
+#include "CMeshCache.h"
+#include "CInstanceBatch.h"
+#include "CInstanceBuffer.h"
+#include "CFrameGraph.h"
+#include "CStaticShadowBatcher.h"
+#include "CWater.h"
+#include "CNurbsSurfaces.h"
+#include "CJobSystem.h"
+#include "CFrameArena.h"
+
+//What the scene passes draw, shared by all of them
+struct ScenePassContext {
+	std::vector<CInstanceBatch*> *batches;
+	std::vector<CInstanceBatch*> *shadow_batches; // only the entities that move
+	CStaticShadowBatcher *static_shadows; // everything else, merged
+	CInstanceBuffer *instances; // appended to by every pass
+	CMeshCache *meshes;
+	CFirstPersonCamera *camera;
+	SceneDelegate *scene;
+	std::vector<Light> lights; // as this frame draws them, which may be between simulation steps
+	CLightTable light_table; // their matrices and shader constants, made from lights each frame
+	CShader *light, *shadow, *ambient;
+	CWater *water; // NULL when there is none
+	CNurbsSurfaces *nurbs;
+	CShader *float_light, *float_ambient; // as light and ambient, reading float normals
+	CJobSystem *jobs; // shares out the CPU work of drawing
+	CFrameArena *arena; // for what a pass works out and throws away, reset every frame
+	MeshletCullStats camera_culling, shadow_culling; // added to by every frame
+};
+
+//Draws every entity lit only by the camera's point light, laying down depth
+class CAmbientPass : public CRenderPass {
+private:
+	ScenePassContext *_context;
+public:
+	CAmbientPass( ScenePassContext *context ) : _context( context ) {}
+	void execute( CRenderDevice *dev, CFrameGraph *graph );
+};
+
+//Renders one light's shadow map
+class CShadowPass : public CRenderPass {
+private:
+	ScenePassContext *_context;
+	unsigned int _light_index;
+public:
+	CShadowPass( ScenePassContext *context, unsigned int light_index ) : _context( context ), _light_index( light_index ) {}
+	void execute( CRenderDevice *dev, CFrameGraph *graph );
+};
+
+//Adds one light's contribution to the frame using its shadow map
+class CLightingPass : public CRenderPass {
+private:
+	ScenePassContext *_context;
+	unsigned int _light_index;
+	FrameResource _shadow_map;
+public:
+	CLightingPass( ScenePassContext *context, unsigned int light_index, FrameResource shadow_map ) : _context( context ), _light_index( light_index ), _shadow_map( shadow_map ) {}
+	void execute( CRenderDevice *dev, CFrameGraph *graph );
+};
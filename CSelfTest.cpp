@@ -0,0 +1,185 @@
+#include "CSelfTest.h"
+#include "CAllocationCounter.h"
+#include "CJobSystem.h"
+#include "CNullRenderDevice.h"
+#include <string>
+#include <process.h>
+
+static int *volatile s_allocated = NULL; // so the allocation is not left out
+
+static void nothing( void *, unsigned int, unsigned int )
+{
+}
+
+static void allocate( void *, unsigned int, unsigned int )
+{
+	s_allocated = new int( 1 );
+	delete s_allocated;
+	s_allocated = NULL;
+}
+
+static unsigned __stdcall allocateOnThread( void * )
+{
+	allocate( NULL, 0, 1 );
+	return 0;
+}
+
+bool CSelfTest::report( std::ostream &out, const char *check, bool passed )
+{
+	out << ( passed ? "passed: " : "FAILED: " ) << check << "\n";
+	return passed;
+}
+
+bool CSelfTest::allocationCounter( std::ostream &out )
+{
+	const bool was_counted = CAllocationCounter::countThisThread( true );
+	CJobSystem jobs;
+	JobCounter done;
+	if ( !report( out, "job system starts with a worker", jobs.init( 1 ) ) )
+		return false;
+
+	//jobs come from a pool that fills on first use, which is not what is checked
+	jobs.run( nothing, NULL, 0, 1, &done );
+	jobs.wait( &done );
+	jobs.runInBackground( nothing, NULL, &done );
+	jobs.wait( &done );
+
+	//the thread is made before the frame, and only let go inside it
+	HANDLE thread = (HANDLE)_beginthreadex( NULL, 0, allocateOnThread, NULL, CREATE_SUSPENDED, NULL );
+	bool passed = report( out, "thread for uncounted allocations starts", thread != NULL );
+
+	CAllocationCounter others;
+	others.init( 0 );
+	others.beginFrame();
+	if ( thread != NULL )
+	{
+		ResumeThread( thread );
+		WaitForSingleObject( thread, INFINITE );
+		CloseHandle( thread );
+	}
+	jobs.runInBackground( allocate, NULL, &done );
+	jobs.wait( &done );
+	others.endFrame( 0, true );
+	passed = report( out, "allocations on other threads and in background jobs are not a frame's", others.passed() ) && passed;
+
+	CAllocationCounter in_job;
+	in_job.init( 0 );
+	in_job.beginFrame();
+	jobs.run( allocate, NULL, 0, 1, &done );
+	jobs.wait( &done );
+	in_job.endFrame( 0, true );
+	passed = report( out, "a frame allocating in a job fails", !in_job.passed() ) && passed;
+
+	CAllocationCounter on_thread;
+	on_thread.init( 0 );
+	on_thread.beginFrame();
+	allocate( NULL, 0, 1 );
+	on_thread.endFrame( 0, true );
+	passed = report( out, "a frame allocating on its own thread fails", !on_thread.passed() ) && passed;
+
+	//frames that are not steady, and the warmup after them, are not checked
+	CAllocationCounter warming;
+	warming.init( 1 );
+	warming.beginFrame();
+	allocate( NULL, 0, 1 );
+	warming.endFrame( 0, false );
+	warming.beginFrame();
+	allocate( NULL, 0, 1 );
+	warming.endFrame( 1, true );
+	warming.beginFrame();
+	warming.endFrame( 2, true );
+	passed = report( out, "loading and warmup frames may allocate", warming.passed() ) && passed;
+
+	jobs.shutdown();
+	CAllocationCounter::countThisThread( was_counted );
+	return passed;
+}
+
+bool CSelfTest::sameCounts( const RenderCounters &a, const RenderCounters &b )
+{
+	return a.scenes == b.scenes && a.clears == b.clears && a.draw_calls == b.draw_calls && a.primitives == b.primitives
+		&& a.target_changes == b.target_changes && a.state_changes == b.state_changes && a.shader_changes == b.shader_changes
+		&& a.stream_changes == b.stream_changes && a.texture_changes == b.texture_changes && a.constant_sets == b.constant_sets
+		&& a.resources_created == b.resources_created && a.vertex_bytes == b.vertex_bytes;
+}
+
+//A shadow pass setting everything up then drawing 5 instances of 100 vertices,
+//a light pass drawing 10 more, then the shadow pass alone. Event names come
+//from one string, as the frame graph's do
+static void replayFrames( CRenderDevice *dev )
+{
+	std::string name( "shadow" );
+	dev->BeginScene();
+	dev->BeginEvent( name.c_str() );
+	dev->SetRenderTarget( 0, NULL );
+	dev->SetDepthStencilSurface( NULL );
+	dev->Clear( 0, NULL, D3DCLEAR_ZBUFFER, 0, 1.0f, 0 );
+	dev->SetRenderState( D3DRS_ZENABLE, TRUE );
+	dev->SetRenderState( D3DRS_CULLMODE, D3DCULL_CW );
+	dev->SetSamplerState( 0, D3DSAMP_MINFILTER, D3DTEXF_POINT );
+	dev->SetVertexShader( NULL );
+	dev->SetPixelShader( NULL );
+	dev->SetVertexDeclaration( NULL );
+	dev->SetStreamSource( 0, NULL, 0, 12 );
+	dev->SetStreamSource( 1, NULL, 0, 64 );
+	dev->SetStreamSourceFreq( 0, D3DSTREAMSOURCE_INDEXEDDATA | 5 );
+	dev->SetStreamSourceFreq( 1, D3DSTREAMSOURCE_INSTANCEDATA | 1 );
+	dev->SetIndices( NULL );
+	dev->SetTexture( 0, NULL );
+	dev->SetMatrix( NULL, NULL, NULL );
+	dev->SetVector( NULL, NULL, NULL );
+	dev->DrawIndexedPrimitive( D3DPT_TRIANGLELIST, 0, 0, 100, 0, 50 );
+	dev->EndEvent();
+	name = "light";
+	dev->BeginEvent( name.c_str() );
+	dev->DrawIndexedPrimitive( D3DPT_TRIANGLELIST, 0, 0, 10, 0, 4 );
+	dev->EndEvent();
+	dev->EndScene();
+	dev->Present( NULL, NULL, NULL, NULL );
+
+	name = "shadow";
+	dev->BeginScene();
+	dev->BeginEvent( name.c_str() );
+	dev->DrawIndexedPrimitive( D3DPT_TRIANGLELIST, 0, 0, 100, 0, 50 );
+	dev->EndEvent();
+	dev->EndScene();
+	dev->Present( NULL, NULL, NULL, NULL );
+}
+
+bool CSelfTest::recordingDevice( std::ostream &out )
+{
+	CRecordingRenderDevice recorder( new CNullRenderDevice( 64, 64 ) );
+	replayFrames( &recorder );
+
+	//each draw reads 12 bytes for each of its vertices and 64 once, for each of 5 instances
+	RenderCounters last;
+	last.scenes = 1;
+	last.draw_calls = 1;
+	last.primitives = 50;
+	last.vertex_bytes = 5 * ( 100 * 12 + 64 );
+
+	RenderCounters total;
+	total.scenes = 2;
+	total.clears = 1;
+	total.draw_calls = 3;
+	total.primitives = 104;
+	total.target_changes = 2;
+	total.state_changes = 3;
+	total.shader_changes = 2;
+	total.stream_changes = 6;
+	total.texture_changes = 1;
+	total.constant_sets = 2;
+	total.vertex_bytes = 2 * 5 * ( 100 * 12 + 64 ) + 5 * ( 10 * 12 + 64 );
+
+	bool passed = report( out, "the recording device counts two frames", recorder.frames() == 2 );
+	passed = report( out, "the recording device counts the last frame", sameCounts( recorder.lastFrame(), last ) ) && passed;
+	passed = report( out, "the recording device counts every frame", sameCounts( recorder.total(), total ) ) && passed;
+
+	//the same name from the same buffer is one event, whatever else the buffer held in between
+	const std::map<std::string, RenderCounters> &events = recorder.eventTotals();
+	std::map<std::string, RenderCounters>::const_iterator shadow = events.find( "shadow" ), light = events.find( "light" );
+	passed = report( out, "the recording device counts each event by name", events.size() == 2
+		&& shadow != events.end() && shadow->second.draw_calls == 2 && shadow->second.primitives == 100
+		&& light != events.end() && light->second.draw_calls == 1 && light->second.primitives == 4 ) && passed;
+	return passed;
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include <windows.h>
+#include <iostream>
+#include <cassert>
+#include "CRecordingRenderDevice.h"
+
+//Checks of the framework's parts on their own, run by -selftest before it runs
+//whole frames. Each prints a line for every check and returns whether all passed
+class CSelfTest {
+public:
+	//print a check's result, returning passed
+	static bool report( std::ostream &out, const char *check, bool passed );
+
+	//frames that allocate on the calling thread or in a frame's job fail, and
+	//frames whose only allocations are on other threads or in background jobs pass
+	static bool allocationCounter( std::ostream &out );
+
+	//a scripted frame, replayed on the recording device over the null device,
+	//gives exactly the counts worked out by hand, per frame, in all and per event
+	static bool recordingDevice( std::ostream &out );
+
+	//every count the same
+	static bool sameCounts( const RenderCounters &a, const RenderCounters &b );
+};
@@ -16,7 +16,7 @@ CShader::~CShader()
 	Release( &_pixel_shader_constants );
 }
 
-bool CShader::init( IDirect3DDevice9 *dev, char *vertex, char *pixel )
+bool CShader::init( CRenderDevice *dev, char *vertex, char *pixel, const D3DXMACRO *defines )
 {
 	#ifdef _DEBUG
 		const DWORD shader_flags = D3DXSHADER_DEBUG | D3DXSHADER_SKIPOPTIMIZATION;
@@ -28,7 +28,7 @@ bool CShader::init( IDirect3DDevice9 *dev, char *vertex, char *pixel )
 	ID3DXBuffer* errors = 0;
 
 	//Attempt to load the vertex shader
-	if ( FAILED(D3DXCompileShaderFromFileA( vertex, 0, 0, "main", "vs_3_0", shader_flags, &shader, &errors, &_vertex_shader_constants )) )
+	if ( FAILED(D3DXCompileShaderFromFileA( vertex, defines, 0, "main", "vs_3_0", shader_flags, &shader, &errors, &_vertex_shader_constants )) )
 	{
 		//Either the shader contained errors, or doesnt exist.
 		//Return false, which inturn will end the program.
@@ -46,7 +46,7 @@ bool CShader::init( IDirect3DDevice9 *dev, char *vertex, char *pixel )
 	Release( &errors );
 
 	//Attempt to load the pixel shader
-	if ( FAILED(D3DXCompileShaderFromFileA( pixel, 0, 0, "main", "ps_3_0", shader_flags, &shader, &errors, &_pixel_shader_constants )) )
+	if ( FAILED(D3DXCompileShaderFromFileA( pixel, defines, 0, "main", "ps_3_0", shader_flags, &shader, &errors, &_pixel_shader_constants )) )
 	{
 		//Either the shader contained errors, or doesnt exist.
 		//Return false, which inturn will end the program.
@@ -67,7 +67,7 @@ bool CShader::init( IDirect3DDevice9 *dev, char *vertex, char *pixel )
 	return true;
 }
 
-void CShader::reload( IDirect3DDevice9 *dev, char *vertex, char *pixel )
+void CShader::reload( CRenderDevice *dev, char *vertex, char *pixel, const D3DXMACRO *defines )
 {
 	//Release the current shaders
 	Release( &_vertex_shader );
@@ -75,7 +75,7 @@ void CShader::reload( IDirect3DDevice9 *dev, char *vertex, char *pixel )
 	Release( &_pixel_shader );
 	Release( &_pixel_shader_constants );
 	//then reload them.
-	init( dev, vertex, pixel );
+	init( dev, vertex, pixel, defines );
 }
 
 ///////////
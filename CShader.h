@@ -4,6 +4,7 @@
 #include <d3dx9.h>
 #include <iostream>
 #include <cassert>
+#include "CRenderDevice.h"
 
 class CShader {
 private:
@@ -24,7 +25,8 @@ public:
 	CShader();
 	~CShader();
 
-	bool init( IDirect3DDevice9 *dev, char *vertex, char *pixel );
+	//defines, ended by a NULL name, picks a variant of the shaders when given
+	bool init( CRenderDevice *dev, char *vertex, char *pixel, const D3DXMACRO *defines = NULL );
 
 	IDirect3DVertexShader9	*vertex();
 	ID3DXConstantTable		*vertex_constants();
@@ -33,5 +35,5 @@ public:
 	
 	bool isCompiled( void ) { return true; }
 
-	void reload( IDirect3DDevice9 *dev, char *vertex, char *pixel );
+	void reload( CRenderDevice *dev, char *vertex, char *pixel, const D3DXMACRO *defines = NULL );
 };
\ No newline at end of file
@@ -0,0 +1,260 @@
+#include "CStaticShadowBatcher.h"
+#include <map>
+#include <cstring>
+#include "CMeshOptimizer.h"
+#include "CVertexConvert.h"
+
+//Batches stay small enough for 16 bit indices, and to cull usefully
+#define MAX_BATCH_VERTICES 65535
+
+CStaticShadowBatcher::CStaticShadowBatcher()
+{
+	_vertex_declaration = NULL;
+	_static_shapes = 0;
+	_drawn = 0;
+}
+
+CStaticShadowBatcher::~CStaticShadowBatcher()
+{
+	clear();
+}
+
+static bool sameShape( const Shape &a, const Shape &b )
+{
+	return a.position.x == b.position.x && a.position.y == b.position.y && a.position.z == b.position.z
+		&& a.rotation.x == b.rotation.x && a.rotation.y == b.rotation.y && a.rotation.z == b.rotation.z;
+}
+
+void CStaticShadowBatcher::findStaticShapes( SceneDelegate *scene, std::vector<bool> *is_static )
+{
+	const unsigned int num_shapes = scene->numberOfShapes();
+
+	//the scene is at time 0 after construction
+	std::vector<Shape> initial( num_shapes );
+	for ( unsigned int i = 0; i < num_shapes; ++i )
+		initial[i] = scene->shapeAtIndex( i );
+
+	is_static->assign( num_shapes, true );
+
+	//sample times spread unevenly over a minute so periodic motion cannot line up with them
+	const unsigned int samples = 32;
+	for ( unsigned int s = 1; s <= samples; ++s )
+	{
+		scene->animate( s * 1.9137f );
+		for ( unsigned int i = 0; i < num_shapes; ++i )
+		{
+			if ( (*is_static)[i] && !sameShape( initial[i], scene->shapeAtIndex( i ) ) )
+				(*is_static)[i] = false;
+		}
+	}
+
+	scene->animate( 0.0f );
+}
+
+bool CStaticShadowBatcher::build( CRenderDevice *dev, SceneDelegate *scene, const std::vector<CEntity*> &entities, const std::vector<bool> &is_static, float cell_size )
+{
+	clear();
+
+	//position only, the world matrix stream is kept so the shadow shader is unchanged
+	D3DVERTEXELEMENT9 vertex_elements[] = {
+		{ 0, 0, D3DDECLTYPE_FLOAT3, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_POSITION, 0 }, // an xyz position
+		{ INSTANCE_STREAM, 0, D3DDECLTYPE_FLOAT4, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_TEXCOORD, 0 }, // world matrix rows
+		{ INSTANCE_STREAM, 16, D3DDECLTYPE_FLOAT4, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_TEXCOORD, 1 },
+		{ INSTANCE_STREAM, 32, D3DDECLTYPE_FLOAT4, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_TEXCOORD, 2 },
+		{ INSTANCE_STREAM, 48, D3DDECLTYPE_FLOAT4, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_TEXCOORD, 3 },
+		D3DDECL_END() 
+	};
+	if ( FAILED( dev->CreateVertexDeclaration( vertex_elements, &_vertex_declaration ) ) )
+		return false;
+
+	//group the static shapes by the grid cell their origin is in
+	typedef std::map< std::pair< int, std::pair< int, int > >, std::vector<unsigned int> > CellMap;
+	CellMap cells;
+	for ( unsigned int i = 0; i < entities.size(); ++i )
+	{
+		if ( !is_static[i] || entities[i] == NULL )
+			continue;
+
+		const D3DXMATRIX &world = entities[i]->world();
+		int x = (int)floorf( world._41 / cell_size );
+		int y = (int)floorf( world._42 / cell_size );
+		int z = (int)floorf( world._43 / cell_size );
+		cells[ std::make_pair( x, std::make_pair( y, z ) ) ].push_back( i );
+		_static_shapes++;
+	}
+
+	const unsigned int stride = sizeof(D3DXVECTOR3);
+	if ( !_geometry.create( dev, &stride, 1, MAX_BATCH_VERTICES, MAX_BATCH_VERTICES * 3 ) )
+		return false;
+
+	//meshes are read from the scene once each, however many shapes use them
+	std::vector<Mesh> meshes( scene->numberOfMeshes() );
+	std::vector<bool> loaded( scene->numberOfMeshes(), false );
+
+	std::vector<D3DXVECTOR3> positions, normals;
+	std::vector<unsigned int> indices;
+	for ( CellMap::iterator cell = cells.begin(); cell != cells.end(); ++cell )
+	{
+		positions.clear();
+		normals.clear();
+		indices.clear();
+
+		for ( unsigned int s = 0; s < cell->second.size(); ++s )
+		{
+			const unsigned int shape_index = cell->second[s];
+			const unsigned int mesh_index = scene->shapeAtIndex( shape_index ).meshIndex;
+			if ( !loaded[mesh_index] )
+			{
+				scene->getMeshAtIndex( mesh_index, &meshes[mesh_index] );
+				CMeshOptimizer::optimize( &meshes[mesh_index] );
+				loaded[mesh_index] = true;
+			}
+			const Mesh &mesh = meshes[mesh_index];
+
+			//start a new batch rather than overflow this one
+			if ( !positions.empty() && positions.size() + mesh.vertexArray.size() > MAX_BATCH_VERTICES )
+			{
+				addBatch( dev, positions, normals, indices );
+				positions.clear();
+				normals.clear();
+				indices.clear();
+			}
+
+			//bake the shape's transform into its vertices
+			const D3DXMATRIX &world = entities[shape_index]->world();
+			const unsigned int base = positions.size();
+			positions.resize( base + mesh.vertexArray.size() );
+			if ( !mesh.vertexArray.empty() )
+				CVertexConvert::transformPositions( &mesh.vertexArray[0], mesh.vertexArray.size(), world, &positions[base] );
+			for ( unsigned int v = 0; v < mesh.vertexArray.size(); ++v )
+			{
+				//normals only go to building meshlets, to tell which way triangles face
+				D3DXVECTOR3 n( mesh.normalArray[v].x, mesh.normalArray[v].y, mesh.normalArray[v].z );
+				D3DXVec3TransformNormal( &n, &n, &world );
+				normals.push_back( n );
+			}
+			for ( unsigned int n = 0; n < mesh.indexArray.size(); ++n )
+				indices.push_back( base + mesh.indexArray[n] );
+		}
+
+		if ( !positions.empty() )
+			addBatch( dev, positions, normals, indices );
+	}
+
+	return true;
+}
+
+void CStaticShadowBatcher::addBatch( CRenderDevice *dev, const std::vector<D3DXVECTOR3> &positions, const std::vector<D3DXVECTOR3> &normals, const std::vector<unsigned int> &indices )
+{
+	Batch batch;
+	batch.handle = _geometry.allocate( dev, positions.size(), indices.size() );
+	if ( batch.handle == INVALID_GEOMETRY )
+		return;
+	batch.num_triangles = indices.size() / 3;
+
+	//bounding sphere around the centre of the box
+	D3DXVECTOR3 lo = positions[0], hi = positions[0];
+	for ( unsigned int i = 1; i < positions.size(); ++i )
+	{
+		D3DXVec3Minimize( &lo, &lo, &positions[i] );
+		D3DXVec3Maximize( &hi, &hi, &positions[i] );
+	}
+	batch.centre = ( lo + hi ) * 0.5f;
+	batch.radius = 0.0f;
+	for ( unsigned int i = 0; i < positions.size(); ++i )
+	{
+		D3DXVECTOR3 offset = positions[i] - batch.centre;
+		float distance = D3DXVec3Length( &offset );
+		if ( distance > batch.radius )
+			batch.radius = distance;
+	}
+
+	//meshlets index from the start of the batch, as draw ranges do
+	batch.first_meshlet = _meshlets.size();
+	batch.num_meshlets = 0;
+	if ( batch.num_triangles >= MESHLET_MIN_TRIANGLES )
+	{
+		std::vector<Meshlet> meshlets;
+		CMeshlets::build( positions, normals, indices, &meshlets );
+		_meshlets.insert( _meshlets.end(), meshlets.begin(), meshlets.end() );
+		batch.num_meshlets = meshlets.size();
+		if ( _ranges.size() < meshlets.size() )
+			_ranges.resize( meshlets.size() );
+	}
+
+	D3DXVECTOR3 *vptr = (D3DXVECTOR3*)_geometry.lockVertices( batch.handle, 0 );
+	if ( vptr )
+	{
+		memcpy( vptr, &positions[0], positions.size() * sizeof(D3DXVECTOR3) );
+		_geometry.unlockVertices( 0 );
+	}
+
+	_geometry.writeIndices( batch.handle, &indices[0] );
+
+	_batches.push_back( batch );
+}
+
+void CStaticShadowBatcher::clear()
+{
+	_batches.clear();
+	_meshlets.clear();
+	_ranges.clear();
+	_static_shapes = 0;
+	_drawn = 0;
+	_geometry.release();
+	Release( &_vertex_declaration );
+}
+
+unsigned int CStaticShadowBatcher::draw( CRenderDevice *dev, CInstanceBuffer *instances, const CFrustum &frustum, const D3DXVECTOR3 &eye, MeshletCullStats *culling )
+{
+	_drawn = 0;
+	if ( _batches.empty() )
+		return 0;
+
+	// configure the pipeline - primitive assembly
+	// the positions are already in world space, so every batch is one identity instance
+	unsigned int identity_instance;
+	D3DXMatrixIdentity( instances->lock( 1, &identity_instance ) );
+	instances->unlock();
+
+	dev->SetVertexDeclaration( _vertex_declaration );
+	_geometry.bind( dev, 1 );
+	instances->bind( dev, identity_instance );
+	dev->SetStreamSourceFreq( 0, D3DSTREAMSOURCE_INDEXEDDATA | 1 );
+	dev->SetStreamSourceFreq( INSTANCE_STREAM, D3DSTREAMSOURCE_INSTANCEDATA | 1 );
+
+	// draw (execute the pipeline), skipping batches the light cannot see
+	for ( unsigned int i = 0; i < _batches.size(); ++i )
+	{
+		const Batch &batch = _batches[i];
+		if ( !frustum.intersectsSphere( batch.centre, batch.radius ) )
+			continue;
+
+		if ( batch.num_meshlets == 0 )
+		{
+			_geometry.draw( dev, batch.handle );
+			_drawn++;
+			continue;
+		}
+
+		const unsigned int ranges = CMeshlets::cull( &_meshlets[batch.first_meshlet], batch.num_meshlets, frustum, eye, &_ranges[0], culling );
+		for ( unsigned int r = 0; r < ranges; ++r )
+			_geometry.draw( dev, batch.handle, _ranges[r].first_index, _ranges[r].num_triangles );
+		if ( ranges > 0 )
+			_drawn++;
+	}
+
+	dev->SetStreamSourceFreq( 0, 1 );
+	dev->SetStreamSourceFreq( INSTANCE_STREAM, 1 );
+	return _drawn;
+}
+
+void CStaticShadowBatcher::print( std::ostream &out ) const
+{
+	unsigned int triangles = 0;
+	for ( unsigned int i = 0; i < _batches.size(); ++i )
+		triangles += _batches[i].num_triangles;
+
+	out << _static_shapes << " static shadow casters merged into " << _batches.size()
+		<< " batches (" << triangles << " triangles, " << _meshlets.size() << " meshlets)\n";
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <windows.h>
+#include <d3d9.h>
+#include <d3dx9.h>
+#include <iostream>
+#include <cassert>
+#include <vector>
+#include "SceneDelegate.hpp"
+#include "CRenderDevice.h"
+#include "CGeometryBuffer.h"
+#include "CInstanceBuffer.h"
+#include "CFrustum.h"
+#include "CEntity.h"
+#include "CMeshlets.h"
+
+//Shadow casters that never move, pre-transformed into world space and merged
+//into a few position-only batches. Shapes are grouped by the grid cell their
+//origin falls in so each batch stays compact enough to cull against a light,
+//then each batch is culled again in meshlets.
+class CStaticShadowBatcher {
+private:
+	struct Batch {
+		GeometryHandle handle;
+		unsigned int num_triangles;
+		D3DXVECTOR3 centre; // bounding sphere in world space
+		float radius;
+		unsigned int first_meshlet, num_meshlets; // none for batches too small to split
+	};
+
+	IDirect3DVertexDeclaration9* _vertex_declaration; // position only, plus the instance stream
+	CGeometryBuffer _geometry; // world space positions of every batch
+	std::vector<Batch> _batches;
+	std::vector<Meshlet> _meshlets; // of every batch, in world space
+	std::vector<IndexRange> _ranges; // what is left of a batch after culling, room for the most meshlets in one
+	unsigned int _static_shapes;
+	unsigned int _drawn; // batches that survived culling in the last draw
+
+	void addBatch( CRenderDevice *dev, const std::vector<D3DXVECTOR3> &positions, const std::vector<D3DXVECTOR3> &normals, const std::vector<unsigned int> &indices );
+
+	template<typename T>
+	void Release(T** ptr) {
+		if ( *ptr != 0 ) {
+			(*ptr)->Release();
+			*ptr = 0;
+		}
+	}
+
+public:
+	CStaticShadowBatcher();
+	~CStaticShadowBatcher();
+
+	//flag every shape whose transform animate() never changes.
+	//the scene is left as it was constructed
+	static void findStaticShapes( SceneDelegate *scene, std::vector<bool> *is_static );
+
+	//merge the flagged entities, cell_size is the width of a grouping cell in world units
+	bool build( CRenderDevice *dev, SceneDelegate *scene, const std::vector<CEntity*> &entities, const std::vector<bool> &is_static, float cell_size );
+	void clear();
+
+	//draw every batch inside the light's frustum, leaving out the meshlets that
+	//are outside it or face away from eye. returns the batches drawn
+	unsigned int draw( CRenderDevice *dev, CInstanceBuffer *instances, const CFrustum &frustum, const D3DXVECTOR3 &eye, MeshletCullStats *culling );
+
+	IDirect3DVertexDeclaration9 *declaration() { return _vertex_declaration; }
+	unsigned int batches() const { return _batches.size(); }
+	unsigned int staticShapes() const { return _static_shapes; }
+	unsigned int drawn() const { return _drawn; }
+
+	void print( std::ostream &out ) const;
+};
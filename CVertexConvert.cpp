@@ -0,0 +1,100 @@
+#include "CVertexConvert.h"
+#include <emmintrin.h>
+
+void CVertexConvert::packPositions( const Float3 *src, unsigned int count, const D3DXVECTOR3 &centre, const D3DXVECTOR3 &half, CMesh::Position *dst )
+{
+	//w comes in as 1 after the bias and scale, so it packs to 32767
+	const __m128 xyz_mask = _mm_castsi128_ps( _mm_set_epi32( 0, -1, -1, -1 ) );
+	const __m128 w_one = _mm_set_ps( 1.0f, 0.0f, 0.0f, 0.0f );
+	const __m128 bias = _mm_set_ps( 0.0f, centre.z, centre.y, centre.x );
+	const __m128 scale = _mm_set_ps( 1.0f, half.z, half.y, half.x );
+	const __m128 lo = _mm_set1_ps( -1.0f ), hi = _mm_set1_ps( 1.0f );
+	const __m128 snorm = _mm_set1_ps( 32767.0f );
+	const __m128 sign_mask = _mm_set1_ps( -0.0f ), half_unit = _mm_set1_ps( 0.5f );
+
+	//two vertices per store. each load reads a float past its vertex, so the
+	//last vertex is left to the scalar loop
+	unsigned int i = 0;
+	for ( ; i + 2 < count; i += 2 )
+	{
+		__m128i packed[2];
+		for ( unsigned int k = 0; k < 2; ++k )
+		{
+			__m128 v = _mm_loadu_ps( &src[i + k].x );
+			v = _mm_or_ps( _mm_and_ps( v, xyz_mask ), w_one );
+			v = _mm_div_ps( _mm_sub_ps( v, bias ), scale );
+			v = _mm_mul_ps( _mm_min_ps( _mm_max_ps( v, lo ), hi ), snorm );
+
+			//round half away from zero, the conversion truncates
+			const __m128 rounding = _mm_or_ps( _mm_and_ps( v, sign_mask ), half_unit );
+			packed[k] = _mm_cvttps_epi32( _mm_add_ps( v, rounding ) );
+		}
+		_mm_storeu_si128( (__m128i*)&dst[i], _mm_packs_epi32( packed[0], packed[1] ) );
+	}
+
+	for ( ; i < count; ++i )
+	{
+		dst[i].position[0] = CMesh::packSnorm( ( src[i].x - centre.x ) / half.x );
+		dst[i].position[1] = CMesh::packSnorm( ( src[i].y - centre.y ) / half.y );
+		dst[i].position[2] = CMesh::packSnorm( ( src[i].z - centre.z ) / half.z );
+		dst[i].position[3] = 32767;
+	}
+}
+
+void CVertexConvert::packNormals( const Float3 *src, unsigned int count, CMesh::Attributes *dst )
+{
+	//the fold is branchy per vertex, so this stays scalar
+	for ( unsigned int i = 0; i < count; ++i )
+	{
+		D3DXVECTOR3 n( src[i].x, src[i].y, src[i].z );
+		D3DXVec3Normalize( &n, &n );
+		CMesh::packNormal( n, dst[i].normal );
+	}
+}
+
+void CVertexConvert::narrowIndices( const unsigned int *src, unsigned int count, unsigned short *dst )
+{
+	//the pack saturates to signed 16 bit, so shift into that range and back
+	const __m128i offset = _mm_set1_epi32( 32768 );
+	const __m128i flip = _mm_set1_epi16( (short)0x8000 );
+
+	unsigned int i = 0;
+	for ( ; i + 8 <= count; i += 8 )
+	{
+		const __m128i a = _mm_sub_epi32( _mm_loadu_si128( (const __m128i*)&src[i] ), offset );
+		const __m128i b = _mm_sub_epi32( _mm_loadu_si128( (const __m128i*)&src[i + 4] ), offset );
+		_mm_storeu_si128( (__m128i*)&dst[i], _mm_xor_si128( _mm_packs_epi32( a, b ), flip ) );
+	}
+
+	for ( ; i < count; ++i )
+	{
+		assert( src[i] < 65536 );
+		dst[i] = (unsigned short)src[i];
+	}
+}
+
+void CVertexConvert::transformPositions( const Float3 *src, unsigned int count, const D3DXMATRIX &transform, D3DXVECTOR3 *dst )
+{
+	const __m128 row0 = _mm_loadu_ps( &transform._11 );
+	const __m128 row1 = _mm_loadu_ps( &transform._21 );
+	const __m128 row2 = _mm_loadu_ps( &transform._31 );
+	const __m128 row3 = _mm_loadu_ps( &transform._41 );
+
+	//each store writes a float past its vertex, which the next one overwrites,
+	//so the last vertex is left to the scalar loop
+	unsigned int i = 0;
+	for ( ; i + 1 < count; ++i )
+	{
+		const __m128 x = _mm_set1_ps( src[i].x );
+		const __m128 y = _mm_set1_ps( src[i].y );
+		const __m128 z = _mm_set1_ps( src[i].z );
+		const __m128 p = _mm_add_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( x, row0 ), _mm_mul_ps( y, row1 ) ), _mm_mul_ps( z, row2 ) ), row3 );
+		_mm_storeu_ps( &dst[i].x, p );
+	}
+
+	for ( ; i < count; ++i )
+	{
+		const D3DXVECTOR3 p( src[i].x, src[i].y, src[i].z );
+		D3DXVec3TransformCoord( &dst[i], &p, &transform );
+	}
+}
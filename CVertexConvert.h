@@ -0,0 +1,26 @@
+#pragma once
+#include <windows.h>
+#include <d3d9.h>
+#include <d3dx9.h>
+#include <iostream>
+#include <cassert>
+#include "SceneDelegate.hpp"
+#include "CMesh.h"
+
+//SSE2 kernels that turn a scene mesh's arrays into what the buffers hold,
+//writing straight into the destination, a locked buffer or a packed block.
+//Each gives exactly what the scalar code it stands in for gives
+class CVertexConvert {
+public:
+	//positions as SHORT4N relative to the bounds, rounded as CMesh::packSnorm
+	static void packPositions( const Float3 *src, unsigned int count, const D3DXVECTOR3 &centre, const D3DXVECTOR3 &half, CMesh::Position *dst );
+
+	//octahedral normals, as CMesh::packNormal
+	static void packNormals( const Float3 *src, unsigned int count, CMesh::Attributes *dst );
+
+	//32 bit indices to 16, every index must be below 65536
+	static void narrowIndices( const unsigned int *src, unsigned int count, unsigned short *dst );
+
+	//positions moved by an affine transform, as D3DXVec3TransformCoord
+	static void transformPositions( const Float3 *src, unsigned int count, const D3DXMATRIX &transform, D3DXVECTOR3 *dst );
+};
@@ -0,0 +1,231 @@
+#include "CWater.h"
+#include "CVertexConvert.h"
+#include "CProfiler.h"
+
+CWater::CWater()
+{
+	_water = NULL;
+	_time_step = 0.0f;
+	D3DXMatrixIdentity( &_world );
+	_num_vertices = 0;
+	_num_indices = 0;
+	_vertex_declaration = NULL;
+	_indices = NULL;
+	for ( unsigned int b = 0; b < WATER_BUFFERS; ++b )
+		_buffers[b] = NULL;
+	_drawing = WATER_BUFFERS;
+	_writing = WATER_BUFFERS;
+	_jobs = NULL;
+	_target = NULL;
+	_steps = 0;
+	_advance_ms = 0.0;
+
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency( &frequency );
+	_frequency = frequency.QuadPart / 1000.0;
+	_sim_time = -1.0f;
+	_frames = _late = 0;
+	_sim_total = _sim_worst = 0.0;
+	_upload_total = _upload_worst = 0.0;
+}
+
+CWater::~CWater()
+{
+	clear();
+}
+
+bool CWater::init( CRenderDevice *dev, CJobSystem *jobs, const D3DXMATRIX &world, float time_step, float size, int num_points, float scale_factor, float wind_direction, float wind_speed )
+{
+	clear();
+	_jobs = jobs;
+	_water = new tsl::Water( time_step, size, num_points, scale_factor, wind_direction, wind_speed );
+	_time_step = time_step;
+	_world = world;
+	_num_vertices = _water->VertexCount();
+	_num_indices = _water->IndexCount();
+	_sim_time = -1.0f;
+
+	D3DVERTEXELEMENT9 vertex_elements[] = {
+		{ 0, 0, D3DDECLTYPE_FLOAT3, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_POSITION, 0 }, // an xyz position
+		{ 0, 12, D3DDECLTYPE_FLOAT3, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_NORMAL, 0 }, // an xyz normal
+		{ INSTANCE_STREAM, 0, D3DDECLTYPE_FLOAT4, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_TEXCOORD, 0 }, // world matrix rows
+		{ INSTANCE_STREAM, 16, D3DDECLTYPE_FLOAT4, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_TEXCOORD, 1 },
+		{ INSTANCE_STREAM, 32, D3DDECLTYPE_FLOAT4, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_TEXCOORD, 2 },
+		{ INSTANCE_STREAM, 48, D3DDECLTYPE_FLOAT4, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_TEXCOORD, 3 },
+		D3DDECL_END()
+	};
+	if ( FAILED( dev->CreateVertexDeclaration( vertex_elements, &_vertex_declaration ) ) )
+		return false;
+
+	//the triangles never change, only the vertices move
+	std::vector<int> indices( _num_indices );
+	_water->GetIndices( &indices[0] );
+
+	const bool narrow = _num_vertices <= 65536;
+	const unsigned int index_size = narrow ? sizeof(unsigned short) : sizeof(unsigned int);
+	if ( FAILED( dev->CreateIndexBuffer( _num_indices * index_size, D3DUSAGE_WRITEONLY, narrow ? D3DFMT_INDEX16 : D3DFMT_INDEX32, D3DPOOL_MANAGED, &_indices, 0 ) ) )
+		return false;
+
+	void *iptr;
+	if ( _indices && SUCCEEDED(_indices->Lock( 0, 0, &iptr, 0 )) )
+	{
+		if ( narrow )
+			CVertexConvert::narrowIndices( (const unsigned int*)&indices[0], _num_indices, (unsigned short*)iptr );
+		else
+			memcpy( iptr, &indices[0], _num_indices * sizeof(unsigned int) );
+		_indices->Unlock();
+	}
+	return true;
+}
+
+void CWater::clear()
+{
+	release();
+
+	delete _water;
+	_water = NULL;
+	Release( &_indices );
+	Release( &_vertex_declaration );
+}
+
+bool CWater::create( CRenderDevice *dev )
+{
+	release();
+	for ( unsigned int b = 0; b < WATER_BUFFERS; ++b )
+	{
+		if ( FAILED( dev->CreateVertexBuffer( _num_vertices * sizeof(WaterVertex), D3DUSAGE_DYNAMIC | D3DUSAGE_WRITEONLY, 0, D3DPOOL_DEFAULT, &_buffers[b], 0 ) ) )
+			return false;
+	}
+	return true;
+}
+
+void CWater::release()
+{
+	//the job may be writing into one of them
+	finish( true );
+
+	for ( unsigned int b = 0; b < WATER_BUFFERS; ++b )
+		Release( &_buffers[b] );
+	_drawing = WATER_BUFFERS;
+}
+
+bool CWater::finish( bool wait )
+{
+	if ( _writing == WATER_BUFFERS )
+		return false;
+
+	//with no workers, the step is only run when waited on
+	if ( !wait && !_stepped.done() && _jobs->threads() > 0 )
+		return false;
+	_jobs->wait( &_stepped );
+
+	//the counter publishes the vertices and the time the job took
+	if ( _buffers[_writing] )
+		_buffers[_writing]->Unlock();
+	_sim_total += _advance_ms;
+	if ( _advance_ms > _sim_worst )
+		_sim_worst = _advance_ms;
+
+	_drawing = _writing;
+	_writing = WATER_BUFFERS;
+	return true;
+}
+
+void CWater::update( float time )
+{
+	if ( _water == NULL )
+		return;
+
+	LARGE_INTEGER start, end;
+	QueryPerformanceCounter( &start );
+	_frames++;
+
+	//a step still being simulated is left to finish, the last one is drawn again
+	if ( _writing != WATER_BUFFERS && !finish( false ) )
+	{
+		_late++;
+		return;
+	}
+
+	//whole steps up to time, the first update simulates one
+	if ( _sim_time < 0.0f )
+		_sim_time = time - _time_step;
+	int steps = (int)( ( time - _sim_time ) / _time_step );
+	if ( steps <= 0 )
+		return;
+	_sim_time += steps * _time_step;
+	if ( steps > WATER_MAX_STEPS )
+		steps = WATER_MAX_STEPS;
+
+	//the job writes the next buffer in place, it is unlocked once it is done
+	const unsigned int next = ( _drawing + 1 ) % WATER_BUFFERS;
+	WaterVertex *ptr;
+	if ( _buffers[next] == NULL || FAILED(_buffers[next]->Lock( 0, 0, (void**)&ptr, D3DLOCK_DISCARD )) )
+	{
+		//the null device has nothing to lock, keep the simulation running anyway
+		_scratch[next].resize( _num_vertices );
+		ptr = &_scratch[next][0];
+	}
+
+	//in the background, so no wait of the render thread's own jobs is held up by it
+	_target = ptr;
+	_steps = steps;
+	_writing = next;
+	_jobs->runInBackground( step, this, &_stepped );
+
+	QueryPerformanceCounter( &end );
+	const double ms = ( end.QuadPart - start.QuadPart ) / _frequency;
+	_upload_total += ms;
+	if ( ms > _upload_worst )
+		_upload_worst = ms;
+}
+
+void CWater::step( void *data, unsigned int, unsigned int )
+{
+	CWater *water = (CWater*)data;
+	PROFILE_SCOPE( "water step" );
+	LARGE_INTEGER start, end;
+	QueryPerformanceCounter( &start );
+	WaterVertex *v = water->_target;
+	water->_water->Advance( water->_steps, &v->position.x, sizeof(WaterVertex), &v->normal.x, sizeof(WaterVertex) );
+	QueryPerformanceCounter( &end );
+	water->_advance_ms = ( end.QuadPart - start.QuadPart ) / water->_frequency;
+}
+
+void CWater::draw( CRenderDevice *dev, CInstanceBuffer *instances )
+{
+	if ( !ready() )
+		return;
+
+	unsigned int instance;
+	*instances->lock( 1, &instance ) = _world;
+	instances->unlock();
+
+	// configure the pipeline - primitive assembly
+	dev->SetVertexDeclaration( _vertex_declaration );
+	dev->SetStreamSource( 0, _buffers[_drawing], 0, sizeof(WaterVertex) );
+	instances->bind( dev, instance );
+	dev->SetStreamSourceFreq( 0, D3DSTREAMSOURCE_INDEXEDDATA | 1 );
+	dev->SetStreamSourceFreq( INSTANCE_STREAM, D3DSTREAMSOURCE_INSTANCEDATA | 1 );
+	dev->SetIndices( _indices );
+
+	// configure the pipeline - rasterizer
+	// the surface is seen from above and below
+	dev->SetRenderState( D3DRS_CULLMODE, D3DCULL_NONE );
+
+	// draw (execute the pipeline)
+	dev->DrawIndexedPrimitive( D3DPT_TRIANGLELIST, 0, 0, _num_vertices, 0, _num_indices / 3 );
+
+	dev->SetRenderState( D3DRS_CULLMODE, D3DCULL_CW );
+	dev->SetStreamSourceFreq( 0, 1 );
+	dev->SetStreamSourceFreq( INSTANCE_STREAM, 1 );
+}
+
+void CWater::print( std::ostream &out ) const
+{
+	const unsigned int frames = _frames > 0 ? _frames : 1;
+	out << "Water: " << _num_vertices << " vertices (" << _num_vertices * sizeof(WaterVertex) / 1024 << " KB a step), simulation "
+		<< _sim_total / frames << " ms a frame (worst " << _sim_worst << " ms), upload "
+		<< _upload_total / frames << " ms a frame (worst " << _upload_worst << " ms), "
+		<< _late << " of " << _frames << " frames drew the step before again\n";
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include <windows.h>
+#include <d3d9.h>
+#include <d3dx9.h>
+#include <iostream>
+#include <cassert>
+#include <vector>
+#include "tsl/water.hpp"
+#include "CRenderDevice.h"
+#include "CInstanceBuffer.h"
+#include "CJobSystem.h"
+
+//Vertex buffers the surface cycles through: one being written by the job,
+//one drawn, and the one drawn before that which the GPU may still be reading
+#define WATER_BUFFERS 3
+
+//Steps simulated in one frame at most, a longer frame drops the rest
+#define WATER_MAX_STEPS 8
+
+//One vertex of the surface, as tsl::Water writes it
+struct WaterVertex {
+	D3DXVECTOR3 position;
+	D3DXVECTOR3 normal;
+};
+
+//A tsl::Water surface drawn like an entity. Each frame the render thread
+//locks the next of the dynamic vertex buffers and a background job advances
+//the simulation straight into it through Advance's strides, so nothing is
+//copied. The buffer is unlocked and drawn the frame after, when the job is
+//done, while the next step is written into another. The buffers live in
+//D3DPOOL_DEFAULT, so they are created and released with the other unmanaged
+//resources.
+class CWater {
+private:
+	tsl::Water *_water;
+	float _time_step;
+	D3DXMATRIX _world;
+	unsigned int _num_vertices, _num_indices;
+
+	IDirect3DVertexDeclaration9* _vertex_declaration; // float position and normal, plus the instance stream
+	IDirect3DIndexBuffer9* _indices;
+	IDirect3DVertexBuffer9* _buffers[WATER_BUFFERS];
+	std::vector<WaterVertex> _scratch[WATER_BUFFERS]; // written instead when the device gives us no buffer
+	unsigned int _drawing; // the newest complete buffer, WATER_BUFFERS for none yet
+	unsigned int _writing; // the buffer the job has, WATER_BUFFERS for none
+
+	//handed to the job by update, read back once _stepped is done
+	CJobSystem *_jobs;
+	JobCounter _stepped;
+	WaterVertex *_target;
+	int _steps;
+	double _advance_ms;
+
+	double _frequency; // performance counter ticks per millisecond
+	float _sim_time; // time simulated up to, negative before the first update
+	unsigned int _frames, _late; // updates, and those the job had not finished by
+	double _sim_total, _sim_worst; // milliseconds in Advance
+	double _upload_total, _upload_worst; // milliseconds locking and unlocking on the render thread
+
+	static void step( void *water, unsigned int begin, unsigned int end );
+
+	//unlock what the job wrote and draw it from now on. false if there is no
+	//job, or it is still running and wait is false
+	bool finish( bool wait );
+
+	template<typename T>
+	void Release(T** ptr) {
+		if ( *ptr != 0 ) {
+			(*ptr)->Release();
+			*ptr = 0;
+		}
+	}
+
+public:
+	CWater();
+	~CWater();
+
+	//a square surface size units across with num_points vertices a side, placed by world,
+	//stepped by jobs
+	bool init( CRenderDevice *dev, CJobSystem *jobs, const D3DXMATRIX &world, float time_step, float size, int num_points, float scale_factor, float wind_direction, float wind_speed );
+	void clear();
+
+	//the dynamic vertex buffers, after every reset
+	bool create( CRenderDevice *dev );
+	void release();
+
+	//collect the last step and start a job on the ones up to time, in seconds
+	void update( float time );
+
+	//the newest complete step, as one instance placed by the world matrix.
+	//the caller sets the shaders, which must read float positions and normals
+	void draw( CRenderDevice *dev, CInstanceBuffer *instances );
+
+	bool ready() const { return _drawing < WATER_BUFFERS; }
+	IDirect3DVertexDeclaration9 *declaration() { return _vertex_declaration; }
+
+	void print( std::ostream &out ) const;
+};
@@ -3,8 +3,9 @@
 // Author(s)    : Tyrone Davison
 // Version      : 1.0
 // Copyright    : Tyrone Davison, Teesside University, 2011
-// Description  : Model class to provide mesh, shape, and light scene data.
-// Instructions : Your work will be marked using the original version of this file.
+// Description  : Model class to provide mesh, shape, and light scene data. Extended from the
+//                original with views of meshes held elsewhere, meshes and shapes added after
+//                construction and a pluggable animator; see SceneDelegate.hpp.
 //================================================================================================
 
 #include <cassert>
@@ -19,6 +20,17 @@ static Float3 scaleVector(const Float3& v, float s) {
 	return Float3(v.x * s, v.y * s, v.z * s);
 }
 
+// a view of a mesh's arrays as they are now
+static MeshView viewOf(const Mesh& mesh) {
+	MeshView view;
+	view.vertexArray = mesh.vertexArray.empty() ? 0 : &mesh.vertexArray[0];
+	view.normalArray = mesh.normalArray.empty() ? 0 : &mesh.normalArray[0];
+	view.numberOfVertices = mesh.vertexArray.size();
+	view.indexArray = mesh.indexArray.empty() ? 0 : &mesh.indexArray[0];
+	view.numberOfIndices = mesh.indexArray.size();
+	return view;
+}
+
 // helper to correct normals and winding order
 static void normalizeMesh(bool invertNormals, Mesh* mesh) {
 
@@ -41,7 +53,7 @@ static void normalizeMesh(bool invertNormals, Mesh* mesh) {
 	}
 }
 
-SceneDelegate::SceneDelegate(void) {
+SceneDelegate::SceneDelegate(void) : animator_(0) {
 	const unsigned int numberOfMeshes = 4;
 
 	// use TSL to generate some geometry
@@ -65,6 +77,11 @@ SceneDelegate::SceneDelegate(void) {
 		normalizeMesh(invertNormals[i], &mesh_[i]);
 	}
 
+	// every mesh is read through a view
+	for (unsigned int i=0; i<numberOfMeshes; ++i)
+		owner_.push_back(i);
+	refreshViews();
+
 	// initialise shapes
 	const unsigned int numberOfShapes = 4;
 	const Float3 shapePositions[numberOfShapes] = {
@@ -93,10 +110,54 @@ SceneDelegate::SceneDelegate(void) {
 		animate(0);
 }
 
+// a scene loaded from elsewhere, such as the scene cache, rather than generated.
+// the meshes are not copied, they must outlive the delegate, as must the animator
+SceneDelegate::SceneDelegate(const std::vector<MeshView>& meshes, const std::vector<Shape>& shapes,
+	const std::vector<Light>& lights, SceneAnimator* animator) : light_(lights), view_(meshes), owner_(meshes.size(), -1),
+	shape_(shapes), animator_(animator) {
+		animate(0);
+}
+
+unsigned int SceneDelegate::addMesh(Mesh* mesh) {
+	assert(mesh != 0 && mesh->normalArray.size() == mesh->vertexArray.size());
+	mesh_.push_back(Mesh());
+	mesh_.back().vertexArray.swap(mesh->vertexArray);
+	mesh_.back().normalArray.swap(mesh->normalArray);
+	mesh_.back().indexArray.swap(mesh->indexArray);
+	owner_.push_back(mesh_.size() - 1);
+	view_.push_back(MeshView());
+
+	// growing mesh_ may have moved the arrays the other views point at
+	refreshViews();
+	return view_.size() - 1;
+}
+
+unsigned int SceneDelegate::addShape(const Shape& shape) {
+	assert(shape.meshIndex < view_.size());
+	shape_.push_back(shape);
+	return shape_.size() - 1;
+}
+
+void SceneDelegate::setAnimator(SceneAnimator* animator) {
+	animator_ = animator;
+}
+
+void SceneDelegate::refreshViews(void) {
+	view_.resize(owner_.size());
+	for (unsigned int i=0; i<owner_.size(); ++i) {
+		if (owner_[i] >= 0)
+			view_[i] = viewOf(mesh_[owner_[i]]);
+	}
+}
+
 SceneDelegate::~SceneDelegate(void) {
 }
 
 void SceneDelegate::animate(float time) {
+	if (animator_ != 0) {
+		animator_->animate(time, shape_, light_);
+		return;
+	}
 	shape_[1].rotation.z = cos(time);
 	shape_[3].position.z = 3.f + 2.f * abs(cos(0.2f * time) * cos(time));
 	light_[0].position = Float3(25.f * cos(time), 25.f * sin(time), 10.f);
@@ -109,12 +170,19 @@ Float3 SceneDelegate::worldUpDirection(void) const {
 }
 
 unsigned int SceneDelegate::numberOfMeshes(void) const {
-	return mesh_.size();
+	return view_.size();
 }
 
 void SceneDelegate::getMeshAtIndex(unsigned int i, Mesh* m) const {
 	assert(m != 0);
-	*m = mesh_[i];
+	const MeshView& view = view_[i];
+	m->vertexArray.assign(view.vertexArray, view.vertexArray + view.numberOfVertices);
+	m->normalArray.assign(view.normalArray, view.normalArray + view.numberOfVertices);
+	m->indexArray.assign(view.indexArray, view.indexArray + view.numberOfIndices);
+}
+
+MeshView SceneDelegate::meshViewAtIndex(unsigned int i) const {
+	return view_[i];
 }
 
 unsigned int SceneDelegate::numberOfShapes(void) const {
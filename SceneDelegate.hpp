@@ -3,14 +3,27 @@
 // Author(s)    : Tyrone Davison
 // Version      : 1.0
 // Copyright    : Tyrone Davison, Teesside University, 2011
-// Description  : Model class to provide mesh, shape, and light scene data.
-// Instructions : Do not modify this file.
+// Description  : Model class to provide mesh, shape, and light scene data. Extended from the
+//                original to take scenes from elsewhere:
+//                  SceneDelegate()          the built in scene, its meshes owned by the delegate
+//                  SceneDelegate(meshes, shapes, lights, animator)
+//                                           a scene from views of meshes the caller owns; the
+//                                           viewed arrays, and the animator, must outlive it
+//                  MeshView                 a mesh's arrays in place, without copying them
+//                  addMesh / addShape       append geometry, addMesh taking the mesh's contents
+//                                           into the delegate, which then owns them
+//                  setAnimator              move the scene from elsewhere, such as a clip; the
+//                                           animator is not owned and must outlive the delegate
+//                Views into meshes the delegate owns are only valid until the next addMesh.
 //================================================================================================
 
 #pragma once
 #ifndef __SCENE_DELEGATE__
 #define __SCENE_DELEGATE__
 
+// Bump when the built in scene's meshes, shapes or lights change, so caches of it are made again
+#define SCENE_DELEGATE_VERSION 1
+
 #include <vector>
 
 class Float2 {
@@ -52,6 +65,15 @@ struct Mesh {
   std::vector<unsigned int> indexArray;
 };
 
+// read-only view of one mesh's arrays, valid for as long as the delegate
+struct MeshView {
+  const Float3* vertexArray;
+  const Float3* normalArray; // one per vertex
+  unsigned int numberOfVertices;
+  const unsigned int* indexArray;
+  unsigned int numberOfIndices;
+};
+
 struct Shape {
   unsigned int meshIndex;
   Float3 position;
@@ -65,9 +87,18 @@ struct Light {
   float intensity;
 };
 
+// moves a scene's shapes and lights in place of the delegate's own animation
+class SceneAnimator {
+public:
+  virtual ~SceneAnimator() {}
+  virtual void animate(float time, std::vector<Shape>& shapes, std::vector<Light>& lights) = 0;
+};
+
 class SceneDelegate {
 public:
   SceneDelegate(void);
+  SceneDelegate(const std::vector<MeshView>& meshes, const std::vector<Shape>& shapes,
+    const std::vector<Light>& lights, SceneAnimator* animator = 0);
   ~SceneDelegate(void);
 public:
   void animate(float time);
@@ -75,14 +106,27 @@ public:
   Float3 worldUpDirection(void) const;
   unsigned int numberOfMeshes(void) const;
   void getMeshAtIndex(unsigned int, Mesh*) const;
+  MeshView meshViewAtIndex(unsigned int) const;
   unsigned int numberOfShapes(void) const;
   Shape shapeAtIndex(unsigned int) const;
   unsigned int numberOfLights(void) const;
   Light lightAtIndex(unsigned int) const;
+public:
+  // add geometry from elsewhere, such as an importer, returning its index.
+  // addMesh takes the mesh's contents, leaving it empty
+  unsigned int addMesh(Mesh*);
+  unsigned int addShape(const Shape&);
+  // moves the scene from the next animate on, 0 for the built in animation.
+  // the animator must outlive the delegate
+  void setAnimator(SceneAnimator*);
 private:
+  void refreshViews(void);
   std::vector<Light> light_;
   std::vector<Mesh> mesh_;
+  std::vector<MeshView> view_; // of mesh_, or of meshes held by whoever constructed us
+  std::vector<int> owner_; // index into mesh_ of each view, -1 for meshes held elsewhere
   std::vector<Shape> shape_;
+  SceneAnimator* animator_; // or 0 for the built in animation
 };
 
 #endif
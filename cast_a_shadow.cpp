@@ -16,23 +16,77 @@
 #include "CEntity.h"
 #include "CFirstPersonCamera.h"
 #include "CLight.h"
+#include "CCommandLine.h"
+#include "CD3D9RenderDevice.h"
+#include "CNullRenderDevice.h"
+#include "CRecordingRenderDevice.h"
+#include "CFrameGraph.h"
+#include "CScenePasses.h"
+#include "CMeshCache.h"
+#include "CInstanceBatch.h"
+#include "CInstanceBuffer.h"
+#include "CStaticShadowBatcher.h"
+#include "CSceneCache.h"
+#include "CLoadBenchmark.h"
+#include "CAnimation.h"
+#include "CMeshLoader.h"
+#include "CMeshImporter.h"
+#include "CWater.h"
+#include "CNurbsSurfaces.h"
+#include "CProfiler.h"
+#include "CCameraPath.h"
+#include "CFrameLog.h"
+#include "CClock.h"
+#include "CSceneGenerator.h"
+#include "CJobSystem.h"
+#include "CJobBenchmark.h"
+#include "CFrameArena.h"
+#include "CAllocationCounter.h"
+#include "CSelfTest.h"
+#include <algorithm>
+#include <string>
+#include <cfloat>
+#include <cstdio>
+#include <cstring>
 
 class D3D9Window {
 public:
 	D3D9Window(void);
 	~D3D9Window(void);
 public:
-	bool Init(unsigned int width, unsigned int height);
+	bool Init(unsigned int width, unsigned int height, const CCommandLine &args);
 	void Run();
 	void Deinit();
+	int exitCode() const { return _exit_code; }
+
+	// What a recorded run drew, kept after Deinit for -selftest to check
+	const CFrameLog &frameLog() const { return _frame_log; }
+	const RenderCounters &recorded() const { return _recorded; }
+	const RenderCounters &recordedInPasses() const { return _recorded_in_passes; }
+	unsigned int recordedFrames() const { return _recorded_frames; }
 
 private:
+	bool CreateWin32Window(unsigned int width, unsigned int height);
+	bool CreateD3D9Device();
 	void CreateManagedResources();
 	void DestroyManagedResources();
 	void CreateUnmanagedResources();
 	void DestroyUnmanagedResources();
-	void UpdateFrame(float time);
+	void BuildFrameGraph();
+	void LoadOrder(std::vector<unsigned int> *order);
+	void UploadMeshes(double budget_ms);
+	void AddShadowCaster(unsigned int shape_index);
+	void FinishLoading();
+	void StepSimulation(double time);
+	void UpdateFrame(double time, float alpha);
+	static void UpdateEntities(void *window, unsigned int begin, unsigned int end);
+	static void BlendLights(void *window, unsigned int begin, unsigned int end);
+	void SimulateFrame(LONGLONG now, double time);
+	static void SimulateJob(void *window, unsigned int begin, unsigned int end);
+	void StartSimulation(LONGLONG now, double time);
+	void BeginFrame(LONGLONG now, double time);
 	void DrawFrame();
+	void BenchmarkFrame();
 
 private:
 	static LRESULT CALLBACK WndProc(HWND wnd, UINT msg, WPARAM wparam, LPARAM lparam);
@@ -62,54 +116,409 @@ private:
 	}
 
 private: // members for basic windowing
-	HWND _wnd; // window handle
+	HWND _wnd; // window handle, 0 when headless
+	bool _headless; // benchmarking on the null device, with no window to show or pump
 	bool _run; // flag to indicate when the message loop should exit
 private: // members for basic D3D9
-	IDirect3D9* _d3d; // Direct3D object
-	IDirect3DDevice9* _dev; // Direct3D rendering device
+	IDirect3D9* _d3d; // Direct3D object, NULL when running on the null device
+	CRenderDevice* _dev; // the rendering device everything draws through
+	CRecordingRenderDevice* _recorder; // _dev when call recording is enabled, otherwise NULL
+	RenderCounters _recorded, _recorded_in_passes; // the recorder's totals, over every frame and summed over its events, once it is gone
+	unsigned int _recorded_frames;
 	bool _lost; // flag to indicate the device needs resetting
 	D3DPRESENT_PARAMETERS _pp; // device settings needed for resetting it when it is lost
 private:
-	LPDIRECT3DTEXTURE9  _shadow_texture; //Texture to store shadow map in
-	IDirect3DSurface9* _shadow_rendertarget; //The first surface level of the shadow texture
-	IDirect3DSurface9* _shadow_depthstencil; //The depth stencil for the shadow pass
-
 	IDirect3DSurface9* _window_rendertarget; //The default screen render target
 	IDirect3DSurface9* _window_depthstencil; //The default septh stencil
 
+	CFrameGraph _frame_graph; //Orders the passes of a frame and owns the shadow maps
+	FrameResource _backbuffer, _backbuffer_depth; //The window surfaces as seen by the frame graph
+	std::vector<CRenderPass*> _passes; //The passes added to the frame graph
+	ScenePassContext _pass_context; //What the passes draw
+	unsigned int _frames; //Frames drawn, for per frame averages
+	bool _print_culling; //Report how much meshlet culling removed on exit
+	bool _print_profile; //Report the time each profiled stage took on exit
+	std::string _trace_path; //Where to write a Chrome trace of the profiled stages on exit, empty for not at all
+	LARGE_INTEGER _frequency, _startup; //When Init began, for time to first frame and to fully loaded
+
+	CClock _clock; //Ticks since startup, which the simulation and frame pacing go by
+	CFixedTimestep _simulation; //Steps the scene's animation at a fixed rate, whatever the frame rate
+	double _sim_step; //Seconds each step simulates
+	bool _interpolate; //Draw between the last two steps rather than at the last one
+	bool _vsync; //Present on the vertical blank, which paces the loop, rather than as fast as possible
+	CFramePacing _pacing; //How evenly frames began
+	std::vector<Shape> _previous_shapes, _current_shapes; //The shapes at the last two steps
+	std::vector<Light> _previous_lights, _current_lights; //And the lights
+	float _alpha; //How far between them the frame being updated is
+	std::vector<Light> _next_lights; //The lights of the frame being simulated, drawn once it is flipped in
+	double _next_time, _frame_time; //The time of the frame being simulated, and of the one being drawn
+
+	bool _pipeline; //Simulate the next frame on a worker while this one is drawn, a frame behind
+	bool _sim_started; //A frame is being simulated by a job
+	LONGLONG _sim_now; //What that job catches the simulation up to
+	double _sim_time; //or in a benchmark, the exact time it steps to
+	JobCounter _simulated; //Done when that job is
+	double _sim_wait_ms; //Time spent waiting on those jobs, in all
+
+	CJobSystem _jobs; //Shares the frame's entity updates and draw preparation over the cores
+	bool _print_jobs; //Report what each job queue did on exit
+
+	CFrameArena _arena; //What each frame works out and throws away, reset as it begins
+	CAllocationCounter _allocations; //Heap allocations made by frames once loaded, which should be none
+	bool _check_allocations; //Count them, and report frames that allocated
+	int _exit_code; //What the process returns, non-zero when a check asked for failed
+
+	unsigned int _bench_frames; //Frames to run flat out, each a fixed step on, before quitting. 0 to run as normal
+	double _bench_step; //Seconds simulated each benchmark frame
+	std::string _bench_csv; //Where each benchmark frame is written
+	CCameraPath _camera_path; //Where the camera flies during a benchmark
+	CFrameLog _frame_log; //Each benchmark frame's timings and counts
+	RenderCounters _bench_counters; //Device totals after the last benchmark frame
+	MeshletCullStats _bench_camera_culling, _bench_shadow_culling; //And culling totals
+
+	CSceneGenerator _generator; //Lays out and animates large scenes for stress tests, outliving the delegate it makes
+	CAnimation _animation; //Keyframed tracks played in place of the scene's own animation, outliving the delegate too
+	bool _animated; //The scene plays _animation, so each step knows which shapes it moved
+	std::vector<unsigned char> _step_moved, _moved; //Shapes the last step moved, and any step since the last frame
+	std::vector<unsigned char> _still; //Frames in a row each entity was placed where it already was, up to two
+	volatile LONG _entities_skipped; //Entity updates left out because neither world matrix would change
 	SceneDelegate* _scene_delegate; //The sceene delegate stores all the sceenes information.
 									//This includes meshes and lighting
+	CSceneCache _scene_cache; //The scene and its packed meshes, mapped from disk when there is a valid cache
+	std::string _scene_cache_path; //Where to write the scene cache once every mesh is packed, empty for not at all
+	unsigned int _scene_source_hash; //Of what the scene and its packing were made from, which the cache must have been made from
+	std::vector<Shape> _made_shapes; //The shapes and lights as the scene was made, before any animation, for the cache
+	std::vector<Light> _made_lights;
 
 	std::vector<CEntity*> _entity; //Store all geometry objects
+	CMeshCache _mesh_cache; //Each mesh uploaded once, shared between entities
+	CMeshLoader _loader; //Packs meshes as background jobs for UploadMeshes to upload
+	bool _loading; //Meshes are still arriving
+	bool _sync_load; //Upload every mesh before the first frame
+	unsigned int _load_threads; //Jobs packing meshes side by side, 0 for one per job worker
+	double _upload_budget; //Milliseconds a frame may spend uploading meshes
+	double _upload_total, _upload_worst; //Milliseconds spent uploading, in all and in the worst frame
+	unsigned int _upload_frames; //Frames that uploaded anything
+	std::vector<bool> _is_static; //Shapes animate() never moves
+	std::vector< std::vector<unsigned int> > _shapes_for_mesh; //The shapes each mesh's arrival brings in
+	std::vector<CInstanceBatch*> _batch_for_mesh, _shadow_batch_for_mesh; //Each mesh's batches in the lists below, NULL until made
+	std::vector<CInstanceBatch*> _batches; //Entities grouped by mesh, one draw each per pass
+	std::vector<CInstanceBatch*> _shadow_batches; //As above but only the moving entities, for shadow maps
+	CStaticShadowBatcher _static_shadows; //Entities that never move, merged for shadow maps
+	CInstanceBuffer _instances; //World matrices, appended to by every pass as it draws
+	CWater *_water; //A simulated water surface, NULL unless asked for
+	CNurbsSurfaces _nurbs; //Curved surfaces, tessellated to suit each view
+	unsigned int _instance_count; //Size of the instance ring
 
 	CFirstPersonCamera *_camera;	//A first person camera used to navigate the sceene
 	CFirstPersonCamera *getCamera() { return _camera; } //A simple getter for the camera
 
 	void reloadShaders( void );	//Reloads all three shaders (pixel and vertex)
 	CShader *_light, *_shadow, *_ambient; //The free shaders used in the sceene
+	CShader *_float_light, *_float_ambient; //The lighting and ambient shaders for float normals, as the water and NURBS have
 };
 
+//Compiles the variant of a shader that reads float normals
+static const D3DXMACRO float_normals[] = { { "FLOAT_NORMALS", "1" }, { NULL, NULL } };
+
 //Initilise unmanaged resources to null
 D3D9Window::D3D9Window() : 
-	_wnd(0), _run(true),
-	_d3d(0), _dev(0), _lost(true), 
-	_window_rendertarget(0), _window_depthstencil(0), _shadow_rendertarget(0),  
-	_shadow_depthstencil(0), _shadow_texture(0)
+	_wnd(0), _headless(false), _run(true),
+	_d3d(0), _dev(0), _recorder(0), _recorded_frames(0), _lost(true), 
+	_window_rendertarget(0), _window_depthstencil(0), _instance_count(0),
+	_frames(0), _print_culling(false), _print_profile(false), _bench_frames(0), _bench_step(0.0),
+	_sim_step(1.0 / 60.0), _interpolate(true), _vsync(true), _alpha(1.0f), _next_time(0.0), _frame_time(0.0),
+	_pipeline(true), _sim_started(false), _sim_now(0), _sim_time(0.0), _sim_wait_ms(0.0), _print_jobs(false), _check_allocations(false), _exit_code(0), _animated(false), _entities_skipped(0), _scene_delegate(0), _scene_source_hash(0),
+	_loading(false), _sync_load(false), _load_threads(0), _upload_budget(2.0),
+	_upload_total(0.0), _upload_worst(0.0), _upload_frames(0),
+	_water(0), _float_light(0), _float_ambient(0)
 {
-	//Create an instance of the sceene delegate
-	_scene_delegate = new SceneDelegate();
 	//Create an instance of the camera
 	_camera = new CFirstPersonCamera();
 }
 
 D3D9Window::~D3D9Window() {
-	assert("D3D9Window::Shutdown not performed" && _wnd == 0);
+	assert("D3D9Window::Shutdown not performed" && _wnd == 0 && _dev == 0);
 	delete _scene_delegate;
+	_scene_cache.close(); // after the delegate, which reads its meshes from the mapping
 }
 
-bool D3D9Window::Init(unsigned int width, unsigned int height) {
-	assert( "D3D9Window::Init already performed" && _wnd == 0 );
+bool D3D9Window::Init(unsigned int width, unsigned int height, const CCommandLine &args) {
+	assert( "D3D9Window::Init already performed" && _wnd == 0 && _dev == 0 );
+
+	// A benchmark on the null device draws nothing and ends by itself, so it needs
+	// no window: it runs without a desktop and has no window messages to wait on
+	_headless = args.hasFlag("-null") && args.getInt("-benchmark", 0) > 0;
+	if (!_headless && !CreateWin32Window(width, height))
+		return false;
+
+	// Per frame work is spread over a worker per core but one, the render thread helping
+	if (!_jobs.init(args.getInt("-jobthreads", 0))) {
+		std::cerr << "D3D9Window::Init failed; could not start the job system" << std::endl;
+		return false;
+	}
+	_print_jobs = args.hasFlag("-jobstats");
+
+	// Steady frames should make no heap allocations, transient data goes in the frame arena.
+	// What the render thread and the job workers allocate is counted, nothing else
+	_check_allocations = args.hasFlag("-allocs");
+	_allocations.init(args.getInt("-allocwarmup", 60));
+	if (_check_allocations)
+		CAllocationCounter::countThisThread(true);
+
+	// The scene is animated in fixed steps and drawn between the last two, presenting
+	// on vsync unless running uncapped
+	_sim_step = 1.0 / args.getFloat("-simrate", 60.0f);
+	_interpolate = !args.hasFlag("-nointerpolate");
+	_vsync = !args.hasFlag("-uncapped");
+
+	// Each frame is simulated on a worker while the one before is drawn, unless asked not to
+	_pipeline = !args.hasFlag("-nopipeline");
+
+	if (args.hasFlag("-null")) {
+		// Discard all rendering, only the CPU side of the frame is run
+		_pp.BackBufferWidth = width;
+		_pp.BackBufferHeight = height;
+		_dev = new CNullRenderDevice(width, height);
+	}
+	else if (!CreateD3D9Device()) {
+		return false;
+	}
+
+	// A benchmark runs a fixed number of frames flat out, each a fixed step of simulated
+	// time on from the last with the camera on a scripted path, so runs can be compared
+	_bench_frames = args.getInt("-benchmark", 0);
+
+	// Count (and optionally log) every call made on the device, which a benchmark reports per frame
+	if (args.hasFlag("-record") || args.hasFlag("-recordlog") || _bench_frames > 0) {
+		_recorder = new CRecordingRenderDevice(_dev);
+		if (args.hasFlag("-recordlog"))
+			_recorder->setLog(&std::clog);
+		_dev = _recorder;
+	}
+
+	// Measure how many triangles meshlet culling saves
+	_print_culling = args.hasFlag("-cullstats");
+
+	// Time each stage of a frame, taking the device counts for each pass when recording
+	_print_profile = args.hasFlag("-profile");
+	_trace_path = args.getString("-trace", "");
+	PROFILE_THREAD("render");
+	if (_recorder != 0)
+		CProfiler::setCounters(&_recorder->frame());
+#ifndef ENABLE_PROFILING
+	if (_print_profile || !_trace_path.empty())
+		std::cout << "Built without ENABLE_PROFILING, there is nothing to profile. Build the Profile configuration to time optimized code\n";
+#endif
+
+	// Meshes are packed on worker threads and uploaded a few each frame, or all
+	// before the first frame as they used to be
+	_sync_load = args.hasFlag("-syncload");
+	_upload_budget = args.getFloat("-uploadbudget", 2.0f);
+	_load_threads = args.getInt("-loadthreads", 0);
+
+	// Every benchmark frame sees the whole scene, flown around on a path from a
+	// file or circling the origin where the camera starts
+	if (_bench_frames > 0) {
+		_sync_load = true;
+		_bench_step = 1.0 / args.getFloat("-benchrate", 60.0f);
+		_bench_csv = args.getString("-benchcsv", "benchmark.csv");
+		const char *path = args.getString("-camerapath", NULL);
+		if (path == NULL)
+			_camera_path.makeOrbit(D3DXVECTOR3(0, 0, 0), args.getFloat("-orbitradius", 26.7f), args.getFloat("-orbitheight", 11.5f), -0.5f, args.getFloat("-orbittime", 20.0f));
+		else if (!_camera_path.load(path)) {
+			std::cout << "Error - Could not read the camera path " << path << "\n";
+			_run = false;
+		}
+		_frame_log.reserve(_bench_frames);
+		memset(&_bench_camera_culling, 0, sizeof(MeshletCullStats));
+		memset(&_bench_shadow_culling, 0, sizeof(MeshletCullStats));
+	}
+
+	// Map the scene from its cache, or make it and write the cache for next time.
+	// The cache is keyed on what the scene is made from, all known before any of it
+	// is made: the built in scene's version, the generator's settings, the file
+	// imported and where it goes, and how meshes are packed
+	const char *scene_cache = args.getString("-scenecache", "scene.cache");
+	const char *import = args.getString("-import", NULL);
+	const char *layout = args.getString("-generate", NULL);
+	bool use_cache = !args.hasFlag("-nocache");
+	LARGE_INTEGER loaded, created;
+	QueryPerformanceFrequency(&_frequency);
+	QueryPerformanceCounter(&_startup);
+	SceneCacheKey key;
+	key.add((unsigned int)SCENE_DELEGATE_VERSION);
+
+	// A grid or scatter of shapes under many spotlights, the same for the same seed
+	SceneGeneratorSettings settings;
+	if (layout != NULL) {
+		settings.scatter = strcmp(layout, "scatter") == 0;
+		settings.shapes = args.getInt("-genshapes", settings.shapes);
+		settings.spacing = args.getFloat("-genspacing", settings.spacing);
+		settings.moving = args.getFloat("-genmoving", settings.moving);
+		settings.lights = args.getInt("-genlights", settings.lights);
+		settings.min_cone = args.getFloat("-genconemin", settings.min_cone);
+		settings.max_cone = args.getFloat("-genconemax", settings.max_cone);
+		settings.seed = args.getInt("-genseed", settings.seed);
+		if (settings.shapes == 0 || settings.spacing <= 0.0f || settings.min_cone > settings.max_cone) {
+			std::cout << "Error - Can not generate that scene\n";
+			settings = SceneGeneratorSettings();
+			_run = false;
+		}
+		key.add("generate");
+		key.add((unsigned int)settings.scatter);
+		key.add(settings.shapes);
+		key.add(settings.spacing);
+		key.add(settings.moving);
+		key.add(settings.lights);
+		key.add(settings.min_cone);
+		key.add(settings.max_cone);
+		key.add(settings.seed);
+	}
+
+	// A mesh from an OBJ or PLY file, scaled and placed as asked. One that can not be
+	// found is not cached, so the import reports why
+	const float import_scale = args.getFloat("-importscale", 1.0f);
+	const char *import_at = args.getString("-importat", "0,0,0");
+	if (import != NULL) {
+		key.add("import");
+		use_cache = key.addFile(import) && use_cache;
+		key.add(import_scale);
+		key.add(import_at);
+	}
+
+	std::vector<float> packer;
+	CMeshCache::packerSettings(&packer);
+	key.add(&packer[0], packer.size() * sizeof(float));
+	_scene_source_hash = key.hash();
+
+	if (use_cache && _scene_cache.open(scene_cache, _scene_source_hash)) {
+		// A generated scene is still moved by the generator, which only has to lay it out again
+		if (layout != NULL) {
+			std::vector<Shape> shapes;
+			std::vector<Light> lights;
+			_generator.layOut(settings, &shapes, &lights);
+			_generator.print(std::cout);
+		}
+		_scene_delegate = _scene_cache.createScene(layout != NULL ? &_generator : 0);
+	}
+	else {
+		if (layout != NULL) {
+			_scene_delegate = _generator.generate(settings);
+			_generator.print(std::cout);
+		}
+		else
+			_scene_delegate = new SceneDelegate();
+
+		if (import != NULL) {
+			Mesh mesh;
+			ImportStats stats;
+			if (CMeshImporter::import(import, &_jobs, args.getInt("-importthreads", 0), &mesh, &stats)) {
+				std::cout << "Imported " << import << ": ";
+				stats.print(std::cout);
+
+				for (UINT i = 0; i < mesh.vertexArray.size(); i++)
+					mesh.vertexArray[i] = Float3(mesh.vertexArray[i].x * import_scale, mesh.vertexArray[i].y * import_scale, mesh.vertexArray[i].z * import_scale);
+
+				Shape shape;
+				shape.meshIndex = _scene_delegate->addMesh(&mesh);
+				if (sscanf(import_at, "%f,%f,%f", &shape.position.x, &shape.position.y, &shape.position.z) != 3)
+					shape.position = Float3(0, 0, 0);
+				_scene_delegate->addShape(shape);
+			}
+		}
+
+		// The cache holds the scene as made, not as it is once animated
+		if (use_cache) {
+			_scene_cache_path = scene_cache;
+			_made_shapes.resize(_scene_delegate->numberOfShapes());
+			for (UINT i = 0; i < _made_shapes.size(); i++)
+				_made_shapes[i] = _scene_delegate->shapeAtIndex(i);
+			_made_lights.resize(_scene_delegate->numberOfLights());
+			for (UINT i = 0; i < _made_lights.size(); i++)
+				_made_lights[i] = _scene_delegate->lightAtIndex(i);
+		}
+	}
 
+	// Play keyframed tracks from a file, or baked from the scene's own animation,
+	// which tell each step exactly which shapes and lights moved
+	const char *animation = args.getString("-animation", NULL);
+	const float bake_seconds = args.getFloat("-bakeanimation", 0.0f);
+	if (animation != NULL || bake_seconds > 0.0f) {
+		if (animation != NULL && !_animation.load(animation))
+			std::cout << "Error - Could not read the animation " << animation << "\n";
+		else if (animation == NULL && !_animation.bake(_scene_delegate, bake_seconds, args.getFloat("-bakerate", 30.0f)))
+			std::cout << "Error - The scene has nothing to bake into an animation\n";
+		else if (!_animation.fits(_scene_delegate))
+			std::cout << "Error - The animation moves shapes or lights the scene does not have\n";
+		else {
+			_animation.setJobs(&_jobs);
+			_scene_delegate->setAnimator(&_animation);
+			_animated = true;
+			_moved.assign(_scene_delegate->numberOfShapes(), 1);
+			_step_moved.assign(_scene_delegate->numberOfShapes(), 1);
+			_still.assign(_scene_delegate->numberOfShapes(), 0);
+		}
+	}
+	QueryPerformanceCounter(&loaded);
+
+	// Compare copying meshes out of the scene against reading them in place, then quit
+	if (args.hasFlag("-loadbench")) {
+		CLoadBenchmark::run(_scene_delegate, std::cout);
+		_run = false;
+	}
+
+	// Measure how the job system scales with threads, then quit
+	if (args.hasFlag("-jobbench")) {
+		CJobBenchmark::run(args.getInt("-jobbenchmax", JOB_MAX_THREADS), std::cout);
+		_run = false;
+	}
+
+	// A water surface simulated as a background job, drawn and shadowed with the rest
+	if (args.hasFlag("-water")) {
+		D3DXMATRIX world;
+		D3DXVECTOR3 at(0, 0, 0);
+		if (sscanf(args.getString("-waterat", "0,0,0"), "%f,%f,%f", &at.x, &at.y, &at.z) != 3)
+			at = D3DXVECTOR3(0, 0, 0);
+		D3DXMatrixTranslation(&world, at.x, at.y, at.z);
+
+		_water = new CWater();
+		if (!_water->init(_dev, &_jobs, world, 1.0f / 60.0f, args.getFloat("-watersize", 40.0f), args.getInt("-waterpoints", 64), 1.0f, 0.5f, 10.0f)) {
+			std::cout << "Error - Could not create the water\n";
+			_run = false;
+		}
+	}
+
+	// NURBS sheets in rows, each tessellated by background jobs to the level each view needs
+	const unsigned int sheets = args.getInt("-nurbs", 0);
+	if (sheets > 0) {
+		D3DXVECTOR3 at(-20, -20, 2);
+		if (sscanf(args.getString("-nurbsat", "-20,-20,2"), "%f,%f,%f", &at.x, &at.y, &at.z) != 3)
+			at = D3DXVECTOR3(-20, -20, 2);
+		for (UINT i = 0; i < sheets; i++) {
+			NurbsPatch patch;
+			CNurbsSurfaces::makeSheet(8, 10.0f, 4.0f, i + 1, at + D3DXVECTOR3(12.0f * (i % 4), 12.0f * (i / 4), 0), &patch);
+			_nurbs.add(patch);
+		}
+		if (!_nurbs.init(_dev, &_jobs, args.getFloat("-nurbstolerance", 1.0f))) {
+			std::cout << "Error - Could not start the NURBS tessellation\n";
+			_run = false;
+		}
+	}
+
+	// Allocate resources
+	CreateManagedResources();
+	QueryPerformanceCounter(&created);
+
+	const double ms = 1000.0 / _frequency.QuadPart;
+	std::cout << "Startup: scene " << (loaded.QuadPart - _startup.QuadPart) * ms << " ms, resources "
+		<< (created.QuadPart - loaded.QuadPart) * ms << " ms, "
+		<< (_scene_cache.isOpen() ? "from the scene cache" : "generated") << "\n";
+
+	return true;
+}
+
+bool D3D9Window::CreateWin32Window(unsigned int width, unsigned int height) {
 	// Define a window "class" - this is Win32 not D3D9
 	WNDCLASS wc;
 	wc.cbClsExtra = 0;
@@ -147,6 +556,10 @@ bool D3D9Window::Init(unsigned int width, unsigned int height) {
 	// Store a pointer to this object in the window - this is helpful for later
 	SetWindowLongPtr(_wnd, GWL_USERDATA, (LONG_PTR)this);
 
+	return true;
+}
+
+bool D3D9Window::CreateD3D9Device() {
 	// Create Direct3D - this isn't the device yet
 	_d3d = Direct3DCreate9(D3D_SDK_VERSION);
 	if (_d3d == 0) {
@@ -180,34 +593,34 @@ bool D3D9Window::Init(unsigned int width, unsigned int height) {
 	_pp.AutoDepthStencilFormat = D3DFMT_D24X8;
 	_pp.Flags = 0;
 	_pp.FullScreen_RefreshRateInHz = 0;
-	_pp.PresentationInterval = D3DPRESENT_INTERVAL_IMMEDIATE;
+	_pp.PresentationInterval = _vsync ? D3DPRESENT_INTERVAL_ONE : D3DPRESENT_INTERVAL_IMMEDIATE;
 
 	// Create a rendering device
+	IDirect3DDevice9* dev = 0;
 	if (FAILED(_d3d->CreateDevice(D3DADAPTER_DEFAULT, D3DDEVTYPE_HAL, _wnd,
-		D3DCREATE_MIXED_VERTEXPROCESSING, &_pp, &_dev))) {
+		D3DCREATE_MIXED_VERTEXPROCESSING, &_pp, &dev))) {
 			std::cerr << "D3D9Window::Init failed; IDirect3D9::CreateDevice failed" << std::endl;
 			Deinit();
 			return false;
 	}
-
-	// Allocate resources
-	CreateManagedResources();
+	_dev = new CD3D9RenderDevice(dev);
 
 	return true;
+
 }
 
 void D3D9Window::Run() {
-	assert("D3D9Window::Init not performed" && _wnd != 0);
+	assert("D3D9Window::Init not performed" && _dev != 0);
 
-	// Make the window appear - this is Win32 not D3D9
-	ShowWindow(_wnd, SW_SHOW);
+	// Make the window appear - this is Win32 not D3D9. A benchmark on the null device has none to show
+	if (!_headless)
+		ShowWindow(_wnd, SW_SHOW);
 
 	// Establish a "message loop", continuously listening for and processing window events,
 	//   updating and drawing the "scene"
 	MSG msg;
-	timeBeginPeriod(1);
-	const long ideal_frame_time = 16;
-	long start_time = timeGetTime();
+	_simulation.init(_clock, _sim_step, 8);
+	LONGLONG last_frame = _clock.ticks();
 	while (_run == true) {
 
 		// Handle all pending events - this is Win32 not D3D9
@@ -232,40 +645,131 @@ void D3D9Window::Run() {
 		// If device is operational, draw
 		if (_lost == false) {
 
-			// Update the scene
-			UpdateFrame(start_time * 0.001f);
+			PROFILE_SCOPE("frame");
 
-			// Render the scene
-			DrawFrame();
-		}
+			// Frames are paced by presenting, so how evenly they begin is how evenly they are shown
+			const LONGLONG now = _clock.ticks();
+			_pacing.add(_clock.toMs(now - last_frame));
+			last_frame = now;
+
+			if (_check_allocations)
+				_allocations.beginFrame();
 
-		// Regulate the frame rate
-		long delta_time = timeGetTime() - start_time;
-		if (delta_time < ideal_frame_time) {
-			Sleep(ideal_frame_time - delta_time - 1);
-			start_time += ideal_frame_time;
+			if (_bench_frames > 0) {
+				BenchmarkFrame();
+			}
+			else {
+				// Take the frame simulated while the last was drawn, or simulate one for now
+				BeginFrame(now, 0.0);
+
+				// Then simulate the next for now while this one is drawn
+				if (_pipeline)
+					StartSimulation(now, 0.0);
+
+				// Render the scene
+				DrawFrame();
+			}
+
+			// Frames still loading meshes allocate as they bring them in
+			if (_check_allocations)
+				_allocations.endFrame(_frames, !_loading);
 		}
 		else {
-			start_time = timeGetTime();
+			// Nothing can be drawn until the device is reset, so give the time away
+			Sleep(10);
 		}
 	}
-	timeEndPeriod(1);
 }
 
 void D3D9Window::Deinit()
 {
-	assert("D3D9Window::Init not performed" && _wnd != 0);
+	assert("D3D9Window::Init not performed" && (_wnd != 0 || _headless));
+
+	// The frame simulated ahead is never drawn, but it still uses the scene
+	_jobs.wait(&_simulated);
+	_sim_started = false;
+
+	// Report where the time went, while the pass names the events point at are still there
+	if (_print_profile)
+		CProfiler::printStats(std::cout);
+	if (!_trace_path.empty() && !CProfiler::writeTrace(_trace_path.c_str()))
+		std::cerr << "Could not write the trace " << _trace_path << std::endl;
+
+	// Report how evenly frames were presented
+	_pacing.print(std::cout);
+	if (_simulation.dropped() > 0)
+		std::cout << _simulation.dropped() << " simulation steps skipped after stalls\n";
+	if (_pipeline && _frames > 0)
+		std::cout << "Waited " << _sim_wait_ms / _frames << " ms a frame for the next to be simulated\n";
+
+	// Report what the keyframed animation cost, and how many entity updates its change masks saved
+	if (_animated) {
+		_animation.print(std::cout);
+		if (_frames > 0)
+			std::cout << "  " << (double)_entities_skipped / _frames << " entity updates a frame skipped as unmoved\n";
+	}
+
+	// Report how the frames' jobs were shared out
+	if (_print_jobs)
+		_jobs.print(std::cout);
+
+	// Report whether steady frames kept off the heap
+	if (_check_allocations) {
+		_arena.print(std::cout);
+		_allocations.print(std::cout);
+		if (!_allocations.passed()) {
+			std::cerr << "Steady frames made heap allocations, see above for the first of them" << std::endl;
+			_exit_code = 1;
+		}
+	}
+
+	// Report the benchmark, and write out its frames
+	if (_bench_frames > 0) {
+		_frame_log.printSummary(std::cout);
+		if (!_frame_log.writeCsv(_bench_csv.c_str()))
+			std::cerr << "Could not write the benchmark frames to " << _bench_csv << std::endl;
+	}
+
+	// Report what the water cost each frame
+	if (_water != 0)
+		_water->print(std::cout);
+	if (_nurbs.numberOfPatches() > 0)
+		_nurbs.print(std::cout, _frames);
 
 	// Release resources
 	DestroyManagedResources();
 	DestroyUnmanagedResources();
 
+	// Report what culling meshlets saved, per frame
+	if (_print_culling) {
+		std::cout << "camera meshlets: ";
+		_pass_context.camera_culling.print(std::cout, _frames);
+		std::cout << "shadow meshlets: ";
+		_pass_context.shadow_culling.print(std::cout, _frames);
+	}
+
+	// Report what the device was asked to do
+	if (_recorder != 0) {
+		_recorder->printSummary(std::cout);
+		CProfiler::setCounters(NULL);
+		_recorded = _recorder->total();
+		_recorded_frames = _recorder->frames();
+		const std::map<std::string, RenderCounters> &events = _recorder->eventTotals();
+		for (std::map<std::string, RenderCounters>::const_iterator e = events.begin(); e != events.end(); ++e)
+			_recorded_in_passes.add(e->second);
+		_recorder = 0;
+	}
+
+	// Nothing is left for the workers to do
+	_jobs.shutdown();
+
 	// Release the Direct3D primary interfaces
-	Release(&_dev);
+	Free(&_dev);
 	Release(&_d3d);
 
 	// Destroy the window - this is Win32 not D3D9
-	DestroyWindow(_wnd);
+	if (_wnd != 0)
+		DestroyWindow(_wnd);
 	_wnd = 0;
 }
 
@@ -277,6 +781,11 @@ void D3D9Window::reloadShaders( void )
 	_light->reload( _dev, "Lighting.vsh", "Lighting.psh" );
 	_shadow->reload( _dev, "Shadow.vsh", "Shadow.psh" );
 	_ambient->reload( _dev, "Ambient.vsh", "Ambient.psh" );
+	if ( _float_light != NULL )
+	{
+		_float_light->reload( _dev, "Lighting.vsh", "Lighting.psh", float_normals );
+		_float_ambient->reload( _dev, "Ambient.vsh", "Ambient.psh", float_normals );
+	}
 }
 
 //Create managed resources
@@ -311,33 +820,335 @@ void D3D9Window::CreateManagedResources() {
 		_run = false;
 	}
 
-	//Create entities based upon the meshes from the sceene delegate
+	//The water and NURBS have float normals rather than packed ones, so need their own variants
+	if ( _water != NULL || _nurbs.numberOfPatches() > 0 )
+	{
+		_float_light = new CShader();
+		_float_ambient = new CShader();
+		if(	!_float_light->init( _dev, "Lighting.vsh", "Lighting.psh", float_normals ) ||
+			!_float_ambient->init( _dev, "Ambient.vsh", "Ambient.psh", float_normals ) )
+		{
+			//if it failed to load quit
+			_run = false;
+		}
+	}
+
+	//Each mesh is uploaded once, for every entity using it
+	if ( !_mesh_cache.init( _dev, _scene_delegate, &_scene_cache ) )
+	{
+		std::cout << "Error - Could not create vertex declaration\n";
+		_run = false;
+	}
+
+	//shapes animate() never moves only need drawing into shadow maps once, merged.
+	//keyframed animation knows which it moves, sampling could miss some
+	if ( _animated )
+		_animation.findStaticShapes( _scene_delegate->numberOfShapes(), &_is_static );
+	else
+		CStaticShadowBatcher::findStaticShapes( _scene_delegate, &_is_static );
+
+	//entities are made as their meshes arrive, until then a shape has none
+	_entity.assign( _scene_delegate->numberOfShapes(), (CEntity*)NULL );
+	_batch_for_mesh.assign( _scene_delegate->numberOfMeshes(), (CInstanceBatch*)NULL );
+	_shadow_batch_for_mesh.assign( _scene_delegate->numberOfMeshes(), (CInstanceBatch*)NULL );
+	_shapes_for_mesh.assign( _scene_delegate->numberOfMeshes(), std::vector<unsigned int>() );
 	for( UINT i = 0; i < _scene_delegate->numberOfShapes(); i++ )
+		_shapes_for_mesh[_scene_delegate->shapeAtIndex( i ).meshIndex].push_back( i );
+
+	//each pass appends the instances it draws, the ring holds a few frames
+	//worth so the GPU is rarely still reading the part being written
+	_instance_count = _entity.size() * 4 + _nurbs.numberOfPatches() + 64;
+
+	//every pass lists a level for each entity it draws and the meshlet ranges it
+	//culls to, and each light has its table entry, the arena grows if that is not enough
+	if ( !_arena.init( _entity.size() * ( 1 + 2 * _scene_delegate->numberOfLights() ) + _scene_delegate->numberOfLights() * 512 + 64 * 1024 ) )
 	{
-		Mesh mesh;
-		_scene_delegate->getMeshAtIndex( i, &mesh );
-		Shape shape = _scene_delegate->shapeAtIndex( i );
+		std::cout << "Error - Could not create the frame arena\n";
+		_run = false;
+	}
 
-		CEntity *new_ent = new CEntity();
-		new_ent->init( _dev, &mesh, shape );
-		new_ent->setshaders( _light, _shadow, _ambient );
-		_entity.push_back( new_ent );
+	//the first step, which is where the scene is drawn until the next
+	StepSimulation( 0.0 );
+	_previous_shapes = _current_shapes;
+	_previous_lights = _current_lights;
+	_animation.resetStats();
+
+	//pack the meshes as background jobs, nearest the camera first
+	std::vector<unsigned int> order;
+	LoadOrder( &order );
+	_loading = _run;
+	if ( _loading )
+		_loader.start( _scene_delegate, &_mesh_cache, &_jobs, order, _load_threads );
+	std::cout << "Loading " << order.size() << " meshes in " << _loader.packers() << " jobs\n";
+
+	//or wait for all of them, as before
+	while ( _sync_load && _loading )
+	{
+		UploadMeshes( DBL_MAX );
+		if ( _loading )
+			Sleep( 1 );
 	}
 
+	BuildFrameGraph();
+}
+
+//Which meshes to load, each as urgent as the shape using it nearest the camera
+void D3D9Window::LoadOrder(std::vector<unsigned int> *order)
+{
+	const D3DXVECTOR4 eye = _camera->getPosition();
+	std::vector< std::pair<float, unsigned int> > nearest;
+	for( UINT m = 0; m < _shapes_for_mesh.size(); m++ )
+	{
+		//meshes no shape uses are never loaded
+		if ( _shapes_for_mesh[m].empty() )
+			continue;
+
+		float distance = FLT_MAX;
+		for( UINT s = 0; s < _shapes_for_mesh[m].size(); s++ )
+		{
+			const Float3 p = _scene_delegate->shapeAtIndex( _shapes_for_mesh[m][s] ).position;
+			const D3DXVECTOR3 offset( p.x - eye.x, p.y - eye.y, p.z - eye.z );
+			const float d = D3DXVec3Length( &offset );
+			if ( d < distance )
+				distance = d;
+		}
+		nearest.push_back( std::make_pair( distance, m ) );
+	}
+	std::sort( nearest.begin(), nearest.end() );
+
+	order->clear();
+	for( UINT i = 0; i < nearest.size(); i++ )
+		order->push_back( nearest[i].second );
+}
+
+//Upload the meshes the workers have packed until budget_ms is used up, at
+//least one if any are ready, bringing in the entities that use each
+void D3D9Window::UploadMeshes(double budget_ms)
+{
+	PROFILE_SCOPE( "upload meshes" );
+	LARGE_INTEGER start, now;
+	QueryPerformanceCounter(&start);
+	const double ms = 1000.0 / _frequency.QuadPart;
+
+	double elapsed = 0.0;
+	unsigned int uploaded = 0;
+	while ( uploaded == 0 || elapsed < budget_ms )
+	{
+		LoadedMesh *loaded = _loader.take();
+		if ( loaded == NULL )
+			break;
+
+		const unsigned int m = loaded->mesh_index;
+		CMesh *mesh = _mesh_cache.upload( _dev, m, loaded->packed );
+		delete loaded;
+		uploaded++;
+
+		//the shapes of a mesh that could not be uploaded get no entity, and are never drawn
+		if ( mesh == NULL )
+			std::cout << "Error - Could not upload mesh " << m << ", its " << _shapes_for_mesh[m].size() << " shapes are left out\n";
+
+		for( UINT s = 0; mesh != NULL && s < _shapes_for_mesh[m].size(); s++ )
+		{
+			const unsigned int i = _shapes_for_mesh[m][s];
+			CEntity *new_ent = new CEntity();
+			new_ent->init( mesh, _scene_delegate->shapeAtIndex( i ), 1 + _scene_delegate->numberOfLights() );
+			_entity[i] = new_ent;
+
+			//group shapes sharing a mesh so they are drawn with one instanced call
+			if ( _batch_for_mesh[m] == NULL )
+			{
+				_batch_for_mesh[m] = new CInstanceBatch( mesh );
+				_batches.push_back( _batch_for_mesh[m] );
+			}
+			_batch_for_mesh[m]->add( new_ent );
+
+			//static shapes cast their shadows like the rest until they can be merged
+			AddShadowCaster( i );
+		}
+
+		QueryPerformanceCounter(&now);
+		elapsed = (now.QuadPart - start.QuadPart) * ms;
+	}
+
+	if ( uploaded > 0 )
+	{
+		_upload_total += elapsed;
+		if ( elapsed > _upload_worst )
+			_upload_worst = elapsed;
+		_upload_frames++;
+	}
+
+	if ( _loader.finished() )
+		FinishLoading();
+}
+
+void D3D9Window::AddShadowCaster(unsigned int shape_index)
+{
+	CEntity *entity = _entity[shape_index];
+	const unsigned int m = _scene_delegate->shapeAtIndex( shape_index ).meshIndex;
+	if ( _shadow_batch_for_mesh[m] == NULL )
+	{
+		_shadow_batch_for_mesh[m] = new CInstanceBatch( entity->mesh() );
+		_shadow_batches.push_back( _shadow_batch_for_mesh[m] );
+	}
+	_shadow_batch_for_mesh[m]->add( entity );
+}
+
+//Every mesh is in: merge the static shadow casters, which needs all of them,
+//report what was loaded and how long it took, and write the scene cache
+void D3D9Window::FinishLoading()
+{
+	_loading = false;
+	_loader.stop();
+
+	if ( !_static_shadows.build( _dev, _scene_delegate, _entity, _is_static, 20.0f ) )
+	{
+		std::cout << "Error - Could not build static shadow batches\n";
+		_run = false;
+	}
+
+	//and the per mesh shadow batches are made again without them
+	for( std::vector<CInstanceBatch*>::iterator batch = _shadow_batches.begin(); batch != _shadow_batches.end(); ++batch ) 
+		Free( &(*batch) );
+	_shadow_batches.clear();
+	_shadow_batch_for_mesh.assign( _shadow_batch_for_mesh.size(), (CInstanceBatch*)NULL );
+	for( UINT i = 0; i < _entity.size(); i++ )
+	{
+		if ( !_is_static[i] && _entity[i] != NULL )
+			AddShadowCaster( i );
+	}
+
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	std::cout << "Loaded after " << (now.QuadPart - _startup.QuadPart) * 1000.0 / _frequency.QuadPart << " ms and "
+		<< _frames << " frames, uploads took " << _upload_total << " ms over " << _upload_frames
+		<< " frames, worst " << _upload_worst << " ms\n";
+
+	std::cout << _entity.size() << " entities share " << _mesh_cache.uploads() << " meshes in "
+		<< _batches.size() << " instanced batches\n";
+	_mesh_cache.geometry()->stats().print( std::cout );
+	_mesh_cache.printOptimization( std::cout );
+	_mesh_cache.printCompression( std::cout );
+	_static_shadows.print( std::cout );
+
+	//every mesh has been packed, so writing them out is just copying
+	if ( !_scene_cache_path.empty() && !_mesh_cache.writeCache( _scene_cache_path.c_str(), _scene_delegate, _made_shapes, _made_lights, _scene_source_hash ) )
+		std::cerr << "Could not write the scene cache " << _scene_cache_path << std::endl;
+}
+
+//Describe a frame as a graph of passes: an ambient pass, then a shadow map
+//and a lighting pass for each light. The frame graph works out the order,
+//and lets every light's shadow map share the same pooled target.
+void D3D9Window::BuildFrameGraph()
+{
+	_pass_context.batches = &_batches;
+	_pass_context.shadow_batches = &_shadow_batches;
+	_pass_context.static_shadows = &_static_shadows;
+	_pass_context.instances = &_instances;
+	_pass_context.meshes = &_mesh_cache;
+	_pass_context.camera = _camera;
+	memset( &_pass_context.camera_culling, 0, sizeof(MeshletCullStats) );
+	memset( &_pass_context.shadow_culling, 0, sizeof(MeshletCullStats) );
+	_pass_context.scene = _scene_delegate;
+	_pass_context.light = _light;
+	_pass_context.shadow = _shadow;
+	_pass_context.ambient = _ambient;
+	_pass_context.water = _water;
+	_pass_context.nurbs = &_nurbs;
+	_pass_context.float_light = _float_light;
+	_pass_context.float_ambient = _float_ambient;
+	_pass_context.jobs = &_jobs;
+	_pass_context.arena = &_arena;
+
+	_frame_graph.clear();
+	_backbuffer = _frame_graph.importTarget( "backbuffer", false );
+	_backbuffer_depth = _frame_graph.importTarget( "backbuffer depth", true );
+	_frame_graph.markOutput( _backbuffer );
+
+	RenderTargetDesc shadow_desc;
+	shadow_desc.width = shadow_desc.height = MAP_SIZE;
+	shadow_desc.depth = false;
+	//Format is D3DFMT_G32R32F as two channels are needed for Varience Shadow mapping
+	shadow_desc.format = D3DFMT_G32R32F;
+
+	RenderTargetDesc shadow_depth_desc = shadow_desc;
+	shadow_depth_desc.depth = true;
+	shadow_depth_desc.format = D3DFMT_D24X8;
+
+	//Draw the sceene with ambient lighting
+	CRenderPass *ambient = new CAmbientPass( &_pass_context );
+	_passes.push_back( ambient );
+	unsigned int pass = _frame_graph.addPass( "ambient", ambient );
+	_frame_graph.setTarget( pass, _backbuffer, _backbuffer_depth, D3DCLEAR_TARGET | D3DCLEAR_ZBUFFER, D3DCOLOR_XRGB(0,0,64) );
+
+	//For each light source in the sceene
+	for( UINT l = 0; l < _scene_delegate->numberOfLights(); l++ )
+	{
+		//named for their light, so each is profiled on its own
+		char shadow_name[32], lighting_name[32];
+		sprintf( shadow_name, "shadow %u", l );
+		sprintf( lighting_name, "lighting %u", l );
+
+		FrameResource shadow_map = _frame_graph.createTarget( "shadow map", shadow_desc );
+		FrameResource shadow_depth = _frame_graph.createTarget( "shadow depth", shadow_depth_desc );
+
+		//Draw the shadows from the lights perspective
+		CRenderPass *shadow = new CShadowPass( &_pass_context, l );
+		_passes.push_back( shadow );
+		pass = _frame_graph.addPass( shadow_name, shadow );
+		_frame_graph.setTarget( pass, shadow_map, shadow_depth, D3DCLEAR_TARGET | D3DCLEAR_ZBUFFER, D3DCOLOR_XRGB(0,0,64) );
+
+		//Draw the sceene normally, blending on top of what is there
+		CRenderPass *lighting = new CLightingPass( &_pass_context, l, shadow_map );
+		_passes.push_back( lighting );
+		pass = _frame_graph.addPass( lighting_name, lighting );
+		_frame_graph.read( pass, shadow_map );
+		_frame_graph.setTarget( pass, _backbuffer, _backbuffer_depth );
+	}
+
+	if ( !_frame_graph.compile() )
+		_run = false;
+	_frame_graph.print( std::cout );
 }
 
 void D3D9Window::DestroyManagedResources() 
 {
+	//the workers use the mesh cache, so stop them first
+	_loader.stop();
+	_loading = false;
+
 	//Release allocated memory
 	Free( &_camera );
 	Free( &_light );
 	Free( &_shadow );
 	Free( &_ambient );
+	Free( &_float_light );
+	Free( &_float_ambient );
+	Free( &_water );
+	_nurbs.clear();
 
 	for( std::vector<CEntity*>::iterator ent = _entity.begin(); ent != _entity.end(); ++ent ) 
 		Free( &(*ent) );
 
 	_entity.clear();
+
+	for( std::vector<CInstanceBatch*>::iterator batch = _batches.begin(); batch != _batches.end(); ++batch ) 
+		Free( &(*batch) );
+
+	_batches.clear();
+
+	for( std::vector<CInstanceBatch*>::iterator batch = _shadow_batches.begin(); batch != _shadow_batches.end(); ++batch ) 
+		Free( &(*batch) );
+
+	_shadow_batches.clear();
+	_static_shadows.clear();
+	_mesh_cache.clear();
+
+	_frame_graph.clear();
+	for( std::vector<CRenderPass*>::iterator pass = _passes.begin(); pass != _passes.end(); ++pass ) 
+		Free( &(*pass) );
+
+	_passes.clear();
 }
 
 void D3D9Window::CreateUnmanagedResources() 
@@ -345,98 +1156,291 @@ void D3D9Window::CreateUnmanagedResources()
 	// retrieve pointers to the backbuffer surfaces
 	_dev->GetRenderTarget(0, &_window_rendertarget);
 	_dev->GetDepthStencilSurface( &_window_depthstencil );
+	_frame_graph.setImported( _backbuffer, _window_rendertarget );
+	_frame_graph.setImported( _backbuffer_depth, _window_depthstencil );
 
-	//Create depth stencil for shadow pass
-	_dev->CreateDepthStencilSurface( MAP_SIZE, MAP_SIZE,
-		D3DFMT_D24X8, D3DMULTISAMPLE_NONE,
-		0, TRUE,
-		&_shadow_depthstencil,
-		NULL );
-
-
-	//Create the texture to render the shadow pass too
-	//Format is D3DFMT_G32R32F as two channels are needed for Varience Shadow mapping
-    if( FAILED(  _dev->CreateTexture( MAP_SIZE, MAP_SIZE, 0, D3DUSAGE_RENDERTARGET,
-                                    D3DFMT_G32R32F, D3DPOOL_DEFAULT, &_shadow_texture,
-                                    NULL ) ) )
+	//the instance buffer is dynamic, so it has to be recreated after a reset too
+	if( !_instances.create( _dev, _instance_count ) )
 	{
-		std::cout << "Error - Could not create shadow map texture\n";   
+		std::cout << "Error - Could not create instance buffer\n";   
 		_run = false;
 	}
 
-	//grab its surface
-	_shadow_texture->GetSurfaceLevel( 0, &_shadow_rendertarget );
+	//as are the water's vertex buffers
+	if( _water != NULL && !_water->create( _dev ) )
+	{
+		std::cout << "Error - Could not create water vertex buffers\n";   
+		_run = false;
+	}
 
+	//(re)create the pooled targets the frame graph assigned, such as the shadow maps
+	if( !_frame_graph.allocate( _dev ) )
+	{
+		std::cout << "Error - Could not create frame graph render targets\n";   
+		_run = false;
+	}
 }
 
 void D3D9Window::DestroyUnmanagedResources() {
 	// release backbuffer surfaces before resize
 	Release( &_window_rendertarget );
 	Release( &_window_depthstencil );
-	Release( &_shadow_rendertarget );
-	Release( &_shadow_depthstencil );
-	Release( &_shadow_texture );
+
+	// the frame graph keeps its pool layout, only the D3DPOOL_DEFAULT memory goes
+	_frame_graph.releaseTargets();
+	_instances.release();
+	if ( _water != NULL )
+		_water->release();
 }
 
-void D3D9Window::UpdateFrame(float time) {
-	_scene_delegate->animate(time);
+static Float3 blend( const Float3 &a, const Float3 &b, float t )
+{
+	return Float3( a.x + ( b.x - a.x ) * t, a.y + ( b.y - a.y ) * t, a.z + ( b.z - a.z ) * t );
+}
 
-	//update all entities with updates sceene delegate information
-	for( UINT i = 0; i < _scene_delegate->numberOfShapes(); i++ ) 
-	{
-		_entity[i]->update( _scene_delegate->shapeAtIndex( i ) );
+//a shape t of the way from one step to the next
+static Shape blendShape( const Shape &a, const Shape &b, float t )
+{
+	Shape shape = b;
+	shape.position = blend( a.position, b.position, t );
+	shape.rotation = blend( a.rotation, b.rotation, t );
+	return shape;
+}
+
+//and a light, keeping its direction unit length
+static Light blendLight( const Light &a, const Light &b, float t )
+{
+	Light light;
+	light.position = blend( a.position, b.position, t );
+	light.direction = blend( a.direction, b.direction, t );
+	const float length = sqrt( light.direction.x * light.direction.x + light.direction.y * light.direction.y + light.direction.z * light.direction.z );
+	if ( length > 0.0f )
+		light.direction = Float3( light.direction.x / length, light.direction.y / length, light.direction.z / length );
+	light.coneAngle = a.coneAngle + ( b.coneAngle - a.coneAngle ) * t;
+	light.intensity = a.intensity + ( b.intensity - a.intensity ) * t;
+	return light;
+}
+
+//Animate the scene to time, keeping where it was the step before to draw between
+void D3D9Window::StepSimulation(double time) {
+	PROFILE_SCOPE( "animate" );
+	_previous_shapes.swap( _current_shapes );
+	_previous_lights.swap( _current_lights );
+
+	//animate takes a float, but the step's time is exact until then
+	_scene_delegate->animate( (float)time );
+
+	_current_shapes.resize( _scene_delegate->numberOfShapes() );
+	for( UINT i = 0; i < _current_shapes.size(); i++ )
+		_current_shapes[i] = _scene_delegate->shapeAtIndex( i );
+	_current_lights.resize( _scene_delegate->numberOfLights() );
+	for( UINT l = 0; l < _current_lights.size(); l++ )
+		_current_lights[l] = _scene_delegate->lightAtIndex( l );
+
+	//keyframed animation says which shapes this step moved
+	if ( _animated ) {
+		for( UINT i = 0; i < _step_moved.size(); i++ ) {
+			_step_moved[i] = _animation.shapeChanged( i ) ? 1 : 0;
+			_moved[i] |= _step_moved[i];
+		}
 	}
 }
 
-void D3D9Window::DrawFrame() {
+//A range of entities placed for the frame, as a job
+void D3D9Window::UpdateEntities(void *data, unsigned int begin, unsigned int end) {
+	D3D9Window *window = (D3D9Window*)data;
+	LONG skipped = 0;
+	for( UINT i = begin; i < end; i++ ) 
+	{
+		//shapes whose meshes are still loading have no entity yet
+		if ( window->_entity[i] == NULL )
+			continue;
+
+		//a shape no step has moved since the last frame, and whose last two steps
+		//match, is placed where it was. Once it has been for two frames both world
+		//matrices hold that already
+		if ( window->_animated ) {
+			const bool still = !window->_moved[i] && !window->_step_moved[i];
+			window->_moved[i] = 0;
+			if ( still && window->_still[i] >= 2 ) {
+				skipped++;
+				continue;
+			}
+			window->_still[i] = still ? window->_still[i] + 1 : 0;
+		}
+		window->_entity[i]->update( blendShape( window->_previous_shapes[i], window->_current_shapes[i], window->_alpha ) );
+	}
+	if ( skipped > 0 )
+		InterlockedExchangeAdd( &window->_entities_skipped, skipped );
+}
 
-	//Draw the sceene with ambient lighting
-	_dev->BeginScene();
+//and a range of the lights the passes will draw with
+void D3D9Window::BlendLights(void *data, unsigned int begin, unsigned int end) {
+	D3D9Window *window = (D3D9Window*)data;
+	for( UINT l = begin; l < end; l++ )
+		window->_next_lights[l] = blendLight( window->_previous_lights[l], window->_current_lights[l], window->_alpha );
+}
 
-	_dev->SetRenderTarget( 0, _window_rendertarget );
-	_dev->SetDepthStencilSurface( _window_depthstencil );
-	_dev->Clear( 0, NULL, D3DCLEAR_TARGET | D3DCLEAR_ZBUFFER, D3DCOLOR_XRGB(0,0,64), 1.0f, 0 );
+//Place everything alpha of the way from the last step to the latest, which is
+//time, for the next frame drawn
+void D3D9Window::UpdateFrame(double time, float alpha) {
+	PROFILE_SCOPE( "update frame" );
+	_alpha = alpha;
+	_next_time = time;
 
-	for( std::vector<CEntity*>::iterator ent = _entity.begin(); ent != _entity.end(); ++ent ) 
+	//update all entities with updates sceene delegate information, each on its own
 	{
-		(*ent)->drawAmbient( _dev, _camera );
+		PROFILE_SCOPE( "update entities" );
+		_jobs.parallelFor( UpdateEntities, this, _current_shapes.size() );
 	}
 
-	_dev->EndScene();
+	//and the lights the passes draw with
+	_next_lights.resize( _current_lights.size() );
+	_jobs.parallelFor( BlendLights, this, _current_lights.size() );
+}
 
-	//For each light source in the sceene
-	for( UINT l = 0; l < _scene_delegate->numberOfLights(); l++ )
-	{
-		CLight light( _scene_delegate, l );
+//Simulate the next frame: in a benchmark exactly to time, otherwise catching up
+//with the clock reading now a step at a time, then placing the scene as far between
+//the last two steps as the clock is towards the next. Only the scene delegate,
+//the shapes, lights and entity transforms are touched, so this can run as a job
+//while the render thread draws the frame before
+void D3D9Window::SimulateFrame(LONGLONG now, double time) {
+	if (_bench_frames > 0) {
+		StepSimulation( time );
+		UpdateFrame( time, 1.0f );
+		return;
+	}
 
-		//Draw the shadows from the lights perspective
-		_dev->BeginScene();
-		_dev->SetRenderTarget( 0, _shadow_rendertarget );
-		_dev->SetDepthStencilSurface( _shadow_depthstencil );
-		_dev->Clear( 0, NULL, D3DCLEAR_TARGET | D3DCLEAR_ZBUFFER, D3DCOLOR_XRGB(0,0,64), 1.0f, 0 );
+	_simulation.advance( now );
+	while ( _simulation.step() )
+		StepSimulation( _simulation.time() );
+	const float alpha = _interpolate ? _simulation.alpha() : 1.0f;
+	UpdateFrame( _simulation.time() - (1.0f - alpha) * _simulation.stepSeconds(), alpha );
+}
 
-		for( std::vector<CEntity*>::iterator ent = _entity.begin(); ent != _entity.end(); ++ent ) 
-		{
-			(*ent)->drawShadows( _dev, &light );
-		}
-		_dev->EndScene();
+void D3D9Window::SimulateJob(void *data, unsigned int, unsigned int) {
+	PROFILE_SCOPE( "simulate" );
+	D3D9Window *window = (D3D9Window*)data;
+	window->SimulateFrame( window->_sim_now, window->_sim_time );
+}
 
-		//Draw the sceene normally
-		_dev->BeginScene();
-		_dev->SetRenderTarget(0, _window_rendertarget);
-		_dev->SetDepthStencilSurface( _window_depthstencil );
+//Simulate the next frame on a worker. BeginFrame must have taken the last one
+void D3D9Window::StartSimulation(LONGLONG now, double time) {
+	assert( "D3D9Window::StartSimulation; a frame is already being simulated" && !_sim_started );
+	_sim_now = now;
+	_sim_time = time;
+	_sim_started = true;
+	_jobs.runInBackground( SimulateJob, this, &_simulated );
+}
 
-		for( std::vector<CEntity*>::iterator ent = _entity.begin(); ent != _entity.end(); ++ent ) 
-		{
-			(*ent)->draw( _dev, _camera, &light, _shadow_texture );
-		}
-		_dev->EndScene();
+//Make the frame simulated last the one drawn, simulating it here for now or time
+//if none was started, then bring in what the render thread must: meshes, the
+//water and NURBS. Nothing is simulated from here until StartSimulation, so the
+//entities and scene delegate can be changed
+void D3D9Window::BeginFrame(LONGLONG now, double time) {
+	//nothing from the last frame is in use any more
+	_arena.reset();
+
+	if ( _sim_started ) {
+		PROFILE_SCOPE( "wait for simulation" );
+		const LONGLONG start = _clock.ticks();
+		_jobs.wait( &_simulated );
+		_sim_wait_ms += _clock.toMs( _clock.ticks() - start );
+		_sim_started = false;
+	}
+	else {
+		SimulateFrame( now, time );
+	}
+
+	//flip the frame in: entity transforms, lights and time all at once
+	CEntity::flip();
+	_pass_context.lights.swap( _next_lights );
+	_frame_time = _next_time;
+
+	//and work out every light's matrices and constants once, for all the passes
+	_pass_context.light_table.build( _pass_context.lights, _scene_delegate->worldUpDirection(), &_arena );
+
+	//bring in whatever meshes the workers have ready, within budget
+	if ( _loading )
+		UploadMeshes( _upload_budget );
+
+	//collect the water's last step and start simulating the next
+	if ( _water != NULL )
+		_water->update( (float)_frame_time );
+
+	//bring in the NURBS tessellations the jobs have finished
+	_nurbs.update( _dev );
+}
+
+void D3D9Window::DrawFrame() {
+	PROFILE_SCOPE( "draw frame" );
+
+	//Run the ambient, shadow and lighting passes in one scene
+	_frame_graph.execute( _dev );
+	_frames++;
+
+	{
+		PROFILE_SCOPE( "present" );
+		_dev->Present(0, 0, 0, 0);
 	}
 
-	_dev->Present(0, 0, 0, 0);
+	if (_frames == 1) {
+		LARGE_INTEGER now;
+		QueryPerformanceCounter(&now);
+		std::cout << "First frame after " << (now.QuadPart - _startup.QuadPart) * 1000.0 / _frequency.QuadPart << " ms, "
+			<< _loader.taken() << " of " << _loader.total() << " meshes in\n";
+	}
 
 }
 
+//One frame of a benchmark: the simulation and camera are set by frame number
+//alone, and the time taken and work done are logged. When pipelined, the update
+//time is only what the render thread waited for the simulation
+void D3D9Window::BenchmarkFrame() {
+	const double time = _frames * _bench_step;
+	_camera_path.apply( time, _camera );
+
+	LARGE_INTEGER start, updated, drawn;
+	QueryPerformanceCounter( &start );
+	BeginFrame( 0, time );
+	if ( _pipeline )
+		StartSimulation( 0, time + _bench_step );
+	QueryPerformanceCounter( &updated );
+	DrawFrame();
+	QueryPerformanceCounter( &drawn );
+
+	//the counts are totals, so the frame's are the change since the last
+	const double ms = 1000.0 / _frequency.QuadPart;
+	const RenderCounters &counters = _recorder->total();
+	const MeshletCullStats &camera = _pass_context.camera_culling;
+	const MeshletCullStats &shadow = _pass_context.shadow_culling;
+
+	FrameRecord record;
+	record.frame = _frames - 1;
+	record.time = time;
+	record.frame_ms = ( drawn.QuadPart - start.QuadPart ) * ms;
+	record.update_ms = ( updated.QuadPart - start.QuadPart ) * ms;
+	record.draw_ms = ( drawn.QuadPart - updated.QuadPart ) * ms;
+	record.draw_calls = counters.draw_calls - _bench_counters.draw_calls;
+	record.primitives = counters.primitives - _bench_counters.primitives;
+	record.state_changes = ( counters.state_changes + counters.shader_changes + counters.stream_changes + counters.texture_changes + counters.target_changes )
+		- ( _bench_counters.state_changes + _bench_counters.shader_changes + _bench_counters.stream_changes + _bench_counters.texture_changes + _bench_counters.target_changes );
+	record.meshlets = camera.meshlets - _bench_camera_culling.meshlets;
+	record.meshlets_culled = ( camera.frustum_culled + camera.cone_culled ) - ( _bench_camera_culling.frustum_culled + _bench_camera_culling.cone_culled );
+	record.triangles = camera.triangles - _bench_camera_culling.triangles;
+	record.triangles_culled = camera.triangles_culled - _bench_camera_culling.triangles_culled;
+	record.shadow_meshlets = shadow.meshlets - _bench_shadow_culling.meshlets;
+	record.shadow_meshlets_culled = ( shadow.frustum_culled + shadow.cone_culled ) - ( _bench_shadow_culling.frustum_culled + _bench_shadow_culling.cone_culled );
+	_frame_log.add( record );
+
+	_bench_counters = counters;
+	_bench_camera_culling = camera;
+	_bench_shadow_culling = shadow;
+
+	if ( _frames >= _bench_frames )
+		_run = false;
+}
+
 LRESULT CALLBACK D3D9Window::WndProc( HWND wnd, UINT msg, WPARAM wParam, LPARAM lParam ) {
 
 	// Retrieve a pointer to the D3D9Window object
@@ -511,15 +1515,78 @@ LRESULT CALLBACK D3D9Window::WndProc( HWND wnd, UINT msg, WPARAM wParam, LPARAM
 	return 0;
 }
 
+//Runs the built in scene headless on the null device with the arguments given,
+//returning the window once it has finished, or NULL if it could not start
+static D3D9Window* SelfTestRun(int argc, const char *argv[]) {
+	CCommandLine args(argc, (char**)argv);
+	D3D9Window* window = new D3D9Window();
+	if (!window->Init(1024, 576, args)) {
+		delete window;
+		return 0;
+	}
+	window->Run();
+	window->Deinit();
+	return window;
+}
+
+//Checks the framework's parts, then whole frames of the scene, for scripts and
+//builds to run. Returns whether every check passed
+static bool SelfTest() {
+	bool passed = CSelfTest::allocationCounter(std::cout);
+	passed = CSelfTest::recordingDevice(std::cout) && passed;
+
+	// Once loaded, frames on the render thread and the job workers make no heap allocations
+	const char *steady[] = { "cast_a_shadow", "-null", "-benchmark", "240", "-allocs", "-allocwarmup", "60", "-nocache", "-benchcsv", "selftest.csv" };
+	D3D9Window* window = SelfTestRun(sizeof(steady) / sizeof(steady[0]), steady);
+	passed = CSelfTest::report(std::cout, "steady frames of the scene make no heap allocations", window != 0 && window->exitCode() == 0) && passed;
+	delete window;
+
+	// The same frames of the scene, recorded twice, make the same calls: one scene a
+	// frame, with every draw in one of the frame graph's passes
+	const char *replay[] = { "cast_a_shadow", "-null", "-benchmark", "8", "-nocache", "-benchcsv", "selftest.csv" };
+	D3D9Window* first = SelfTestRun(sizeof(replay) / sizeof(replay[0]), replay);
+	D3D9Window* second = SelfTestRun(sizeof(replay) / sizeof(replay[0]), replay);
+	if (CSelfTest::report(std::cout, "the scene runs on the recording device", first != 0 && second != 0)) {
+		const RenderCounters &counts = first->recorded();
+		passed = CSelfTest::report(std::cout, "each recorded frame is one scene that draws", first->recordedFrames() == 8
+			&& counts.scenes == first->recordedFrames() && counts.draw_calls >= counts.scenes) && passed;
+		passed = CSelfTest::report(std::cout, "every recorded draw is in a pass",
+			counts.draw_calls == first->recordedInPasses().draw_calls && counts.primitives == first->recordedInPasses().primitives) && passed;
+
+		bool same = CSelfTest::sameCounts(counts, second->recorded()) && first->frameLog().size() == second->frameLog().size();
+		for (unsigned int f = 0; same && f < first->frameLog().size(); f++) {
+			const FrameRecord &a = first->frameLog().frame(f), &b = second->frameLog().frame(f);
+			same = a.draw_calls == b.draw_calls && a.primitives == b.primitives && a.state_changes == b.state_changes;
+		}
+		passed = CSelfTest::report(std::cout, "replaying the frames makes the same calls", same) && passed;
+	}
+	else
+		passed = false;
+	delete first;
+	delete second;
+
+	std::cout << (passed ? "Every self test passed\n" : "Self tests failed, see above\n");
+	return passed;
+}
+
 int main(int argc, char* argv[]) {
+	CCommandLine args(argc, argv);
+
+	// Run the checks and nothing else, exiting non-zero if any fail
+	if (args.hasFlag("-selftest"))
+		return SelfTest() ? 0 : 1;
+
 	D3D9Window* window = new D3D9Window();
-	if (window->Init(1024, 576)) {
+	int exit_code = 1;
+	if (window->Init(1024, 576, args)) {
 		window->Run();
 		window->Deinit();
+		exit_code = window->exitCode();
 	}
 	delete window;
 
-	// Pause to display any console messages
-	system("PAUSE");
-	return 0;
+	// Pause to display any console messages, unless run by a script that wants the exit code
+	if (!args.hasFlag("-null") && args.getInt("-benchmark", 0) == 0)
+		system("PAUSE");
+	return exit_code;
 }